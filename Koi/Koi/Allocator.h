@@ -0,0 +1,372 @@
+//
+//  Allocator.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef Allocator_h
+#define Allocator_h
+
+    #include <algorithm>
+    #include <cstddef>
+    #include <cstdint>
+    #include <cstdlib>
+    #include <cstring>
+    #include <mutex>
+    #include <new>
+    #include <string>
+    #include <vector>
+
+    #if defined(_WIN32)
+        #include <malloc.h>
+    #else
+        #include <sys/mman.h>
+    #endif
+
+    // std::pmr needs C++17, the arenas themselves do not
+    #if __cplusplus >= 201703L && defined(__has_include)
+        #if __has_include(<memory_resource>)
+            #include <memory_resource>
+            #define KOI_HAS_PMR
+        #endif
+    #endif
+
+    namespace koi {
+        constexpr size_t nPixelAlignment = 64; // Cache line, and wide enough for any SIMD load
+
+        // MARK: koi::PixelAllocator
+        // +------------------------------------------------------------------------------+
+        // | koi::PixelAllocator - Recycles aligned pixel buffers grouped by size class   |
+        // +------------------------------------------------------------------------------+
+        class PixelAllocator {
+        public:
+            static PixelAllocator& Get();                                       // Process wide pool, thread safe
+
+            void*  Allocate (size_t nBytes, size_t& nCapacity, bool bZero);     // nCapacity receives the real buffer size
+            void   Release  (void* p, size_t nCapacity);                        // nCapacity must be the value Allocate returned
+            void   Trim     ();                                                 // Hand every cached buffer back to the system
+            size_t CachedBytes() const;
+
+            ~PixelAllocator();
+
+        private:
+            // Four classes per power of two (1, 1.25, 1.5, 1.75) keeps the worst case waste under 25%
+            static constexpr uint32_t nMinShift       = 8;                      // 256 bytes
+            static constexpr uint32_t nMaxShift       = 24;                     // 16MB, anything bigger bypasses the pool
+            static constexpr uint32_t nClasses        = (nMaxShift - nMinShift + 1) * 4;
+            static constexpr size_t   nMapThreshold   = 256 * 1024;             // Served by mmap, which is zero filled for free
+            static constexpr size_t   nMaxCachedBytes = 64 * 1024 * 1024;
+
+            static uint32_t ClassIndex  (size_t nBytes);
+            static size_t   ClassSize   (uint32_t nIndex);
+            static void*    SystemAlloc (size_t nBytes, bool bZero);
+            static void     SystemFree  (void* p, size_t nBytes);
+
+            mutable std::mutex muxPool;
+            std::vector<void*> vFree[nClasses];
+            size_t             nCachedBytes = 0;
+        };
+
+        // Never destroyed, so sprites with static storage duration can still release into it at exit
+        PixelAllocator& PixelAllocator::Get() { static PixelAllocator* pool = new PixelAllocator(); return *pool; }
+
+        PixelAllocator::~PixelAllocator() { Trim(); }
+
+        uint32_t PixelAllocator::ClassIndex(size_t nBytes) {
+            if (nBytes <= (size_t(1) << nMinShift)) return 0;
+            uint32_t nShift = nMinShift;
+            while ((size_t(2) << nShift) <= nBytes) nShift++;
+            size_t nBase = size_t(1) << nShift, nStep = nBase >> 2;
+            uint32_t nSub = uint32_t((nBytes - nBase + nStep - 1) / nStep);
+            if (nSub == 4) { nShift++; nSub = 0; }
+            return (nShift - nMinShift) * 4 + nSub;
+        }
+
+        size_t PixelAllocator::ClassSize(uint32_t nIndex) {
+            size_t nBase = size_t(1) << (nMinShift + nIndex / 4);
+            return nBase + (nBase >> 2) * (nIndex % 4);
+        }
+
+        void* PixelAllocator::SystemAlloc(size_t nBytes, bool bZero) {
+            #if defined(_WIN32)
+                void* p = _aligned_malloc(nBytes, nPixelAlignment);
+                if (p && bZero) memset(p, 0, nBytes);
+                return p;
+            #else
+                if (nBytes >= nMapThreshold) {
+                    void* p = mmap(nullptr, nBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                    return p == MAP_FAILED ? nullptr : p;
+                }
+                void* p = nullptr;
+                if (posix_memalign(&p, nPixelAlignment, nBytes) != 0) return nullptr;
+                if (bZero) memset(p, 0, nBytes);
+                return p;
+            #endif
+        }
+
+        void PixelAllocator::SystemFree(void* p, size_t nBytes) {
+            #if defined(_WIN32)
+                (void)nBytes;
+                _aligned_free(p);
+            #else
+                if (nBytes >= nMapThreshold) munmap(p, nBytes);
+                else                         free(p);
+            #endif
+        }
+
+        void* PixelAllocator::Allocate(size_t nBytes, size_t& nCapacity, bool bZero) {
+            if (nBytes == 0) { nCapacity = 0; return nullptr; }
+
+            uint32_t nIndex = ClassIndex(nBytes);
+            if (nIndex >= nClasses) {
+                // Too big to be worth keeping around, round to whole pages and go to the OS
+                nCapacity = (nBytes + 4095) & ~size_t(4095);
+                return SystemAlloc(nCapacity, bZero);
+            }
+
+            nCapacity = ClassSize(nIndex);
+            {
+                std::lock_guard<std::mutex> lock(muxPool);
+                if (!vFree[nIndex].empty()) {
+                    void* p = vFree[nIndex].back();
+                    vFree[nIndex].pop_back();
+                    nCachedBytes -= nCapacity;
+                    if (bZero) memset(p, 0, nCapacity);
+                    return p;
+                }
+            }
+            return SystemAlloc(nCapacity, bZero);
+        }
+
+        void PixelAllocator::Release(void* p, size_t nCapacity) {
+            if (p == nullptr) return;
+            uint32_t nIndex = ClassIndex(nCapacity);
+            if (nIndex < nClasses && ClassSize(nIndex) == nCapacity) {
+                std::lock_guard<std::mutex> lock(muxPool);
+                if (nCachedBytes + nCapacity <= nMaxCachedBytes) {
+                    vFree[nIndex].push_back(p);
+                    nCachedBytes += nCapacity;
+                    return;
+                }
+            }
+            SystemFree(p, nCapacity);
+        }
+
+        void PixelAllocator::Trim() {
+            std::lock_guard<std::mutex> lock(muxPool);
+            for (uint32_t i = 0; i < nClasses; i++) {
+                for (void* p : vFree[i]) SystemFree(p, ClassSize(i));
+                vFree[i].clear();
+            }
+            nCachedBytes = 0;
+        }
+
+        size_t PixelAllocator::CachedBytes() const { std::lock_guard<std::mutex> lock(muxPool); return nCachedBytes; }
+
+
+        // MARK: koi::AlignedAllocator
+        // +------------------------------------------------------------------------------+
+        // | koi::AlignedAllocator - std::allocator with nPixelAlignment aligned storage  |
+        // +------------------------------------------------------------------------------+
+        template<class T>
+        struct AlignedAllocator {
+            typedef T value_type;
+
+            AlignedAllocator() = default;
+            template<class U> AlignedAllocator(const AlignedAllocator<U>&) {}
+
+            T* allocate(size_t n) {
+                size_t nBytes = std::max<size_t>(n * sizeof(T), 1);
+                #if defined(_WIN32)
+                    void* p = _aligned_malloc(nBytes, nPixelAlignment);
+                #else
+                    void* p = nullptr;
+                    if (posix_memalign(&p, nPixelAlignment, nBytes) != 0) p = nullptr;
+                #endif
+                if (p == nullptr) throw std::bad_alloc();
+                return (T*)p;
+            }
+
+            void deallocate(T* p, size_t) {
+                #if defined(_WIN32)
+                    _aligned_free(p);
+                #else
+                    free(p);
+                #endif
+            }
+
+            template<class U> bool operator == (const AlignedAllocator<U>&) const { return true;  }
+            template<class U> bool operator != (const AlignedAllocator<U>&) const { return false; }
+        };
+
+        template<class T> using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+
+        // MARK: koi::LinearArena
+        // +------------------------------------------------------------------------------+
+        // | koi::LinearArena - Bump allocator, everything is freed at once by Reset      |
+        // +------------------------------------------------------------------------------+
+        // Blocks come from the PixelAllocator. Reset keeps them, and when the last round
+        // needed more than one it trades them for a single block of the combined size, so
+        // a steady workload settles on one block and never calls the system. Nothing is
+        // destructed, keep it to trivially destructible data or containers that own none.
+        class LinearArena {
+        public:
+            explicit LinearArena(size_t nBlockSize = 64 * 1024);
+            ~LinearArena();
+            LinearArena(const LinearArena&) = delete;
+            LinearArena& operator = (const LinearArena&) = delete;
+
+            void*  Allocate (size_t nBytes, size_t nAlign = alignof(std::max_align_t));    // nAlign must be a power of two
+            template<class T> T* AllocateArray(size_t n);                                // Uninitialised
+            void   Reset    ();
+
+            size_t Used     () const { return nUsed;      }        // Bytes handed out since Reset, padding included
+            size_t HighWater() const { return nHighWater; }        // Most ever used between two Resets
+            size_t Capacity () const;
+
+        private:
+            struct Block { char* p; size_t nSize; };
+
+            void koi_Release();
+
+            std::vector<Block> vBlocks;
+            size_t             nBlockSize;
+            size_t             nBlock     = 0;                      // Block being bumped
+            size_t             nOffset    = 0;
+            size_t             nUsed      = 0;
+            size_t             nHighWater = 0;
+        };
+
+        LinearArena::LinearArena(size_t n) : nBlockSize(std::max<size_t>(n, 256)) {}
+
+        LinearArena::~LinearArena() { koi_Release(); }
+
+        void LinearArena::koi_Release() {
+            for (const Block& b : vBlocks) PixelAllocator::Get().Release(b.p, b.nSize);
+            vBlocks.clear();
+        }
+
+        size_t LinearArena::Capacity() const {
+            size_t n = 0;
+            for (const Block& b : vBlocks) n += b.nSize;
+            return n;
+        }
+
+        void* LinearArena::Allocate(size_t nBytes, size_t nAlign) {
+            nBytes = std::max<size_t>(nBytes, 1);
+            for (;;) {
+                if (nBlock < vBlocks.size()) {
+                    const Block& b = vBlocks[nBlock];
+                    uintptr_t nBase  = uintptr_t(b.p);
+                    size_t    nStart = ((nBase + nOffset + nAlign - 1) & ~uintptr_t(nAlign - 1)) - nBase;
+                    if (nStart <= b.nSize && nBytes <= b.nSize - nStart) {
+                        nUsed  += nStart + nBytes - nOffset;
+                        nOffset = nStart + nBytes;
+                        return b.p + nStart;
+                    }
+                    if (nBlock + 1 < vBlocks.size()) { nUsed += b.nSize - nOffset; nBlock++; nOffset = 0; continue; }
+                }
+
+                // Out of blocks, grow by at least what is there already so a burst needs few of them
+                if (nBytes > SIZE_MAX / 2 - nAlign) throw std::bad_alloc();
+                size_t nWant = std::max(std::max(nBlockSize, Capacity()), nBytes + nAlign), nSize = 0;
+                void*  p     = PixelAllocator::Get().Allocate(nWant, nSize, false);
+                if (p == nullptr) throw std::bad_alloc();
+                if (nBlock < vBlocks.size()) nUsed += vBlocks[nBlock].nSize - nOffset;
+                vBlocks.push_back({ (char*)p, nSize });
+                nBlock  = vBlocks.size() - 1;
+                nOffset = 0;
+            }
+        }
+
+        template<class T>
+        T* LinearArena::AllocateArray(size_t n) {
+            if (n > SIZE_MAX / sizeof(T)) throw std::bad_alloc();
+            return (T*)Allocate(n * sizeof(T), alignof(T));
+        }
+
+        void LinearArena::Reset() {
+            nHighWater = std::max(nHighWater, nUsed);
+            if (vBlocks.size() > 1) {
+                size_t nTotal = Capacity(), nSize = 0;
+                koi_Release();
+                void* p = PixelAllocator::Get().Allocate(nTotal, nSize, false);
+                if (p) vBlocks.push_back({ (char*)p, nSize });        // Otherwise start over from nothing next time
+            }
+            nBlock = nOffset = nUsed = 0;
+        }
+
+
+        // MARK: koi::FrameArena
+        // +------------------------------------------------------------------------------+
+        // | koi::FrameArena - Two linear arenas taking turns, one per frame              |
+        // +------------------------------------------------------------------------------+
+        // NextFrame resets the arena used two frames ago and makes it current, so memory
+        // allocated in a frame stays valid until the end of the next one. Not thread safe,
+        // use it from the thread that runs the frames.
+        class FrameArena {
+        public:
+            void* Allocate (size_t nBytes, size_t nAlign = alignof(std::max_align_t)) { return arenas[nCurrent].Allocate(nBytes, nAlign); }
+            template<class T> T* AllocateArray(size_t n) { return arenas[nCurrent].AllocateArray<T>(n); }
+            void  NextFrame() { nCurrent ^= 1; arenas[nCurrent].Reset(); nFrame++; }
+
+            LinearArena&       Current  ()       { return arenas[nCurrent];     }
+            LinearArena&       Previous ()       { return arenas[nCurrent ^ 1]; }
+            const LinearArena& Current  () const { return arenas[nCurrent];     }
+            uint64_t           Frame    () const { return nFrame;               }
+
+        private:
+            LinearArena arenas[2];
+            uint32_t    nCurrent = 0;
+            uint64_t    nFrame   = 0;
+        };
+
+
+        // MARK: koi::ArenaAllocator
+        // +------------------------------------------------------------------------------+
+        // | koi::ArenaAllocator - std::allocator that bumps from a FrameArena            |
+        // +------------------------------------------------------------------------------+
+        // Deallocation is free and does nothing. A container that grows in a later frame
+        // moves into that frame's arena, but one kept past the next frame is left dangling.
+        template<class T>
+        struct ArenaAllocator {
+            typedef T value_type;
+
+            explicit ArenaAllocator(FrameArena& a) : pArena(&a) {}
+            template<class U> ArenaAllocator(const ArenaAllocator<U>& other) : pArena(other.pArena) {}
+
+            T*   allocate  (size_t n)    { return pArena->AllocateArray<T>(n); }
+            void deallocate(T*, size_t)  {}
+
+            template<class U> bool operator == (const ArenaAllocator<U>& other) const { return pArena == other.pArena; }
+            template<class U> bool operator != (const ArenaAllocator<U>& other) const { return pArena != other.pArena; }
+
+            FrameArena* pArena;
+        };
+
+        template<class T> using FrameVector = std::vector<T, ArenaAllocator<T>>;
+        using FrameString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+
+        #if defined(KOI_HAS_PMR)
+            // MARK: koi::FrameResource
+            // +------------------------------------------------------------------------------+
+            // | koi::FrameResource - std::pmr::memory_resource over a FrameArena             |
+            // +------------------------------------------------------------------------------+
+            class FrameResource : public std::pmr::memory_resource {
+            public:
+                explicit FrameResource(FrameArena& a) : arena(a) {}
+
+            private:
+                void* do_allocate  (size_t nBytes, size_t nAlign) override  { return arena.Allocate(nBytes, nAlign); }
+                void  do_deallocate(void*, size_t, size_t) override         {}
+                bool  do_is_equal  (const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+                FrameArena& arena;
+            };
+        #endif
+    }
+
+#endif /* Allocator_h */
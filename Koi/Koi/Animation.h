@@ -0,0 +1,269 @@
+//
+//  Animation.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef Animation_h
+#define Animation_h
+
+    #include <array>
+    #include "Global.h"
+    #include "VectorBatch.h"
+    #include "Mat4.h"
+
+    namespace koi {
+        // MARK: koi::Skeleton
+        // +------------------------------------------------------------------------------+
+        // | koi::Skeleton - Bone hierarchy, parents always come before their children    |
+        // +------------------------------------------------------------------------------+
+        struct Skeleton {
+            std::vector<int32_t> vParent;                   // -1 for a root
+            std::vector<Mat4>    vInverseBind;              // Model space to bone space in the bind pose
+
+            int32_t Size   () const { return int32_t(vParent.size()); }
+            int32_t AddBone(int32_t nParent, const Mat4& matInverseBind = Mat4());   // Returns the new bone's index
+        };
+
+        int32_t Skeleton::AddBone(int32_t nParent, const Mat4& matInverseBind) {
+            vParent.push_back(nParent < Size() ? nParent : -1);
+            vInverseBind.push_back(matInverseBind);
+            return Size() - 1;
+        }
+
+
+        // MARK: koi::Pose
+        // +------------------------------------------------------------------------------+
+        // | koi::Pose - Local rotation, translation and scale of every bone              |
+        // +------------------------------------------------------------------------------+
+        // One array per component so a sampling kernel handles a lane's worth of bones at once.
+        struct Pose {
+            AlignedVector<float> rw, rx, ry, rz;
+            AlignedVector<float> tx, ty, tz;
+            AlignedVector<float> sx, sy, sz;
+
+            int32_t     Size        () const { return int32_t(rw.size()); }
+            void        Resize      (int32_t nBones);                        // New bones are the identity
+            Quaternionf GetRotation (int32_t i) const { return { rw[i], rx[i], ry[i], rz[i] }; }
+            Vector3f    GetPosition (int32_t i) const { return { tx[i], ty[i], tz[i] }; }
+            Vector3f    GetScale    (int32_t i) const { return { sx[i], sy[i], sz[i] }; }
+            void        Set         (int32_t i, const Quaternionf& r, const Vector3f& t, const Vector3f& s = { 1.0f, 1.0f, 1.0f });
+
+            std::array<float*, 10>       Channels()       { return { { rw.data(), rx.data(), ry.data(), rz.data(), tx.data(), ty.data(), tz.data(), sx.data(), sy.data(), sz.data() } }; }
+            std::array<const float*, 10> Channels() const { return { { rw.data(), rx.data(), ry.data(), rz.data(), tx.data(), ty.data(), tz.data(), sx.data(), sy.data(), sz.data() } }; }
+        };
+
+        void Pose::Resize(int32_t nBones) {
+            size_t n = size_t(std::max(nBones, 0));
+            rw.resize(n, 1.0f); rx.resize(n, 0.0f); ry.resize(n, 0.0f); rz.resize(n, 0.0f);
+            tx.resize(n, 0.0f); ty.resize(n, 0.0f); tz.resize(n, 0.0f);
+            sx.resize(n, 1.0f); sy.resize(n, 1.0f); sz.resize(n, 1.0f);
+        }
+
+        void Pose::Set(int32_t i, const Quaternionf& r, const Vector3f& t, const Vector3f& s) {
+            rw[i] = r.w; rx[i] = r.x; ry[i] = r.y; rz[i] = r.z;
+            tx[i] = t.x; ty[i] = t.y; tz[i] = t.z;
+            sx[i] = s.x; sy[i] = s.y; sz[i] = s.z;
+        }
+
+
+        // MARK: Quaternion Lanes
+        // +------------------------------------------------------------------------------+
+        // | Quaternion Lanes - nlerp and slerp across a lane of bones                    |
+        // +------------------------------------------------------------------------------+
+        // koi_Slerp is nlerp with t bent by a cubic fitted to slerp's easing (from Zeux's
+        // "Approximating slerp"), it stays within 2e-3 radians of the exact Slerp while avoiding acos
+        // and sin, which have no SIMD instructions.
+        template<class L> void koi_Nlerp(L& w, L& x, L& y, L& z, L bw, L bx, L by, L bz, L t) {
+            L d  = w * bw + x * bx + y * by + z * bz;
+            L tb = FlipSign(t, d), ta = L::Set(1.0f) - t;
+            w = w * ta + bw * tb; x = x * ta + bx * tb; y = y * ta + by * tb; z = z * ta + bz * tb;
+            L r = L::Set(1.0f) / Sqrt(Max(w * w + x * x + y * y + z * z, L::Set(1e-30f)));
+            w = w * r; x = x * r; y = y * r; z = z * r;
+        }
+
+        template<class L> void koi_Slerp(L& w, L& x, L& y, L& z, L bw, L bx, L by, L bz, L t) {
+            L d  = FlipSign(w * bw + x * bx + y * by + z * bz, w * bw + x * bx + y * by + z * bz);  // |cos theta|
+            L a  = L::Set(1.0904f) + d * (L::Set(-3.2452f) + d * (L::Set(3.55645f) - d * L::Set(1.43519f)));
+            L b  = L::Set(0.848013f) + d * (L::Set(-1.06021f) + d * L::Set(0.215638f));
+            L h  = t - L::Set(0.5f);
+            L k  = a * h * h + b;
+            koi_Nlerp(w, x, y, z, bw, bx, by, bz, t + t * h * (t - L::Set(1.0f)) * k);
+        }
+
+
+        // MARK: koi::AnimationClip
+        // +------------------------------------------------------------------------------+
+        // | koi::AnimationClip - Keyframes for every bone at a fixed frame rate          |
+        // +------------------------------------------------------------------------------+
+        // Keys are stored frame by frame, each frame holding the ten pose components as
+        // arrays across the bones. Sampling reads two neighbouring frames front to back and
+        // writes the pose component by component, all of it in straight lines through memory.
+        // Tracks keyed at irregular times should be resampled to the clip's rate when loading.
+        class AnimationClip {
+        public:
+            enum Interpolation { NLERP, SLERP };
+
+            AnimationClip() = default;
+            AnimationClip(int32_t nBones, int32_t nFrames, float fFrameRate = 30.0f);
+
+            int32_t Bones   () const { return nBones;  }
+            int32_t Frames  () const { return nFrames; }
+            float   Duration() const { return nFrames > 1 ? (nFrames - 1) / fFrameRate : 0.0f; }
+
+            void SetKey(int32_t nFrame, int32_t nBone, const Quaternionf& r, const Vector3f& t, const Vector3f& s = { 1.0f, 1.0f, 1.0f });
+            void Sample(float fTime, Pose& out, bool bLoop = true, Interpolation interp = NLERP) const;  // out is resized to Bones(), NaN or infinite fTime gives the first key
+
+        private:
+            enum { nChannels = 10 };    // rw rx ry rz tx ty tz sx sy sz
+            float*       Channel(int32_t nFrame, int32_t c)       { return vKeys.data() + (size_t(nFrame) * nChannels + c) * nStride; }
+            const float* Channel(int32_t nFrame, int32_t c) const { return vKeys.data() + (size_t(nFrame) * nChannels + c) * nStride; }
+
+            int32_t nBones     = 0;
+            int32_t nFrames    = 0;
+            int32_t nStride    = 0;     // Bones rounded up to whole cache lines
+            float   fFrameRate = 30.0f;
+            AlignedVector<float> vKeys;
+        };
+
+        AnimationClip::AnimationClip(int32_t nBones, int32_t nFrames, float fFrameRate)
+            : nBones(std::max(nBones, 0)), nFrames(std::max(nFrames, 0)), fFrameRate(fFrameRate > 0.0f ? fFrameRate : 30.0f) {
+            nStride = (this->nBones + 15) & ~15;
+            vKeys.assign(size_t(nStride) * nChannels * this->nFrames, 0.0f);
+            for (int32_t f = 0; f < this->nFrames; f++)
+                for (int32_t c : { 0, 7, 8, 9 }) std::fill_n(Channel(f, c), nStride, 1.0f);
+        }
+
+        void AnimationClip::SetKey(int32_t nFrame, int32_t nBone, const Quaternionf& r, const Vector3f& t, const Vector3f& s) {
+            if (nFrame < 0 || nFrame >= nFrames || nBone < 0 || nBone >= nBones) return;
+            const float v[nChannels] = { r.w, r.x, r.y, r.z, t.x, t.y, t.z, s.x, s.y, s.z };
+            for (int32_t c = 0; c < nChannels; c++) Channel(nFrame, c)[nBone] = v[c];
+        }
+
+        void AnimationClip::Sample(float fTime, Pose& out, bool bLoop, Interpolation interp) const {
+            out.Resize(nBones);
+            if (nFrames == 0) return;
+
+            // Non-finite times sample the first key, looping can't wrap them and the conversion below would be undefined
+            float fFrame = std::isfinite(fTime) ? fTime * fFrameRate : 0.0f, fLast = float(nFrames - 1);
+            if (bLoop && nFrames > 1) { fFrame = std::isfinite(fFrame) ? std::fmod(fFrame, fLast) : 0.0f; if (fFrame < 0.0f) fFrame += fLast; }
+            fFrame = std::min(std::max(fFrame, 0.0f), fLast);
+            int32_t f0 = std::min(int32_t(fFrame), nFrames - 1), f1 = std::min(f0 + 1, nFrames - 1);
+            float   t  = fFrame - float(f0);
+
+            const float* a[nChannels]; const float* b[nChannels];
+            for (int32_t c = 0; c < nChannels; c++) { a[c] = Channel(f0, c); b[c] = Channel(f1, c); }
+            std::array<float*, nChannels> o = out.Channels();
+            koi_BatchFor(size_t(nBones), [&](auto l, size_t i) {
+                using L = decltype(l);
+                L lt = L::Set(t), w = L::Load(a[0] + i), x = L::Load(a[1] + i), y = L::Load(a[2] + i), z = L::Load(a[3] + i);
+                L bw = L::Load(b[0] + i), bx = L::Load(b[1] + i), by = L::Load(b[2] + i), bz = L::Load(b[3] + i);
+                if (interp == SLERP) koi_Slerp(w, x, y, z, bw, bx, by, bz, lt);
+                else                 koi_Nlerp(w, x, y, z, bw, bx, by, bz, lt);
+                L::Store(o[0] + i, w); L::Store(o[1] + i, x); L::Store(o[2] + i, y); L::Store(o[3] + i, z);
+                for (int32_t c = 4; c < nChannels; c++) {
+                    L va = L::Load(a[c] + i);
+                    L::Store(o[c] + i, va + (L::Load(b[c] + i) - va) * lt);
+                }
+            });
+        }
+
+
+        // MARK: Pose Functions
+        // +------------------------------------------------------------------------------+
+        // | Pose Functions - Blending and bone matrices                                  |
+        // +------------------------------------------------------------------------------+
+        void BlendPoses          (const Pose& a, const Pose& b, float fWeight, Pose& out);  // fWeight 0 is a, 1 is b, out may alias either
+        void ComputeModelMatrices(const Skeleton& skel, const Pose& pose, std::vector<Mat4>& vModel);
+        void ComputeSkinMatrices (const Skeleton& skel, const std::vector<Mat4>& vModel, std::vector<Mat4>& vSkin);   // Model * inverse bind
+
+        void BlendPoses(const Pose& a, const Pose& b, float fWeight, Pose& out) {
+            int32_t n = std::min(a.Size(), b.Size());
+            out.Resize(n);
+            std::array<const float*, 10> ca = a.Channels(), cb = b.Channels();
+            std::array<float*, 10> o = out.Channels();
+            koi_BatchFor(size_t(n), [&](auto l, size_t i) {
+                using L = decltype(l);
+                L t = L::Set(fWeight);
+                L w = L::Load(ca[0] + i), x = L::Load(ca[1] + i), y = L::Load(ca[2] + i), z = L::Load(ca[3] + i);
+                koi_Nlerp(w, x, y, z, L::Load(cb[0] + i), L::Load(cb[1] + i), L::Load(cb[2] + i), L::Load(cb[3] + i), t);
+                L::Store(o[0] + i, w); L::Store(o[1] + i, x); L::Store(o[2] + i, y); L::Store(o[3] + i, z);
+                for (int32_t k = 4; k < 10; k++) {
+                    L va = L::Load(ca[k] + i);
+                    L::Store(o[k] + i, va + (L::Load(cb[k] + i) - va) * t);
+                }
+            });
+        }
+
+        // a * b for matrices whose bottom row is 0 0 0 1, a quarter fewer multiplies than Mat4::operator *
+        void koi_MulAffine(const Mat4& a, const Mat4& b, Mat4& out) {
+            for (int32_t r = 0; r < 3; r++) {
+                for (int32_t c = 0; c < 4; c++) out.m[r][c] = a.m[r][0] * b.m[0][c] + a.m[r][1] * b.m[1][c] + a.m[r][2] * b.m[2][c];
+                out.m[r][3] += a.m[r][3];
+            }
+            out.m[3][0] = out.m[3][1] = out.m[3][2] = 0.0f; out.m[3][3] = 1.0f;
+        }
+
+        void ComputeModelMatrices(const Skeleton& skel, const Pose& pose, std::vector<Mat4>& vModel) {
+            int32_t n = std::min(skel.Size(), pose.Size());
+            vModel.resize(size_t(n));
+            for (int32_t i = 0; i < n; i++) {
+                // Local rotate and scale, as in Mat4::FromQuaternion with the columns scaled
+                float w = pose.rw[i], x = pose.rx[i], y = pose.ry[i], z = pose.rz[i];
+                float xx = x * x, yy = y * y, zz = z * z, xy = x * y, xz = x * z, yz = y * z, wx = w * x, wy = w * y, wz = w * z;
+                float sx = pose.sx[i], sy = pose.sy[i], sz = pose.sz[i];
+                Mat4 l;
+                l.m[0][0] = (1 - 2 * (yy + zz)) * sx; l.m[0][1] = 2 * (xy - wz) * sy;       l.m[0][2] = 2 * (xz + wy) * sz;       l.m[0][3] = pose.tx[i];
+                l.m[1][0] = 2 * (xy + wz) * sx;       l.m[1][1] = (1 - 2 * (xx + zz)) * sy; l.m[1][2] = 2 * (yz - wx) * sz;       l.m[1][3] = pose.ty[i];
+                l.m[2][0] = 2 * (xz - wy) * sx;       l.m[2][1] = 2 * (yz + wx) * sy;       l.m[2][2] = (1 - 2 * (xx + yy)) * sz; l.m[2][3] = pose.tz[i];
+
+                int32_t nParent = skel.vParent[i];
+                if (nParent < 0 || nParent >= i) vModel[i] = l;
+                else                             koi_MulAffine(vModel[nParent], l, vModel[i]);
+            }
+        }
+
+        void ComputeSkinMatrices(const Skeleton& skel, const std::vector<Mat4>& vModel, std::vector<Mat4>& vSkin) {
+            size_t n = std::min(vModel.size(), skel.vInverseBind.size());
+            vSkin.resize(n);
+            for (size_t i = 0; i < n; i++) koi_MulAffine(vModel[i], skel.vInverseBind[i], vSkin[i]);
+        }
+
+
+        // MARK: koi::AnimationInstance
+        // +------------------------------------------------------------------------------+
+        // | koi::AnimationInstance - One animated rig, and updating many of them         |
+        // +------------------------------------------------------------------------------+
+        struct AnimationInstance {
+            const Skeleton*      pSkeleton = nullptr;
+            const AnimationClip* pClip     = nullptr;
+            float                fTime     = 0.0f;
+            float                fSpeed    = 1.0f;
+            bool                 bLoop     = true;
+            bool                 bSkin     = false;         // Also fill vSkin
+            AnimationClip::Interpolation interp = AnimationClip::NLERP;
+
+            Pose              pose;
+            std::vector<Mat4> vModel;
+            std::vector<Mat4> vSkin;
+        };
+
+        // Advances, samples and builds matrices for every instance. Rigs are independent so
+        // they are shared out across the threads nGrain at a time.
+        void UpdateAnimations(std::vector<AnimationInstance>& vInstances, float fElapsedTime, int32_t nGrain = 8) {
+            auto update = [&](int32_t i) {
+                AnimationInstance& inst = vInstances[i];
+                if (!inst.pSkeleton || !inst.pClip) return;
+                inst.fTime += fElapsedTime * inst.fSpeed;
+                inst.pClip->Sample(inst.fTime, inst.pose, inst.bLoop, inst.interp);
+                ComputeModelMatrices(*inst.pSkeleton, inst.pose, inst.vModel);
+                if (inst.bSkin) ComputeSkinMatrices(*inst.pSkeleton, inst.vModel, inst.vSkin);
+            };
+            int32_t n = int32_t(vInstances.size());
+            if (n <= nGrain) { for (int32_t i = 0; i < n; i++) update(i); return; }
+            ParallelFor(0, n, update, nGrain);
+        }
+    }
+
+#endif /* Animation_h */
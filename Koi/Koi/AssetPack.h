@@ -0,0 +1,382 @@
+//
+//  AssetPack.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef AssetPack_h
+#define AssetPack_h
+
+    #include <cstdio>
+    #include "Global.h"
+    #include "Sprite.h"
+    #include "ImageLoader.h"
+
+    #if defined(_WIN32)
+        #include <windows.h>
+    #else
+        #include <fcntl.h>
+        #include <sys/mman.h>
+        #include <sys/stat.h>
+        #include <unistd.h>
+    #endif
+
+    // A pack is one file of pre-decoded sprites that is memory mapped at runtime:
+    //
+    //   PackHeader
+    //   PackEntry[nEntries]
+    //   uint32_t  table[nTableSize]    open addressed on the name hash, entry index + 1, 0 = empty
+    //   names, not terminated
+    //   pixel blobs, each 64 byte aligned, rows of stride pixels (or LZ4 blocks of the same)
+    //
+    // Everything is little endian. Uncompressed blobs are used in place, straight out of the
+    // mapping, so loading costs page faults and the pages are shared by every process that
+    // maps the same pack until somebody writes to them.
+
+    namespace koi {
+        // MARK: koi::lz4
+        // +------------------------------------------------------------------------------+
+        // | koi::lz4 - LZ4 block format compression                                      |
+        // +------------------------------------------------------------------------------+
+        namespace lz4 {
+            size_t CompressBound(size_t n) { return n + n / 255 + 16; }
+
+            // Greedy single hash compressor, returns the compressed size
+            size_t Compress(const uint8_t* src, size_t n, uint8_t* dst) {
+                constexpr int    nHashBits   = 14;
+                constexpr size_t nMinMatch   = 4, nLastLiterals = 5, nMatchLimit = 12;
+                std::vector<uint32_t> vTable(size_t(1) << nHashBits, 0xFFFFFFFF);
+                auto read32 = [&](size_t i) { uint32_t v; memcpy(&v, src + i, 4); return v; };
+                auto hash   = [&](uint32_t v) { return (v * 2654435761u) >> (32 - nHashBits); };
+
+                uint8_t* op = dst;
+                auto writeLength = [&](size_t len) { while (len >= 255) { *op++ = 255; len -= 255; } *op++ = uint8_t(len); };
+                auto emit = [&](size_t anchor, size_t nLit, size_t nOffset, size_t nMatch) {
+                    uint8_t* token = op++;
+                    *token = uint8_t(std::min<size_t>(nLit, 15) << 4);
+                    if (nLit >= 15) writeLength(nLit - 15);
+                    memcpy(op, src + anchor, nLit); op += nLit;
+                    if (nMatch == 0) return; // Final literal run
+                    *op++ = uint8_t(nOffset); *op++ = uint8_t(nOffset >> 8);
+                    *token |= uint8_t(std::min<size_t>(nMatch - nMinMatch, 15));
+                    if (nMatch - nMinMatch >= 15) writeLength(nMatch - nMinMatch - 15);
+                };
+
+                size_t ip = 0, anchor = 0;
+                if (n > nMatchLimit) {
+                    while (ip < n - nMatchLimit) {
+                        uint32_t seq = read32(ip), h = hash(seq), ref = vTable[h];
+                        vTable[h] = uint32_t(ip);
+                        if (ref != 0xFFFFFFFF && ip - ref <= 0xFFFF && read32(ref) == seq) {
+                            size_t nMatch = nMinMatch;
+                            while (ip + nMatch < n - nLastLiterals && src[ref + nMatch] == src[ip + nMatch]) nMatch++;
+                            emit(anchor, ip - anchor, ip - ref, nMatch);
+                            ip += nMatch; anchor = ip;
+                        } else ip++;
+                    }
+                }
+                emit(anchor, n - anchor, 0, 0);
+                return size_t(op - dst);
+            }
+
+            // Returns false on malformed input or if the output would not be exactly nDst bytes
+            bool Decompress(const uint8_t* src, size_t nSrc, uint8_t* dst, size_t nDst) {
+                const uint8_t *ip = src, *iend = src + nSrc;
+                uint8_t *op = dst, *oend = dst + nDst;
+                auto readLength = [&](size_t& len) {
+                    uint8_t b;
+                    do { if (ip >= iend) return false; b = *ip++; len += b; } while (b == 255);
+                    return true;
+                };
+
+                while (ip < iend) {
+                    uint8_t token = *ip++;
+                    size_t nLit = token >> 4;
+                    if (nLit == 15 && !readLength(nLit)) return false;
+                    if (size_t(iend - ip) < nLit || size_t(oend - op) < nLit) return false;
+                    memcpy(op, ip, nLit); ip += nLit; op += nLit;
+                    if (ip >= iend) break; // Last sequence has no match
+
+                    if (iend - ip < 2) return false;
+                    size_t nOffset = size_t(ip[0]) | (size_t(ip[1]) << 8); ip += 2;
+                    size_t nMatch = token & 15;
+                    if (nMatch == 15 && !readLength(nMatch)) return false;
+                    nMatch += 4;
+                    if (nOffset == 0 || nOffset > size_t(op - dst) || size_t(oend - op) < nMatch) return false;
+
+                    const uint8_t* ref = op - nOffset;
+                    if (nOffset >= nMatch) memcpy(op, ref, nMatch);
+                    else for (size_t i = 0; i < nMatch; i++) op[i] = ref[i];
+                    op += nMatch;
+                }
+                return op == oend;
+            }
+        }
+
+
+        struct PackHeader {
+            char     sMagic[4]    = { 'K', 'O', 'I', 'P' };
+            uint32_t nVersion     = 1;
+            uint32_t nEntries     = 0;
+            uint32_t nTableSize   = 0;     // Power of two
+            uint64_t nTableOffset = 0;
+            uint64_t nNamesOffset = 0;
+        };
+
+        struct PackEntry {
+            enum Flags : uint32_t { COMPRESSED = 1 };
+            uint64_t nHash        = 0;
+            uint32_t nNameOffset  = 0;     // Relative to PackHeader::nNamesOffset
+            uint32_t nNameLength  = 0;
+            int32_t  width        = 0;
+            int32_t  height       = 0;
+            int32_t  stride       = 0;     // Pixels
+            uint32_t nFlags       = 0;
+            uint64_t nDataOffset  = 0;     // From the start of the file, 64 byte aligned
+            uint64_t nDataSize    = 0;     // Bytes stored in the file
+        };
+
+        uint64_t PackHash(const char* s, size_t n) { // FNV-1a
+            uint64_t h = 14695981039346656037ull;
+            for (size_t i = 0; i < n; i++) { h ^= uint8_t(s[i]); h *= 1099511628211ull; }
+            return h;
+        }
+
+
+        // MARK: koi::AssetPackBuilder
+        // +------------------------------------------------------------------------------+
+        // | koi::AssetPackBuilder - Collects sprites and writes a pack file              |
+        // +------------------------------------------------------------------------------+
+        class AssetPackBuilder {
+        public:
+            rcode Add     (const std::string& sName, const SpriteView& spr);     // Copies the pixels
+            rcode AddImage(const std::string& sName, const std::string& sImageFile);
+            rcode Write   (const std::string& sPackFile, bool bCompress = false) const;
+
+        private:
+            struct Item { std::string sName; Sprite spr; };
+            std::vector<Item> vItems;
+        };
+
+        rcode AssetPackBuilder::Add(const std::string& sName, const SpriteView& view) {
+            Sprite spr;
+            if (spr.Resize(view.width, view.height) != OK) return FAIL;
+            for (int32_t y = 0; y < view.height; y++) memcpy((void*)spr.GetRow(y), view.GetRow(y), view.width * sizeof(Color));
+            vItems.push_back({ sName, std::move(spr) });
+            return OK;
+        }
+
+        rcode AssetPackBuilder::AddImage(const std::string& sName, const std::string& sImageFile) {
+            Sprite spr;
+            rcode rc = ImageLoader::LoadImage(spr, sImageFile);
+            if (rc == OK) vItems.push_back({ sName, std::move(spr) });
+            return rc;
+        }
+
+        rcode AssetPackBuilder::Write(const std::string& sPackFile, bool bCompress) const {
+            PackHeader header;
+            header.nEntries = uint32_t(vItems.size());
+            header.nTableSize = 1;
+            while (header.nTableSize < header.nEntries * 2) header.nTableSize <<= 1; // Load factor <= 0.5
+
+            std::vector<PackEntry> vEntries(vItems.size());
+            std::vector<uint32_t>  vTable(header.nTableSize, 0);
+            std::string            sNames;
+            for (size_t i = 0; i < vItems.size(); i++) {
+                PackEntry& e = vEntries[i];
+                e.nHash       = PackHash(vItems[i].sName.data(), vItems[i].sName.size());
+                e.nNameOffset = uint32_t(sNames.size());
+                e.nNameLength = uint32_t(vItems[i].sName.size());
+                e.width       = vItems[i].spr.width;
+                e.height      = vItems[i].spr.height;
+                e.stride      = vItems[i].spr.stride;
+                sNames       += vItems[i].sName;
+
+                uint32_t slot = uint32_t(e.nHash) & (header.nTableSize - 1);
+                while (vTable[slot]) slot = (slot + 1) & (header.nTableSize - 1);
+                vTable[slot] = uint32_t(i + 1);
+            }
+
+            auto align = [](uint64_t v) { return (v + nPixelAlignment - 1) & ~uint64_t(nPixelAlignment - 1); };
+            header.nTableOffset = sizeof(PackHeader) + vEntries.size() * sizeof(PackEntry);
+            header.nNamesOffset = header.nTableOffset + vTable.size() * sizeof(uint32_t);
+            uint64_t nOffset    = align(header.nNamesOffset + sNames.size());
+
+            // Compress up front so every data offset is known before anything is written
+            std::vector<std::vector<uint8_t>> vCompressed(vItems.size());
+            for (size_t i = 0; i < vItems.size(); i++) {
+                PackEntry& e = vEntries[i];
+                const Sprite& spr = vItems[i].spr;
+                size_t nRaw = size_t(spr.stride) * spr.height * sizeof(Color);
+                e.nDataSize = nRaw;
+                if (bCompress && nRaw > 0) {
+                    vCompressed[i].resize(lz4::CompressBound(nRaw));
+                    size_t n = lz4::Compress((const uint8_t*)spr.pColData, nRaw, vCompressed[i].data());
+                    if (n < nRaw - nRaw / 8) { vCompressed[i].resize(n); e.nDataSize = n; e.nFlags |= PackEntry::COMPRESSED; }
+                    else vCompressed[i].clear();
+                }
+                e.nDataOffset = nOffset;
+                nOffset = align(nOffset + e.nDataSize);
+            }
+
+            FILE* f = fopen(sPackFile.c_str(), "wb");
+            if (f == nullptr) return NO_FILE;
+            bool bOK = fwrite(&header, sizeof(header), 1, f) == 1;
+            if (!vEntries.empty()) bOK &= fwrite(vEntries.data(), sizeof(PackEntry), vEntries.size(), f) == vEntries.size();
+            bOK &= fwrite(vTable.data(), sizeof(uint32_t), vTable.size(), f) == vTable.size();
+            bOK &= fwrite(sNames.data(), 1, sNames.size(), f) == sNames.size();
+
+            static const uint8_t zeros[nPixelAlignment] = { 0 };
+            uint64_t nPos = header.nNamesOffset + sNames.size();
+            for (size_t i = 0; i < vItems.size() && bOK; i++) {
+                const PackEntry& e = vEntries[i];
+                bOK &= fwrite(zeros, 1, size_t(e.nDataOffset - nPos), f) == size_t(e.nDataOffset - nPos);
+                const uint8_t* pData = (e.nFlags & PackEntry::COMPRESSED) ? vCompressed[i].data() : (const uint8_t*)vItems[i].spr.pColData;
+                if (e.nDataSize) bOK &= fwrite(pData, 1, size_t(e.nDataSize), f) == size_t(e.nDataSize);
+                nPos = e.nDataOffset + e.nDataSize;
+            }
+            bOK &= fclose(f) == 0;
+            return bOK ? OK : FAIL;
+        }
+
+
+        // MARK: koi::AssetPack
+        // +------------------------------------------------------------------------------+
+        // | koi::AssetPack - Memory mapped, read only at heart, pack of sprites          |
+        // +------------------------------------------------------------------------------+
+        class AssetPack {
+        public:
+            AssetPack() = default;
+            AssetPack(const AssetPack&) = delete;
+            AssetPack& operator = (const AssetPack&) = delete;
+            ~AssetPack();
+
+            rcode            Open     (const std::string& sPackFile);
+            void             Close    ();
+            uint32_t         Count    () const;
+            const PackEntry* Find     (const std::string& sName) const;
+            std::string      GetName  (const PackEntry& e) const;
+            // Uncompressed views and sprites borrow the mapping and dangle once the pack is closed or destroyed,
+            // copy them (Sprite's copy constructor owns its pixels) to keep them past Close
+            SpriteView       GetView  (const std::string& sName) const;   // Empty for compressed entries
+            Sprite           GetSprite(const std::string& sName) const;   // Borrows the mapping unless compressed
+            Sprite           GetSprite(const PackEntry& e) const;
+
+        private:
+            const uint8_t*    pBase    = nullptr;
+            size_t            nSize    = 0;
+            const PackHeader* pHeader  = nullptr;
+            const PackEntry*  pEntries = nullptr;
+            const uint32_t*   pTable   = nullptr;
+            #if defined(_WIN32)
+                HANDLE hFile = INVALID_HANDLE_VALUE, hMapping = nullptr;
+            #endif
+        };
+
+        AssetPack::~AssetPack() { Close(); }
+
+        rcode AssetPack::Open(const std::string& sPackFile) {
+            Close();
+            #if defined(_WIN32)
+                hFile = CreateFileA(sPackFile.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+                if (hFile == INVALID_HANDLE_VALUE) return NO_FILE;
+                LARGE_INTEGER size;
+                GetFileSizeEx(hFile, &size);
+                nSize = size_t(size.QuadPart);
+                hMapping = CreateFileMappingA(hFile, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+                if (hMapping) pBase = (const uint8_t*)MapViewOfFile(hMapping, FILE_MAP_COPY, 0, 0, 0);
+            #else
+                int fd = open(sPackFile.c_str(), O_RDONLY);
+                if (fd < 0) return NO_FILE;
+                struct stat st;
+                if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                    nSize = size_t(st.st_size);
+                    // Private and writable: pages stay shared with the page cache until written to
+                    void* p = mmap(nullptr, nSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+                    if (p != MAP_FAILED) pBase = (const uint8_t*)p;
+                }
+                close(fd);
+            #endif
+            if (pBase == nullptr) { Close(); return FAIL; }
+
+            pHeader = (const PackHeader*)pBase;
+            bool bValid = nSize >= sizeof(PackHeader) && memcmp(pHeader->sMagic, "KOIP", 4) == 0 && pHeader->nVersion == 1
+                       && pHeader->nTableSize && (pHeader->nTableSize & (pHeader->nTableSize - 1)) == 0
+                       && pHeader->nTableOffset == sizeof(PackHeader) + uint64_t(pHeader->nEntries) * sizeof(PackEntry)
+                       && pHeader->nNamesOffset == pHeader->nTableOffset + uint64_t(pHeader->nTableSize) * sizeof(uint32_t)
+                       && pHeader->nNamesOffset <= nSize;
+            if (bValid) {
+                pEntries = (const PackEntry*)(pBase + sizeof(PackHeader));
+                pTable   = (const uint32_t*)(pBase + pHeader->nTableOffset);
+                for (uint32_t i = 0; i < pHeader->nEntries && bValid; i++) {
+                    const PackEntry& e = pEntries[i];
+                    bValid = e.nDataOffset % nPixelAlignment == 0 && e.nDataOffset <= nSize && e.nDataSize <= nSize - e.nDataOffset
+                          && pHeader->nNamesOffset + e.nNameOffset + e.nNameLength <= nSize
+                          // Borrowed sprites must look exactly like ones we allocated: aligned rows and aligned base
+                          && e.width >= 0 && e.height >= 0 && e.width <= INT32_MAX - int32_t(nPixelAlignment)
+                          && e.stride == Sprite::AlignedStride(e.width)
+                          && ((e.nFlags & PackEntry::COMPRESSED) || e.nDataSize >= uint64_t(e.stride) * e.height * sizeof(Color));
+                }
+            }
+            if (!bValid) { Close(); return FAIL; }
+            return OK;
+        }
+
+        void AssetPack::Close() {
+            #if defined(_WIN32)
+                if (pBase) UnmapViewOfFile(pBase);
+                if (hMapping) CloseHandle(hMapping);
+                if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+                hMapping = nullptr; hFile = INVALID_HANDLE_VALUE;
+            #else
+                if (pBase) munmap((void*)pBase, nSize);
+            #endif
+            pBase = nullptr; nSize = 0;
+            pHeader = nullptr; pEntries = nullptr; pTable = nullptr;
+        }
+
+        uint32_t AssetPack::Count() const { return pHeader ? pHeader->nEntries : 0; }
+
+        std::string AssetPack::GetName(const PackEntry& e) const {
+            return std::string((const char*)pBase + pHeader->nNamesOffset + e.nNameOffset, e.nNameLength);
+        }
+
+        const PackEntry* AssetPack::Find(const std::string& sName) const {
+            if (pHeader == nullptr) return nullptr;
+            uint64_t h = PackHash(sName.data(), sName.size());
+            uint32_t nMask = pHeader->nTableSize - 1;
+            for (uint32_t slot = uint32_t(h) & nMask, n = 0; n <= nMask; slot = (slot + 1) & nMask, n++) {
+                uint32_t i = pTable[slot];
+                if (i == 0 || i > pHeader->nEntries) return nullptr;
+                const PackEntry& e = pEntries[i - 1];
+                if (e.nHash == h && e.nNameLength == sName.size() &&
+                    memcmp(pBase + pHeader->nNamesOffset + e.nNameOffset, sName.data(), e.nNameLength) == 0) return &e;
+            }
+            return nullptr;
+        }
+
+        SpriteView AssetPack::GetView(const std::string& sName) const {
+            const PackEntry* e = Find(sName);
+            if (e == nullptr || (e->nFlags & PackEntry::COMPRESSED)) return SpriteView();
+            return SpriteView((Color*)(pBase + e->nDataOffset), e->width, e->height, e->stride);
+        }
+
+        Sprite AssetPack::GetSprite(const std::string& sName) const {
+            const PackEntry* e = Find(sName);
+            return e ? GetSprite(*e) : Sprite();
+        }
+
+        Sprite AssetPack::GetSprite(const PackEntry& e) const {
+            if (!(e.nFlags & PackEntry::COMPRESSED)) return Sprite((Color*)(pBase + e.nDataOffset), e.width, e.height, e.stride);
+
+            // Compressed entries decompress into a pooled buffer, the stored stride always matches ours
+            Sprite spr(e.width, e.height);
+            if (spr.stride != e.stride ||
+                !lz4::Decompress(pBase + e.nDataOffset, size_t(e.nDataSize), (uint8_t*)spr.pColData, size_t(e.stride) * e.height * sizeof(Color)))
+                return Sprite();
+            return spr;
+        }
+    }
+
+#endif /* AssetPack_h */
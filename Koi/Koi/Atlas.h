@@ -0,0 +1,269 @@
+//
+//  Atlas.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef Atlas_h
+#define Atlas_h
+
+    #include "Global.h"
+    #include "Sprite.h"
+    #include "ImageLoader.h"
+
+    namespace koi {
+        // MARK: koi::MaxRectsPacker
+        // +------------------------------------------------------------------------------+
+        // | koi::MaxRectsPacker - Rectangle bin packer, best short side fit              |
+        // +------------------------------------------------------------------------------+
+        class MaxRectsPacker {
+        public:
+            struct Rect { int32_t x = 0, y = 0, w = 0, h = 0; };
+
+            MaxRectsPacker(int32_t w, int32_t h);
+            bool Insert(int32_t w, int32_t h, Rect& out); // False when the rectangle does not fit
+
+        private:
+            void SplitFreeRects(const Rect& used);
+            void PruneFreeRects();
+
+            std::vector<Rect> vFree;
+            std::vector<Rect> vNew;
+        };
+
+        MaxRectsPacker::MaxRectsPacker(int32_t w, int32_t h) { vFree.push_back({ 0, 0, w, h }); }
+
+        bool MaxRectsPacker::Insert(int32_t w, int32_t h, Rect& out) {
+            int32_t nBestShort = INT32_MAX, nBestLong = INT32_MAX;
+            for (const Rect& r : vFree) {
+                if (r.w < w || r.h < h) continue;
+                int32_t dw = r.w - w, dh = r.h - h;
+                int32_t nShort = std::min(dw, dh), nLong = std::max(dw, dh);
+                if (nShort < nBestShort || (nShort == nBestShort && nLong < nBestLong)) {
+                    out = { r.x, r.y, w, h };
+                    nBestShort = nShort; nBestLong = nLong;
+                }
+            }
+            if (nBestShort == INT32_MAX) return false;
+            SplitFreeRects(out);
+            PruneFreeRects();
+            return true;
+        }
+
+        void MaxRectsPacker::SplitFreeRects(const Rect& u) {
+            vNew.clear();
+            for (size_t i = 0; i < vFree.size();) {
+                Rect r = vFree[i];
+                if (u.x >= r.x + r.w || u.x + u.w <= r.x || u.y >= r.y + r.h || u.y + u.h <= r.y) { i++; continue; }
+
+                // Up to four maximal rectangles remain around the used one
+                if (u.x > r.x)             vNew.push_back({ r.x, r.y, u.x - r.x, r.h });
+                if (u.x + u.w < r.x + r.w) vNew.push_back({ u.x + u.w, r.y, r.x + r.w - u.x - u.w, r.h });
+                if (u.y > r.y)             vNew.push_back({ r.x, r.y, r.w, u.y - r.y });
+                if (u.y + u.h < r.y + r.h) vNew.push_back({ r.x, u.y + u.h, r.w, r.y + r.h - u.y - u.h });
+                vFree[i] = vFree.back();
+                vFree.pop_back();
+            }
+            vFree.insert(vFree.end(), vNew.begin(), vNew.end());
+        }
+
+        void MaxRectsPacker::PruneFreeRects() {
+            auto contains = [](const Rect& a, const Rect& b) {
+                return b.x >= a.x && b.y >= a.y && b.x + b.w <= a.x + a.w && b.y + b.h <= a.y + a.h;
+            };
+            for (size_t i = 0; i < vFree.size(); i++) {
+                for (size_t j = i + 1; j < vFree.size(); j++) {
+                    if (contains(vFree[j], vFree[i])) { vFree.erase(vFree.begin() + i); i--; break; }
+                    if (contains(vFree[i], vFree[j])) { vFree.erase(vFree.begin() + j); j--; }
+                }
+            }
+        }
+
+
+        // MARK: koi::Atlas
+        // +------------------------------------------------------------------------------+
+        // | koi::Atlas - Pages of packed sprites                                         |
+        // +------------------------------------------------------------------------------+
+        struct AtlasEntry {
+            std::string sName;
+            int32_t     nPage   = 0;
+            int32_t     x = 0, y = 0, w = 0, h = 0;    // Trimmed rectangle on the page
+            int32_t     nOffsetX = 0, nOffsetY = 0;    // Where the trimmed rectangle sat in the source
+            int32_t     nSourceW = 0, nSourceH = 0;
+            float       u0 = 0.0f, v0 = 0.0f, u1 = 0.0f, v1 = 0.0f;
+            SpriteView  view;                          // Draw at (px + nOffsetX, py + nOffsetY)
+        };
+
+        class Atlas {
+        public:
+            std::vector<Sprite>     vPages;
+            std::vector<AtlasEntry> vEntries;           // Same order the sprites were added in
+
+            Atlas() = default;
+            Atlas(const Atlas& atlas);                  // Copies rebase every entry view on the new pages
+            Atlas(Atlas&&) = default;
+            Atlas& operator=(const Atlas& atlas);
+            Atlas& operator=(Atlas&&) = default;
+
+            const AtlasEntry* Find(const std::string& sName) const;
+
+        private:
+            friend class AtlasBuilder;
+            void koi_RebaseViews();
+
+            std::map<std::string, size_t> mapEntries;
+        };
+
+        Atlas::Atlas(const Atlas& atlas) : vPages(atlas.vPages), vEntries(atlas.vEntries), mapEntries(atlas.mapEntries) { koi_RebaseViews(); }
+
+        Atlas& Atlas::operator=(const Atlas& atlas) {
+            if (this == &atlas) return *this;
+            vPages     = atlas.vPages;
+            vEntries   = atlas.vEntries;
+            mapEntries = atlas.mapEntries;
+            koi_RebaseViews();
+            return *this;
+        }
+
+        void Atlas::koi_RebaseViews() {
+            for (AtlasEntry& e : vEntries)
+                e.view = (e.w > 0 && e.h > 0) ? vPages[e.nPage].GetSubView(e.x, e.y, e.w, e.h) : SpriteView();
+        }
+
+        const AtlasEntry* Atlas::Find(const std::string& sName) const {
+            auto it = mapEntries.find(sName);
+            return it == mapEntries.end() ? nullptr : &vEntries[it->second];
+        }
+
+
+        // MARK: koi::AtlasBuilder
+        // +------------------------------------------------------------------------------+
+        // | koi::AtlasBuilder - Packs sprites onto as few atlas pages as it can          |
+        // +------------------------------------------------------------------------------+
+        class AtlasBuilder {
+        public:
+            AtlasBuilder(int32_t nMaxPageSize = 2048, int32_t nPadding = 1, bool bTrim = true);
+
+            void  Add     (const std::string& sName, const SpriteView& spr);  // The pixels must stay valid until Build
+            rcode AddImage(const std::string& sName, const std::string& sImageFile);
+            rcode Build   (Atlas& atlas) const;                               // FAIL if a sprite is bigger than a page
+
+        private:
+            struct Item { std::string sName; SpriteView view; int32_t nOwned = -1; };
+            int32_t             nMaxPageSize, nPadding;
+            bool                bTrim;
+            std::vector<Item>   vItems;
+            std::vector<Sprite> vOwned;
+        };
+
+        AtlasBuilder::AtlasBuilder(int32_t nMaxPageSize, int32_t nPadding, bool bTrim)
+            : nMaxPageSize(nMaxPageSize), nPadding(std::max(nPadding, 0)), bTrim(bTrim) { }
+
+        void AtlasBuilder::Add(const std::string& sName, const SpriteView& spr) { vItems.push_back({ sName, spr }); }
+
+        rcode AtlasBuilder::AddImage(const std::string& sName, const std::string& sImageFile) {
+            Sprite spr;
+            rcode rc = ImageLoader::LoadImage(spr, sImageFile);
+            if (rc != OK) return rc;
+            // Views are taken in Build, vOwned may still reallocate
+            vOwned.push_back(std::move(spr));
+            vItems.push_back({ sName, SpriteView(), int32_t(vOwned.size() - 1) });
+            return OK;
+        }
+
+        rcode AtlasBuilder::Build(Atlas& atlas) const {
+            struct Placed { SpriteView src; int32_t nPage, ox, oy; MaxRectsPacker::Rect rect; };
+            std::vector<Placed> vPlaced(vItems.size());
+
+            // Trim transparent borders
+            for (size_t i = 0; i < vItems.size(); i++) {
+                SpriteView v = vItems[i].nOwned >= 0 ? SpriteView(vOwned[vItems[i].nOwned]) : vItems[i].view;
+                int32_t x0 = 0, y0 = 0, x1 = v.width, y1 = v.height;
+                if (bTrim && !v.Empty()) {
+                    x0 = v.width; y0 = v.height; x1 = 0; y1 = 0;
+                    for (int32_t y = 0; y < v.height; y++) {
+                        const Color* row = v.GetRow(y);
+                        int32_t l = 0, r = v.width;
+                        while (l < r && row[l].a == 0) l++;
+                        if (l == r) continue;
+                        while (row[r - 1].a == 0) r--;
+                        x0 = std::min(x0, l); x1 = std::max(x1, r);
+                        y0 = std::min(y0, y); y1 = y + 1;
+                    }
+                    if (x1 <= x0) { x0 = y0 = x1 = y1 = 0; }
+                }
+                vPlaced[i].src = v.SubView(x0, y0, x1 - x0, y1 - y0);
+                vPlaced[i].ox = x0; vPlaced[i].oy = y0;
+                if (vPlaced[i].src.width  + nPadding * 2 > nMaxPageSize ||
+                    vPlaced[i].src.height + nPadding * 2 > nMaxPageSize) return FAIL;
+            }
+
+            // Biggest first packs far tighter than insertion order
+            std::vector<size_t> vOrder(vItems.size());
+            for (size_t i = 0; i < vOrder.size(); i++) vOrder[i] = i;
+            std::stable_sort(vOrder.begin(), vOrder.end(), [&](size_t a, size_t b) {
+                const SpriteView &va = vPlaced[a].src, &vb = vPlaced[b].src;
+                int32_t na = std::max(va.width, va.height), nb = std::max(vb.width, vb.height);
+                return na != nb ? na > nb : va.width * va.height > vb.width * vb.height;
+            });
+
+            // Every sprite gets nPadding clear pixels on each side, so bilinear sampling never bleeds
+            std::vector<MaxRectsPacker> vPackers;
+            std::vector<Vector2i>       vUsed;
+            for (size_t i : vOrder) {
+                Placed& p = vPlaced[i];
+                if (p.src.Empty()) { p.nPage = -1; continue; }
+                int32_t w = p.src.width + nPadding * 2, h = p.src.height + nPadding * 2;
+                size_t nPage = 0;
+                while (nPage < vPackers.size() && !vPackers[nPage].Insert(w, h, p.rect)) nPage++;
+                if (nPage == vPackers.size()) {
+                    vPackers.emplace_back(nMaxPageSize, nMaxPageSize);
+                    vUsed.push_back(Vector2i(0, 0));
+                    vPackers.back().Insert(w, h, p.rect);
+                }
+                p.nPage = int32_t(nPage);
+                vUsed[nPage].x = std::max(vUsed[nPage].x, p.rect.x + w);
+                vUsed[nPage].y = std::max(vUsed[nPage].y, p.rect.y + h);
+            }
+
+            // Shrink each page to the smallest power of two that holds what landed on it, but never past nMaxPageSize
+            atlas.vPages.clear();
+            for (const Vector2i& used : vUsed) {
+                int32_t w = 1, h = 1;
+                while (w < used.x) w <<= 1;
+                while (h < used.y) h <<= 1;
+                w = std::min(w, nMaxPageSize);
+                h = std::min(h, nMaxPageSize);
+                atlas.vPages.emplace_back();
+                if (atlas.vPages.back().Resize(w, h) != OK) return FAIL;
+            }
+
+            atlas.vEntries.clear();
+            atlas.mapEntries.clear();
+            atlas.vEntries.reserve(vItems.size());
+            for (size_t i = 0; i < vItems.size(); i++) {
+                const Placed& p = vPlaced[i];
+                AtlasEntry e;
+                e.sName    = vItems[i].sName;
+                e.nOffsetX = p.ox;  e.nOffsetY = p.oy;
+                e.nSourceW = vItems[i].nOwned >= 0 ? vOwned[vItems[i].nOwned].width  : vItems[i].view.width;
+                e.nSourceH = vItems[i].nOwned >= 0 ? vOwned[vItems[i].nOwned].height : vItems[i].view.height;
+                if (p.nPage >= 0) {
+                    Sprite& page = atlas.vPages[p.nPage];
+                    e.nPage = p.nPage;
+                    e.x = p.rect.x + nPadding; e.y = p.rect.y + nPadding;
+                    e.w = p.src.width;         e.h = p.src.height;
+                    for (int32_t y = 0; y < e.h; y++) memcpy((void*)(page.GetRow(e.y + y) + e.x), p.src.GetRow(y), e.w * sizeof(Color));
+                    e.u0 = float(e.x) / page.width;         e.v0 = float(e.y) / page.height;
+                    e.u1 = float(e.x + e.w) / page.width;   e.v1 = float(e.y + e.h) / page.height;
+                    e.view = page.GetSubView(e.x, e.y, e.w, e.h);
+                }
+                atlas.mapEntries[e.sName] = atlas.vEntries.size();
+                atlas.vEntries.push_back(std::move(e));
+            }
+            return OK;
+        }
+    }
+
+#endif /* Atlas_h */
@@ -0,0 +1,578 @@
+//
+//  Audio.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef Audio_h
+#define Audio_h
+
+    #include <algorithm>
+    #include <atomic>
+    #include <chrono>
+    #include <cmath>
+    #include <cstdio>
+    #include <cstring>
+    #include <memory>
+    #include <string>
+    #include <thread>
+    #include <vector>
+    #include "Global.h"
+    #include "Allocator.h"
+    #include "VectorBatch.h"
+
+    // Define KOI_AUDIO_ALSA and link with -lasound for AudioSink_ALSA
+    #if defined(KOI_AUDIO_ALSA)
+        #include <alsa/asoundlib.h>
+    #endif
+
+    namespace koi {
+        // MARK: koi::SpscRing
+        // +------------------------------------------------------------------------------+
+        // | koi::SpscRing - Lock free ring for exactly one writer and one reader thread  |
+        // +------------------------------------------------------------------------------+
+        // Each side only ever stores its own index, so neither side waits on the other.
+        // T must be trivially copyable.
+        template<class T> class SpscRing {
+        public:
+            explicit SpscRing(size_t nCapacity);                        // Rounded up to a power of two
+
+            size_t Capacity      () const { return nMask + 1; }
+            size_t ReadAvailable () const;                              // Reader side
+            size_t WriteAvailable() const;                              // Writer side
+
+            size_t Write(const T* p, size_t n);                         // Returns how many fit
+            size_t Read (T* p, size_t n);                               // Returns how many there were
+            bool   Push (const T& v) { return Write(&v, 1) == 1; }
+            bool   Pop  (T& v)       { return Read(&v, 1) == 1; }
+
+        private:
+            std::vector<T>      vData;
+            size_t              nMask;
+            std::atomic<size_t> nWrite{ 0 };
+            char                pPad[64];                               // Keeps the two indices on separate cache lines
+            std::atomic<size_t> nRead{ 0 };
+        };
+
+        template<class T> SpscRing<T>::SpscRing(size_t nCapacity) {
+            size_t n = 1;
+            while (n < nCapacity) n <<= 1;
+            vData.resize(n);
+            nMask = n - 1;
+        }
+
+        template<class T> size_t SpscRing<T>::ReadAvailable () const { return nWrite.load(std::memory_order_acquire) - nRead.load(std::memory_order_relaxed); }
+        template<class T> size_t SpscRing<T>::WriteAvailable() const { return Capacity() - (nWrite.load(std::memory_order_relaxed) - nRead.load(std::memory_order_acquire)); }
+
+        template<class T> size_t SpscRing<T>::Write(const T* p, size_t n) {
+            size_t w = nWrite.load(std::memory_order_relaxed);
+            n = std::min(n, Capacity() - (w - nRead.load(std::memory_order_acquire)));
+            size_t i = w & nMask, n1 = std::min(n, Capacity() - i);
+            std::copy(p, p + n1, vData.begin() + i);
+            std::copy(p + n1, p + n, vData.begin());
+            nWrite.store(w + n, std::memory_order_release);
+            return n;
+        }
+
+        template<class T> size_t SpscRing<T>::Read(T* p, size_t n) {
+            size_t r = nRead.load(std::memory_order_relaxed);
+            n = std::min(n, nWrite.load(std::memory_order_acquire) - r);
+            size_t i = r & nMask, n1 = std::min(n, Capacity() - i);
+            std::copy(vData.begin() + i, vData.begin() + i + n1, p);
+            std::copy(vData.begin(), vData.begin() + (n - n1), p + n1);
+            nRead.store(r + n, std::memory_order_release);
+            return n;
+        }
+
+
+        // MARK: koi::AudioClip
+        // +------------------------------------------------------------------------------+
+        // | koi::AudioClip - Decoded sound, one float array per channel                  |
+        // +------------------------------------------------------------------------------+
+        class AudioClip {
+        public:
+            AudioClip() = default;
+            AudioClip(const float* pSamples, int32_t nFrames, int32_t nChannels, int32_t nSampleRate);    // Interleaved, channels past two are dropped, empty if nSampleRate <= 0
+
+            rcode LoadWav(const std::string& sFile);
+            rcode LoadWav(const uint8_t* pData, size_t nSize);          // 8, 16, 24 bit PCM or 32 bit float
+
+            int32_t      Frames    () const { return nFrames;     }
+            int32_t      Channels  () const { return nChannels;   }     // 1 or 2, 0 when empty
+            int32_t      SampleRate() const { return nSampleRate; }
+            const float* GetChannel(int32_t c) const { return vChannels[std::min(c, nChannels - 1)].data(); }
+
+        private:
+            AlignedVector<float> vChannels[2];
+            int32_t              nFrames = 0, nChannels = 0, nSampleRate = 0;
+        };
+
+        AudioClip::AudioClip(const float* pSamples, int32_t frames, int32_t channels, int32_t rate) {
+            nFrames = std::max(frames, 0); nChannels = std::min(std::max(channels, 0), 2); nSampleRate = std::max(rate, 0);
+            if (nChannels == 0 || nSampleRate == 0) { nFrames = 0; nChannels = 0; return; }
+            for (int32_t c = 0; c < nChannels; c++) {
+                vChannels[c].resize(nFrames);
+                for (int32_t i = 0; i < nFrames; i++) vChannels[c][i] = pSamples[size_t(i) * channels + c];
+            }
+        }
+
+        rcode AudioClip::LoadWav(const uint8_t* pData, size_t nSize) {
+            auto u16 = [](const uint8_t* p) { return uint32_t(p[0]) | (uint32_t(p[1]) << 8); };
+            auto u32 = [](const uint8_t* p) { return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24); };
+            if (nSize < 12 || memcmp(pData, "RIFF", 4) != 0 || memcmp(pData + 8, "WAVE", 4) != 0) return FAIL;
+
+            // Walk the chunks for the format and the samples, anything else is skipped
+            uint32_t nFormat = 0, nChans = 0, nRate = 0, nBits = 0;
+            const uint8_t* pSamples = nullptr;
+            size_t nBytes = 0;
+            for (size_t nPos = 12; nPos + 8 <= nSize;) {
+                size_t nChunk = u32(pData + nPos + 4), nBody = nPos + 8;
+                if (nChunk > nSize - nBody) nChunk = nSize - nBody;
+                if (memcmp(pData + nPos, "fmt ", 4) == 0 && nChunk >= 16) {
+                    nFormat = u16(pData + nBody);     nChans = u16(pData + nBody + 2);
+                    nRate   = u32(pData + nBody + 4); nBits  = u16(pData + nBody + 14);
+                    if (nFormat == 0xFFFE && nChunk >= 26) nFormat = u16(pData + nBody + 24);   // WAVE_FORMAT_EXTENSIBLE sub format
+                } else if (memcmp(pData + nPos, "data", 4) == 0) { pSamples = pData + nBody; nBytes = nChunk; }
+                nPos = nBody + nChunk + (nChunk & 1);
+            }
+
+            bool bPCM = nFormat == 1 && (nBits == 8 || nBits == 16 || nBits == 24), bFloat = nFormat == 3 && nBits == 32;
+            if (pSamples == nullptr || nChans == 0 || nRate == 0 || nRate > 0x7FFFFFFF || !(bPCM || bFloat)) return FAIL;
+
+            uint32_t nStride = nChans * nBits / 8;
+            nFrames = int32_t(std::min<size_t>(nBytes / nStride, 0x7FFFFFFF)); nChannels = int32_t(std::min(nChans, 2u)); nSampleRate = int32_t(nRate);
+            for (int32_t c = 0; c < 2; c++) vChannels[c].assign(c < nChannels ? nFrames : 0, 0.0f);
+            for (int32_t c = 0; c < nChannels; c++) {
+                const uint8_t* p = pSamples + c * (nBits / 8);
+                float* pOut = vChannels[c].data();
+                for (int32_t i = 0; i < nFrames; i++, p += nStride) {
+                    switch (nBits) {
+                        case 8:  pOut[i] = (float(p[0]) - 128.0f) * (1.0f / 128.0f);                                                                      break;
+                        case 16: pOut[i] = float(int16_t(u16(p))) * (1.0f / 32768.0f);                                                                    break;
+                        case 24: pOut[i] = float(int32_t((uint32_t(p[0]) << 8) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 24)) / 256) * (1.0f / 8388608.0f); break;
+                        case 32: { uint32_t n = u32(p); memcpy(&pOut[i], &n, 4); }                                                                      break;
+                    }
+                }
+            }
+            return OK;
+        }
+
+        rcode AudioClip::LoadWav(const std::string& sFile) {
+            FILE* f = fopen(sFile.c_str(), "rb");
+            if (f == nullptr) return NO_FILE;
+            std::vector<uint8_t> vFile;
+            if (fseek(f, 0, SEEK_END) == 0) {
+                long nSize = ftell(f);
+                if (nSize > 0) {
+                    vFile.resize(size_t(nSize));
+                    fseek(f, 0, SEEK_SET);
+                    if (fread(vFile.data(), 1, vFile.size(), f) != vFile.size()) vFile.clear();
+                }
+            }
+            fclose(f);
+            if (vFile.empty()) return FAIL;
+            return LoadWav(vFile.data(), vFile.size());
+        }
+
+
+        // MARK: koi::AudioSink
+        // +------------------------------------------------------------------------------+
+        // | koi::AudioSink - Where mixed audio ends up, always 16 bit interleaved stereo |
+        // +------------------------------------------------------------------------------+
+        class AudioSink {
+        public:
+            virtual ~AudioSink() = default;
+            virtual rcode Open (int32_t nSampleRate) = 0;
+            virtual void  Write(const int16_t* pFrames, int32_t nFrames) = 0;
+            virtual void  Close() {}
+            virtual bool  Paced() const { return false; }               // True when Write blocks at the device's rate
+        };
+
+        // Throws the audio away, for headless runs and tests
+        class AudioSink_Null : public AudioSink {
+        public:
+            rcode    Open (int32_t) override { return OK; }
+            void     Write(const int16_t*, int32_t nFrames) override { nWritten += uint64_t(nFrames); }
+            uint64_t Frames() const { return nWritten.load(); }
+
+        private:
+            std::atomic<uint64_t> nWritten{ 0 };
+        };
+
+        // Records everything to a WAV file, the sizes in the header are filled in by Close
+        class AudioSink_Wav : public AudioSink {
+        public:
+            explicit AudioSink_Wav(const std::string& sFile) : sFile(sFile) {}
+            ~AudioSink_Wav() override { Close(); }
+
+            rcode Open(int32_t nSampleRate) override {
+                Close();
+                f = fopen(sFile.c_str(), "wb");
+                if (f == nullptr) return NO_FILE;
+                nWritten = 0;
+                koi_Header(nSampleRate);
+                return OK;
+            }
+
+            void Write(const int16_t* pFrames, int32_t nFrames) override {
+                if (f == nullptr || nFrames <= 0) return;
+                nWritten += uint64_t(fwrite(pFrames, 4, size_t(nFrames), f));
+            }
+
+            void Close() override {
+                if (f == nullptr) return;
+                koi_Header(nRate);
+                fclose(f);
+                f = nullptr;
+            }
+
+            uint64_t Frames() const { return nWritten; }
+
+        private:
+            void koi_Header(int32_t nSampleRate) {
+                nRate = nSampleRate;
+                uint32_t nData = uint32_t(std::min<uint64_t>(nWritten * 4, 0xFFFFFFFFu - 36));
+                uint8_t h[44];
+                auto put = [&](int32_t i, uint32_t v, int32_t n) { for (int32_t b = 0; b < n; b++) h[i + b] = uint8_t(v >> (8 * b)); };
+                memcpy(h, "RIFF", 4); put(4, 36 + nData, 4); memcpy(h + 8, "WAVEfmt ", 8);
+                put(16, 16, 4); put(20, 1, 2); put(22, 2, 2); put(24, uint32_t(nRate), 4); put(28, uint32_t(nRate) * 4, 4); put(32, 4, 2); put(34, 16, 2);
+                memcpy(h + 36, "data", 4); put(40, nData, 4);
+                long nEnd = ftell(f);
+                fseek(f, 0, SEEK_SET);
+                fwrite(h, 1, sizeof(h), f);
+                if (nEnd > long(sizeof(h))) fseek(f, nEnd, SEEK_SET);
+            }
+
+            std::string sFile;
+            FILE*       f        = nullptr;
+            uint64_t    nWritten = 0;
+            int32_t     nRate    = 0;
+        };
+
+        #if defined(KOI_AUDIO_ALSA)
+            // Blocking writes to an ALSA device, the device clock paces the output thread
+            class AudioSink_ALSA : public AudioSink {
+            public:
+                explicit AudioSink_ALSA(const std::string& sDevice = "default", uint32_t nLatencyUs = 50000) : sDevice(sDevice), nLatencyUs(nLatencyUs) {}
+                ~AudioSink_ALSA() override { Close(); }
+
+                rcode Open(int32_t nSampleRate) override {
+                    if (snd_pcm_open(&pPCM, sDevice.c_str(), SND_PCM_STREAM_PLAYBACK, 0) < 0) { pPCM = nullptr; return FAIL; }
+                    if (snd_pcm_set_params(pPCM, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED, 2, uint32_t(nSampleRate), 1, nLatencyUs) < 0) { Close(); return FAIL; }
+                    return OK;
+                }
+
+                void Write(const int16_t* pFrames, int32_t nFrames) override {
+                    while (pPCM && nFrames > 0) {
+                        snd_pcm_sframes_t n = snd_pcm_writei(pPCM, pFrames, snd_pcm_uframes_t(nFrames));
+                        if (n < 0) { if (snd_pcm_recover(pPCM, int(n), 1) < 0) return; continue; }   // Underrun or suspend
+                        pFrames += n * 2; nFrames -= int32_t(n);
+                    }
+                }
+
+                void Close() override { if (pPCM) { snd_pcm_drain(pPCM); snd_pcm_close(pPCM); pPCM = nullptr; } }
+                bool Paced() const override { return true; }
+
+            private:
+                std::string sDevice;
+                uint32_t    nLatencyUs;
+                snd_pcm_t*  pPCM = nullptr;
+            };
+        #endif
+
+
+        // MARK: koi::AudioMixer
+        // +------------------------------------------------------------------------------+
+        // | koi::AudioMixer - Voices mixed on their own thread into a ring for the sink  |
+        // +------------------------------------------------------------------------------+
+        // Play, StopVoice and the other commands are pushed onto a lock free queue and
+        // picked up by the mixer thread at the next block, so the calling thread never
+        // waits on audio. They must all come from one thread, usually the engine thread.
+        // A full queue drops the command and reports it. Play also counts the voices it
+        // has started against the ones the mixer has finished, so it returns 0 rather
+        // than a handle to a voice that would never sound once nMaxVoices are in use,
+        // queued plays included. The mixer thread runs ahead of
+        // the output by up to nLatencyFrames, an output thread drains the ring into the
+        // sink and pads with silence if the mixer ever falls behind. Clips are read in
+        // place and must outlive the voices playing them.
+        struct SoundParams {
+            float fVolume = 1.0f;
+            float fPan    = 0.0f;                                       // -1 left to 1 right, equal power
+            float fPitch  = 1.0f;                                       // Playback speed
+            bool  bLoop   = false;
+        };
+
+        class AudioMixer {
+        public:
+            explicit AudioMixer(int32_t nSampleRate = 48000, int32_t nMaxVoices = 64, int32_t nLatencyFrames = 2048);
+            ~AudioMixer();
+            AudioMixer(const AudioMixer&) = delete;
+            AudioMixer& operator=(const AudioMixer&) = delete;
+
+            rcode Start(std::unique_ptr<AudioSink> sink);               // Opens the sink and starts both threads
+            void  Stop ();                                              // Joins the threads and closes the sink
+
+            uint32_t Play           (const AudioClip& clip, const SoundParams& params = SoundParams()); // Voice handle, 0 if every voice is taken or the queue was full
+            bool     StopVoice      (uint32_t nVoice);
+            bool     SetVoice       (uint32_t nVoice, float fVolume, float fPan, float fPitch);
+            bool     StopAll        ();
+            bool     SetMasterVolume(float fVolume);
+
+            // Mixes straight into pOut on the calling thread, for offline rendering. Not while started.
+            void     Render         (int16_t* pOut, int32_t nFrames);   // Interleaved stereo
+
+            int32_t  SampleRate     () const { return nSampleRate; }
+            int32_t  ActiveVoices   () const { return nActive.load(std::memory_order_relaxed); }
+            uint64_t FramesMixed    () const { return nMixed.load(std::memory_order_relaxed); }
+            uint32_t Underruns      () const { return nUnderruns.load(std::memory_order_relaxed); }   // Output blocks padded with silence
+
+        private:
+            struct Command {
+                enum Type : uint8_t { PLAY, STOP, SET, STOP_ALL, MASTER } type;
+                uint32_t         nVoice;
+                const AudioClip* pClip;
+                SoundParams      params;
+            };
+
+            struct Voice {
+                const AudioClip* pClip;
+                uint32_t         nId;
+                double           fPos;                                  // In clip frames
+                SoundParams      params;
+                float            fGainL, fGainR;                        // Reached at the end of the last block
+                bool             bStopping;
+            };
+
+            static constexpr int32_t nBlock = 256;                      // Frames mixed at a time, commands apply per block
+
+            static constexpr float   fMinPitch = 1.0f / 64.0f;          // Keeps every voice moving forward
+
+            bool         koi_Send     (const Command& cmd);
+            static bool  koi_Sanitize (SoundParams& p);
+            void         koi_Apply    ();
+            void         koi_Mix      (int16_t* pOut, int32_t nFrames);
+            const float* koi_Fetch    (Voice& v, int32_t c, int32_t nFrames, bool& bEnded);
+            void         koi_MixThread();
+            void         koi_OutThread();
+
+            int32_t                    nSampleRate, nMaxVoices, nLatencyFrames;
+            SpscRing<Command>          qCommands;
+            SpscRing<int16_t>          ringOut;
+            std::unique_ptr<AudioSink> sink;
+            std::thread                thMix, thOut;
+            std::atomic<bool>          bRunning{ false };
+            uint32_t                   nNextId = 1;                     // Command side only
+            uint64_t                   nStarted = 0;                    // Command side only, plays sent
+            std::atomic<uint64_t>      nFinished{ 0 };                  // Plays the mixer has dropped or finished
+
+            // Mixer side only
+            std::vector<Voice>         vVoices;
+            AlignedVector<float>       vMixL, vMixR, vSrc[2], vRamp;
+            int32_t                    nRampFrames = 0;
+            float                      fMaster     = 1.0f;
+
+            std::atomic<int32_t>       nActive{ 0 };
+            std::atomic<uint64_t>      nMixed{ 0 };
+            std::atomic<uint32_t>      nUnderruns{ 0 };
+        };
+
+        AudioMixer::AudioMixer(int32_t nRate, int32_t nVoices, int32_t nLatency)
+            : nSampleRate(std::max(nRate, 1)), nMaxVoices(std::max(nVoices, 1)), nLatencyFrames(std::max(nLatency, 2 * nBlock)),
+              qCommands(256), ringOut(size_t(std::max(nLatency, 2 * nBlock)) * 2) {
+            vVoices.reserve(nMaxVoices);
+            vMixL.resize(nBlock); vMixR.resize(nBlock); vRamp.resize(nBlock);
+            vSrc[0].resize(nBlock); vSrc[1].resize(nBlock);
+        }
+
+        AudioMixer::~AudioMixer() { Stop(); }
+
+        rcode AudioMixer::Start(std::unique_ptr<AudioSink> s) {
+            if (bRunning || !s) return FAIL;
+            rcode r = s->Open(nSampleRate);
+            if (r != OK) return r;
+            sink = std::move(s);
+
+            // Prime the ring so the output starts with a full latency buffer rather than an underrun
+            std::vector<int16_t> vBlock(nBlock * 2);
+            while (ringOut.WriteAvailable() >= vBlock.size()) { koi_Mix(vBlock.data(), nBlock); ringOut.Write(vBlock.data(), vBlock.size()); }
+
+            bRunning = true;
+            thMix = std::thread(&AudioMixer::koi_MixThread, this);
+            thOut = std::thread(&AudioMixer::koi_OutThread, this);
+            return OK;
+        }
+
+        void AudioMixer::Stop() {
+            if (!bRunning) return;
+            bRunning = false;
+            thMix.join();
+            thOut.join();
+            sink->Close();
+            sink.reset();
+        }
+
+        bool AudioMixer::koi_Send(const Command& cmd) { return qCommands.Push(cmd); }
+
+        uint32_t AudioMixer::Play(const AudioClip& clip, const SoundParams& params) {
+            if (clip.Frames() == 0 || clip.SampleRate() <= 0) return 0;
+            if (nStarted - nFinished.load(std::memory_order_acquire) >= uint64_t(nMaxVoices)) return 0;
+            uint32_t nId = nNextId;
+            if (!koi_Send({ Command::PLAY, nId, &clip, params })) return 0;
+            nStarted++;
+            if (++nNextId == 0) nNextId = 1;
+            return nId;
+        }
+
+        bool AudioMixer::StopVoice      (uint32_t nVoice)                                  { return koi_Send({ Command::STOP,     nVoice, nullptr, SoundParams() });                          }
+        bool AudioMixer::SetVoice       (uint32_t nVoice, float fVol, float fPan, float fPitch) { return koi_Send({ Command::SET, nVoice, nullptr, { fVol, fPan, fPitch, false } });            }
+        bool AudioMixer::StopAll        ()                                                 { return koi_Send({ Command::STOP_ALL, 0,      nullptr, SoundParams() });                          }
+        bool AudioMixer::SetMasterVolume(float fVolume)                                    { return koi_Send({ Command::MASTER,   0,      nullptr, { fVolume, 0.0f, 1.0f, false } });         }
+
+        // Commands with non-finite values are dropped, pitch is clamped so voices always advance
+        bool AudioMixer::koi_Sanitize(SoundParams& p) {
+            if (!std::isfinite(p.fVolume) || !std::isfinite(p.fPan) || !std::isfinite(p.fPitch)) return false;
+            if (p.fPitch < fMinPitch) p.fPitch = fMinPitch;
+            return true;
+        }
+
+        void AudioMixer::koi_Apply() {
+            Command cmd;
+            while (qCommands.Pop(cmd)) {
+                if (!koi_Sanitize(cmd.params)) {
+                    if (cmd.type == Command::PLAY) nFinished.fetch_add(1, std::memory_order_release);
+                    continue;
+                }
+                switch (cmd.type) {
+                    case Command::PLAY:
+                        // Play keeps this from filling up, the check only guards the pool
+                        if (int32_t(vVoices.size()) < nMaxVoices) vVoices.push_back({ cmd.pClip, cmd.nVoice, 0.0, cmd.params, 0.0f, 0.0f, false });
+                        else nFinished.fetch_add(1, std::memory_order_release);
+                        break;
+                    case Command::STOP:
+                        for (Voice& v : vVoices) if (v.nId == cmd.nVoice) v.bStopping = true;
+                        break;
+                    case Command::SET:
+                        for (Voice& v : vVoices) if (v.nId == cmd.nVoice) { v.params.fVolume = cmd.params.fVolume; v.params.fPan = cmd.params.fPan; v.params.fPitch = cmd.params.fPitch; }
+                        break;
+                    case Command::STOP_ALL: for (Voice& v : vVoices) v.bStopping = true; break;
+                    case Command::MASTER:   fMaster = cmd.params.fVolume;              break;
+                }
+            }
+        }
+
+        // One channel of source frames for the block. Unpitched voices at the mixer's rate
+        // are read straight from the clip, everything else is resampled linearly here.
+        const float* AudioMixer::koi_Fetch(Voice& v, int32_t c, int32_t n, bool& bEnded) {
+            const AudioClip& clip = *v.pClip;
+            const float* pIn = clip.GetChannel(c);
+            double fStep = double(v.params.fPitch) * clip.SampleRate() / nSampleRate, fPos = v.fPos;
+            int32_t nFrames = clip.Frames();
+            if (fStep == 1.0 && fPos == std::floor(fPos) && fPos + n <= nFrames) return pIn + int32_t(fPos);
+
+            float* pOut = vSrc[c].data();
+            int32_t i = 0;
+            for (; i < n; i++, fPos += fStep) {
+                if (fPos >= nFrames) {
+                    if (!v.params.bLoop) break;
+                    fPos = std::fmod(fPos, double(nFrames));
+                }
+                int32_t i0 = int32_t(fPos), i1 = i0 + 1;
+                float t = float(fPos - i0), a = pIn[i0], b = i1 < nFrames ? pIn[i1] : (v.params.bLoop ? pIn[0] : 0.0f);
+                pOut[i] = a + (b - a) * t;
+            }
+            if (i < n) { std::fill(pOut + i, pOut + n, 0.0f); bEnded = true; }
+            return pOut;
+        }
+
+        void AudioMixer::koi_Mix(int16_t* pOut, int32_t nFrames) {
+            koi_Apply();
+            for (int32_t nDone = 0; nDone < nFrames; nDone += nBlock) {
+                int32_t n = std::min(int32_t(nBlock), nFrames - nDone);
+                float* pL = vMixL.data();
+                float* pR = vMixR.data();
+                std::fill(pL, pL + n, 0.0f);
+                std::fill(pR, pR + n, 0.0f);
+                if (n != nRampFrames) { for (int32_t i = 0; i < n; i++) vRamp[i] = float(i + 1) / n; nRampFrames = n; }
+
+                for (size_t nv = 0; nv < vVoices.size();) {
+                    Voice& v = vVoices[nv];
+
+                    // Gains ramp from where the last block left them, so volume and pan changes don't click
+                    float fVol = v.bStopping ? 0.0f : std::max(v.params.fVolume, 0.0f);
+                    float fAngle = (std::min(std::max(v.params.fPan, -1.0f), 1.0f) + 1.0f) * 0.785398163f;
+                    float gL = fVol * std::cos(fAngle), gR = fVol * std::sin(fAngle);
+                    bool bEnded = false;
+                    const float* sL = koi_Fetch(v, 0, n, bEnded);
+                    const float* sR = v.pClip->Channels() > 1 ? koi_Fetch(v, 1, n, bEnded) : sL;
+                    float l0 = v.fGainL, dl = gL - v.fGainL, r0 = v.fGainR, dr = gR - v.fGainR;
+                    const float* pRamp = vRamp.data();
+                    auto kernel = [&](auto lane, int32_t i) {
+                        using L = decltype(lane);
+                        L t = L::Load(pRamp + i);
+                        L::Store(pL + i, L::Load(pL + i) + L::Load(sL + i) * (L::Set(l0) + t * L::Set(dl)));
+                        L::Store(pR + i, L::Load(pR + i) + L::Load(sR + i) * (L::Set(r0) + t * L::Set(dr)));
+                    };
+                    int32_t i = 0;
+                    for (; i + koi_Lanes::N <= n; i += koi_Lanes::N) kernel(koi_Lanes(), i);
+                    for (; i < n; i++) kernel(koi_Lane(), i);
+
+                    v.fGainL = gL; v.fGainR = gR;
+                    v.fPos += double(v.params.fPitch) * v.pClip->SampleRate() / nSampleRate * n;
+                    if (v.params.bLoop && v.fPos >= v.pClip->Frames()) v.fPos = std::fmod(v.fPos, double(v.pClip->Frames()));
+                    if (bEnded || v.bStopping || (!v.params.bLoop && v.fPos >= v.pClip->Frames())) {
+                        v = vVoices.back(); vVoices.pop_back();
+                        nFinished.fetch_add(1, std::memory_order_release);
+                    }
+                    else nv++;
+                }
+
+                int16_t* pDst = pOut + size_t(nDone) * 2;
+                for (int32_t i = 0; i < n; i++) {
+                    float l = std::min(std::max(pL[i] * fMaster, -1.0f), 1.0f), r = std::min(std::max(pR[i] * fMaster, -1.0f), 1.0f);
+                    pDst[2 * i]     = int16_t(std::lrint(l * 32767.0f));
+                    pDst[2 * i + 1] = int16_t(std::lrint(r * 32767.0f));
+                }
+            }
+            nActive.store(int32_t(vVoices.size()), std::memory_order_relaxed);
+            nMixed.fetch_add(uint64_t(nFrames), std::memory_order_relaxed);
+        }
+
+        void AudioMixer::Render(int16_t* pOut, int32_t nFrames) {
+            if (bRunning || nFrames <= 0) return;
+            koi_Mix(pOut, nFrames);
+        }
+
+        void AudioMixer::koi_MixThread() {
+            std::vector<int16_t> vBlock(nBlock * 2);
+            auto tNap = std::chrono::microseconds(int64_t(nBlock) * 250000 / nSampleRate);
+            while (bRunning) {
+                if (ringOut.WriteAvailable() < vBlock.size()) { std::this_thread::sleep_for(tNap); continue; }
+                koi_Mix(vBlock.data(), nBlock);
+                ringOut.Write(vBlock.data(), vBlock.size());
+            }
+        }
+
+        void AudioMixer::koi_OutThread() {
+            std::vector<int16_t> vPeriod(nBlock * 2);
+            auto tStart = std::chrono::steady_clock::now();
+            uint64_t nSent = 0;
+            while (bRunning) {
+                // Without a device clock to block on, the output keeps time with the wall clock
+                if (!sink->Paced()) {
+                    double fSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+                    uint64_t nDue = uint64_t(fSeconds * nSampleRate);
+                    if (nDue < nSent + nBlock) {
+                        std::this_thread::sleep_for(std::chrono::microseconds(int64_t((nSent + nBlock - nDue) * 1000000 / uint64_t(nSampleRate))));
+                        continue;
+                    }
+                }
+                size_t n = ringOut.Read(vPeriod.data(), vPeriod.size());
+                if (n < vPeriod.size()) { std::fill(vPeriod.begin() + n, vPeriod.end(), int16_t(0)); nUnderruns.fetch_add(1, std::memory_order_relaxed); }
+                sink->Write(vPeriod.data(), nBlock);
+                nSent += nBlock;
+            }
+        }
+    }
+
+#endif /* Audio_h */
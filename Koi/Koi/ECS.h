@@ -0,0 +1,521 @@
+//
+//  ECS.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef ECS_h
+#define ECS_h
+
+    #include <functional>
+    #include <memory>
+    #include <mutex>
+    #include <new>
+    #include <string>
+    #include <type_traits>
+    #include <unordered_map>
+    #include <utility>
+    #include <vector>
+    #include "Allocator.h"
+    #include "Parallel.h"
+
+    namespace koi {
+        // MARK: koi::Entity
+        // +------------------------------------------------------------------------------+
+        // | koi::Entity - Handle to a row in a World, stale once the entity is destroyed |
+        // +------------------------------------------------------------------------------+
+        struct Entity {
+            uint32_t nIndex      = 0xFFFFFFFF;
+            uint32_t nGeneration = 0;
+
+            bool Valid     ()                  const { return nIndex != 0xFFFFFFFF; }
+            bool operator==(const Entity& rhs) const { return nIndex == rhs.nIndex && nGeneration == rhs.nGeneration; }
+            bool operator!=(const Entity& rhs) const { return !(*this == rhs); }
+        };
+
+
+        // MARK: koi::Component
+        // +------------------------------------------------------------------------------+
+        // | koi::Component - Gives an existing type its own component identity          |
+        // +------------------------------------------------------------------------------+
+        // Components are keyed by type, so two Vector2f can't both be components. Tag them
+        // instead and they still behave as the type they wrap:
+        //     using Position = koi::Component<koi::Vector2f, struct PositionTag>;
+        template<class T, class Tag>
+        struct Component : public T {
+            using T::T;
+            Component() = default;
+            Component(const T& v) : T(v) {}
+        };
+
+
+        // MARK: koi::ComponentId
+        // +------------------------------------------------------------------------------+
+        // | koi::ComponentId - Process wide id and lifetime functions of a component    |
+        // +------------------------------------------------------------------------------+
+        // A process has room for nMaxComponents types. Past that ComponentId is -1 and the
+        // World calls that take such a type do nothing and report FAIL or an invalid Entity.
+        constexpr int32_t nMaxComponents = 64;
+        typedef uint64_t ComponentMask;
+
+        struct ComponentInfo {
+            size_t nSize  = 0;
+            size_t nAlign = 0;
+            void (*Relocate)(void* dst, void* src) = nullptr;  // Move construct into dst, then destroy src
+            void (*Destroy) (void* p)              = nullptr;
+        };
+
+        ComponentInfo           koi_Components[nMaxComponents];
+        std::atomic<int32_t>    koi_nComponents{ 0 };                // Entries below are fully written
+
+        int32_t koi_RegisterComponent(const ComponentInfo& info) {
+            // The info is written before the count is published, a reader that sees the id sees the info
+            static std::mutex mux;
+            std::lock_guard<std::mutex> lock(mux);
+            int32_t id = koi_nComponents.load(std::memory_order_relaxed);
+            if (id >= nMaxComponents) return -1;
+            koi_Components[id] = info;
+            koi_nComponents.store(id + 1, std::memory_order_release);
+            return id;
+        }
+
+        template<class T>
+        int32_t ComponentId() {
+            static_assert(!std::is_const<T>::value && !std::is_reference<T>::value, "Use the plain component type");
+            static const int32_t id = koi_RegisterComponent({ sizeof(T), alignof(T),
+                [](void* dst, void* src) { new (dst) T(std::move(*(T*)src)); ((T*)src)->~T(); },
+                [](void* p) { ((T*)p)->~T(); } });
+            return id;
+        }
+
+        bool koi_AddToMask(ComponentMask& m, int32_t id) {
+            if (id < 0 || (m & (ComponentMask(1) << id))) return false;  // No id, or the type is listed twice
+            m |= ComponentMask(1) << id;
+            return true;
+        }
+
+        template<class... Ts>
+        rcode koi_MaskOf(ComponentMask& m) {                        // FAIL if a type has no id or repeats
+            bool bOk = true;
+            m = 0;
+            int dummy[] = { 0, (bOk &= koi_AddToMask(m, ComponentId<typename std::decay<Ts>::type>()), 0)... };
+            (void)dummy;
+            return bOk ? OK : FAIL;
+        }
+
+
+        // MARK: koi::Read / koi::Write
+        // +------------------------------------------------------------------------------+
+        // | koi::Read, koi::Write - Declared access of a system to one component        |
+        // +------------------------------------------------------------------------------+
+        template<class T> struct Read  { typedef T type; typedef const T* pointer; typedef const T& reference; static constexpr bool bWrite = false; };
+        template<class T> struct Write { typedef T type; typedef       T* pointer; typedef       T& reference; static constexpr bool bWrite = true;  };
+
+
+        // MARK: koi::Archetype
+        // +------------------------------------------------------------------------------+
+        // | koi::Archetype - Every entity with exactly one set of components             |
+        // +------------------------------------------------------------------------------+
+        // Entities live in chunks of about 16KB. Inside a chunk every component is its own
+        // contiguous array, cache line aligned, so iterating touches only what is used.
+        // All chunks are full except the last one, removal fills holes from the back.
+        struct Chunk {
+            AlignedVector<uint8_t> vData;
+            int32_t                nCount = 0;
+        };
+
+        class Archetype {
+        public:
+            static constexpr size_t nChunkBytes = 16 * 1024;
+
+            explicit Archetype(ComponentMask m);
+
+            ComponentMask                       mask = 0;
+            std::vector<int32_t>                vComponents;            // Ids in ascending order, one column each
+            std::vector<size_t>                 vOffsets;               // Byte offset of each column inside a chunk
+            int8_t                              nColumn[nMaxComponents]; // Component id to column, -1 when absent
+            int32_t                             nCapacity  = 0;         // Entities per chunk
+            size_t                              nDataBytes = 0;
+            std::vector<std::unique_ptr<Chunk>> vChunks;
+            std::unordered_map<int32_t, Archetype*> mapAdd, mapRemove; // Cached neighbours one component away
+
+            int32_t Size() const { return vChunks.empty() ? 0 : (int32_t(vChunks.size()) - 1) * nCapacity + vChunks.back()->nCount; }
+
+            Entity* Entities(Chunk& c) const { return (Entity*)c.vData.data(); }
+            void*   Column  (Chunk& c, int32_t nCol, int32_t nRow) const { return c.vData.data() + vOffsets[nCol] + size_t(nRow) * koi_Components[vComponents[nCol]].nSize; }
+            template<class T> T* Array(Chunk& c) const { return (T*)(c.vData.data() + vOffsets[nColumn[ComponentId<T>()]]); }
+        };
+
+        Archetype::Archetype(ComponentMask m) : mask(m) {
+            std::fill_n(nColumn, nMaxComponents, int8_t(-1));
+            size_t nRowBytes = sizeof(Entity);
+            for (int32_t id = 0; id < nMaxComponents; id++) {
+                if (!(m & (ComponentMask(1) << id))) continue;
+                nColumn[id] = int8_t(vComponents.size());
+                vComponents.push_back(id);
+                nRowBytes += koi_Components[id].nSize;
+            }
+
+            // Shrink the capacity until the aligned columns fit, one entity per chunk at least
+            auto layout = [&](int32_t nCap) {
+                vOffsets.clear();
+                size_t nAt = (size_t(nCap) * sizeof(Entity) + nPixelAlignment - 1) & ~(nPixelAlignment - 1);
+                for (int32_t id : vComponents) {
+                    vOffsets.push_back(nAt);
+                    nAt = (nAt + size_t(nCap) * koi_Components[id].nSize + nPixelAlignment - 1) & ~(nPixelAlignment - 1);
+                }
+                return nAt;
+            };
+            nCapacity  = std::max<int32_t>(1, int32_t(nChunkBytes / nRowBytes));
+            nDataBytes = layout(nCapacity);
+            while (nDataBytes > nChunkBytes && nCapacity > 1) nDataBytes = layout(--nCapacity);
+        }
+
+
+        // MARK: koi::World
+        // +------------------------------------------------------------------------------+
+        // | koi::World - Entities, their components and the systems that update them    |
+        // +------------------------------------------------------------------------------+
+        // Structural changes (Create, Destroy, Add, Remove) are not thread safe and must
+        // not happen while iterating. From inside Each callbacks and systems, queue them
+        // with Defer instead, they run once RunSystems finishes.
+        class World {
+        public:
+            World();
+            ~World();
+            World(const World&) = delete;
+            World& operator=(const World&) = delete;
+
+            template<class... Ts> Entity Create (Ts&&... values);   // Components are moved in, invalid if a type has no id or repeats
+            void                         Destroy(Entity e);
+            bool                         Alive  (Entity e) const;
+            int32_t                      Count  ()         const { return nAlive; }
+
+            template<class T> rcode Add  (Entity e, T value = T());  // Replaces the component if it is already there
+            template<class T> void Remove(Entity e);
+            template<class T> bool Has   (Entity e) const;
+            template<class T> T*   Get   (Entity e);                 // nullptr if dead or missing, invalidated by structural changes
+
+            // Queries, matching archetypes are cached per component set
+            template<class... Ts, class F> void    Each        (F f);   // f(Entity, Ts&...)
+            template<class... Ts, class F> void    ParallelEach(F f);   // Same, chunks spread over the job system
+            template<class... Ts, class F> void    EachChunk   (F f);   // f(int32_t n, const Entity*, Ts*...) for batch or SIMD code
+            template<class... Ts>          int32_t CountWith   ();
+
+            // Systems run in the order added unless their access doesn't overlap, then they
+            // run side by side. Each system also spreads its own chunks over the job system.
+            template<class... As, class F> rcode AddSystem(const std::string& sName, F f); // f(float fElapsedTime, As::reference...)
+            void RunSystems(float fElapsedTime);
+            void Defer     (std::function<void(World&)> f);          // Thread safe
+
+        private:
+            struct Record {
+                Archetype* pArchetype  = nullptr;
+                int32_t    nChunk      = 0;
+                int32_t    nRow        = 0;
+                uint32_t   nGeneration = 0;
+            };
+
+            struct QueryCache {
+                ComponentMask           mask = 0;
+                std::vector<Archetype*> vMatches;
+                size_t                  nSeen = 0;                  // Archetypes already checked
+                std::vector<std::pair<Archetype*, Chunk*>> vWork;   // Every matching chunk as of the last refresh, for parallel runs
+            };
+
+            struct System {
+                std::string                sName;
+                ComponentMask              maskRead  = 0;
+                ComponentMask              maskWrite = 0;
+                QueryCache*                pQuery    = nullptr;
+                std::function<void(float)> func;
+            };
+
+            Archetype*  koi_GetArchetype (ComponentMask m);
+            Archetype*  koi_Neighbour    (Archetype* a, int32_t nId, bool bAdd);
+            void        koi_Allocate     (Archetype* a, int32_t& nChunk, int32_t& nRow);
+            void        koi_RemoveRow    (Archetype* a, int32_t nChunk, int32_t nRow, bool bDestroy);
+            void        koi_Move         (Entity e, Archetype* pTo);
+            QueryCache* koi_Query        (ComponentMask m);
+            void        koi_Refresh      (QueryCache& q);
+            void        koi_Schedule     ();
+            template<class F> void koi_ForChunks(QueryCache& q, bool bParallel, F f);
+
+            std::unordered_map<ComponentMask, std::unique_ptr<Archetype>>  mapArchetypes;
+            std::vector<Archetype*>                                         vArchetypes;    // Creation order
+            std::unordered_map<ComponentMask, std::unique_ptr<QueryCache>> mapQueries;
+            std::vector<Record>                                             vRecords;
+            std::vector<uint32_t>                                           vFree;
+            int32_t                                                         nAlive = 0;
+            std::vector<System>                                             vSystems;
+            TaskGraph                                                       graph;
+            float                                                           fCurrentElapsed = 0.0f;
+            bool                                                            bScheduleDirty = true;
+            std::mutex                                                      muxDeferred;
+            std::vector<std::function<void(World&)>>                        vDeferred;
+        };
+
+        World::World() { koi_GetArchetype(0); }
+
+        World::~World() {
+            for (Archetype* a : vArchetypes)
+                for (auto& c : a->vChunks)
+                    for (int32_t col = 0; col < int32_t(a->vComponents.size()); col++)
+                        for (int32_t r = 0; r < c->nCount; r++) koi_Components[a->vComponents[col]].Destroy(a->Column(*c, col, r));
+        }
+
+        Archetype* World::koi_GetArchetype(ComponentMask m) {
+            auto it = mapArchetypes.find(m);
+            if (it != mapArchetypes.end()) return it->second.get();
+            Archetype* a = new Archetype(m);
+            mapArchetypes.emplace(m, std::unique_ptr<Archetype>(a));
+            vArchetypes.push_back(a);
+            return a;
+        }
+
+        Archetype* World::koi_Neighbour(Archetype* a, int32_t nId, bool bAdd) {
+            auto& map = bAdd ? a->mapAdd : a->mapRemove;
+            auto it = map.find(nId);
+            if (it != map.end()) return it->second;
+            ComponentMask bit = ComponentMask(1) << nId;
+            Archetype* b = koi_GetArchetype(bAdd ? (a->mask | bit) : (a->mask & ~bit));
+            map.emplace(nId, b);
+            return b;
+        }
+
+        void World::koi_Allocate(Archetype* a, int32_t& nChunk, int32_t& nRow) {
+            if (a->vChunks.empty() || a->vChunks.back()->nCount == a->nCapacity) {
+                a->vChunks.emplace_back(new Chunk());
+                a->vChunks.back()->vData.resize(a->nDataBytes);
+            }
+            nChunk = int32_t(a->vChunks.size()) - 1;
+            nRow   = a->vChunks.back()->nCount++;
+        }
+
+        void World::koi_RemoveRow(Archetype* a, int32_t nChunk, int32_t nRow, bool bDestroy) {
+            Chunk& c = *a->vChunks[nChunk];
+            int32_t nCols = int32_t(a->vComponents.size());
+            if (bDestroy) for (int32_t col = 0; col < nCols; col++) koi_Components[a->vComponents[col]].Destroy(a->Column(c, col, nRow));
+
+            // Fill the hole with the very last entity so chunks stay packed
+            int32_t nLastChunk = int32_t(a->vChunks.size()) - 1;
+            Chunk& last = *a->vChunks[nLastChunk];
+            int32_t nLastRow = last.nCount - 1;
+            if (nChunk != nLastChunk || nRow != nLastRow) {
+                for (int32_t col = 0; col < nCols; col++)
+                    koi_Components[a->vComponents[col]].Relocate(a->Column(c, col, nRow), a->Column(last, col, nLastRow));
+                Entity moved = a->Entities(last)[nLastRow];
+                a->Entities(c)[nRow] = moved;
+                vRecords[moved.nIndex].nChunk = nChunk;
+                vRecords[moved.nIndex].nRow   = nRow;
+            }
+            if (--last.nCount == 0) a->vChunks.pop_back();
+        }
+
+        void World::koi_Move(Entity e, Archetype* pTo) {
+            Record& r = vRecords[e.nIndex];
+            Archetype* pFrom = r.pArchetype;
+            int32_t nChunk, nRow;
+            koi_Allocate(pTo, nChunk, nRow);
+            Chunk& src = *pFrom->vChunks[r.nChunk];
+            Chunk& dst = *pTo->vChunks[nChunk];
+            pTo->Entities(dst)[nRow] = e;
+
+            // Shared components are relocated, ones the target lacks are destroyed
+            for (int32_t col = 0; col < int32_t(pFrom->vComponents.size()); col++) {
+                int32_t id = pFrom->vComponents[col];
+                if (pTo->nColumn[id] >= 0) koi_Components[id].Relocate(pTo->Column(dst, pTo->nColumn[id], nRow), pFrom->Column(src, col, r.nRow));
+                else                       koi_Components[id].Destroy(pFrom->Column(src, col, r.nRow));
+            }
+            koi_RemoveRow(pFrom, r.nChunk, r.nRow, false);
+            r.pArchetype = pTo; r.nChunk = nChunk; r.nRow = nRow;
+        }
+
+        template<class... Ts>
+        Entity World::Create(Ts&&... values) {
+            Entity e;
+            ComponentMask m;
+            if (koi_MaskOf<Ts...>(m) != OK) return e;
+            if (!vFree.empty()) { e.nIndex = vFree.back(); vFree.pop_back(); }
+            else { e.nIndex = uint32_t(vRecords.size()); vRecords.emplace_back(); }
+            e.nGeneration = vRecords[e.nIndex].nGeneration;
+
+            Archetype* a = koi_GetArchetype(m);
+            Record& r = vRecords[e.nIndex];
+            r.pArchetype = a;
+            koi_Allocate(a, r.nChunk, r.nRow);
+            Chunk& c = *a->vChunks[r.nChunk];
+            a->Entities(c)[r.nRow] = e;
+            int dummy[] = { 0, (new (a->Array<typename std::decay<Ts>::type>(c) + r.nRow) typename std::decay<Ts>::type(std::forward<Ts>(values)), 0)... };
+            (void)dummy;
+            nAlive++;
+            return e;
+        }
+
+        void World::Destroy(Entity e) {
+            if (!Alive(e)) return;
+            Record& r = vRecords[e.nIndex];
+            koi_RemoveRow(r.pArchetype, r.nChunk, r.nRow, true);
+            r.pArchetype = nullptr;
+            r.nGeneration++;
+            vFree.push_back(e.nIndex);
+            nAlive--;
+        }
+
+        bool World::Alive(Entity e) const {
+            return e.nIndex < vRecords.size() && vRecords[e.nIndex].nGeneration == e.nGeneration && vRecords[e.nIndex].pArchetype;
+        }
+
+        template<class T>
+        rcode World::Add(Entity e, T value) {
+            if (!Alive(e) || ComponentId<T>() < 0) return FAIL;
+            if (T* p = Get<T>(e)) { *p = std::move(value); return OK; }
+            koi_Move(e, koi_Neighbour(vRecords[e.nIndex].pArchetype, ComponentId<T>(), true));
+            Record& r = vRecords[e.nIndex];
+            new (r.pArchetype->Array<T>(*r.pArchetype->vChunks[r.nChunk]) + r.nRow) T(std::move(value));
+            return OK;
+        }
+
+        template<class T>
+        void World::Remove(Entity e) {
+            if (!Has<T>(e)) return;
+            koi_Move(e, koi_Neighbour(vRecords[e.nIndex].pArchetype, ComponentId<T>(), false));
+        }
+
+        template<class T>
+        bool World::Has(Entity e) const {
+            return Alive(e) && ComponentId<T>() >= 0 && vRecords[e.nIndex].pArchetype->nColumn[ComponentId<T>()] >= 0;
+        }
+
+        template<class T>
+        T* World::Get(Entity e) {
+            if (!Has<T>(e)) return nullptr;
+            const Record& r = vRecords[e.nIndex];
+            return r.pArchetype->Array<T>(*r.pArchetype->vChunks[r.nChunk]) + r.nRow;
+        }
+
+        World::QueryCache* World::koi_Query(ComponentMask m) {
+            auto it = mapQueries.find(m);
+            if (it == mapQueries.end()) {
+                it = mapQueries.emplace(m, std::unique_ptr<QueryCache>(new QueryCache())).first;
+                it->second->mask = m;
+            }
+            koi_Refresh(*it->second);
+            return it->second.get();
+        }
+
+        void World::koi_Refresh(QueryCache& q) {
+            // Archetypes are never removed, so only the ones created since last time need a look
+            for (; q.nSeen < vArchetypes.size(); q.nSeen++)
+                if ((vArchetypes[q.nSeen]->mask & q.mask) == q.mask) q.vMatches.push_back(vArchetypes[q.nSeen]);
+
+            // Rebuilt here rather than per run: systems sharing a query may run side by side and only read it
+            q.vWork.clear();
+            for (Archetype* a : q.vMatches) for (auto& c : a->vChunks) q.vWork.emplace_back(a, c.get());
+        }
+
+        template<class F>
+        void World::koi_ForChunks(QueryCache& q, bool bParallel, F f) {
+            if (!bParallel) {
+                for (Archetype* a : q.vMatches) for (auto& c : a->vChunks) f(*a, *c);
+                return;
+            }
+            ParallelFor(0, int32_t(q.vWork.size()), [&](int32_t i) { f(*q.vWork[i].first, *q.vWork[i].second); });
+        }
+
+        template<class F, class... Ps>
+        void koi_EachRow(F& f, int32_t n, const Entity* pEntities, Ps... ps) { for (int32_t i = 0; i < n; i++) f(pEntities[i], ps[i]...); }
+
+        template<class F, class... Ps>
+        void koi_SystemRows(F& f, float fElapsedTime, int32_t n, Ps... ps) { for (int32_t i = 0; i < n; i++) f(fElapsedTime, ps[i]...); }
+
+        template<class... Ts, class F>
+        void World::Each(F f) {
+            ComponentMask m;
+            if (koi_MaskOf<Ts...>(m) != OK) return;                  // No entity can have a type without an id
+            koi_ForChunks(*koi_Query(m), false, [&](Archetype& a, Chunk& c) {
+                koi_EachRow(f, c.nCount, a.Entities(c), a.Array<typename std::decay<Ts>::type>(c)...);
+            });
+        }
+
+        template<class... Ts, class F>
+        void World::ParallelEach(F f) {
+            ComponentMask m;
+            if (koi_MaskOf<Ts...>(m) != OK) return;                  // No entity can have a type without an id
+            koi_ForChunks(*koi_Query(m), true, [&](Archetype& a, Chunk& c) {
+                koi_EachRow(f, c.nCount, a.Entities(c), a.Array<typename std::decay<Ts>::type>(c)...);
+            });
+        }
+
+        template<class... Ts, class F>
+        void World::EachChunk(F f) {
+            ComponentMask m;
+            if (koi_MaskOf<Ts...>(m) != OK) return;                  // No entity can have a type without an id
+            koi_ForChunks(*koi_Query(m), false, [&](Archetype& a, Chunk& c) {
+                f(c.nCount, (const Entity*)a.Entities(c), a.Array<typename std::decay<Ts>::type>(c)...);
+            });
+        }
+
+        template<class... Ts>
+        int32_t World::CountWith() {
+            int32_t n = 0;
+            ComponentMask m;
+            if (koi_MaskOf<Ts...>(m) != OK) return 0;
+            for (Archetype* a : koi_Query(m)->vMatches) n += a->Size();
+            return n;
+        }
+
+        template<class... As, class F>
+        rcode World::AddSystem(const std::string& sName, F f) {
+            static_assert(sizeof...(As) > 0, "A system needs at least one Read<T> or Write<T>");
+            System s;
+            s.sName = sName;
+            bool bOk = true;
+            int dummy[] = { 0, (bOk &= koi_AddToMask(As::bWrite ? s.maskWrite : s.maskRead, ComponentId<typename As::type>()), 0)... };
+            (void)dummy;
+            if (!bOk) return FAIL;
+            QueryCache* q = koi_Query(s.maskRead | s.maskWrite);
+            s.pQuery = q;
+            s.func = [this, q, f](float fElapsedTime) {
+                koi_ForChunks(*q, true, [&](Archetype& a, Chunk& c) {
+                    koi_SystemRows(f, fElapsedTime, c.nCount, typename As::pointer(a.Array<typename As::type>(c))...);
+                });
+            };
+            vSystems.push_back(std::move(s));
+            bScheduleDirty = true;
+            return OK;
+        }
+
+        void World::koi_Schedule() {
+            // A system waits for every earlier one it conflicts with: anything one writes,
+            // the other must not touch
+            graph = TaskGraph();
+            for (size_t i = 0; i < vSystems.size(); i++) graph.Add([this, i]() { vSystems[i].func(fCurrentElapsed); });
+            for (size_t j = 0; j < vSystems.size(); j++)
+                for (size_t i = 0; i < j; i++) {
+                    const System& a = vSystems[i];
+                    const System& b = vSystems[j];
+                    if ((a.maskWrite & (b.maskRead | b.maskWrite)) || (b.maskWrite & a.maskRead)) graph.Precede(int32_t(i), int32_t(j));
+                }
+            bScheduleDirty = false;
+        }
+
+        void World::RunSystems(float fElapsedTime) {
+            if (bScheduleDirty) koi_Schedule();
+            for (System& s : vSystems) koi_Refresh(*s.pQuery);   // No structural changes while the graph runs
+            fCurrentElapsed = fElapsedTime;
+            graph.Run(JobSystem::Get());
+
+            std::vector<std::function<void(World&)>> vRun;
+            { std::lock_guard<std::mutex> lock(muxDeferred); vRun.swap(vDeferred); }
+            for (auto& f : vRun) f(*this);
+        }
+
+        void World::Defer(std::function<void(World&)> f) {
+            std::lock_guard<std::mutex> lock(muxDeferred);
+            vDeferred.push_back(std::move(f));
+        }
+    }
+
+#endif /* ECS_h */
@@ -0,0 +1,188 @@
+//
+//  Font.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef Font_h
+#define Font_h
+
+    #include <atomic>
+    #include <unordered_map>
+    #include "Global.h"
+    #include "Sprite.h"
+    #include "Atlas.h"
+    #include "RLESprite.h"
+
+    namespace koi {
+        // 8x8 glyphs for ' ' to '~', one byte per row, bit 0 is the leftmost pixel
+        static const uint8_t koi_FontData[95][8] = {
+            { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00 }, { 0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00 },   // sp ! " #
+            { 0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00 }, { 0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00 }, { 0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00 }, { 0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 },   // $ % & '
+            { 0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00 }, { 0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00 }, { 0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00 }, { 0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00 },   // ( ) * +
+            { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06 }, { 0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00 }, { 0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00 },   // , - . /
+            { 0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00 }, { 0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00 }, { 0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00 }, { 0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00 },   // 0 1 2 3
+            { 0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00 }, { 0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00 }, { 0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00 }, { 0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00 },   // 4 5 6 7
+            { 0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00 }, { 0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00 }, { 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00 }, { 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06 },   // 8 9 : ;
+            { 0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00 }, { 0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00 }, { 0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00 }, { 0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00 },   // < = > ?
+            { 0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00 }, { 0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00 }, { 0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00 }, { 0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00 },   // @ A B C
+            { 0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00 }, { 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00 }, { 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00 }, { 0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00 },   // D E F G
+            { 0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00 }, { 0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, { 0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00 }, { 0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00 },   // H I J K
+            { 0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00 }, { 0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00 }, { 0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00 }, { 0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00 },   // L M N O
+            { 0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00 }, { 0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00 }, { 0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00 }, { 0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00 },   // P Q R S
+            { 0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, { 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00 }, { 0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 }, { 0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00 },   // T U V W
+            { 0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00 }, { 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00 }, { 0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00 }, { 0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00 },   // X Y Z [
+            { 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00 }, { 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00 }, { 0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF },   // \\ ] ^ _
+            { 0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00 }, { 0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00 }, { 0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00 },   // ` a b c
+            { 0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00 }, { 0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00 }, { 0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00 }, { 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F },   // d e f g
+            { 0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00 }, { 0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, { 0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E }, { 0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00 },   // h i j k
+            { 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, { 0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00 }, { 0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00 }, { 0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00 },   // l m n o
+            { 0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F }, { 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78 }, { 0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00 }, { 0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00 },   // p q r s
+            { 0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00 }, { 0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00 }, { 0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 }, { 0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00 },   // t u v w
+            { 0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00 }, { 0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F }, { 0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00 }, { 0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00 },   // x y z {
+            { 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 }, { 0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00 }, { 0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // | } ~
+        };
+
+
+        // MARK: koi::Font
+        // +------------------------------------------------------------------------------+
+        // | koi::Font - Glyphs packed into one atlas sprite                               |
+        // +------------------------------------------------------------------------------+
+        // Glyphs are looked up by byte, so any 8 bit encoding works. Rendered text is cached
+        // by the engine against nId and nVersion, adding a glyph invalidates those entries.
+        class Font {
+        public:
+            struct Glyph {
+                int32_t x = 0, y = 0, w = 0, h = 0;    // Rectangle in sprAtlas
+                int32_t nOffsetX = 0, nOffsetY = 0;    // From the pen position to the top left of the glyph
+                int32_t nAdvance = 0;
+            };
+
+            Font(int32_t nLineHeight = 8, int32_t nAtlasSize = 256);
+
+            static Font Default();                      // The built in 8x8 font
+
+            rcode        AddGlyph (uint8_t c, const SpriteView& glyph, int32_t nAdvance, int32_t nOffsetX = 0, int32_t nOffsetY = 0); // FAIL when the atlas is full
+            rcode        AddSheet (const SpriteView& sheet, int32_t nCellW, int32_t nCellH, uint8_t nFirst = ' ', bool bProportional = false);
+            const Glyph* GetGlyph (uint8_t c) const;    // nullptr if the font has no such glyph
+            Vector2i     Measure  (const std::string& sText) const;
+            void         Render   (const std::string& sText, Sprite& out) const; // Untinted, out is resized to Measure
+
+            int32_t  nLineHeight = 8;
+            Sprite   sprAtlas;
+            bool     bMonochrome = true;                 // Every glyph pixel is white, so tinting is a fill
+            uint64_t nId         = 0;
+            uint64_t nVersion    = 0;
+
+        private:
+            MaxRectsPacker     packer;
+            std::array<Glyph, 256> vGlyphs;
+            std::array<bool,  256> vHasGlyph;
+        };
+
+        Font::Font(int32_t nLineHeight, int32_t nAtlasSize)
+            : nLineHeight(nLineHeight), sprAtlas(nAtlasSize, nAtlasSize), packer(nAtlasSize, nAtlasSize) {
+            static std::atomic<uint64_t> nNextId{ 1 };
+            nId = nNextId++;
+            vHasGlyph.fill(false);
+        }
+
+        Font Font::Default() {
+            Font font(8, 128);
+            Sprite glyph(8, 8);
+            for (int32_t c = 0; c < 95; c++) {
+                for (int32_t y = 0; y < 8; y++)
+                    for (int32_t x = 0; x < 8; x++)
+                        glyph.SetPixel(x, y, (koi_FontData[c][y] >> x) & 1 ? Color::WHITE : Color::BLANK);
+                font.AddGlyph(uint8_t(' ' + c), glyph, 8);
+            }
+            return font;
+        }
+
+        rcode Font::AddGlyph(uint8_t c, const SpriteView& glyph, int32_t nAdvance, int32_t nOffsetX, int32_t nOffsetY) {
+            Glyph g;
+            g.w = std::max(glyph.width, 0); g.h = std::max(glyph.height, 0);
+            g.nOffsetX = nOffsetX; g.nOffsetY = nOffsetY; g.nAdvance = nAdvance;
+            if (g.w > 0 && g.h > 0) {
+                MaxRectsPacker::Rect r;
+                if (!packer.Insert(g.w, g.h, r)) return FAIL;
+                g.x = r.x; g.y = r.y;
+                for (int32_t y = 0; y < g.h; y++) {
+                    const Color* src = glyph.GetRow(y);
+                    memcpy((void*)(sprAtlas.GetRow(g.y + y) + g.x), src, g.w * sizeof(Color));
+                    for (int32_t x = 0; x < g.w && bMonochrome; x++)
+                        if (src[x].a != 0 && (src[x].n | 0xFF000000) != 0xFFFFFFFF) bMonochrome = false;
+                }
+            }
+            vGlyphs[c] = g; vHasGlyph[c] = true;
+            nVersion++;
+            return OK;
+        }
+
+        rcode Font::AddSheet(const SpriteView& sheet, int32_t nCellW, int32_t nCellH, uint8_t nFirst, bool bProportional) {
+            if (nCellW <= 0 || nCellH <= 0) return FAIL;
+            int32_t nCols = sheet.width / nCellW, nCells = nCols * (sheet.height / nCellH);
+            for (int32_t i = 0; i < nCells && nFirst + i < 256; i++) {
+                SpriteView cell = sheet.SubView((i % nCols) * nCellW, (i / nCols) * nCellH, nCellW, nCellH);
+                int32_t nAdvance = nCellW;
+                if (bProportional) {
+                    // Rightmost covered column plus a pixel of spacing, empty cells keep half a cell
+                    int32_t nRight = 0;
+                    for (int32_t y = 0; y < cell.height; y++)
+                        for (int32_t x = cell.width - 1; x >= nRight; x--)
+                            if (cell.GetRow(y)[x].a != 0) { nRight = x + 1; break; }
+                    nAdvance = nRight ? nRight + 1 : nCellW / 2;
+                    cell = cell.SubView(0, 0, nRight, cell.height);
+                }
+                if (AddGlyph(uint8_t(nFirst + i), cell, nAdvance) == FAIL) return FAIL;
+            }
+            return OK;
+        }
+
+        const Font::Glyph* Font::GetGlyph(uint8_t c) const { return vHasGlyph[c] ? &vGlyphs[c] : nullptr; }
+
+        Vector2i Font::Measure(const std::string& sText) const {
+            int32_t x = 0, w = 0, nLines = sText.empty() ? 0 : 1;
+            const Glyph* space = GetGlyph(' ');
+            for (char ch : sText) {
+                uint8_t c = uint8_t(ch);
+                if (c == '\n') { x = 0; nLines++; continue; }
+                if (c == '\t') { x += 4 * (space ? space->nAdvance : nLineHeight); w = std::max(w, x); continue; }
+                const Glyph* g = GetGlyph(c);
+                if (g == nullptr) g = GetGlyph('?');
+                if (g == nullptr) continue;
+                w = std::max(w, x + std::max(g->nOffsetX + g->w, g->nAdvance));
+                x += g->nAdvance;
+            }
+            return Vector2i(w, nLines * nLineHeight);
+        }
+
+        void Font::Render(const std::string& sText, Sprite& out) const {
+            Vector2i size = Measure(sText);
+            out.Resize(size.x, size.y);
+            int32_t x = 0, y = 0;
+            const Glyph* space = GetGlyph(' ');
+            for (char ch : sText) {
+                uint8_t c = uint8_t(ch);
+                if (c == '\n') { x = 0; y += nLineHeight; continue; }
+                if (c == '\t') { x += 4 * (space ? space->nAdvance : nLineHeight); continue; }
+                const Glyph* g = GetGlyph(c);
+                if (g == nullptr) g = GetGlyph('?');
+                if (g == nullptr) continue;
+                for (int32_t gy = 0; gy < g->h; gy++) {
+                    int32_t dy = y + g->nOffsetY + gy;
+                    if (dy < 0 || dy >= out.height) continue;
+                    const Color* src = sprAtlas.GetRow(g->y + gy) + g->x;
+                    Color* dst = out.GetRow(dy);
+                    for (int32_t gx = 0; gx < g->w; gx++) {
+                        int32_t dx = x + g->nOffsetX + gx;
+                        if (dx >= 0 && dx < out.width && src[gx].a != 0) dst[dx] = src[gx];
+                    }
+                }
+                x += g->nAdvance;
+            }
+        }
+    }
+
+#endif /* Font_h */
@@ -0,0 +1,45 @@
+//
+//  HeadlessPlatform.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef HeadlessPlatform_h
+#define HeadlessPlatform_h
+
+    #include "Global.h"
+    #include "Platform.h"
+
+    // MARK: HEADLESS
+    // +------------------------------------------------------------------------------+
+    // | START PLATFORM: HEADLESS                                                     |
+    // +------------------------------------------------------------------------------+
+    // No window, no events and no graphics context. Paired with Renderer_Headless it
+    // lets an engine run its update loop on any thread, with every instance fully
+    // independent of the others.
+    namespace koi {
+        class Platform_Headless : public koi::Platform {
+        public:
+            virtual koi::rcode ApplicationStartUp()     override { return koi::OK; }
+            virtual koi::rcode ApplicationCleanUp()     override { return koi::OK; }
+            virtual koi::rcode ThreadStartUp()          override { return koi::OK; }
+            virtual koi::rcode ThreadCleanUp()          override { renderer->DestroyDevice(); return koi::OK; }
+
+            virtual koi::rcode CreateGraphics(bool bFullScreen, bool bEnableVSYNC, const koi::Vector2i& vViewPos, const koi::Vector2i& vViewSize) override {
+                if (renderer->CreateDevice({}, bFullScreen, bEnableVSYNC) != koi::OK) return koi::FAIL;
+                renderer->UpdateViewport(vViewPos, vViewSize);
+                return koi::OK;
+            }
+
+            virtual koi::rcode CreateWindowPane(const koi::Vector2i&, koi::Vector2i&, bool) override { return koi::OK; }
+            virtual koi::rcode SetWindowTitle(const char*)           override { return koi::OK; }
+            virtual koi::rcode StartSystemEventLoop()                override { return koi::OK; }
+            virtual koi::rcode HandleSystemEvent()                   override { return koi::OK; }
+        };
+    }
+    // +------------------------------------------------------------------------------+
+    // | END PLATFORM: HEADLESS                                                       |
+    // +------------------------------------------------------------------------------+
+
+#endif /* HeadlessPlatform_h */
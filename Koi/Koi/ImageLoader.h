@@ -0,0 +1,521 @@
+//
+//  ImageLoader.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef ImageLoader_h
+#define ImageLoader_h
+
+    #include <cstdio>
+    #include <new>
+    #include "Global.h"
+    #include "Sprite.h"
+    #include "Parallel.h"
+
+    namespace koi {
+        // MARK: koi::ImageLoader
+        // +------------------------------------------------------------------------------+
+        // | koi::ImageLoader - Built in PNG and QOI decoding straight into a Sprite      |
+        // +------------------------------------------------------------------------------+
+        class ImageLoader {
+        public:
+            static rcode LoadImage (Sprite& spr, const std::string& sImageFile);    // Picks the decoder from the file signature
+            static rcode LoadImage (Sprite& spr, const uint8_t* pData, size_t nSize);
+            static rcode DecodePNG (Sprite& spr, const uint8_t* pData, size_t nSize);
+            static rcode DecodeQOI (Sprite& spr, const uint8_t* pData, size_t nSize);
+
+            // Decodes every file on the worker threads, vSprites is resized to match vFiles
+            static std::vector<rcode> LoadImages(const std::vector<std::string>& vFiles, std::vector<Sprite>& vSprites);
+
+        private:
+            static constexpr size_t nMaxPixels = size_t(1) << 28;             // 1GB as RGBA, anything bigger is a corrupt or hostile header
+
+            static bool     ValidSize(uint32_t w, uint32_t h) { return w > 0 && h > 0 && w <= (1u << 24) && h <= (1u << 24) && size_t(w) * h <= nMaxPixels; }
+            static uint32_t ReadBE32(const uint8_t* p) { return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3]; }
+        };
+
+
+        // MARK: koi::Inflate
+        // +------------------------------------------------------------------------------+
+        // | koi::Inflate - zlib / DEFLATE (RFC 1950, 1951) decompressor                  |
+        // +------------------------------------------------------------------------------+
+        // Input may be split over several buffers (PNG spreads it across IDAT chunks), the
+        // output buffer must be large enough to hold everything, as PNG always knows the size.
+        class Inflate {
+        public:
+            void  AddInput  (const uint8_t* p, size_t n) { vInput.push_back({ p, n }); }
+            rcode Decompress(uint8_t* pOut, size_t nOutSize, size_t& nWritten, bool bZlibHeader = true);
+
+        private:
+            static constexpr int nFastBits = 9;
+
+            struct Huffman {
+                uint16_t fast  [1 << nFastBits];   // (length << 9) | symbol for short codes, 0 if longer
+                uint16_t count [16];
+                uint16_t symbol[288];
+                bool     Build (const uint8_t* pLengths, int n);
+            };
+
+            struct Span { const uint8_t* p; size_t n; };
+            std::vector<Span> vInput;
+            size_t   nSpan = 0, nPos = 0, nOverrun = 0;
+            uint64_t nBitBuf = 0;
+            int      nBitCnt = 0;
+
+            void     Refill    ();
+            uint32_t GetBits   (int n);
+            int      Decode    (const Huffman& h);
+            rcode    Block     (const Huffman& lit, const Huffman& dist, uint8_t* pOut, size_t nOutSize, size_t& nOut);
+        };
+
+        bool Inflate::Huffman::Build(const uint8_t* pLengths, int n) {
+            memset(fast, 0, sizeof(fast));
+            memset(count, 0, sizeof(count));
+            for (int i = 0; i < n; i++) count[pLengths[i]]++;
+            count[0] = 0;
+
+            // Reject over-subscribed code sets, incomplete ones are legal (single distance code)
+            int left = 1;
+            for (int len = 1; len < 16; len++) { left <<= 1; left -= count[len]; if (left < 0) return false; }
+
+            uint16_t offs[16] = { 0 };
+            for (int len = 1; len < 15; len++) offs[len + 1] = offs[len] + count[len];
+            for (int i = 0; i < n; i++) if (pLengths[i]) symbol[offs[pLengths[i]]++] = uint16_t(i);
+
+            // Walk the canonical codes in order, filling the lookup table for the short ones
+            int code = 0, index = 0;
+            for (int len = 1; len <= nFastBits; len++) {
+                for (int k = 0; k < count[len]; k++, code++, index++) {
+                    int rev = 0;
+                    for (int b = 0; b < len; b++) rev |= ((code >> b) & 1) << (len - 1 - b);
+                    for (int fill = rev; fill < (1 << nFastBits); fill += (1 << len))
+                        fast[fill] = uint16_t((len << 9) | symbol[index]);
+                }
+                code <<= 1;
+            }
+            return true;
+        }
+
+        void Inflate::Refill() {
+            while (nBitCnt <= 56) {
+                while (nSpan < vInput.size() && nPos >= vInput[nSpan].n) { nSpan++; nPos = 0; }
+                uint64_t b = 0;
+                if (nSpan < vInput.size()) b = vInput[nSpan].p[nPos++];
+                else                       nOverrun++; // Pad with zeros, callers check for overrun
+                nBitBuf |= b << nBitCnt;
+                nBitCnt += 8;
+            }
+        }
+
+        uint32_t Inflate::GetBits(int n) {
+            if (n == 0) return 0;
+            if (nBitCnt < n) Refill();
+            uint32_t v = uint32_t(nBitBuf & ((uint64_t(1) << n) - 1));
+            nBitBuf >>= n; nBitCnt -= n;
+            return v;
+        }
+
+        int Inflate::Decode(const Huffman& h) {
+            if (nBitCnt < 16) Refill();
+            uint16_t e = h.fast[nBitBuf & ((1 << nFastBits) - 1)];
+            if (e) { int len = e >> 9; nBitBuf >>= len; nBitCnt -= len; return e & 511; }
+
+            // Long code, walk it one bit at a time
+            int code = 0, first = 0, index = 0;
+            for (int len = 1; len < 16; len++) {
+                code |= GetBits(1);
+                int c = h.count[len];
+                if (code - c < first) return h.symbol[index + (code - first)];
+                index += c; first += c;
+                first <<= 1; code <<= 1;
+            }
+            return -1;
+        }
+
+        rcode Inflate::Block(const Huffman& lit, const Huffman& dist, uint8_t* pOut, size_t nOutSize, size_t& nOut) {
+            static const uint16_t nLenBase [29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+            static const uint8_t  nLenExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+            static const uint16_t nDistBase [30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+            static const uint8_t  nDistExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+            while (true) {
+                int sym = Decode(lit);
+                if (sym < 0 || nOverrun > 8) return FAIL;
+                if (sym < 256) {
+                    if (nOut >= nOutSize) return FAIL;
+                    pOut[nOut++] = uint8_t(sym);
+                } else if (sym == 256) {
+                    return OK;
+                } else {
+                    sym -= 257;
+                    if (sym >= 29) return FAIL;
+                    size_t len = nLenBase[sym] + GetBits(nLenExtra[sym]);
+                    int d = Decode(dist);
+                    if (d < 0 || d >= 30) return FAIL;
+                    size_t back = nDistBase[d] + GetBits(nDistExtra[d]);
+                    if (back > nOut || nOut + len > nOutSize) return FAIL;
+
+                    uint8_t* dst = pOut + nOut;
+                    const uint8_t* src = dst - back;
+                    if (back >= len) memcpy(dst, src, len);
+                    else for (size_t i = 0; i < len; i++) dst[i] = src[i]; // Overlapping run
+                    nOut += len;
+                }
+            }
+        }
+
+        rcode Inflate::Decompress(uint8_t* pOut, size_t nOutSize, size_t& nWritten, bool bZlibHeader) {
+            nSpan = 0; nPos = 0; nOverrun = 0; nBitBuf = 0; nBitCnt = 0; nWritten = 0;
+
+            if (bZlibHeader) {
+                uint32_t cmf = GetBits(8), flg = GetBits(8);
+                if ((cmf & 15) != 8 || ((cmf << 8) | flg) % 31 != 0 || (flg & 32)) return FAIL;
+            }
+
+            static Huffman fixedLit, fixedDist;
+            static bool bFixedBuilt = [] {
+                uint8_t l[288];
+                for (int i = 0;   i < 144; i++) l[i] = 8;
+                for (int i = 144; i < 256; i++) l[i] = 9;
+                for (int i = 256; i < 280; i++) l[i] = 7;
+                for (int i = 280; i < 288; i++) l[i] = 8;
+                fixedLit.Build(l, 288);
+                for (int i = 0; i < 30; i++) l[i] = 5;
+                fixedDist.Build(l, 30);
+                return true;
+            }();
+            (void)bFixedBuilt;
+
+            bool bFinal = false;
+            while (!bFinal) {
+                bFinal = GetBits(1) != 0;
+                uint32_t nType = GetBits(2);
+
+                if (nType == 0) {
+                    // Stored block, skip to the byte boundary then copy
+                    GetBits(nBitCnt & 7);
+                    uint32_t len = GetBits(16), nlen = GetBits(16);
+                    if ((len ^ 0xFFFF) != nlen || nWritten + len > nOutSize) return FAIL;
+                    for (uint32_t i = 0; i < len; i++) pOut[nWritten++] = uint8_t(GetBits(8));
+                } else if (nType == 1) {
+                    if (Block(fixedLit, fixedDist, pOut, nOutSize, nWritten) != OK) return FAIL;
+                } else if (nType == 2) {
+                    static const uint8_t nOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+                    int nLit = GetBits(5) + 257, nDist = GetBits(5) + 1, nCode = GetBits(4) + 4;
+                    if (nLit > 286 || nDist > 30) return FAIL;
+
+                    uint8_t lengths[320] = { 0 };
+                    for (int i = 0; i < nCode; i++) lengths[nOrder[i]] = uint8_t(GetBits(3));
+                    Huffman lencode;
+                    if (!lencode.Build(lengths, 19)) return FAIL;
+
+                    memset(lengths, 0, sizeof(lengths));
+                    for (int i = 0; i < nLit + nDist;) {
+                        int sym = Decode(lencode);
+                        if (sym < 0 || nOverrun > 8) return FAIL;
+                        if (sym < 16) { lengths[i++] = uint8_t(sym); continue; }
+                        uint8_t rep = 0; int n = 0;
+                        if      (sym == 16) { if (i == 0) return FAIL; rep = lengths[i - 1]; n = 3 + GetBits(2); }
+                        else if (sym == 17) n = 3  + GetBits(3);
+                        else                n = 11 + GetBits(7);
+                        if (i + n > nLit + nDist) return FAIL;
+                        while (n--) lengths[i++] = rep;
+                    }
+
+                    Huffman lit, dist;
+                    if (!lit.Build(lengths, nLit) || !dist.Build(lengths + nLit, nDist)) return FAIL;
+                    if (Block(lit, dist, pOut, nOutSize, nWritten) != OK) return FAIL;
+                } else return FAIL;
+
+                if (nOverrun > 8) return FAIL;
+            }
+            return OK;
+        }
+
+
+        // MARK: PNG
+        namespace png {
+            // Reverses one scanline filter, out may alias in. prior is the previous unfiltered row or nullptr
+            void UnfilterRow(uint8_t* out, const uint8_t* in, const uint8_t* prior, size_t nRowBytes, size_t nBpp, uint8_t nFilter) {
+                switch (nFilter) {
+                    case 0: if (out != in) memcpy(out, in, nRowBytes); break;
+                    case 1:
+                        for (size_t i = 0; i < nBpp; i++)         out[i] = in[i];
+                        for (size_t i = nBpp; i < nRowBytes; i++) out[i] = uint8_t(in[i] + out[i - nBpp]);
+                        break;
+                    case 2:
+                        if (prior) for (size_t i = 0; i < nRowBytes; i++) out[i] = uint8_t(in[i] + prior[i]);
+                        else if (out != in) memcpy(out, in, nRowBytes);
+                        break;
+                    case 3:
+                        for (size_t i = 0; i < nRowBytes; i++) {
+                            int a = i >= nBpp ? out[i - nBpp] : 0, b = prior ? prior[i] : 0;
+                            out[i] = uint8_t(in[i] + ((a + b) >> 1));
+                        }
+                        break;
+                    case 4:
+                        for (size_t i = 0; i < nRowBytes; i++) {
+                            int a = i >= nBpp ? out[i - nBpp] : 0, b = prior ? prior[i] : 0, c = (prior && i >= nBpp) ? prior[i - nBpp] : 0;
+                            int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+                            out[i] = uint8_t(in[i] + ((pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c)));
+                        }
+                        break;
+                }
+            }
+
+            struct Format {
+                uint8_t  nColorType = 0, nBitDepth = 0;
+                uint32_t nChannels  = 0;
+                Color    palette[256];
+                bool     bColorKey  = false;
+                uint16_t nKey[3]    = { 0, 0, 0 };
+
+                size_t BitsPerPixel() const { return size_t(nChannels) * nBitDepth; }
+                size_t RowBytes(uint32_t w) const { return (w * BitsPerPixel() + 7) / 8; }
+
+                uint16_t Sample(const uint8_t* row, uint32_t i) const {
+                    if (nBitDepth == 16) return uint16_t((row[i * 2] << 8) | row[i * 2 + 1]);
+                    if (nBitDepth == 8)  return row[i];
+                    uint32_t nBit = i * nBitDepth;
+                    return uint16_t((row[nBit >> 3] >> (8 - nBitDepth - (nBit & 7))) & ((1 << nBitDepth) - 1));
+                }
+
+                uint8_t To8(uint16_t v) const {
+                    switch (nBitDepth) {
+                        case 1:  return v ? 255 : 0;
+                        case 2:  return uint8_t(v * 0x55);
+                        case 4:  return uint8_t(v * 0x11);
+                        case 16: return uint8_t(v >> 8);
+                        default: return uint8_t(v);
+                    }
+                }
+
+                // Expands one unfiltered scanline of w pixels
+                void ConvertRow(const uint8_t* row, Color* out, uint32_t w) const {
+                    for (uint32_t x = 0; x < w; x++) {
+                        uint32_t s = x * nChannels;
+                        switch (nColorType) {
+                            case 0: {
+                                uint16_t v = Sample(row, s);
+                                uint8_t  g = To8(v);
+                                out[x] = Color(g, g, g, (bColorKey && v == nKey[0]) ? 0 : 255);
+                            } break;
+                            case 2: {
+                                uint16_t r = Sample(row, s), g = Sample(row, s + 1), b = Sample(row, s + 2);
+                                bool bKey = bColorKey && r == nKey[0] && g == nKey[1] && b == nKey[2];
+                                out[x] = Color(To8(r), To8(g), To8(b), bKey ? 0 : 255);
+                            } break;
+                            case 3: out[x] = palette[Sample(row, s) & 255]; break;
+                            case 4: { uint8_t g = To8(Sample(row, s)); out[x] = Color(g, g, g, To8(Sample(row, s + 1))); } break;
+                            case 6: out[x] = Color(To8(Sample(row, s)), To8(Sample(row, s + 1)), To8(Sample(row, s + 2)), To8(Sample(row, s + 3))); break;
+                        }
+                    }
+                }
+            };
+        }
+
+        rcode ImageLoader::DecodePNG(Sprite& spr, const uint8_t* pData, size_t nSize) {
+            static const uint8_t sig[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+            if (nSize < 8 || memcmp(pData, sig, 8) != 0) return FAIL;
+
+            png::Format fmt;
+            Inflate     inflate;
+            uint32_t    w = 0, h = 0;
+            uint8_t     nInterlace = 0;
+            size_t      nCompressed = 0;
+            for (int i = 0; i < 256; i++) fmt.palette[i] = Color(0, 0, 0, 255);
+
+            // Walk the chunks, IDAT payloads are handed to the inflater in place
+            size_t p = 8;
+            bool bHeader = false, bEnd = false;
+            while (!bEnd && p + 12 <= nSize) {
+                uint32_t nLen = ReadBE32(pData + p);
+                const uint8_t* type = pData + p + 4;
+                const uint8_t* body = pData + p + 8;
+                if (nLen > nSize - p - 12) return FAIL;
+
+                if (!memcmp(type, "IHDR", 4)) {
+                    if (nLen < 13) return FAIL;
+                    w = ReadBE32(body); h = ReadBE32(body + 4);
+                    fmt.nBitDepth = body[8]; fmt.nColorType = body[9]; nInterlace = body[12];
+                    static const uint32_t nChannels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+                    static const uint32_t nDepths  [7] = { 0x10116, 0, 0x10100, 0x00116, 0x10100, 0, 0x10100 };   // Bit n set when depth n is allowed
+                    if (fmt.nColorType > 6 || nChannels[fmt.nColorType] == 0 || body[10] != 0 || body[11] != 0 || nInterlace > 1) return FAIL;
+                    if (fmt.nBitDepth > 16 || !(nDepths[fmt.nColorType] & (1u << fmt.nBitDepth))) return FAIL;
+                    fmt.nChannels = nChannels[fmt.nColorType];
+                    if (!ValidSize(w, h)) return FAIL;
+                    bHeader = true;
+                } else if (!memcmp(type, "PLTE", 4)) {
+                    for (uint32_t i = 0; i < nLen / 3 && i < 256; i++) fmt.palette[i] = Color(body[i * 3], body[i * 3 + 1], body[i * 3 + 2], 255);
+                } else if (!memcmp(type, "tRNS", 4)) {
+                    if (fmt.nColorType == 3) for (uint32_t i = 0; i < nLen && i < 256; i++) fmt.palette[i].a = body[i];
+                    else if (fmt.nColorType == 0 && nLen >= 2) { fmt.bColorKey = true; fmt.nKey[0] = uint16_t((body[0] << 8) | body[1]); }
+                    else if (fmt.nColorType == 2 && nLen >= 6) {
+                        fmt.bColorKey = true;
+                        for (int c = 0; c < 3; c++) fmt.nKey[c] = uint16_t((body[c * 2] << 8) | body[c * 2 + 1]);
+                    }
+                } else if (!memcmp(type, "IDAT", 4)) {
+                    inflate.AddInput(body, nLen);
+                    nCompressed += nLen;
+                } else if (!memcmp(type, "IEND", 4)) {
+                    bEnd = true;
+                }
+                p += 12 + nLen;
+            }
+            if (!bHeader) return FAIL;
+
+            // Pass geometry, a single pass covering the whole image when not interlaced
+            static const uint32_t x0[7] = { 0, 4, 0, 2, 0, 1, 0 }, dx[7] = { 8, 8, 4, 4, 2, 2, 1 };
+            static const uint32_t y0[7] = { 0, 0, 4, 0, 2, 0, 1 }, dy[7] = { 8, 8, 8, 4, 4, 2, 2 };
+            uint32_t nPasses = nInterlace ? 7 : 1;
+            uint32_t pw[7], ph[7];
+            size_t nTotal = 0;
+            for (uint32_t i = 0; i < nPasses; i++) {
+                pw[i] = nInterlace ? (w + dx[i] - 1 - x0[i]) / dx[i] : w;
+                ph[i] = nInterlace ? (h + dy[i] - 1 - y0[i]) / dy[i] : h;
+                if (w <= x0[i]) pw[i] = 0;
+                if (h <= y0[i]) ph[i] = 0;
+                if (pw[i] && ph[i]) nTotal += ph[i] * (fmt.RowBytes(pw[i]) + 1);
+            }
+
+            // DEFLATE expands at most 1032:1, so reject what the IDAT data could never fill before allocating it
+            if (nTotal / 1032 > nCompressed) return FAIL;
+
+            // The only intermediate buffer is the inflated, still filtered, image
+            std::vector<uint8_t> vRaw(nTotal);
+            size_t nWritten = 0;
+            if (inflate.Decompress(vRaw.data(), nTotal, nWritten) != OK || nWritten != nTotal) return FAIL;
+
+            if (spr.Resize(int32_t(w), int32_t(h)) != OK) return FAIL;
+            size_t nBpp = std::max<size_t>(1, fmt.BitsPerPixel() / 8);
+
+            if (!nInterlace && fmt.nColorType == 6 && fmt.nBitDepth == 8) {
+                // RGBA8 matches Color's memory layout, so unfilter directly into the sprite rows
+                size_t nRowBytes = size_t(w) * 4;
+                for (uint32_t y = 0; y < h; y++) {
+                    const uint8_t* in = vRaw.data() + y * (nRowBytes + 1);
+                    if (in[0] > 4) return FAIL;
+                    uint8_t* out = (uint8_t*)spr.GetRow(int32_t(y));
+                    png::UnfilterRow(out, in + 1, y ? (const uint8_t*)spr.GetRow(int32_t(y) - 1) : nullptr, nRowBytes, nBpp, in[0]);
+                }
+                return OK;
+            }
+
+            std::vector<Color> vPassRow(nInterlace ? w : 0);
+            uint8_t* pRaw = vRaw.data();
+            for (uint32_t pass = 0; pass < nPasses; pass++) {
+                if (pw[pass] == 0 || ph[pass] == 0) continue;
+                size_t nRowBytes = fmt.RowBytes(pw[pass]);
+                const uint8_t* prior = nullptr;
+                for (uint32_t y = 0; y < ph[pass]; y++) {
+                    uint8_t* row = pRaw + 1;
+                    if (pRaw[0] > 4) return FAIL;
+                    png::UnfilterRow(row, row, prior, nRowBytes, nBpp, pRaw[0]);
+
+                    if (!nInterlace) fmt.ConvertRow(row, spr.GetRow(int32_t(y)), w);
+                    else {
+                        fmt.ConvertRow(row, vPassRow.data(), pw[pass]);
+                        Color* out = spr.GetRow(int32_t(y0[pass] + y * dy[pass]));
+                        for (uint32_t x = 0; x < pw[pass]; x++) out[x0[pass] + x * dx[pass]] = vPassRow[x];
+                    }
+                    prior = row;
+                    pRaw += nRowBytes + 1;
+                }
+            }
+            return OK;
+        }
+
+
+        // MARK: QOI
+        rcode ImageLoader::DecodeQOI(Sprite& spr, const uint8_t* pData, size_t nSize) {
+            if (nSize < 22 || memcmp(pData, "qoif", 4) != 0) return FAIL;
+            uint32_t w = ReadBE32(pData + 4), h = ReadBE32(pData + 8);
+            // Every pixel costs at least 1/62 of a byte, the longest run, so a short body cannot claim a huge image
+            if (!ValidSize(w, h) || size_t(w) * h > (nSize - 22) * 62) return FAIL;
+
+            if (spr.Resize(int32_t(w), int32_t(h)) != OK) return FAIL;
+
+            Color index[64];
+            for (auto& c : index) c = Color(0, 0, 0, 0);
+            Color px(0, 0, 0, 255);
+            const uint8_t* p   = pData + 14;
+            const uint8_t* end = pData + nSize - 8; // 8 byte end marker
+            uint32_t nRun = 0;
+
+            for (uint32_t y = 0; y < h; y++) {
+                Color* out = spr.GetRow(int32_t(y));
+                for (uint32_t x = 0; x < w; x++) {
+                    if (nRun > 0) { nRun--; out[x] = px; continue; }
+                    if (p >= end) return FAIL;
+
+                    uint8_t b = *p++;
+                    if (b == 0xFE) {
+                        if (end - p < 3) return FAIL;
+                        px.r = p[0]; px.g = p[1]; px.b = p[2]; p += 3;
+                    } else if (b == 0xFF) {
+                        if (end - p < 4) return FAIL;
+                        px.r = p[0]; px.g = p[1]; px.b = p[2]; px.a = p[3]; p += 4;
+                    } else switch (b >> 6) {
+                        case 0: px = index[b]; break;
+                        case 1:
+                            px.r += ((b >> 4) & 3) - 2;
+                            px.g += ((b >> 2) & 3) - 2;
+                            px.b += ( b       & 3) - 2;
+                            break;
+                        case 2: {
+                            if (p >= end) return FAIL;
+                            int dg = (b & 0x3F) - 32, b2 = *p++;
+                            px.r += dg - 8 + ((b2 >> 4) & 15);
+                            px.g += dg;
+                            px.b += dg - 8 + (b2 & 15);
+                        } break;
+                        case 3: nRun = b & 0x3F; break;
+                    }
+                    index[(px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) & 63] = px;
+                    out[x] = px;
+                }
+            }
+            return OK;
+        }
+
+        rcode ImageLoader::LoadImage(Sprite& spr, const uint8_t* pData, size_t nSize) {
+            if (nSize >= 8 && pData[0] == 137 && pData[1] == 'P' && pData[2] == 'N' && pData[3] == 'G') return DecodePNG(spr, pData, nSize);
+            if (nSize >= 4 && memcmp(pData, "qoif", 4) == 0)                                             return DecodeQOI(spr, pData, nSize);
+            return FAIL;
+        }
+
+        rcode ImageLoader::LoadImage(Sprite& spr, const std::string& sImageFile) {
+            FILE* f = fopen(sImageFile.c_str(), "rb");
+            if (f == nullptr) return NO_FILE;
+            std::vector<uint8_t> vFile;
+            if (fseek(f, 0, SEEK_END) == 0) {
+                long nSize = ftell(f);
+                if (nSize > 0) {
+                    vFile.resize(size_t(nSize));
+                    fseek(f, 0, SEEK_SET);
+                    if (fread(vFile.data(), 1, vFile.size(), f) != vFile.size()) vFile.clear();
+                }
+            }
+            fclose(f);
+            if (vFile.empty()) return FAIL;
+            return LoadImage(spr, vFile.data(), vFile.size());
+        }
+
+        std::vector<rcode> ImageLoader::LoadImages(const std::vector<std::string>& vFiles, std::vector<Sprite>& vSprites) {
+            std::vector<rcode> vResults(vFiles.size(), FAIL);
+            vSprites.resize(vFiles.size());
+            ParallelFor(0, int32_t(vFiles.size()), [&](int32_t i) {
+                // An exception escaping a job would terminate, so a file too big for memory just fails
+                try                            { vResults[i] = LoadImage(vSprites[i], vFiles[i]); }
+                catch (const std::bad_alloc&)  { vResults[i] = FAIL; vSprites[i] = Sprite(); }
+            });
+            return vResults;
+        }
+
+
+        rcode koi_LoadSprite(Sprite& spr, const std::string& sImageFile) { return ImageLoader::LoadImage(spr, sImageFile); }
+    }
+
+#endif /* ImageLoader_h */
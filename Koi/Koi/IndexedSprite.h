@@ -0,0 +1,206 @@
+//
+//  IndexedSprite.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef IndexedSprite_h
+#define IndexedSprite_h
+
+    #include <array>
+    #include <unordered_map>
+    #include "Global.h"
+    #include "Sprite.h"
+    #include "Parallel.h"
+    #include "Simd.h"
+
+    namespace koi {
+        // MARK: koi::Palette
+        // +------------------------------------------------------------------------------+
+        // | koi::Palette - 256 colours looked up by an IndexedSprite                     |
+        // +------------------------------------------------------------------------------+
+        struct Palette {
+            std::array<Color, 256> vColors;
+
+            Palette();                                                  // Greyscale ramp
+
+            Color&       operator [] (uint8_t i)       { return vColors[i]; }
+            const Color& operator [] (uint8_t i) const { return vColors[i]; }
+            const Color* GetData    ()           const { return vColors.data(); }
+
+            void    Cycle  (uint8_t first, int32_t count, int32_t step = 1);   // Rotates [first, first + count), count up to 256
+            uint8_t Nearest(Color c) const;                                     // Closest entry by RGBA distance
+        };
+
+        Palette::Palette() { for (int32_t i = 0; i < 256; i++) vColors[i] = Color(uint8_t(i), uint8_t(i), uint8_t(i)); }
+
+        void Palette::Cycle(uint8_t first, int32_t count, int32_t step) {
+            count = std::min(count, 256 - int32_t(first));
+            if (count < 2) return;
+            step %= int32_t(count);
+            if (step < 0) step += count;
+            auto it = vColors.begin() + first;
+            std::rotate(it, it + (count - step) % count, it + count);
+        }
+
+        uint8_t Palette::Nearest(Color c) const {
+            int32_t nBest = INT32_MAX, nIndex = 0;
+            for (int32_t i = 0; i < 256; i++) {
+                int32_t dr = c.r - vColors[i].r, dg = c.g - vColors[i].g, db = c.b - vColors[i].b, da = c.a - vColors[i].a;
+                int32_t d = dr * dr + dg * dg + db * db + da * da;
+                if (d < nBest) { nBest = d; nIndex = i; if (d == 0) break; }
+            }
+            return uint8_t(nIndex);
+        }
+
+
+        // MARK: koi::ExpandIndexedRow
+        // +------------------------------------------------------------------------------+
+        // | koi::ExpandIndexedRow - Palette lookup from indices to RGBA                  |
+        // +------------------------------------------------------------------------------+
+        void ExpandIndexedRow(const uint8_t* src, Color* dst, int32_t count, const Color* pal) {
+            int32_t i = 0;
+            #if defined(KOI_SIMD_AVX2)
+                // Eight lookups per gather
+                for (; i + 8 <= count; i += 8) {
+                    __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+                    _mm256_storeu_si256((__m256i*)(dst + i), _mm256_i32gather_epi32((const int*)pal, idx, 4));
+                }
+            #endif
+            for (; i + 4 <= count; i += 4) {
+                dst[i    ] = pal[src[i    ]];
+                dst[i + 1] = pal[src[i + 1]];
+                dst[i + 2] = pal[src[i + 2]];
+                dst[i + 3] = pal[src[i + 3]];
+            }
+            for (; i < count; i++) dst[i] = pal[src[i]];
+        }
+
+
+        // MARK: koi::IndexedSprite
+        // +------------------------------------------------------------------------------+
+        // | koi::IndexedSprite - One byte per pixel, coloured through a Palette          |
+        // +------------------------------------------------------------------------------+
+        // Rows are 64 byte aligned like Sprite, stride is in bytes (which is also pixels).
+        class IndexedSprite {
+        public:
+            IndexedSprite();
+            IndexedSprite(int32_t w, int32_t h);
+            IndexedSprite(const IndexedSprite& spr);
+            IndexedSprite(IndexedSprite&& spr) noexcept;
+            ~IndexedSprite();
+
+            IndexedSprite& operator = (const IndexedSprite& spr);
+            IndexedSprite& operator = (IndexedSprite&& spr) noexcept;
+
+            int32_t  width       = 0;
+            int32_t  height      = 0;
+            int32_t  stride      = 0;
+            uint8_t* pIndexData  = nullptr;
+            size_t   nCapacity   = 0;
+
+            uint8_t        GetIndex(int32_t x, int32_t y) const;          // 0 outside the sprite
+            bool           SetIndex(int32_t x, int32_t y, uint8_t i);
+            uint8_t*       GetRow  (int32_t y)       { return pIndexData + y * stride; }
+            const uint8_t* GetRow  (int32_t y) const { return pIndexData + y * stride; }
+            void           Resize  (int32_t w, int32_t h);               // Contents become index 0
+            void           Clear   (uint8_t i);
+            void           Expand  (const SpriteView& dst, const Palette& pal) const; // dst is clipped to this size
+
+            static IndexedSprite FromSprite(const SpriteView& spr, const Palette& pal);
+
+        private:
+            void Release();
+        };
+
+        IndexedSprite::IndexedSprite() { }
+        IndexedSprite::IndexedSprite(int32_t w, int32_t h) { Resize(w, h); }
+        IndexedSprite::~IndexedSprite() { Release(); }
+
+        IndexedSprite::IndexedSprite(const IndexedSprite& spr) {
+            Resize(spr.width, spr.height);
+            for (int32_t y = 0; y < height; y++) memcpy(GetRow(y), spr.GetRow(y), width);
+        }
+
+        IndexedSprite::IndexedSprite(IndexedSprite&& spr) noexcept
+            : width(spr.width), height(spr.height), stride(spr.stride), pIndexData(spr.pIndexData), nCapacity(spr.nCapacity) {
+            spr.pIndexData = nullptr; spr.nCapacity = 0;
+            spr.width = spr.height = spr.stride = 0;
+        }
+
+        IndexedSprite& IndexedSprite::operator = (const IndexedSprite& spr) {
+            if (this == &spr) return *this;
+            Resize(spr.width, spr.height);
+            for (int32_t y = 0; y < height; y++) memcpy(GetRow(y), spr.GetRow(y), width);
+            return *this;
+        }
+
+        IndexedSprite& IndexedSprite::operator = (IndexedSprite&& spr) noexcept {
+            if (this == &spr) return *this;
+            Release();
+            width = spr.width; height = spr.height; stride = spr.stride;
+            pIndexData = spr.pIndexData; nCapacity = spr.nCapacity;
+            spr.pIndexData = nullptr; spr.nCapacity = 0;
+            spr.width = spr.height = spr.stride = 0;
+            return *this;
+        }
+
+        void IndexedSprite::Release() {
+            if (nCapacity) PixelAllocator::Get().Release(pIndexData, nCapacity);
+            pIndexData = nullptr; nCapacity = 0;
+        }
+
+        void IndexedSprite::Resize(int32_t w, int32_t h) {
+            width = std::max(w, 0); height = std::max(h, 0);
+            stride = int32_t((size_t(width) + nPixelAlignment - 1) & ~(nPixelAlignment - 1));
+            size_t nBytes = size_t(stride) * size_t(height);
+            if (nBytes <= nCapacity && nBytes * 2 > nCapacity) { memset(pIndexData, 0, nBytes); return; }
+            Release();
+            pIndexData = (uint8_t*)PixelAllocator::Get().Allocate(nBytes, nCapacity, true);
+        }
+
+        void IndexedSprite::Clear(uint8_t i) { if (pIndexData) memset(pIndexData, i, size_t(stride) * height); }
+
+        uint8_t IndexedSprite::GetIndex(int32_t x, int32_t y) const {
+            if (x >= 0 && x < width && y >= 0 && y < height) return pIndexData[y * stride + x];
+            else                                             return 0;
+        }
+
+        bool IndexedSprite::SetIndex(int32_t x, int32_t y, uint8_t i) {
+            if (x >= 0 && x < width && y >= 0 && y < height) {
+                pIndexData[y * stride + x] = i; return true;
+            } else return false;
+        }
+
+        void IndexedSprite::Expand(const SpriteView& dst, const Palette& pal) const {
+            int32_t w = std::min(width, dst.width), h = std::min(height, dst.height);
+            if (w <= 0 || h <= 0) return;
+            constexpr int32_t nRowsPerTask = 32;
+            auto expand = [&](int32_t y0, int32_t y1) {
+                for (int32_t y = y0; y < y1; y++) ExpandIndexedRow(GetRow(y), dst.GetRow(y), w, pal.GetData());
+            };
+            if (int64_t(w) * h < 512 * 512) { expand(0, h); return; }
+            ParallelFor(0, (h + nRowsPerTask - 1) / nRowsPerTask, [&](int32_t i) {
+                expand(i * nRowsPerTask, std::min((i + 1) * nRowsPerTask, h));
+            });
+        }
+
+        IndexedSprite IndexedSprite::FromSprite(const SpriteView& spr, const Palette& pal) {
+            IndexedSprite out(spr.width, spr.height);
+            // Images rarely use many distinct colours, remember each lookup
+            std::unordered_map<uint32_t, uint8_t> mapCache;
+            for (int32_t y = 0; y < spr.height; y++) {
+                const Color* src = spr.GetRow(y);
+                uint8_t* dst = out.GetRow(y);
+                for (int32_t x = 0; x < spr.width; x++) {
+                    auto it = mapCache.find(src[x].n);
+                    if (it == mapCache.end()) it = mapCache.emplace(src[x].n, pal.Nearest(src[x])).first;
+                    dst[x] = it->second;
+                }
+            }
+            return out;
+        }
+    }
+
+#endif /* IndexedSprite_h */
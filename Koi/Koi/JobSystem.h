@@ -0,0 +1,272 @@
+//
+//  JobSystem.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef JobSystem_h
+#define JobSystem_h
+
+    #include <algorithm>
+    #include <atomic>
+    #include <condition_variable>
+    #include <deque>
+    #include <functional>
+    #include <memory>
+    #include <mutex>
+    #include <thread>
+    #include <vector>
+
+    namespace koi {
+        // MARK: koi::JobCounter
+        // +------------------------------------------------------------------------------+
+        // | koi::JobCounter - Number of submitted jobs that have not finished yet        |
+        // +------------------------------------------------------------------------------+
+        class JobCounter {
+        public:
+            bool Done() const { return nJobs.load(std::memory_order_acquire) == 0; }
+
+        private:
+            friend class JobSystem;
+            std::atomic<int32_t> nJobs{ 0 };
+        };
+
+
+        // MARK: koi::JobSystem
+        // +------------------------------------------------------------------------------+
+        // | koi::JobSystem - Work stealing thread pool                                   |
+        // +------------------------------------------------------------------------------+
+        // Every worker owns a deque: it pushes and pops its own jobs at the back and steals
+        // from the front of the others when it runs dry. Threads outside the pool submit to
+        // a shared queue. The waiting thread runs queued jobs until its counter drops to zero,
+        // so jobs may submit and wait on jobs of their own. Once there is nothing left to
+        // steal it sleeps until a counter finishes or new jobs arrive.
+        class JobSystem {
+        public:
+            explicit JobSystem(int32_t nWorkers);                       // Background threads, the waiting thread is an extra one
+            ~JobSystem();
+            JobSystem(const JobSystem&) = delete;
+            JobSystem& operator=(const JobSystem&) = delete;
+
+            static JobSystem& Get();                                    // Process wide pool, hardware_concurrency threads in total
+
+            int32_t Workers    () const { return int32_t(vThreads.size()); }
+            int32_t Concurrency() const { return Workers() + 1; }
+
+            void Submit     (std::function<void()> fn, JobCounter* pCounter = nullptr);
+            void Wait       (JobCounter& counter);                      // Helps run jobs until the counter is done
+            void ParallelFor(int32_t begin, int32_t end, const std::function<void(int32_t)>& func, int32_t nGrain = 1);
+            void ParallelRows(int32_t y0, int32_t y1, int32_t nRowsPerBand, const std::function<void(int32_t, int32_t)>& func); // func(band start, band end)
+
+        private:
+            struct Queue {
+                std::mutex muxJobs;
+                std::deque<std::function<void()>> dqJobs;
+            };
+
+            bool TryRun     (int32_t nHome);
+            void WorkerLoop (int32_t nIndex);
+            void Push       (int32_t nQueue, std::function<void()> fn);
+            void WakeWaiters();
+
+            std::vector<std::unique_ptr<Queue>> vQueues;                // 0 is the shared queue, worker i owns i + 1
+            std::vector<std::thread>            vThreads;
+            std::atomic<int32_t>                nQueued{ 0 };
+            std::atomic<bool>                   bRunning{ true };
+            std::mutex                          muxSleep;
+            std::condition_variable             cvSleep;                // Idle workers
+            std::condition_variable             cvDone;                 // Threads parked in Wait
+            int32_t                             nWaiting = 0;           // Guarded by muxSleep
+
+            // Which pool and queue the current thread works for, so nested submits stay local
+            static thread_local JobSystem* pThreadPool;
+            static thread_local int32_t    nThreadQueue;
+        };
+
+        thread_local JobSystem* JobSystem::pThreadPool  = nullptr;
+        thread_local int32_t    JobSystem::nThreadQueue = 0;
+
+        JobSystem::JobSystem(int32_t nWorkers) {
+            nWorkers = std::max(nWorkers, 0);
+            for (int32_t i = 0; i <= nWorkers; i++) vQueues.emplace_back(new Queue());
+            vThreads.reserve(nWorkers);
+            for (int32_t i = 0; i < nWorkers; i++) vThreads.emplace_back(&JobSystem::WorkerLoop, this, i + 1);
+        }
+
+        JobSystem::~JobSystem() {
+            { std::lock_guard<std::mutex> lock(muxSleep); bRunning = false; }
+            cvSleep.notify_all();
+            for (auto& t : vThreads) t.join();
+        }
+
+        JobSystem& JobSystem::Get() {
+            // Define KOI_JOB_THREADS to pin the thread count, e.g. to share a machine
+            #if defined(KOI_JOB_THREADS)
+                static JobSystem pool(KOI_JOB_THREADS - 1);
+            #else
+                static JobSystem pool(int32_t(std::max(1u, std::thread::hardware_concurrency())) - 1);
+            #endif
+            return pool;
+        }
+
+        void JobSystem::Push(int32_t nQueue, std::function<void()> fn) {
+            // Counted first so the count never drops below the jobs actually queued
+            nQueued.fetch_add(1, std::memory_order_release);
+            {
+                std::lock_guard<std::mutex> lock(vQueues[nQueue]->muxJobs);
+                vQueues[nQueue]->dqJobs.push_back(std::move(fn));
+            }
+            // Taking the sleep lock orders this push before a worker that is about to sleep
+            bool bWaiters;
+            { std::lock_guard<std::mutex> lock(muxSleep); bWaiters = nWaiting > 0; }
+            cvSleep.notify_one();
+            if (bWaiters) cvDone.notify_all();  // A parked waiter may be the only thread free to run it
+        }
+        
+        void JobSystem::WakeWaiters() {
+            { std::lock_guard<std::mutex> lock(muxSleep); if (nWaiting == 0) return; }
+            cvDone.notify_all();
+        }
+
+        void JobSystem::Submit(std::function<void()> fn, JobCounter* pCounter) {
+            int32_t nQueue = pThreadPool == this ? nThreadQueue : 0;
+            if (pCounter) {
+                pCounter->nJobs.fetch_add(1, std::memory_order_relaxed);
+                Push(nQueue, [this, fn = std::move(fn), pCounter]() {
+                    fn();
+                    if (pCounter->nJobs.fetch_sub(1, std::memory_order_acq_rel) == 1) WakeWaiters(); // The counter may be gone after this
+                });
+            } else Push(nQueue, std::move(fn));
+        }
+
+        bool JobSystem::TryRun(int32_t nHome) {
+            if (nQueued.load(std::memory_order_acquire) == 0) return false;
+            std::function<void()> fn;
+            int32_t nQueues = int32_t(vQueues.size());
+
+            // Newest first from our own queue keeps the working set warm, oldest first when stealing
+            for (int32_t i = 0; i < nQueues && !fn; i++) {
+                Queue& q = *vQueues[(nHome + i) % nQueues];
+                std::lock_guard<std::mutex> lock(q.muxJobs);
+                if (q.dqJobs.empty()) continue;
+                if (i == 0 && nHome != 0) { fn = std::move(q.dqJobs.back());  q.dqJobs.pop_back();  }
+                else                      { fn = std::move(q.dqJobs.front()); q.dqJobs.pop_front(); }
+            }
+            if (!fn) return false;
+
+            nQueued.fetch_sub(1, std::memory_order_relaxed);
+            fn();
+            return true;
+        }
+
+        void JobSystem::WorkerLoop(int32_t nIndex) {
+            pThreadPool  = this;
+            nThreadQueue = nIndex;
+            while (bRunning) {
+                if (TryRun(nIndex)) continue;
+                std::unique_lock<std::mutex> lock(muxSleep);
+                cvSleep.wait(lock, [&]() { return nQueued.load() > 0 || !bRunning; });
+            }
+        }
+
+        void JobSystem::Wait(JobCounter& counter) {
+            int32_t nHome = pThreadPool == this ? nThreadQueue : 0;
+            for (int32_t nSpins = 0; !counter.Done(); ) {
+                if (TryRun(nHome)) { nSpins = 0; continue; }
+                
+                // The jobs left are running on other threads, give them a moment before sleeping
+                if (nSpins++ < 16) { std::this_thread::yield(); continue; }
+                std::unique_lock<std::mutex> lock(muxSleep);
+                nWaiting++;
+                cvDone.wait(lock, [&]() { return counter.Done() || nQueued.load() > 0; });
+                nWaiting--;
+                nSpins = 0;
+            }
+        }
+
+        void JobSystem::ParallelFor(int32_t begin, int32_t end, const std::function<void(int32_t)>& func, int32_t nGrain) {
+            if (end <= begin) return;
+            if (nGrain < 1) nGrain = 1;
+
+            int32_t nChunks  = (end - begin + nGrain - 1) / nGrain;
+            int32_t nHelpers = std::min(nChunks, Concurrency()) - 1;
+            if (nHelpers <= 0) { for (int32_t i = begin; i < end; i++) func(i); return; }
+
+            // Helpers and the caller all pull chunks from one counter, late helpers find nothing left
+            std::atomic<int32_t> nNext{ begin };
+            auto work = [&]() {
+                for (int32_t i = nNext.fetch_add(nGrain); i < end; i = nNext.fetch_add(nGrain))
+                    for (int32_t j = i, e = std::min(i + nGrain, end); j < e; j++) func(j);
+            };
+
+            JobCounter counter;
+            for (int32_t t = 0; t < nHelpers; t++) Submit(work, &counter);
+            work();
+            Wait(counter);
+        }
+
+        void JobSystem::ParallelRows(int32_t y0, int32_t y1, int32_t nRowsPerBand, const std::function<void(int32_t, int32_t)>& func) {
+            if (y1 <= y0) return;
+            nRowsPerBand = std::max(nRowsPerBand, 1);
+            ParallelFor(0, (y1 - y0 + nRowsPerBand - 1) / nRowsPerBand, [&](int32_t i) {
+                func(y0 + i * nRowsPerBand, std::min(y0 + (i + 1) * nRowsPerBand, y1));
+            });
+        }
+
+
+        // MARK: koi::TaskGraph
+        // +------------------------------------------------------------------------------+
+        // | koi::TaskGraph - Jobs that start once the jobs they depend on are done       |
+        // +------------------------------------------------------------------------------+
+        // Build once, Run as often as needed. The graph must not have cycles.
+        class TaskGraph {
+        public:
+            int32_t Add    (std::function<void()> fn);                  // Returns the task id
+            void    Precede(int32_t nBefore, int32_t nAfter);           // nAfter waits for nBefore
+            void    Run    (JobSystem& jobs = JobSystem::Get());        // Returns once every task has run
+            int32_t Size   () const { return int32_t(vTasks.size()); }
+
+        private:
+            struct Task {
+                std::function<void()> fn;
+                std::vector<int32_t>  vNext;
+                int32_t               nDeps = 0;
+            };
+
+            std::vector<Task> vTasks;
+            std::unique_ptr<std::atomic<int32_t>[]> pWaiting;            // Unfinished dependencies during a run
+        };
+
+        int32_t TaskGraph::Add(std::function<void()> fn) {
+            vTasks.push_back({ std::move(fn), {}, 0 });
+            return int32_t(vTasks.size()) - 1;
+        }
+
+        void TaskGraph::Precede(int32_t nBefore, int32_t nAfter) {
+            vTasks[nBefore].vNext.push_back(nAfter);
+            vTasks[nAfter].nDeps++;
+        }
+
+        void TaskGraph::Run(JobSystem& jobs) {
+            if (vTasks.empty()) return;
+            pWaiting.reset(new std::atomic<int32_t>[vTasks.size()]);
+            for (size_t i = 0; i < vTasks.size(); i++) pWaiting[i] = vTasks[i].nDeps;
+
+            // Successors are submitted before their predecessor's job ends, so the counter
+            // only reaches zero once the last task is done
+            JobCounter counter;
+            std::function<void(int32_t)> launch = [&](int32_t nTask) {
+                jobs.Submit([&, nTask]() {
+                    vTasks[nTask].fn();
+                    for (int32_t n : vTasks[nTask].vNext)
+                        if (pWaiting[n].fetch_sub(1, std::memory_order_acq_rel) == 1) launch(n);
+                }, &counter);
+            };
+
+            for (int32_t i = 0; i < Size(); i++) if (vTasks[i].nDeps == 0) launch(i);
+            jobs.Wait(counter);
+        }
+    }
+
+#endif /* JobSystem_h */
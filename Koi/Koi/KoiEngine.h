@@ -32,6 +32,7 @@
                             bool cohesion = false);
             
             rcode Start();
+            void  EnableHeadless(bool b);       // Run without a window or graphics device, call before Start
             
             
             
@@ -55,12 +56,31 @@
             
             
             // Utility
-            int32_t         ScreenWidth         ()           const; // Returns the width of the screen in "pixels"
-            int32_t         ScreenHeight        ()           const; // Returns the height of the screen in "pixels"
+            int32_t         ScreenWidth         ()           const; // Returns the width of the screen in "pixels", at the current render resolution
+            int32_t         ScreenHeight        ()           const; // Returns the height of the screen in "pixels", at the current render resolution
             int32_t         GetDrawTargetWidth  ()           const; // Returns the width of the currently selected drawing target in "pixels"
             int32_t         GetDrawTargetHeight ()           const; // Returns the height of the currently selected drawing target in "pixels"
-            Sprite*         GetDrawTarget       ()           const; // Returns the currently active draw target
+            Sprite*         GetDrawTarget       ()           const; // Returns the currently active draw target, nullptr if it is a view
+            SpriteView      GetDrawTargetView   ()           const; // Returns the pixels that drawing routines write to
+            void            SetDrawTarget       (Sprite* target);   // Redirect drawing to a sprite, nullptr selects the screen
+            void            SetDrawTarget       (const SpriteView& target); // Redirect drawing to part of a sprite
             void            SetScreenSize       (int w, int h);     // Resize the primary screen sprite
+            
+            // Dynamic resolution, frames that run over budget are drawn into a smaller part of
+            // the screen sprite and scaled up to the window. Raster plus upload time is averaged,
+            // the scale drops a step after a run of slow frames and climbs back only once the
+            // next step up is predicted to fit well inside the budget. Not used with the indexed screen.
+            void            EnableDynamicResolution(float fBudgetMs, float fMinScale = 0.5f); // fBudgetMs <= 0 turns it off and restores full size
+            void            SetResolutionScale  (float fScale);     // Takes effect at once, call before drawing the frame
+            float           GetResolutionScale  ()           const;
+            
+            // On demand rendering, for tools and editors. While enabled the engine thread sleeps
+            // until there is input, a resize, a RequestRedraw or a scheduled redraw falls due,
+            // instead of running frames back to back. The first frame after a sleep gets the
+            // whole idle time as its elapsed time.
+            void            EnableOnDemandRendering(bool b);
+            void            RequestRedraw       ();                 // Thread safe, e.g. from a loader thread
+            void            ScheduleRedraw      (float fSeconds);   // Engine thread only, for timers and animations; the earliest one pending wins
             uint32_t        GetFPS              ()           const; // Gets the current Frames Per Second
             float           GetElapsedTime      ()           const; // Gets last update of elapsed time
             const Vector2i& GetWindowSize       ()           const; // Gets Actual Window size
@@ -69,6 +89,24 @@
             
             
             
+            // Multithreading, started with the engine and sized to the hardware
+            JobSystem&      GetJobs             ()           const; // Submit, Wait, ParallelFor or run a TaskGraph on it
+            void            ParallelRows        (const std::function<void(const SpriteView& band, int32_t y)>& func, int32_t nRowsPerBand = 32); // func gets bands of the draw target and their first row
+            
+            
+            
+            // Frame memory, bump allocated and dropped all at once at the start of the frame after
+            // next, so anything allocated during a frame is valid until the end of the following one.
+            // Engine thread only.
+            FrameArena&     GetFrameArena       ();
+            void*           FrameAlloc          (size_t nBytes, size_t nAlign = alignof(std::max_align_t));
+            template<class T> ArenaAllocator<T> GetFrameAllocator() { return ArenaAllocator<T>(frameArena); } // e.g. FrameVector<int> v(GetFrameAllocator<int>());
+            #if defined(KOI_HAS_PMR)
+                std::pmr::memory_resource* GetFrameResource();
+            #endif
+            
+            
+            
             // CONFIGURATION ROUTINES
             
             // window targeting functions
@@ -91,8 +129,28 @@
             void        SetPixelBlend(float fBlend);   // Change the blend factor form between 0.0f to 1.0f;
             
             
+            // Camera, while enabled draw calls take world coordinates and map them to (p - pos) * zoom.
+            // Every draw call is first checked against the draw target by its screen bounds, the
+            // ones that miss are culled before any per pixel work. Single pixels from Draw are
+            // only bounds checked and are not counted.
+            struct DrawStats {
+                uint32_t nDrawn  = 0;                   // Draw calls that reached the rasterisers
+                uint32_t nCulled = 0;                   // Draw calls rejected by their bounds
+            };
+            void             SetCamera          (const Vector2f& pos, float fZoom = 1.0f); // Enables the camera, fZoom > 0
+            void             EnableCamera       (bool b);           // Disable to draw a HUD in screen space
+            const Vector2f&  GetCameraPos       ()           const;
+            float            GetCameraZoom      ()           const;
+            Vector2f         WorldToScreen      (const Vector2f& p) const;
+            Vector2f         ScreenToWorld      (const Vector2f& p) const; // e.g. the world position under the mouse
+            const DrawStats& GetDrawStats       ()           const; // Counted since the start of the frame
+            void             ResetDrawStats     ();
+            
+            
             
             // DRAWING ROUTINES
+            // These write to the draw target. While the indexed screen is enabled it replaces the
+            // screen's contents at the end of the frame, so draw into another target instead.
             virtual bool Draw     (int32_t x, int32_t y,   Color p = Color::WHITE);
                     bool Draw     (const Vector2i& pos,    Color p = Color::WHITE);
             
@@ -116,9 +174,40 @@
             
             void DrawSprite       (int32_t x, int32_t y,   Sprite* sprite, uint32_t scale = 1, uint8_t flip = Sprite::NONE);
             void DrawSprite       (const Vector2i& p,      Sprite* sprite, uint32_t scale = 1, uint8_t flip = Sprite::NONE);
+            void DrawSprite       (int32_t x, int32_t y,   const SpriteView& sprite, uint32_t scale = 1, uint8_t flip = Sprite::NONE);
+            void DrawSprite       (const Vector2i& p,      const SpriteView& sprite, uint32_t scale = 1, uint8_t flip = Sprite::NONE);
             void DrawPartialSprite(int32_t x, int32_t y,   Sprite* sprite, int32_t ox, int32_t oy, int32_t w, int32_t h, uint32_t scale = 1, uint8_t flip = Sprite::NONE);
             void DrawPartialSprite(const Vector2i& p,      Sprite* sprite, const Vector2i& origin, const Vector2i& size, uint32_t scale = 1, uint8_t flip = Sprite::NONE);
+            void DrawPartialSprite(int32_t x, int32_t y,   const SpriteView& sprite, int32_t ox, int32_t oy, int32_t w, int32_t h, uint32_t scale = 1, uint8_t flip = Sprite::NONE);
+            void DrawPartialSprite(const Vector2i& p,      const SpriteView& sprite, const Vector2i& origin, const Vector2i& size, uint32_t scale = 1, uint8_t flip = Sprite::NONE);
+            void DrawScaledSprite (int32_t x, int32_t y,   Sprite* sprite, float scale, uint8_t flip = Sprite::NONE);  // Shrinking reads from the mip chain
+            void DrawScaledSprite (const Vector2i& p,      Sprite* sprite, float scale, uint8_t flip = Sprite::NONE);
+            void DrawScaledSprite (int32_t x, int32_t y,   const SpriteView& sprite, float scale, uint8_t flip = Sprite::NONE);
+            void DrawScaledSprite (const Vector2i& p,      const SpriteView& sprite, float scale, uint8_t flip = Sprite::NONE);
+            void DrawRLESprite    (int32_t x, int32_t y,   const RLESprite& sprite);   // Fully transparent pixels are always skipped
+            void DrawRLESprite    (const Vector2i& p,      const RLESprite& sprite);
+            void DrawTexturedRect (int32_t x, int32_t y,   int32_t w, int32_t h,   const SpriteView& sprite, const Sampler& sampler, float u0 = 0.0f, float v0 = 0.0f, float u1 = 1.0f, float v1 = 1.0f);
+            void DrawParticles    (const ParticleSystem& particles);          // Uses the pixel mode and blend factor
+            void DrawTileMap      (int32_t x, int32_t y,   TileMap& map);      // Map's top left at (x, y), one blit per visible chunk. NORMAL draws as ALPHA so empty cells stay see-through
+            void DrawTileMap      (const Vector2i& p,      TileMap& map);
             void Clear(Color c);
+            
+            // Text, laid out once per distinct string and font and then drawn from a cache of runs.
+            void     DrawString     (int32_t x, int32_t y,   const std::string& sText, Color col = Color::WHITE, uint32_t scale = 1, const Font* font = nullptr);
+            void     DrawString     (const Vector2i& p,      const std::string& sText, Color col = Color::WHITE, uint32_t scale = 1, const Font* font = nullptr);
+            Vector2i GetTextSize    (const std::string& sText, const Font* font = nullptr);
+            Font*    GetDefaultFont ();
+            
+            // Indexed colour screen, drawn with palette indices and expanded to RGBA once per frame.
+            // These always take screen coordinates. The mode is exclusive: the expansion overwrites the
+            // whole RGBA screen, so colour drawing to the screen is lost while it is enabled.
+            void            EnableIndexedScreen (bool b);
+            IndexedSprite*  GetIndexedScreen    ()           const; // nullptr unless enabled
+            Palette&        GetPalette          ();                 // Change entries to recolour or cycle the whole screen
+            bool DrawIndex        (int32_t x, int32_t y,   uint8_t i);
+            void FillRectIndex    (int32_t x, int32_t y,   int32_t w, int32_t h,   uint8_t i);
+            void ClearIndex       (uint8_t i);
+            void DrawIndexedSprite(int32_t x, int32_t y,   const IndexedSprite& sprite, int32_t nTransparent = -1); // Into the indexed screen when the screen is the target, other targets go through the palette
             void ClearBuffer(Color c, bool bDepth = true);  // Clears the rendering back buffer
             
             
@@ -129,6 +218,7 @@
             Color::Mode nColorMode              = Color::NORMAL;
             float       fBlendFactor            = 1.0f;
             Vector2i    vScreenSize             = { 256, 240 };
+            Vector2i    vRenderSize             = { 256, 240 };   // Part of the screen drawn this frame, see SetResolutionScale
             Vector2f    vInvScreenSize          = { 1.0f / 256.0f, 1.0f / 240.0f };
             Vector2i    vPixelSize              = { 4, 4 };
             Vector2i    vScreenPixelSize        = { 4, 4 };
@@ -157,11 +247,53 @@
             // Window vars
             Vector2f    vOffset              = { 0, 0 };
             Vector2f    vScale               = { 1, 1 };
+            Sprite*     pScreen              = nullptr; // Primary "window" sprite, uploaded every frame
             Sprite*     pDrawTarget          = nullptr;
+            SpriteView  viewTarget;                     // What the drawing routines actually write to
+            std::vector<Color> vBlitRow;                // Scratch row for scaled and flipped blits
+            FrameArena  frameArena;                     // Reset at the start of every frame
+            std::shared_ptr<void> pFrameResource;       // FrameResource made by GetFrameResource, untyped so the layout never depends on std::pmr
+            std::unique_ptr<IndexedSprite> pIndexedScreen; // Expanded into pScreen before upload when set
+            Palette     palScreen;
+            std::unique_ptr<Font> pFont;                // Built in 8x8 font, made on first use
+            struct koi_CachedText {
+                const Font* pFont;
+                uint64_t    nId, nVersion;
+                uint64_t    nFrame;                     // Last frame it was drawn in
+                size_t      nHash;
+                std::string sText;
+                RLESprite   text;
+            };
+            std::list<koi_CachedText> lstTextCache;     // Most recently drawn first
+            std::unordered_map<size_t, std::list<koi_CachedText>::iterator> mapTextCache;
+            static constexpr size_t nMaxCachedStrings = 1024;   // Exceeded only by text drawn this frame, up to 4x
             uint32_t    nResID               = 0;
             Color       tint                 = Color::WHITE;
             std::function<void()> funcHook  = nullptr;
             
+            // Dynamic resolution
+            float       fResBudget           = 0.0f;    // Seconds, 0 when off
+            float       fResMinScale         = 0.5f;
+            float       fResScale            = 1.0f;
+            float       fResAverage          = 0.0f;
+            int32_t     nResOver             = 0;       // Consecutive frames over budget
+            int32_t     nResUnder            = 0;       // Consecutive frames with room for the next step up
+            float       fResStep             = 0.125f;  // Scale change per step
+            
+            // On demand rendering
+            std::atomic<bool> bOnDemand{ false };
+            std::atomic<bool> bRedraw{ true };          // Set by RequestRedraw, consumed before the next sleep
+            bool        bRedrawScheduled     = false;
+            std::chrono::steady_clock::time_point tRedraw;
+            std::thread::id idEngineThread;
+            
+            // Camera
+            Vector2f    vCameraPos           = { 0.0f, 0.0f };
+            float       fCameraZoom          = 1.0f;
+            bool        bCamera              = false;
+            bool        bScreenSpace         = false;   // Set while a draw call forwards already transformed coordinates
+            DrawStats   stats;
+            
             
             // Keyboard state
             bool        pKeyNewState  [256]           = { 0 };
@@ -176,8 +308,17 @@
             
             void EngineThread();                  // The main engine thread
             void koi_ConfigureSystem();           // At the end of this file, chooses which components to compile
-            
-            static std::atomic<bool> bAtomActive; // Shutdown flag
+            rcode koi_StartThreaded();            // Window on this thread, engine on its own
+            
+            // Per instance so several engines can run in one process
+            std::unique_ptr<Renderer> renderer;
+            std::unique_ptr<Platform> platform;
+            std::atomic<bool> bAtomActive{ false }; // Shutdown flag
+            #if defined(KOI_HEADLESS)
+                bool bHeadless = true;
+            #else
+                bool bHeadless = false;
+            #endif
             
         public:
             void koi_UpdateMouse        (int32_t x, int32_t y);
@@ -185,6 +326,7 @@
             void koi_UpdateWindowSize   (int32_t x, int32_t y);
             void koi_UpdateViewport     ();
             void koi_ConstructFontSheet ();
+            const RLESprite& koi_GetCachedText(const Font& f, const std::string& sText);
             void koi_CoreUpdate         ();
             void koi_PrepareEngine      ();
             void koi_UpdateMouseState   (int32_t button, bool state);
@@ -193,6 +335,30 @@
             void koi_UpdateKeyFocus     (bool state);
             void koi_Terminate          ();
             
+        private:
+            Color koi_BlendAlpha        (Color src, Color dst) const;
+            void  koi_DrawSpan          (Color* dst, const Color* src, int32_t count, int32_t x, int32_t y, bool bPremultiplied = false);
+            void  koi_DrawResampled     (int32_t x, int32_t y, const SpriteView& src, int32_t w, int32_t h, uint8_t flip);
+            void  koi_DrawRLEScaled     (int32_t x, int32_t y, int32_t w, int32_t h, const RLESprite& sprite);
+            static int32_t koi_FirstCentre(int32_t s, int32_t nSrc, int32_t nDst);  // First of nDst pixels whose centre samples source index s or later
+            void  koi_ForRowBands       (int32_t y1, int32_t y2, int32_t nWidth, const std::function<void(int32_t, int32_t, Color*)>& func);
+            int32_t koi_CameraX         (double x) const;
+            int32_t koi_CameraY         (double y) const;
+            int32_t koi_CameraSize      (double n) const;
+            bool    koi_Cull            (int32_t x1, int32_t y1, int32_t x2, int32_t y2);   // Counts the call, true if the rectangle misses the target
+            void    koi_UpdateResolution(float fWork);
+            void    koi_WaitForWork     ();                     // Returns once a frame is due or the engine stopped
+            void    koi_WakeForInput    ();
+            
+            // Marks the calls made in its scope as screen space, so forwarded coordinates are not transformed twice
+            struct koi_ScreenSpace {
+                explicit koi_ScreenSpace(bool& b) : bFlag(b), bOld(b) { bFlag = true; }
+                ~koi_ScreenSpace() { bFlag = bOld; }
+                bool& bFlag;
+                bool  bOld;
+            };
+            
+            static constexpr int64_t nParallelPixels = 256 * 256;  // Smaller blits aren't worth waking the workers
         };
         
         KoiEngine::KoiEngine() {
@@ -200,11 +366,14 @@
             koi_ConfigureSystem(); // Bring in relevant Platform & Rendering systems depending on compiler parameters
         }
         
-        KoiEngine::~KoiEngine() { }
+        KoiEngine::~KoiEngine() {
+            delete pScreen;
+        }
         
         rcode KoiEngine::Construct(int32_t screen_w, int32_t screen_h, int32_t pixel_w, int32_t pixel_h, bool full_screen, bool vsync, bool cohesion) {
             bPixelCohesion  = cohesion;
             vScreenSize     = { screen_w, screen_h };
+            vRenderSize     = vScreenSize;
             vInvScreenSize  = { 1.0f / screen_w, 1.0f / screen_h };
             vPixelSize      = { pixel_w, pixel_h };
             vWindowSize     = vScreenSize * vPixelSize;
@@ -218,39 +387,52 @@
         void KoiEngine::SetScreenSize(int w, int h) {
             vScreenSize    = { w, h };
             vInvScreenSize = { 1.0f / float(w), 1.0f / float(h) };
-            delete pDrawTarget; // Erase existing window sprites
-            pDrawTarget = new Sprite(vScreenSize.x, vScreenSize.y);
+            if (pScreen) pScreen->Resize(vScreenSize.x, vScreenSize.y); // Reuses the buffer when it fits
+            else         pScreen = new Sprite(vScreenSize.x, vScreenSize.y);
+            if (pIndexedScreen) pIndexedScreen->Resize(vScreenSize.x, vScreenSize.y);
+            SetResolutionScale(fResScale);
             
+            // The quad's texture scale is relative to the screen size, so the texture has to match it
+            if (nResID) { renderer->ApplyTexture(nResID); renderer->UpdateTexture(nResID, pScreen); }
             renderer->ClearBuffer(BACK, true);
             renderer->DisplayFrame();
             renderer->ClearBuffer(BACK, true);
             renderer->UpdateViewport(vViewPos, vViewSize);
         }
         
+        rcode KoiEngine::koi_StartThreaded() {
+            GetJobs(); // Bring the workers up before the first frame needs them
+            if (platform->ApplicationStartUp() != OK) return FAIL;
+            
+            // Construct the window
+            if (platform->CreateWindowPane({ 30, 30 }, vWindowSize, bFullScreen) != OK) return FAIL;
+            koi_UpdateWindowSize(vWindowSize.x, vWindowSize.y);
+            
+            // Start the thread
+            bAtomActive = true;
+            std::thread t = std::thread(&KoiEngine::EngineThread, this);
+            
+            // Some implementations may form an event loop here
+            platform->StartSystemEventLoop();
+            
+            // Wait for thread to be exited
+            t.join();
+            
+            if (platform->ApplicationCleanUp() != OK) return FAIL;
+            
+            return OK;
+        }
+        
         #if !defined(__APPLE__)
-            rcode KoiEngine::Start() {
-                if (platform->ApplicationStartUp() != OK) return FAIL;
-                
-                // Construct the window
-                if (platform->CreateWindowPane({ 30, 30 }, vWindowSize, bFullScreen) != OK) return FAIL;
-                koi_UpdateWindowSize(vWindowSize.x, vWindowSize.y);
-                
-                // Start the thread
-                bAtomActive = true;
-                std::thread t = std::thread(&KoiEngine::EngineThread, this);
-                
-                // Some implementations may form an event loop here
-                platform->StartSystemEventLoop();
-                
-                // Wait for thread to be exited
-                t.join();
-                
-                if (platform->ApplicationCleanUp() != OK) return FAIL;
-                
-                return OK;
-            }
+            rcode KoiEngine::Start() { return koi_StartThreaded(); }
         #endif
         
+        void KoiEngine::EnableHeadless(bool b) {
+            if (bHeadless == b || bAtomActive) return;
+            bHeadless = b;
+            koi_ConfigureSystem();
+        }
+        
         void            KoiEngine::SetWindowOffset  (const Vector2f& offset)  { SetWindowOffset(offset.x, offset.y); }
         void            KoiEngine::SetWindowOffset  (float x, float y)        { vOffset = { x, y };                  }
         void            KoiEngine::SetWindowScale   (const Vector2f& scale)   { SetWindowScale(scale.x, scale.y);    }
@@ -260,8 +442,67 @@
         void            KoiEngine::SetWindowCustomRenderFunction(std::function<void()> f) { funcHook = f; }
         
         Sprite*         KoiEngine::GetDrawTarget        ()              const { return pDrawTarget;                           }
-        int32_t         KoiEngine::GetDrawTargetWidth   ()              const { return pDrawTarget ? pDrawTarget->width : 0;  }
-        int32_t         KoiEngine::GetDrawTargetHeight  ()              const { return pDrawTarget ? pDrawTarget->height : 0; }
+        SpriteView      KoiEngine::GetDrawTargetView    ()              const { return viewTarget;                            }
+        int32_t         KoiEngine::GetDrawTargetWidth   ()              const { return viewTarget.width;                      }
+        int32_t         KoiEngine::GetDrawTargetHeight  ()              const { return viewTarget.height;                     }
+        
+        void KoiEngine::SetDrawTarget(Sprite* target) {
+            pDrawTarget = target ? target : pScreen;
+            if (pDrawTarget && pDrawTarget == pScreen) viewTarget = pScreen->GetSubView(0, 0, vRenderSize.x, vRenderSize.y);
+            else viewTarget = pDrawTarget ? pDrawTarget->GetView() : SpriteView();
+        }
+        
+        void KoiEngine::EnableDynamicResolution(float fBudgetMs, float fMinScale) {
+            fResBudget   = std::max(fBudgetMs, 0.0f) / 1000.0f;
+            fResMinScale = std::min(std::max(fMinScale, fResStep), 1.0f);
+            fResAverage  = 0.0f;
+            nResOver     = nResUnder = 0;
+            SetResolutionScale(fResBudget > 0.0f ? std::max(fResScale, fResMinScale) : 1.0f);
+        }
+        
+        float KoiEngine::GetResolutionScale() const { return fResScale; }
+        
+        void KoiEngine::SetResolutionScale(float fScale) {
+            // Every size fits in the screen sprite, so changing it never reallocates anything
+            fResScale   = std::min(std::max(fScale, fResStep / 2.0f), 1.0f);
+            vRenderSize = { std::max(1, int32_t(vScreenSize.x * fResScale + 0.5f)), std::max(1, int32_t(vScreenSize.y * fResScale + 0.5f)) };
+            if (pDrawTarget == pScreen || pDrawTarget == nullptr) SetDrawTarget(nullptr);
+        }
+        
+        void KoiEngine::koi_UpdateResolution(float fWork) {
+            if (fResBudget <= 0.0f || pIndexedScreen) return;
+            fResAverage = fResAverage == 0.0f ? fWork : fResAverage + (fWork - fResAverage) * 0.1f;
+            
+            // Raster cost follows the pixel count, so a step costs about (new / old)^2 of now
+            float fDown = std::max(fResScale - fResStep, fResMinScale), fUp = std::min(fResScale + fResStep, 1.0f);
+            float fUpCost = fResAverage * (fUp / fResScale) * (fUp / fResScale);
+            nResOver  = (fResAverage > fResBudget && fDown < fResScale)          ? nResOver  + 1 : 0;
+            nResUnder = (fUpCost < fResBudget * 0.85f && fUp > fResScale)        ? nResUnder + 1 : 0;
+            
+            float fNew = nResOver >= 8 ? fDown : nResUnder >= 30 ? fUp : fResScale;
+            if (fNew == fResScale) return;
+            fResAverage *= (fNew / fResScale) * (fNew / fResScale);
+            nResOver = nResUnder = 0;
+            SetResolutionScale(fNew);
+        }
+        
+        void KoiEngine::EnableOnDemandRendering(bool b) {
+            bOnDemand = b;
+            RequestRedraw();    // Gets a sleeping engine thread going again when turned off
+        }
+        
+        void KoiEngine::RequestRedraw() {
+            bRedraw = true;
+            // The engine thread checks the flag before it sleeps, so it only needs waking from elsewhere
+            if (platform && std::this_thread::get_id() != idEngineThread) platform->Wake();
+        }
+        
+        void KoiEngine::ScheduleRedraw(float fSeconds) {
+            auto t = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(std::max(fSeconds, 0.0f)));
+            if (!bRedrawScheduled || t < tRedraw) { tRedraw = t; bRedrawScheduled = true; }
+        }
+        
+        void KoiEngine::SetDrawTarget(const SpriteView& target) { pDrawTarget = nullptr; viewTarget = target; }
         
         uint32_t        KoiEngine::GetFPS               ()              const { return nLastFPS;                              }
         bool            KoiEngine::IsFocused            ()              const { return bHasInputFocus;                        }
@@ -271,34 +512,112 @@
         int32_t         KoiEngine::GetMouseY            ()              const { return vMousePos.y;                           }
         const Vector2i& KoiEngine::GetMousePos          ()              const { return vMousePos;                             }
         int32_t         KoiEngine::GetMouseWheel        ()              const { return nMouseWheelDelta;                      }
-        int32_t         KoiEngine::ScreenWidth          ()              const { return vScreenSize.x;                         }
-        int32_t         KoiEngine::ScreenHeight         ()              const { return vScreenSize.y;                         }
+        int32_t         KoiEngine::ScreenWidth          ()              const { return vRenderSize.x;                         }
+        int32_t         KoiEngine::ScreenHeight         ()              const { return vRenderSize.y;                         }
         float           KoiEngine::GetElapsedTime       ()              const { return fLastElapsed;                          }
         const Vector2i& KoiEngine::GetWindowSize        ()              const { return vWindowSize;                           }
         const Vector2i& KoiEngine::GetPixelSize         ()              const { return vPixelSize;                            }
         const Vector2i& KoiEngine::GetScreenPixelSize   ()              const { return vScreenPixelSize;                      }
         const Vector2i& KoiEngine::GetWindowMouse       ()              const { return vMouseWindowPos;                       }
         
+        void KoiEngine::SetCamera(const Vector2f& pos, float fZoom) {
+            vCameraPos = pos;
+            if (fZoom > 0.0f) fCameraZoom = fZoom;
+            bCamera = true;
+        }
+        
+        void                           KoiEngine::EnableCamera   (bool b)                   { bCamera = b;                                               }
+        const Vector2f&                KoiEngine::GetCameraPos   ()                   const { return vCameraPos;                                         }
+        float                          KoiEngine::GetCameraZoom  ()                   const { return fCameraZoom;                                        }
+        Vector2f                       KoiEngine::WorldToScreen  (const Vector2f& p)  const { return bCamera ? (p - vCameraPos) * fCameraZoom : p;       }
+        Vector2f                       KoiEngine::ScreenToWorld  (const Vector2f& p)  const { return bCamera ? p / fCameraZoom + vCameraPos : p;         }
+        const KoiEngine::DrawStats&    KoiEngine::GetDrawStats   ()                   const { return stats;                                              }
+        void                           KoiEngine::ResetDrawStats ()                         { stats = DrawStats();                                       }
+        
+        // Screen coordinates are clamped to +-2^29 so bounds and sizes built from them cannot overflow
+        int32_t KoiEngine::koi_CameraX(double x) const {
+            if (bCamera) x = std::floor((x - vCameraPos.x) * fCameraZoom);
+            return int32_t(std::min(std::max(x, -536870912.0), 536870912.0));
+        }
+        
+        int32_t KoiEngine::koi_CameraY(double y) const {
+            if (bCamera) y = std::floor((y - vCameraPos.y) * fCameraZoom);
+            return int32_t(std::min(std::max(y, -536870912.0), 536870912.0));
+        }
+        
+        int32_t KoiEngine::koi_CameraSize(double n) const {
+            if (bCamera) n *= fCameraZoom;
+            return int32_t(std::min(std::max(n + 0.5, 0.0), 536870912.0));
+        }
+        
+        bool KoiEngine::koi_Cull(int32_t x1, int32_t y1, int32_t x2, int32_t y2) {
+            if (x1 >= x2 || y1 >= y2 || x2 <= 0 || y2 <= 0 || x1 >= viewTarget.width || y1 >= viewTarget.height) { stats.nCulled++; return true; }
+            stats.nDrawn++;
+            return false;
+        }
+        
         bool KoiEngine::Draw(const Vector2i& p, Color c)    { return Draw(p.x, p.y, c); }
         bool KoiEngine::Draw(int32_t x, int32_t y, Color c) {
-            if (!pDrawTarget) return false;
-            if (nColorMode == Color::NORMAL) return pDrawTarget->SetPixel(x, y, c);
-            if (nColorMode == Color::MASK) if (c.a == 255) return pDrawTarget->SetPixel(x, y, c);
-            if (nColorMode == Color::ALPHA) {
-                Color d = pDrawTarget->GetPixel(x, y);
-                float a = (float)(c.a / 255.0f) * fBlendFactor;
-                float k = 1.0f - a;
-                uint8_t r = a * (float)c.r + k * (float)d.r;
-                uint8_t g = a * (float)c.g + k * (float)d.g;
-                uint8_t b = a * (float)c.b + k * (float)d.b;
-                return pDrawTarget->SetPixel(x, y, Color(r, g, b/*, (uint8_t)(p.a * fBlendFactor)*/));
-            }
-            if (nColorMode == Color::CUSTOM) return pDrawTarget->SetPixel(x, y, funcPixelMode(x, y, c, pDrawTarget->GetPixel(x, y)));
+            if (bCamera && !bScreenSpace) {
+                // A world pixel covers at least one screen pixel, zoomed in it becomes a block. Single
+                // pixels are left out of the draw stats, SetPixel below does their bounds check
+                int32_t x1 = koi_CameraX(x), x2 = std::max(koi_CameraX(x + 1.0), x1 + 1);
+                int32_t y1 = koi_CameraY(y), y2 = std::max(koi_CameraY(y + 1.0), y1 + 1);
+                if (x2 - x1 > 1 || y2 - y1 > 1) { koi_ScreenSpace screen(bScreenSpace); FillRect(x1, y1, x2 - x1, y2 - y1, c); return true; }
+                x = x1; y = y1;
+            }
+            if (viewTarget.Empty()) return false;
+            if (nColorMode == Color::NORMAL) return viewTarget.SetPixel(x, y, c);
+            if (nColorMode == Color::MASK) if (c.a == 255) return viewTarget.SetPixel(x, y, c);
+            if (nColorMode == Color::ALPHA) return viewTarget.SetPixel(x, y, koi_BlendAlpha(c, viewTarget.GetPixel(x, y)));
+            if (nColorMode == Color::CUSTOM) return viewTarget.SetPixel(x, y, funcPixelMode(x, y, c, viewTarget.GetPixel(x, y)));
             return false;
         }
         
+        Color KoiEngine::koi_BlendAlpha(Color c, Color d) const {
+            float a = (float)(c.a / 255.0f) * fBlendFactor;
+            float k = 1.0f - a;
+            uint8_t r = a * (float)c.r + k * (float)d.r;
+            uint8_t g = a * (float)c.g + k * (float)d.g;
+            uint8_t b = a * (float)c.b + k * (float)d.b;
+            return Color(r, g, b/*, (uint8_t)(p.a * fBlendFactor)*/);
+        }
+        
+        // Writes count pixels of one row with the current pixel mode, dst and src are already clipped
+        void KoiEngine::koi_DrawSpan(Color* dst, const Color* src, int32_t count, int32_t x, int32_t y, bool bPremultiplied) {
+            // A source in the other alpha format than the target is converted in small pieces on the stack
+            // first, only MASK can skip it as opaque pixels are the same either way
+            if (bPremultiplied != viewTarget.bPremultiplied && nColorMode != Color::MASK) {
+                Color tmp[64];
+                for (int32_t i = 0; i < count; i += 64) {
+                    int32_t n = std::min(count - i, int32_t(64));
+                    if (bPremultiplied) koi::Unpremultiply(src + i, tmp, n);
+                    else                koi::Premultiply  (src + i, tmp, n);
+                    koi_DrawSpan(dst + i, tmp, n, x + i, y, viewTarget.bPremultiplied);
+                }
+                return;
+            }
+            switch (nColorMode) {
+                case Color::NORMAL: memcpy((void*)dst, src, count * sizeof(Color));                                           break;
+                case Color::MASK:   for (int32_t i = 0; i < count; i++) if (src[i].a == 255) dst[i] = src[i];                 break;
+                case Color::ALPHA:
+                    // Premultiplied over premultiplied needs one multiply-add per channel, see PixelFormat.h
+                    if (bPremultiplied) BlendPremultiplied(dst, src, count, uint32_t(std::min(std::max(fBlendFactor, 0.0f), 1.0f) * 255.0f + 0.5f));
+                    else for (int32_t i = 0; i < count; i++) dst[i] = koi_BlendAlpha(src[i], dst[i]);
+                    break;
+                case Color::CUSTOM: for (int32_t i = 0; i < count; i++) dst[i] = funcPixelMode(x + i, y, src[i], dst[i]);     break;
+            }
+        }
+        
         void KoiEngine::DrawLine(const Vector2i& p1,     const Vector2i& p2,     Color c, uint32_t pattern) { DrawLine(p1.x, p1.y, p2.x, p2.y, c, pattern); }
         void KoiEngine::DrawLine(int32_t x1, int32_t y1, int32_t x2, int32_t y2, Color c, uint32_t pattern) {
+            if (!bScreenSpace) {
+                int32_t sx1 = koi_CameraX(x1), sy1 = koi_CameraY(y1), sx2 = koi_CameraX(x2), sy2 = koi_CameraY(y2);
+                if (koi_Cull(std::min(sx1, sx2), std::min(sy1, sy2), std::max(sx1, sx2) + 1, std::max(sy1, sy2) + 1)) return;
+                koi_ScreenSpace screen(bScreenSpace);
+                DrawLine(sx1, sy1, sx2, sy2, c, pattern);
+                return;
+            }
             int x, y, dx = x2 - x1, dy = y2 - y1, dx1, dy1, px, py, xe, ye, i;
             
             auto rol = [&](void) { pattern = (pattern << 1) | (pattern >> 31); return pattern & 1; };
@@ -347,6 +666,14 @@
         
         void KoiEngine::DrawCircle(const Vector2i& p,    int32_t radius, Color c, uint8_t mask) { DrawCircle(p.x, p.y, radius, c, mask); }
         void KoiEngine::DrawCircle(int32_t x, int32_t y, int32_t radius, Color c, uint8_t mask) {
+            if (!bScreenSpace) {
+                if (radius < 0) return;
+                int32_t sx = koi_CameraX(x), sy = koi_CameraY(y), r = koi_CameraSize(radius);
+                if (koi_Cull(sx - r, sy - r, sx + r + 1, sy + r + 1)) return;
+                koi_ScreenSpace screen(bScreenSpace);
+                DrawCircle(sx, sy, r, c, mask);
+                return;
+            }
             if (radius < 0 || x < -radius || y < -radius || x - GetDrawTargetWidth() > radius || y - GetDrawTargetHeight() > radius) return;
             if (radius == 0) { Draw(x, y, c); return; }
             int x0 = 0, y0 = radius;
@@ -371,6 +698,14 @@
         
         void KoiEngine::FillCircle(const Vector2i& p,    int32_t radius, Color c) { FillCircle(p.x, p.y, radius, c); }
         void KoiEngine::FillCircle(int32_t x, int32_t y, int32_t radius, Color c) {
+            if (!bScreenSpace) {
+                if (radius < 0) return;
+                int32_t sx = koi_CameraX(x), sy = koi_CameraY(y), r = koi_CameraSize(radius);
+                if (koi_Cull(sx - r, sy - r, sx + r + 1, sy + r + 1)) return;
+                koi_ScreenSpace screen(bScreenSpace);
+                FillCircle(sx, sy, r, c);
+                return;
+            }
             if (radius < 0 || x < -radius || y < -radius || x - GetDrawTargetWidth() > radius || y - GetDrawTargetHeight() > radius) return;
 
             if (radius == 0) { Draw(x, y, c); return; }
@@ -398,6 +733,14 @@
         
         void KoiEngine::DrawRect(const Vector2i& p,    const Vector2i& size, Color c) { DrawRect(p.x, p.y, size.x, size.y, c); }
         void KoiEngine::DrawRect(int32_t x, int32_t y, int32_t w, int32_t h, Color c) {
+            if (!bScreenSpace) {
+                int32_t x1 = koi_CameraX(x), x2 = koi_CameraX(x + double(w));
+                int32_t y1 = koi_CameraY(y), y2 = koi_CameraY(y + double(h));
+                if (koi_Cull(std::min(x1, x2), std::min(y1, y2), std::max(x1, x2) + 1, std::max(y1, y2) + 1)) return;
+                koi_ScreenSpace screen(bScreenSpace);
+                DrawRect(x1, y1, x2 - x1, y2 - y1, c);
+                return;
+            }
             DrawLine(x, y, x + w, y, c);
             DrawLine(x + w, y, x + w, y + h, c);
             DrawLine(x + w, y + h, x, y + h, c);
@@ -406,6 +749,15 @@
         
         void KoiEngine::FillRect(const Vector2i& p,    const Vector2i& size, Color c) { FillRect(p.x, p.y, size.x, size.y, c);}
         void KoiEngine::FillRect(int32_t x, int32_t y, int32_t w, int32_t h, Color c) {
+            if (!bScreenSpace) {
+                // Edges map separately, so rectangles that touch in the world still touch on screen
+                int32_t x1 = koi_CameraX(x), x2 = koi_CameraX(x + double(w));
+                int32_t y1 = koi_CameraY(y), y2 = koi_CameraY(y + double(h));
+                if (koi_Cull(x1, y1, x2, y2)) return;
+                koi_ScreenSpace screen(bScreenSpace);
+                FillRect(x1, y1, x2 - x1, y2 - y1, c);
+                return;
+            }
             int32_t x2 = x + w, y2 = y + h;
 
             if (x < 0) x = 0;
@@ -423,6 +775,13 @@
 
         void KoiEngine::DrawTriangle(const Vector2i& p1,     const Vector2i& p2,     const Vector2i& p3,     Color c) { DrawTriangle(p1.x, p1.y, p2.x, p2.y, p3.x, p3.y, c); }
         void KoiEngine::DrawTriangle(int32_t x1, int32_t y1, int32_t x2, int32_t y2, int32_t x3, int32_t y3, Color c) {
+            if (!bScreenSpace) {
+                int32_t sx1 = koi_CameraX(x1), sy1 = koi_CameraY(y1), sx2 = koi_CameraX(x2), sy2 = koi_CameraY(y2), sx3 = koi_CameraX(x3), sy3 = koi_CameraY(y3);
+                if (koi_Cull(std::min({ sx1, sx2, sx3 }), std::min({ sy1, sy2, sy3 }), std::max({ sx1, sx2, sx3 }) + 1, std::max({ sy1, sy2, sy3 }) + 1)) return;
+                koi_ScreenSpace screen(bScreenSpace);
+                DrawTriangle(sx1, sy1, sx2, sy2, sx3, sy3, c);
+                return;
+            }
             DrawLine(x1, y1, x2, y2, c);
             DrawLine(x2, y2, x3, y3, c);
             DrawLine(x3, y3, x1, y1, c);
@@ -430,6 +789,13 @@
         
         void KoiEngine::FillTriangle(const Vector2i& p1,     const Vector2i& p2,     const Vector2i& p3,     Color c) { FillTriangle(p1.x, p1.y, p2.x, p2.y, p3.x, p3.y, c); }
         void KoiEngine::FillTriangle(int32_t x1, int32_t y1, int32_t x2, int32_t y2, int32_t x3, int32_t y3, Color c) {
+            if (!bScreenSpace) {
+                int32_t sx1 = koi_CameraX(x1), sy1 = koi_CameraY(y1), sx2 = koi_CameraX(x2), sy2 = koi_CameraY(y2), sx3 = koi_CameraX(x3), sy3 = koi_CameraY(y3);
+                if (koi_Cull(std::min({ sx1, sx2, sx3 }), std::min({ sy1, sy2, sy3 }), std::max({ sx1, sx2, sx3 }) + 1, std::max({ sy1, sy2, sy3 }) + 1)) return;
+                koi_ScreenSpace screen(bScreenSpace);
+                FillTriangle(sx1, sy1, sx2, sy2, sx3, sy3, c);
+                return;
+            }
             auto drawline = [&](int sx, int ex, int ny) { for (int i = sx; i <= ex; i++) Draw(i, ny, c); };
 
             int t1x, t2x, y, minx, maxx, t1xp, t2xp;
@@ -563,64 +929,459 @@
             }
         }
         
-        void KoiEngine::DrawSprite(const Vector2i& p,    Sprite* sprite, uint32_t scale, uint8_t flip) { DrawSprite(p.x, p.y, sprite, scale, flip); }
-        void KoiEngine::DrawSprite(int32_t x, int32_t y, Sprite* sprite, uint32_t scale, uint8_t flip) {
+        void KoiEngine::DrawSprite(const Vector2i& p,    Sprite* sprite,           uint32_t scale, uint8_t flip) { DrawSprite(p.x, p.y, sprite, scale, flip); }
+        void KoiEngine::DrawSprite(const Vector2i& p,    const SpriteView& sprite, uint32_t scale, uint8_t flip) { DrawSprite(p.x, p.y, sprite, scale, flip); }
+        void KoiEngine::DrawSprite(int32_t x, int32_t y, Sprite* sprite,           uint32_t scale, uint8_t flip) {
             if (sprite == nullptr) return;
+            DrawSprite(x, y, sprite->GetView(), scale, flip);
+        }
+        
+        void KoiEngine::DrawSprite(int32_t x, int32_t y, const SpriteView& sprite, uint32_t scale, uint8_t flip) {
+            if (sprite.Empty() || viewTarget.Empty() || scale == 0) return;
+            if (!bScreenSpace) {
+                int32_t sw = sprite.width * int32_t(scale), sh = sprite.height * int32_t(scale);
+                int32_t x1 = koi_CameraX(x), x2 = koi_CameraX(x + double(sw));
+                int32_t y1 = koi_CameraY(y), y2 = koi_CameraY(y + double(sh));
+                if (koi_Cull(x1, y1, x2, y2)) return;
+                
+                // Whole multiples keep the integer blit, anything else is resampled edge to edge
+                // so that neighbouring sprites and tiles meet without gaps or overlap
+                koi_ScreenSpace screen(bScreenSpace);
+                int32_t k = (x2 - x1) / sw;
+                if (k >= 1 && x2 - x1 == k * sw && y2 - y1 == k * sh) DrawSprite(x1, y1, sprite, scale * uint32_t(k), flip);
+                else koi_DrawResampled(x1, y1, sprite, x2 - x1, y2 - y1, flip);
+                return;
+            }
+            
+            // Clip the scaled destination rectangle against the draw target once, up front
+            int32_t s  = int32_t(scale);
+            int32_t x1 = std::max(x, 0), x2 = std::min(x + sprite.width  * s, viewTarget.width);
+            int32_t y1 = std::max(y, 0), y2 = std::min(y + sprite.height * s, viewTarget.height);
+            if (x1 >= x2 || y1 >= y2) return;
+            
+            int32_t count = x2 - x1;
+            bool bDirect  = (scale == 1 && !(flip & Sprite::Flip::HORZ));
+            
+            koi_ForRowBands(y1, y2, count, [&](int32_t b1, int32_t b2, Color* pRow) {
+                int32_t lastRow = -1;
+                for (int32_t dy = b1; dy < b2; dy++) {
+                    int32_t sy = (dy - y) / s;
+                    if (flip & Sprite::Flip::VERT) sy = sprite.height - 1 - sy;
+                    const Color* src = sprite.GetRow(sy);
+                    
+                    if (bDirect) src += x1 - x;
+                    else {
+                        // Expand the source row once, scaled rows reuse it for the next scale-1 lines
+                        if (sy != lastRow) {
+                            int32_t i = (x1 - x) / s, rem = (x1 - x) % s;
+                            int32_t step = 1;
+                            if (flip & Sprite::Flip::HORZ) { i = sprite.width - 1 - i; step = -1; }
+                            for (int32_t n = 0; n < count; n++) {
+                                pRow[n] = src[i];
+                                if (++rem == s) { rem = 0; i += step; }
+                            }
+                            lastRow = sy;
+                        }
+                        src = pRow;
+                    }
+                    koi_DrawSpan(viewTarget.GetRow(dy) + x1, src, count, x1, dy, sprite.bPremultiplied);
+                }
+            });
+        }
 
-            int32_t fxs = 0, fxm = 1, fx = 0;
-            int32_t fys = 0, fym = 1, fy = 0;
-            if (flip & Sprite::Flip::HORZ) { fxs = sprite->width - 1; fxm = -1; }
-            if (flip & Sprite::Flip::VERT) { fys = sprite->height - 1; fym = -1; }
-            
-            fx = fxs;
-            if (scale > 1) {
-                for (int32_t i = 0; i < sprite->width; i++, fx += fxm) {
-                    fy = fys;
-                    for (int32_t j = 0; j < sprite->height; j++, fy += fym)
-                        for (uint32_t is = 0; is < scale; is++)
-                            for (uint32_t js = 0; js < scale; js++)
-                                Draw(x + (i * scale) + is, y + (j * scale) + js, sprite->GetPixel(fx, fy));
+        void KoiEngine::DrawPartialSprite(const Vector2i& p,    Sprite* sprite,           const Vector2i& origin, const Vector2i& size, uint32_t scale, uint8_t flip) { DrawPartialSprite(p.x, p.y, sprite, origin.x, origin.y, size.x, size.y, scale, flip); }
+        void KoiEngine::DrawPartialSprite(const Vector2i& p,    const SpriteView& sprite, const Vector2i& origin, const Vector2i& size, uint32_t scale, uint8_t flip) { DrawPartialSprite(p.x, p.y, sprite, origin.x, origin.y, size.x, size.y, scale, flip); }
+        void KoiEngine::DrawPartialSprite(int32_t x, int32_t y, Sprite* sprite,           int32_t ox, int32_t oy, int32_t w, int32_t h, uint32_t scale, uint8_t flip) {
+            if (sprite == nullptr) return;
+            if (sprite->modeSample != Sprite::Mode::PERIODIC || sprite->width <= 0 || sprite->height <= 0) {
+                DrawPartialSprite(x, y, sprite->GetView(), ox, oy, w, h, scale, flip);
+                return;
+            }
+            
+            // Periodic sprites repeat like GetPixel does, one blit per piece between wrap points
+            SpriteView view = sprite->GetView();
+            int32_t s = int32_t(scale);
+            for (int32_t j = 0, ph = 0; j < h; j += ph) {
+                int32_t sy = ((oy + j) % view.height + view.height) % view.height;
+                ph = std::min(h - j, view.height - sy);
+                int32_t dy = y + ((flip & Sprite::Flip::VERT) ? h - j - ph : j) * s;
+                for (int32_t i = 0, pw = 0; i < w; i += pw) {
+                    int32_t sx = ((ox + i) % view.width + view.width) % view.width;
+                    pw = std::min(w - i, view.width - sx);
+                    int32_t dx = x + ((flip & Sprite::Flip::HORZ) ? w - i - pw : i) * s;
+                    DrawSprite(dx, dy, view.SubView(sx, sy, pw, ph), scale, flip);
                 }
-            } else {
-                for (int32_t i = 0; i < sprite->width; i++, fx += fxm) {
-                    fy = fys;
-                    for (int32_t j = 0; j < sprite->height; j++, fy += fym)
-                        Draw(x + i, y + j, sprite->GetPixel(fx, fy));
+            }
+        }
+        
+        void KoiEngine::DrawPartialSprite(int32_t x, int32_t y, const SpriteView& sprite, int32_t ox, int32_t oy, int32_t w, int32_t h, uint32_t scale, uint8_t flip) {
+            // Keep the destination anchored where the unclipped rectangle would have been
+            int32_t s = int32_t(scale);
+            if (ox < 0) { if (!(flip & Sprite::Flip::HORZ)) x -= ox * s; w += ox; ox = 0; }
+            if (oy < 0) { if (!(flip & Sprite::Flip::VERT)) y -= oy * s; h += oy; oy = 0; }
+            if (ox + w > sprite.width)  { if (flip & Sprite::Flip::HORZ) x += (ox + w - sprite.width)  * s; w = sprite.width  - ox; }
+            if (oy + h > sprite.height) { if (flip & Sprite::Flip::VERT) y += (oy + h - sprite.height) * s; h = sprite.height - oy; }
+            DrawSprite(x, y, sprite.SubView(ox, oy, w, h), scale, flip);
+        }
+        
+        void KoiEngine::DrawScaledSprite(const Vector2i& p,    Sprite* sprite,           float scale, uint8_t flip) { DrawScaledSprite(p.x, p.y, sprite, scale, flip); }
+        void KoiEngine::DrawScaledSprite(const Vector2i& p,    const SpriteView& sprite, float scale, uint8_t flip) { DrawScaledSprite(p.x, p.y, sprite, scale, flip); }
+        void KoiEngine::DrawScaledSprite(int32_t x, int32_t y, Sprite* sprite,           float scale, uint8_t flip) {
+            if (sprite == nullptr || !(scale > 0.0f)) return;
+            if (!bScreenSpace) {
+                int32_t x1 = koi_CameraX(x), y1 = koi_CameraY(y);
+                if (koi_Cull(x1, y1, x1 + koi_CameraSize(sprite->width * double(scale)), y1 + koi_CameraSize(sprite->height * double(scale)))) return;
+                koi_ScreenSpace screen(bScreenSpace);
+                DrawScaledSprite(x1, y1, sprite, bCamera ? scale * fCameraZoom : scale, flip);
+                return;
+            }
+            if (scale >= 1.0f) { DrawScaledSprite(x, y, sprite->GetView(), scale, flip); return; }
+            
+            // The smallest level that is still no smaller than the destination, so each
+            // sample stands for at most a 2x2 block of the level it reads from
+            int32_t w = int32_t(sprite->width * scale + 0.5f), h = int32_t(sprite->height * scale + 0.5f);
+            int32_t nLevel = 0, nLevels = sprite->MipLevels();
+            while (nLevel + 1 < nLevels && (sprite->width >> (nLevel + 1)) >= w && (sprite->height >> (nLevel + 1)) >= h) nLevel++;
+            koi_DrawResampled(x, y, sprite->GetMipLevel(nLevel), w, h, flip);
+        }
+        
+        void KoiEngine::DrawScaledSprite(int32_t x, int32_t y, const SpriteView& sprite, float scale, uint8_t flip) {
+            if (!(scale > 0.0f)) return;
+            if (!bScreenSpace) {
+                int32_t x1 = koi_CameraX(x), y1 = koi_CameraY(y);
+                if (koi_Cull(x1, y1, x1 + koi_CameraSize(sprite.width * double(scale)), y1 + koi_CameraSize(sprite.height * double(scale)))) return;
+                koi_ScreenSpace screen(bScreenSpace);
+                DrawScaledSprite(x1, y1, sprite, bCamera ? scale * fCameraZoom : scale, flip);
+                return;
+            }
+            if (scale >= 1.0f && scale == float(uint32_t(scale))) { DrawSprite(x, y, sprite, uint32_t(scale), flip); return; }
+            koi_DrawResampled(x, y, sprite, int32_t(sprite.width * scale + 0.5f), int32_t(sprite.height * scale + 0.5f), flip);
+        }
+        
+        void KoiEngine::koi_DrawResampled(int32_t x, int32_t y, const SpriteView& src, int32_t w, int32_t h, uint8_t flip) {
+            if (src.Empty() || viewTarget.Empty() || w <= 0 || h <= 0) return;
+            int32_t x1 = std::max(x, 0), x2 = std::min(x + w, viewTarget.width);
+            int32_t y1 = std::max(y, 0), y2 = std::min(y + h, viewTarget.height);
+            if (x1 >= x2 || y1 >= y2) return;
+            
+            // Nearest sample at each destination pixel centre, stepped in 16.16 fixed point
+            int32_t count = x2 - x1;
+            int64_t nStepX = (int64_t(src.width) << 16) / w;
+            int64_t nX0    = ((int64_t(x1 - x) * 2 + 1) * src.width << 16) / (int64_t(w) * 2);
+            
+            koi_ForRowBands(y1, y2, count, [&](int32_t b1, int32_t b2, Color* pRow) {
+                int32_t lastRow = -1;
+                for (int32_t dy = b1; dy < b2; dy++) {
+                    int32_t sy = int32_t((int64_t(dy - y) * 2 + 1) * src.height / (int64_t(h) * 2));
+                    if (flip & Sprite::Flip::VERT) sy = src.height - 1 - sy;
+                    if (sy != lastRow) {
+                        const Color* row = src.GetRow(sy);
+                        int64_t fx = nX0;
+                        for (int32_t n = 0; n < count; n++, fx += nStepX) {
+                            int32_t sx = std::min(int32_t(fx >> 16), src.width - 1);
+                            pRow[n] = row[(flip & Sprite::Flip::HORZ) ? src.width - 1 - sx : sx];
+                        }
+                        lastRow = sy;
+                    }
+                    koi_DrawSpan(viewTarget.GetRow(dy) + x1, pRow, count, x1, dy, src.bPremultiplied);
+                }
+            });
+        }
+        
+        void KoiEngine::DrawRLESprite(const Vector2i& p, const RLESprite& sprite) { DrawRLESprite(p.x, p.y, sprite); }
+        void KoiEngine::DrawRLESprite(int32_t x, int32_t y, const RLESprite& sprite) {
+            if (viewTarget.Empty()) return;
+            int32_t w = sprite.width, h = sprite.height;
+            if (!bScreenSpace) {
+                x = koi_CameraX(x); y = koi_CameraY(y);
+                w = koi_CameraSize(sprite.width); h = koi_CameraSize(sprite.height);
+                if (koi_Cull(x, y, x + w, y + h)) return;
+            }
+            if (w != sprite.width || h != sprite.height) { koi_DrawRLEScaled(x, y, w, h, sprite); return; }
+            int32_t y1 = std::max(y, 0), y2 = std::min(y + sprite.height, viewTarget.height);
+            
+            // Opaque runs come out of ALPHA blending unchanged at full blend, so they are copied too
+            bool bCopyOpaque = nColorMode == Color::NORMAL || nColorMode == Color::MASK || (nColorMode == Color::ALPHA && fBlendFactor >= 1.0f);
+            for (int32_t dy = y1; dy < y2; dy++) {
+                Color* dstRow = viewTarget.GetRow(dy);
+                for (int32_t r = sprite.vRowStart[dy - y]; r < sprite.vRowStart[dy - y + 1]; r++) {
+                    const RLESprite::Run& run = sprite.vRuns[r];
+                    int32_t x1 = std::max(x + run.x, 0), x2 = std::min(x + run.x + run.nLength, viewTarget.width);
+                    if (x1 >= x2) continue;
+                    const Color* src = sprite.vPixels.data() + run.nPixel + (x1 - x - run.x);
+                    
+                    if (run.type == RLESprite::OPAQUE && bCopyOpaque) memcpy((void*)(dstRow + x1), src, (x2 - x1) * sizeof(Color));
+                    else if (run.type == RLESprite::BLEND && nColorMode == Color::MASK) continue;
+                    else koi_DrawSpan(dstRow + x1, src, x2 - x1, x1, dy, sprite.bPremultiplied);
                 }
             }
         }
-
-        void KoiEngine::DrawPartialSprite(const Vector2i& p,    Sprite* sprite, const Vector2i& origin, const Vector2i& size, uint32_t scale, uint8_t flip) { DrawPartialSprite(p.x, p.y, sprite, origin.x, origin.y, size.x, size.y, scale, flip); }
-        void KoiEngine::DrawPartialSprite(int32_t x, int32_t y, Sprite* sprite, int32_t ox, int32_t oy, int32_t w, int32_t h, uint32_t scale, uint8_t flip) {
-            if (sprite == nullptr) return;
-
-            int32_t fxs = 0, fxm = 1, fx = 0;
-            int32_t fys = 0, fym = 1, fy = 0;
-            if (flip & Sprite::Flip::HORZ) { fxs = w - 1; fxm = -1; }
-            if (flip & Sprite::Flip::VERT) { fys = h - 1; fym = -1; }
-            
-            fx = fxs;
-            if (scale > 1) {
-                for (int32_t i = 0; i < w; i++, fx += fxm) {
-                    fy = fys;
-                    for (int32_t j = 0; j < h; j++, fy += fym)
-                        for (uint32_t is = 0; is < scale; is++)
-                            for (uint32_t js = 0; js < scale; js++)
-                                Draw(x + (i * scale) + is, y + (j * scale) + js, sprite->GetPixel(fx + ox, fy + oy));
+        
+        // Smallest d with (2d + 1) * nSrc / (2 * nDst) >= s, the numerator is never below -nSrc
+        int32_t KoiEngine::koi_FirstCentre(int32_t s, int32_t nSrc, int32_t nDst) {
+            int64_t n = int64_t(s) * nDst * 2 - nSrc, d = int64_t(nSrc) * 2;
+            return int32_t((n + d * 2 - 1) / d - 1);
+        }
+        
+        // Nearest sample at each pixel centre, as koi_DrawResampled, a run covers the pixels whose centres map into it
+        void KoiEngine::koi_DrawRLEScaled(int32_t x, int32_t y, int32_t w, int32_t h, const RLESprite& sprite) {
+            if (w <= 0 || h <= 0 || sprite.width <= 0 || sprite.height <= 0) return;
+            int32_t y1 = std::max(y, 0), y2 = std::min(y + h, viewTarget.height);
+            auto toScreen = [&](int32_t sx) { return x + koi_FirstCentre(sx, sprite.width, w); };
+            for (int32_t dy = y1; dy < y2; dy++) {
+                int32_t sy = int32_t((int64_t(dy - y) * 2 + 1) * sprite.height / (int64_t(h) * 2));
+                for (int32_t r = sprite.vRowStart[sy]; r < sprite.vRowStart[sy + 1]; r++) {
+                    const RLESprite::Run& run = sprite.vRuns[r];
+                    if (run.type == RLESprite::BLEND && nColorMode == Color::MASK) continue;
+                    int32_t x1 = std::max(toScreen(run.x), 0), x2 = std::min(toScreen(run.x + run.nLength), viewTarget.width);
+                    if (x1 >= x2) continue;
+                    int32_t count = x2 - x1;
+                    if (int32_t(vBlitRow.size()) < count) vBlitRow.resize(count);
+                    const Color* src = sprite.vPixels.data() + run.nPixel - run.x;
+                    for (int32_t n = 0; n < count; n++) vBlitRow[n] = src[(int64_t(x1 + n - x) * 2 + 1) * sprite.width / (int64_t(w) * 2)];
+                    koi_DrawSpan(viewTarget.GetRow(dy) + x1, vBlitRow.data(), count, x1, dy, sprite.bPremultiplied);
                 }
-            } else {
-                for (int32_t i = 0; i < w; i++, fx += fxm) {
-                    fy = fys;
-                    for (int32_t j = 0; j < h; j++, fy += fym)
-                        Draw(x + i, y + j, sprite->GetPixel(fx + ox, fy + oy));
+            }
+        }
+        
+        void KoiEngine::DrawParticles(const ParticleSystem& particles) {
+            if (viewTarget.Empty()) return;
+            Vector2f vOrigin = bCamera ? vCameraPos : Vector2f(0.0f, 0.0f);
+            float    fZoom   = bCamera ? fCameraZoom : 1.0f;
+            if (!bScreenSpace) stats.nDrawn++;
+            koi_ScreenSpace screen(bScreenSpace);
+            if (nColorMode == Color::CUSTOM) particles.ForEachPixel([&](int32_t x, int32_t y, Color c) { Draw(x, y, c); }, vOrigin, fZoom);
+            else particles.Render(viewTarget, nColorMode, fBlendFactor, true, vOrigin, fZoom);
+        }
+        
+        void KoiEngine::DrawTileMap(const Vector2i& p, TileMap& map) { DrawTileMap(p.x, p.y, map); }
+        void KoiEngine::DrawTileMap(int32_t x, int32_t y, TileMap& map) {
+            if (viewTarget.Empty() || map.ChunksX() == 0 || map.ChunksY() == 0) return;
+            int32_t cw = map.ChunkWidth(), ch = map.ChunkHeight();
+            
+            // Only chunks overlapping the target, found by taking the target back into map pixels
+            double fZoom = bCamera && !bScreenSpace ? fCameraZoom : 1.0;
+            double ax = bCamera && !bScreenSpace ? vCameraPos.x - double(x) : -double(x);
+            double ay = bCamera && !bScreenSpace ? vCameraPos.y - double(y) : -double(y);
+            auto first = [](double a, int32_t d, int32_t n) { return int32_t(std::min(std::max(std::floor(a / d), 0.0), double(n))); };
+            auto last  = [](double a, int32_t d, int32_t n) { return int32_t(std::min(std::max(std::ceil (a / d), 0.0), double(n))) - 1; };
+            int32_t cx1 = first(ax, cw, map.ChunksX()), cx2 = last(ax + viewTarget.width  / fZoom, cw, map.ChunksX());
+            int32_t cy1 = first(ay, ch, map.ChunksY()), cy2 = last(ay + viewTarget.height / fZoom, ch, map.ChunksY());
+            if (!bScreenSpace) stats.nCulled += uint32_t(map.ChunksX() * map.ChunksY() - std::max(cx2 - cx1 + 1, 0) * std::max(cy2 - cy1 + 1, 0));
+            
+            // Chunks hold transparent cells, copying them as NORMAL would punch holes in whatever is below
+            Color::Mode nOldMode = nColorMode;
+            float       fOldBlend = fBlendFactor;
+            if (nColorMode == Color::NORMAL) { nColorMode = Color::ALPHA; fBlendFactor = 1.0f; }
+            for (int32_t cy = cy1; cy <= cy2; cy++)
+                for (int32_t cx = cx1; cx <= cx2; cx++)
+                    if (const Sprite* spr = map.GetChunk(cx, cy)) DrawSprite(x + cx * cw, y + cy * ch, SpriteView(*spr));
+            nColorMode = nOldMode; fBlendFactor = fOldBlend;
+        }
+        
+        void KoiEngine::DrawTexturedRect(int32_t x, int32_t y, int32_t w, int32_t h, const SpriteView& sprite, const Sampler& sampler, float u0, float v0, float u1, float v1) {
+            if (viewTarget.Empty() || w <= 0 || h <= 0) return;
+            if (!bScreenSpace) {
+                int32_t x2 = koi_CameraX(x + double(w)), y2 = koi_CameraY(y + double(h));
+                x = koi_CameraX(x); y = koi_CameraY(y);
+                if (koi_Cull(x, y, x2, y2)) return;
+                w = x2 - x; h = y2 - y;
+            }
+            int32_t x1 = std::max(x, 0), x2 = std::min(x + w, viewTarget.width);
+            int32_t y1 = std::max(y, 0), y2 = std::min(y + h, viewTarget.height);
+            if (x1 >= x2 || y1 >= y2) return;
+            
+            // UVs run from the destination pixel centres, a scrolling background is just a u/v offset
+            int32_t count = x2 - x1;
+            float du = (u1 - u0) / w, dv = (v1 - v0) / h;
+            float u  = u0 + (x1 - x + 0.5f) * du;
+            koi_ForRowBands(y1, y2, count, [&](int32_t b1, int32_t b2, Color* pRow) {
+                for (int32_t dy = b1; dy < b2; dy++) {
+                    sampler.SampleSpan(sprite, u, v0 + (dy - y + 0.5f) * dv, du, 0.0f, pRow, count);
+                    koi_DrawSpan(viewTarget.GetRow(dy) + x1, pRow, count, x1, dy, sprite.bPremultiplied);
+                }
+            });
+        }
+        
+        // Rows are independent in every blit, so large ones are split into bands of 32 rows.
+        // Each band gets its own scratch row. Custom pixel modes run user code per pixel and
+        // always stay on the calling thread.
+        void KoiEngine::koi_ForRowBands(int32_t y1, int32_t y2, int32_t nWidth, const std::function<void(int32_t, int32_t, Color*)>& func) {
+            if (nColorMode == Color::CUSTOM || int64_t(nWidth) * (y2 - y1) < nParallelPixels || GetJobs().Workers() == 0) {
+                if (int32_t(vBlitRow.size()) < nWidth) vBlitRow.resize(nWidth);
+                func(y1, y2, vBlitRow.data());
+                return;
+            }
+            // One row per band, handed out here so the workers never touch the heap
+            Color* pRows = frameArena.AllocateArray<Color>(size_t((y2 - y1 + 31) / 32) * nWidth);
+            GetJobs().ParallelRows(y1, y2, 32, [&](int32_t b1, int32_t b2) {
+                func(b1, b2, pRows + size_t((b1 - y1) / 32) * nWidth);
+            });
+        }
+        
+        JobSystem& KoiEngine::GetJobs() const { return JobSystem::Get(); }
+        
+        FrameArena& KoiEngine::GetFrameArena() { return frameArena; }
+        
+        void* KoiEngine::FrameAlloc(size_t nBytes, size_t nAlign) { return frameArena.Allocate(nBytes, nAlign); }
+        
+        #if defined(KOI_HAS_PMR)
+            std::pmr::memory_resource* KoiEngine::GetFrameResource() {
+                if (!pFrameResource) pFrameResource = std::make_shared<FrameResource>(frameArena);
+                return static_cast<FrameResource*>(pFrameResource.get());
+            }
+        #endif
+        
+        void KoiEngine::ParallelRows(const std::function<void(const SpriteView& band, int32_t y)>& func, int32_t nRowsPerBand) {
+            if (viewTarget.Empty()) return;
+            SpriteView target = viewTarget;
+            GetJobs().ParallelRows(0, target.height, nRowsPerBand, [&](int32_t y0, int32_t y1) {
+                func(target.SubView(0, y0, target.width, y1 - y0), y0);
+            });
+        }
+        
+        void            KoiEngine::EnableIndexedScreen(bool b) {
+            if (b && pIndexedScreen == nullptr) { pIndexedScreen.reset(new IndexedSprite(vScreenSize.x, vScreenSize.y)); SetResolutionScale(1.0f); }
+            if (!b) pIndexedScreen.reset();
+        }
+        IndexedSprite*  KoiEngine::GetIndexedScreen()   const { return pIndexedScreen.get(); }
+        Palette&        KoiEngine::GetPalette()               { return palScreen;      }
+        
+        bool KoiEngine::DrawIndex(int32_t x, int32_t y, uint8_t i) { return pIndexedScreen ? pIndexedScreen->SetIndex(x, y, i) : false; }
+        void KoiEngine::ClearIndex(uint8_t i)                      { if (pIndexedScreen) pIndexedScreen->Clear(i); }
+        
+        void KoiEngine::FillRectIndex(int32_t x, int32_t y, int32_t w, int32_t h, uint8_t i) {
+            if (pIndexedScreen == nullptr) return;
+            int32_t x1 = std::max(x, 0), x2 = std::min(x + w, pIndexedScreen->width);
+            int32_t y1 = std::max(y, 0), y2 = std::min(y + h, pIndexedScreen->height);
+            for (int32_t dy = y1; dy < y2 && x1 < x2; dy++) memset(pIndexedScreen->GetRow(dy) + x1, i, x2 - x1);
+        }
+        
+        void KoiEngine::DrawIndexedSprite(int32_t x, int32_t y, const IndexedSprite& sprite, int32_t nTransparent) {
+            IndexedSprite* pIndexed = (pDrawTarget && pDrawTarget == pScreen) ? pIndexedScreen.get() : nullptr;
+            int32_t nTargetW = pIndexed ? pIndexed->width  : viewTarget.width;
+            int32_t nTargetH = pIndexed ? pIndexed->height : viewTarget.height;
+            int32_t x1 = std::max(x, 0), x2 = std::min(x + sprite.width,  nTargetW);
+            int32_t y1 = std::max(y, 0), y2 = std::min(y + sprite.height, nTargetH);
+            if (x1 >= x2 || y1 >= y2) return;
+            int32_t count = x2 - x1;
+            
+            if (pIndexed) {
+                for (int32_t dy = y1; dy < y2; dy++) {
+                    const uint8_t* src = sprite.GetRow(dy - y) + (x1 - x);
+                    uint8_t* dst = pIndexed->GetRow(dy) + x1;
+                    if (nTransparent < 0) memcpy(dst, src, count);
+                    else for (int32_t i = 0; i < count; i++) if (src[i] != nTransparent) dst[i] = src[i];
+                }
+                return;
+            }
+            
+            // Any other target, expand through the palette and draw as colour. The
+            // transparent index becomes BLANK so MASK and ALPHA modes skip it
+            if (int32_t(vBlitRow.size()) < count) vBlitRow.resize(count);
+            Palette pal = palScreen;
+            if (nTransparent >= 0) pal[uint8_t(nTransparent)] = Color::BLANK;
+            for (int32_t dy = y1; dy < y2; dy++) {
+                ExpandIndexedRow(sprite.GetRow(dy - y) + (x1 - x), vBlitRow.data(), count, pal.GetData());
+                koi_DrawSpan(viewTarget.GetRow(dy) + x1, vBlitRow.data(), count, x1, dy);
+            }
+        }
+        
+        void KoiEngine::koi_ConstructFontSheet() { if (pFont == nullptr) pFont.reset(new Font(Font::Default())); }
+        
+        Font*    KoiEngine::GetDefaultFont()                                             { koi_ConstructFontSheet(); return pFont.get();       }
+        Vector2i KoiEngine::GetTextSize   (const std::string& sText, const Font* font)   { return (font ? font : GetDefaultFont())->Measure(sText); }
+        void     KoiEngine::DrawString    (const Vector2i& p, const std::string& sText, Color col, uint32_t scale, const Font* font) { DrawString(p.x, p.y, sText, col, scale, font); }
+        
+        void KoiEngine::DrawString(int32_t x, int32_t y, const std::string& sText, Color col, uint32_t scale, const Font* font) {
+            if (sText.empty() || viewTarget.Empty() || scale == 0) return;
+            const Font& f = font ? *font : *GetDefaultFont();
+            
+            // Culled on the measured size, which is what Render produces, so text off screen never reaches the cache.
+            // Glyph pixels map onto a w x h screen rectangle, scale times the text and zoomed by the camera
+            Vector2i size = f.Measure(sText);
+            int32_t w = int32_t(std::min<int64_t>(int64_t(size.x) * scale, 536870912));
+            int32_t h = int32_t(std::min<int64_t>(int64_t(size.y) * scale, 536870912));
+            if (!bScreenSpace) {
+                x = koi_CameraX(x); y = koi_CameraY(y);
+                w = koi_CameraSize(double(size.x) * scale); h = koi_CameraSize(double(size.y) * scale);
+                if (koi_Cull(x, y, x + w, y + h)) return;
+            }
+            if (w <= 0 || h <= 0) return;
+            const RLESprite& text = koi_GetCachedText(f, sText);
+            if (text.width != size.x || text.height != size.y) return;
+            auto toScreenX = [&](int32_t sx) { return x + koi_FirstCentre(sx, text.width,  w); };
+            auto toScreenY = [&](int32_t sy) { return y + koi_FirstCentre(sy, text.height, h); };
+            bool bFill = (nColorMode == Color::NORMAL && !viewTarget.bPremultiplied) ||
+                        (col.a == 255 && (nColorMode == Color::NORMAL || nColorMode == Color::MASK || (nColorMode == Color::ALPHA && fBlendFactor >= 1.0f)));
+            for (int32_t ry = 0; ry < text.height; ry++) {
+                int32_t y1 = std::max(toScreenY(ry), 0), y2 = std::min(toScreenY(ry + 1), viewTarget.height);
+                if (y1 >= y2) continue;
+                for (int32_t r = text.vRowStart[ry]; r < text.vRowStart[ry + 1]; r++) {
+                    const RLESprite::Run& run = text.vRuns[r];
+                    int32_t x1 = std::max(toScreenX(run.x), 0), x2 = std::min(toScreenX(run.x + run.nLength), viewTarget.width);
+                    if (x1 >= x2) continue;
+                    int32_t count = x2 - x1;
+                    
+                    // Solid white glyph runs tinted by an opaque colour are plain fills
+                    if (f.bMonochrome && run.type == RLESprite::OPAQUE && bFill) {
+                        for (int32_t dy = y1; dy < y2; dy++) std::fill_n(viewTarget.GetRow(dy) + x1, count, col);
+                        continue;
+                    }
+                    
+                    if (int32_t(vBlitRow.size()) < count) vBlitRow.resize(count);
+                    const Color* src = text.vPixels.data() + run.nPixel - run.x;
+                    for (int32_t n = 0; n < count; n++) {
+                        Color p = src[(int64_t(x1 + n - x) * 2 + 1) * text.width / (int64_t(w) * 2)];
+                        vBlitRow[n] = Color(uint8_t(Div255(p.r * col.r)), uint8_t(Div255(p.g * col.g)), uint8_t(Div255(p.b * col.b)), uint8_t(Div255(p.a * col.a)));
+                    }
+                    for (int32_t dy = y1; dy < y2; dy++) koi_DrawSpan(viewTarget.GetRow(dy) + x1, vBlitRow.data(), count, x1, dy);
+                }
+            }
+        }
+        
+        // Keyed on the font instance and its glyph version, so edited fonts never hit stale text. A hit
+        // only hashes and compares, and moves the entry to the front. The least recently drawn entry is
+        // evicted once the cache is full, unless it was drawn this frame, so a frame with more distinct
+        // strings than nMaxCachedStrings keeps them instead of rebuilding everything.
+        const RLESprite& KoiEngine::koi_GetCachedText(const Font& f, const std::string& sText) {
+            size_t nHash = std::hash<std::string>()(sText);
+            for (uint64_t v : { uint64_t(uintptr_t(&f)), f.nId, f.nVersion }) nHash ^= size_t(v) + size_t(0x9E3779B9) + (nHash << 6) + (nHash >> 2);
+            uint64_t nFrame = frameArena.Frame();
+            
+            auto it = mapTextCache.find(nHash);
+            if (it != mapTextCache.end()) {
+                koi_CachedText& e = *it->second;
+                if (e.pFont == &f && e.nId == f.nId && e.nVersion == f.nVersion && e.sText == sText) {
+                    lstTextCache.splice(lstTextCache.begin(), lstTextCache, it->second);
+                    e.nFrame = nFrame;
+                    return e.text;
                 }
+                lstTextCache.erase(it->second);         // Stale version or a hash collision, replaced below
+                mapTextCache.erase(it);
             }
+            
+            while (!lstTextCache.empty() && (lstTextCache.size() >= nMaxCachedStrings * 4 ||
+                   (lstTextCache.size() >= nMaxCachedStrings && lstTextCache.back().nFrame != nFrame))) {
+                mapTextCache.erase(lstTextCache.back().nHash);
+                lstTextCache.pop_back();
+            }
+            Sprite spr;
+            f.Render(sText, spr);
+            lstTextCache.push_front({ &f, f.nId, f.nVersion, nFrame, nHash, sText, RLESprite(spr) });
+            mapTextCache[nHash] = lstTextCache.begin();
+            return lstTextCache.front().text;
         }
         
         void KoiEngine::Clear(Color p) {
-            int pixels = GetDrawTargetWidth() * GetDrawTargetHeight();
-            Color* m = GetDrawTarget()->GetData();
-            for (int i = 0; i < pixels; i++) m[i] = p;
+            auto clear = [&](int32_t y0, int32_t y1) {
+                for (int32_t y = y0; y < y1; y++) {
+                    if (p.n == 0) memset((void*)viewTarget.GetRow(y), 0, viewTarget.width * sizeof(Color));
+                    else          std::fill_n(viewTarget.GetRow(y), viewTarget.width, p);
+                }
+            };
+            if (int64_t(viewTarget.width) * viewTarget.height < nParallelPixels) clear(0, viewTarget.height);
+            else GetJobs().ParallelRows(0, viewTarget.height, 32, clear);
         }
         
         void        KoiEngine::ClearBuffer (Color p, bool bDepth)   { renderer->ClearBuffer(p, bDepth); }
@@ -663,9 +1424,9 @@
             vViewPos = (vWindowSize - vViewSize) / 2;
         }
         
-        void KoiEngine::koi_UpdateWindowSize(int32_t x, int32_t y) { vWindowSize = { x, y }; koi_UpdateViewport(); }
+        void KoiEngine::koi_UpdateWindowSize(int32_t x, int32_t y) { vWindowSize = { x, y }; koi_UpdateViewport(); koi_WakeForInput(); }
         
-        void KoiEngine::koi_UpdateMouseWheel(int32_t delta) { nMouseWheelDeltaCache += delta; }
+        void KoiEngine::koi_UpdateMouseWheel(int32_t delta) { nMouseWheelDeltaCache += delta; koi_WakeForInput(); }
         
         void KoiEngine::koi_UpdateMouse(int32_t x, int32_t y) {
             // Mouse coords come in screen space
@@ -681,23 +1442,51 @@
             if (vMousePosCache.y >= (int32_t)vScreenSize.y) vMousePosCache.y = vScreenSize.y - 1;
             if (vMousePosCache.x < 0) vMousePosCache.x = 0;
             if (vMousePosCache.y < 0) vMousePosCache.y = 0;
+            koi_WakeForInput();
         }
         
-        void KoiEngine::koi_UpdateMouseState    (int32_t button, bool state)    { pMouseNewState[button] = state; }
-        void KoiEngine::koi_UpdateKeyState      (int32_t key, bool state)       { pKeyNewState[key] = state;      }
-        void KoiEngine::koi_UpdateMouseFocus    (bool state)                    { bHasMouseFocus = state;         }
-        void KoiEngine::koi_UpdateKeyFocus      (bool state)                    { bHasInputFocus = state;         }
-        void KoiEngine::koi_Terminate           ()                              { bAtomActive = false;            }
+        void KoiEngine::koi_UpdateMouseState    (int32_t button, bool state)    { pMouseNewState[button] = state; koi_WakeForInput(); }
+        void KoiEngine::koi_UpdateKeyState      (int32_t key, bool state)       { pKeyNewState[key] = state;      koi_WakeForInput(); }
+        void KoiEngine::koi_UpdateMouseFocus    (bool state)                    { bHasMouseFocus = state;         koi_WakeForInput(); }
+        void KoiEngine::koi_UpdateKeyFocus      (bool state)                    { bHasInputFocus = state;         koi_WakeForInput(); }
+        void KoiEngine::koi_Terminate           ()                              { bAtomActive = false; if (platform) platform->Wake(); }
+        
+        void KoiEngine::koi_WakeForInput() {
+            // Events pumped on the engine thread already woke it, only other threads need to
+            if (bOnDemand && std::this_thread::get_id() != idEngineThread) RequestRedraw();
+        }
+        
+        void KoiEngine::koi_WaitForWork() {
+            // A request and its wake both stand for the next frame, whichever is seen first clears
+            // the other so one request never draws twice
+            if (bRedraw.exchange(false)) platform->WaitForEvents(0.0f);
+            else {
+                while (bAtomActive) {
+                    float fTimeout = -1.0f;
+                    if (bRedrawScheduled) {
+                        fTimeout = std::chrono::duration<float>(tRedraw - std::chrono::steady_clock::now()).count();
+                        if (fTimeout <= 0.0f) break;
+                    }
+                    if (platform->WaitForEvents(fTimeout) == OK) break;    // Input, a resize or a wake
+                }
+                bRedraw = false;
+            }
+            if (bRedrawScheduled && std::chrono::steady_clock::now() >= tRedraw) bRedrawScheduled = false;
+        }
         
         void KoiEngine::EngineThread() {
             if (platform->ThreadStartUp() == FAIL) return;  // Allow platform to do stuff here if needed, since its now in the context of this thread
+            idEngineThread = std::this_thread::get_id();
             
             koi_PrepareEngine();                            // Do engine context specific initialisation
             
             if (!OnUserCreate()) bAtomActive = false;       // Create user resources as part of this thread
             
             while (bAtomActive) {
-                while (bAtomActive) { koi_CoreUpdate(); }   // Run as fast as possible
+                while (bAtomActive) {                       // Run as fast as possible, or as needed when on demand
+                    if (bOnDemand) koi_WaitForWork();
+                    if (bAtomActive) koi_CoreUpdate();
+                }
                 
                 if (!OnUserDestroy()) {                     // Allow the user to free resources if they have overrided the destroy function
                     bAtomActive = true;                     // User denied destroy for some reason, so continue running
@@ -711,16 +1500,22 @@
             // Start OpenGL, the context is owned by the game thread
             if (platform->CreateGraphics(bFullScreen, bEnableVSYNC, vViewPos, vViewSize) == FAIL) return;
             
+            koi_ConstructFontSheet();
+            
             // Create Primary window "0"
-            pDrawTarget = new Sprite(vScreenSize.x, vScreenSize.y);
+            delete pScreen;
+            pScreen = new Sprite(vScreenSize.x, vScreenSize.y);
+            SetDrawTarget(nullptr);
             nResID = renderer->CreateTexture(vScreenSize.x, vScreenSize.y);
-            renderer->UpdateTexture(nResID, pDrawTarget);
+            renderer->UpdateTexture(nResID, pScreen);
             
             m_tp1 = std::chrono::system_clock::now();
             m_tp2 = std::chrono::system_clock::now();
         }
         
         void KoiEngine::koi_CoreUpdate() {
+            frameArena.NextFrame();
+            
             // Handle Timing
             m_tp2 = std::chrono::system_clock::now();
             std::chrono::duration<float> elapsedTime = m_tp2 - m_tp1;
@@ -755,11 +1550,13 @@
             ScanHardware(pMouseState, pMouseOldState, pMouseNewState, nMouseButtons);
             
             // Cache mouse coordinates so they remain consistent during frame
-            vMousePos = vMousePosCache;
+            vMousePos = { vMousePosCache.x * vRenderSize.x / vScreenSize.x, vMousePosCache.y * vRenderSize.y / vScreenSize.y };
             nMouseWheelDelta = nMouseWheelDeltaCache;
             nMouseWheelDeltaCache = 0;
             
             
+            stats = DrawStats();
+            auto tWork = std::chrono::steady_clock::now();
             if (!OnUserUpdate(fElapsedTime)) bAtomActive = false; // Handle Frame Update
             
             // Display Frame
@@ -769,12 +1566,16 @@
             renderer->PrepareDrawing();
             
             if (funcHook == nullptr) {
+                // Only the rendered part is uploaded, the quad's texture scale stretches it over the view
+                if (pIndexedScreen) pIndexedScreen->Expand(*pScreen, palScreen);
                 renderer->ApplyTexture(nResID);
-                renderer->UpdateTexture(nResID, pDrawTarget);
-                renderer->DrawWindowQuad(vOffset, vScale, tint);
+                renderer->UpdateSubTexture(nResID, pScreen->GetSubView(0, 0, vRenderSize.x, vRenderSize.y));
+                renderer->DrawWindowQuad(vOffset, vScale * Vector2f(float(vRenderSize.x) / vScreenSize.x, float(vRenderSize.y) / vScreenSize.y), tint);
                 
             } else funcHook();
             
+            // The swap can wait on vsync, so the budget covers everything up to it
+            koi_UpdateResolution(std::chrono::duration<float>(std::chrono::steady_clock::now() - tWork).count());
             
             renderer->DisplayFrame(); // Present Graphics to screen
             
@@ -784,7 +1585,9 @@
             if (fFrameTimer >= 1.0f) {
                 nLastFPS = nFrameCount;
                 fFrameTimer -= 1.0f;
-                std::string sTitle = sAppName + " - FPS: " + std::to_string(nFrameCount);
+                size_t nTitle = sAppName.size() + 32;
+                char*  sTitle = (char*)frameArena.Allocate(nTitle, 1);
+                snprintf(sTitle, nTitle, "%s - FPS: %d", sAppName.c_str(), nFrameCount);
                 platform->SetWindowTitle(sTitle);
                 nFrameCount = 0;
             }
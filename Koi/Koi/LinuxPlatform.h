@@ -16,6 +16,10 @@
     // | START PLATFORM: LINUX                                                        |
     // +------------------------------------------------------------------------------+
     #if defined(__linux__) || defined(__FreeBSD__)
+        #include <poll.h>
+        #include <fcntl.h>
+        #include <unistd.h>
+        
         namespace koi {
             class Platform_Linux : public koi::Platform {
             private:
@@ -25,8 +29,13 @@
                 X11::XVisualInfo* koi_VisualInfo;
                 X11::Colormap                koi_ColourMap;
                 X11::XSetWindowAttributes    koi_SetWindowAttribs;
+                int                          koi_WakePipe[2] = { -1, -1 };  // Written by Wake, polled next to the X connection
                 
             public:
+                virtual ~Platform_Linux() {
+                    if (koi_WakePipe[0] >= 0) { close(koi_WakePipe[0]); close(koi_WakePipe[1]); }
+                }
+                
                 virtual koi::rcode ApplicationStartUp() override { return koi::rcode::OK; }
                 
                 virtual koi::rcode ApplicationCleanUp() override { return koi::rcode::OK; }
@@ -51,6 +60,10 @@
                     using namespace X11;
                     XInitThreads();
                     
+                    if (pipe(koi_WakePipe) == 0) {
+                        for (int fd : koi_WakePipe) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                    } else koi_WakePipe[0] = koi_WakePipe[1] = -1;
+                    
                     // Grab the deafult display and window
                     koi_Display = XOpenDisplay(NULL);
                     koi_WindowRoot = DefaultRootWindow(koi_Display);
@@ -133,13 +146,33 @@
                     return koi::OK;
                 }
                 
-                virtual koi::rcode SetWindowTitle(const std::string& s) override {
-                    X11::XStoreName(koi_Display, koi_Window, s.c_str());
+                virtual koi::rcode SetWindowTitle(const char* s) override {
+                    X11::XStoreName(koi_Display, koi_Window, s);
                     return koi::OK;
                 }
                 
                 virtual koi::rcode StartSystemEventLoop() override { return koi::OK; }
                 
+                virtual koi::rcode WaitForEvents(float fTimeout) override {
+                    using namespace X11;
+                    // Xlib may already hold events it read off the socket, poll would not see those
+                    if (XPending(koi_Display)) return koi::OK;
+                    
+                    pollfd fds[2] = { { ConnectionNumber(koi_Display), POLLIN, 0 }, { koi_WakePipe[0], POLLIN, 0 } };
+                    int nTimeout = fTimeout < 0.0f ? -1 : int(std::ceil(fTimeout * 1000.0f));
+                    if (poll(fds, koi_WakePipe[0] >= 0 ? 2 : 1, nTimeout) <= 0) return koi::FAIL;
+                    
+                    if (fds[1].revents & POLLIN) {
+                        char buf[64];
+                        while (read(koi_WakePipe[0], buf, sizeof(buf)) > 0) {}
+                    }
+                    return koi::OK;
+                }
+                
+                virtual void Wake() override {
+                    if (koi_WakePipe[1] >= 0) { char c = 1; (void)!write(koi_WakePipe[1], &c, 1); }   // A full pipe is already a pending wake
+                }
+                
                 virtual koi::rcode HandleSystemEvent() override {
                     using namespace X11;
                     // Handle Xlib Message Loop - we do this in the
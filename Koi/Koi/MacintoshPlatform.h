@@ -19,7 +19,9 @@
         namespace koi {
             class Platform_GLUT : public koi::Platform {
             public:
-                static std::atomic<bool>* bActiveRef;
+                // GLUT callbacks are plain functions and GLUT runs one main loop per process,
+                // so the windowed engine registers its platform here. Headless engines don't.
+                static Platform_GLUT* pActive;
                 virtual koi::rcode ApplicationStartUp()     override { return koi::rcode::OK; }
                 virtual koi::rcode ApplicationCleanUp()     override { return koi::rcode::OK; }
                 virtual koi::rcode ThreadStartUp()          override { return koi::rcode::OK; }
@@ -33,14 +35,14 @@
                 }
                 
                 static void ExitMainLoop() {
-                    if (!ptrPGE->OnUserDestroy()) { *bActiveRef = true; return; }
-                    platform->ThreadCleanUp();
-                    platform->ApplicationCleanUp();
+                    if (!pActive->ptrPGE->OnUserDestroy()) { pActive->ptrPGE->bAtomActive = true; return; }
+                    pActive->ThreadCleanUp();
+                    pActive->ApplicationCleanUp();
                     exit(0);
                 }
                 
-                static void ThreadFunct() { if (!*bActiveRef) ExitMainLoop(); else glutPostRedisplay(); }
-                static void DrawFunct()   { ptrPGE->koi_CoreUpdate(); }
+                static void ThreadFunct() { if (!pActive->ptrPGE->bAtomActive) ExitMainLoop(); else glutPostRedisplay(); }
+                static void DrawFunct()   { pActive->ptrPGE->koi_CoreUpdate(); }
                 
                 virtual koi::rcode CreateWindowPane(const koi::Vector2i& vWindowPos, koi::Vector2i& vWindowSize, bool bFullScreen) override {
                     renderer->PrepareDevice();
@@ -102,53 +104,53 @@
                     glutKeyboardFunc([](unsigned char key, int x, int y) -> void {
                         switch (glutGetModifiers()) {
                             case 0:                 if ('a' <= key && key <= 'z') key -= 32;                                                break;
-                            case GLUT_ACTIVE_SHIFT:                                          ptrPGE->koi_UpdateKeyState(Key::SHIFT, true);  break;
-                            case GLUT_ACTIVE_CTRL:  if ('a' <= key && key <= 'z') key -= 32; ptrPGE->koi_UpdateKeyState(Key::CTRL,  true);  break;
+                            case GLUT_ACTIVE_SHIFT:                                          pActive->ptrPGE->koi_UpdateKeyState(Key::SHIFT, true);  break;
+                            case GLUT_ACTIVE_CTRL:  if ('a' <= key && key <= 'z') key -= 32; pActive->ptrPGE->koi_UpdateKeyState(Key::CTRL,  true);  break;
                             case GLUT_ACTIVE_ALT:   if ('a' <= key && key <= 'z') key -= 32;                                                break;
                         }
                         
-                        if (mapKeys[key]) ptrPGE->koi_UpdateKeyState(mapKeys[key], true);
+                        if (pActive->mapKeys[key]) pActive->ptrPGE->koi_UpdateKeyState(pActive->mapKeys[key], true);
                     });
                     
                     glutKeyboardUpFunc([](unsigned char key, int x, int y) -> void {
                         switch (glutGetModifiers()) {
                             case 0:                 if ('a' <= key && key <= 'z') key -= 32;                                                break;
-                            case GLUT_ACTIVE_SHIFT:                                          ptrPGE->koi_UpdateKeyState(Key::SHIFT, false); break;
-                            case GLUT_ACTIVE_CTRL:  if ('a' <= key && key <= 'z') key -= 32; ptrPGE->koi_UpdateKeyState(Key::CTRL,  false); break;
+                            case GLUT_ACTIVE_SHIFT:                                          pActive->ptrPGE->koi_UpdateKeyState(Key::SHIFT, false); break;
+                            case GLUT_ACTIVE_CTRL:  if ('a' <= key && key <= 'z') key -= 32; pActive->ptrPGE->koi_UpdateKeyState(Key::CTRL,  false); break;
                             case GLUT_ACTIVE_ALT:   if ('a' <= key && key <= 'z') key -= 32;                                                break;
                         }
                         
-                        if (mapKeys[key]) ptrPGE->koi_UpdateKeyState(mapKeys[key], false);
+                        if (pActive->mapKeys[key]) pActive->ptrPGE->koi_UpdateKeyState(pActive->mapKeys[key], false);
                     });
                     
-                    glutSpecialFunc   ([](int key, int x, int y) -> void { if (mapKeys[key]) ptrPGE->koi_UpdateKeyState(mapKeys[key], true); });
-                    glutSpecialUpFunc ([](int key, int x, int y) -> void { if (mapKeys[key]) ptrPGE->koi_UpdateKeyState(mapKeys[key], false); });
+                    glutSpecialFunc   ([](int key, int x, int y) -> void { if (pActive->mapKeys[key]) pActive->ptrPGE->koi_UpdateKeyState(pActive->mapKeys[key], true); });
+                    glutSpecialUpFunc ([](int key, int x, int y) -> void { if (pActive->mapKeys[key]) pActive->ptrPGE->koi_UpdateKeyState(pActive->mapKeys[key], false); });
                     
                     glutMouseFunc([](int button, int state, int x, int y) -> void {
                         switch (button) {
                             case GLUT_LEFT_BUTTON:
-                                if      (state == GLUT_UP  ) ptrPGE->koi_UpdateMouseState(0, false);
-                                else if (state == GLUT_DOWN) ptrPGE->koi_UpdateMouseState(0, true );
+                                if      (state == GLUT_UP  ) pActive->ptrPGE->koi_UpdateMouseState(0, false);
+                                else if (state == GLUT_DOWN) pActive->ptrPGE->koi_UpdateMouseState(0, true );
                                 break;
                             case GLUT_MIDDLE_BUTTON:
-                                if      (state == GLUT_UP  ) ptrPGE->koi_UpdateMouseState(2, false);
-                                else if (state == GLUT_DOWN) ptrPGE->koi_UpdateMouseState(2, true );
+                                if      (state == GLUT_UP  ) pActive->ptrPGE->koi_UpdateMouseState(2, false);
+                                else if (state == GLUT_DOWN) pActive->ptrPGE->koi_UpdateMouseState(2, true );
                                 break;
                             case GLUT_RIGHT_BUTTON:
-                                if      (state == GLUT_UP  ) ptrPGE->koi_UpdateMouseState(1, false);
-                                else if (state == GLUT_DOWN) ptrPGE->koi_UpdateMouseState(1, true );
+                                if      (state == GLUT_UP  ) pActive->ptrPGE->koi_UpdateMouseState(1, false);
+                                else if (state == GLUT_DOWN) pActive->ptrPGE->koi_UpdateMouseState(1, true );
                                 break;
                         }
                     });
                     
-                    auto mouseMoveCall = [](int x, int y) -> void { ptrPGE->koi_UpdateMouse(x, y); };
+                    auto mouseMoveCall = [](int x, int y) -> void { pActive->ptrPGE->koi_UpdateMouse(x, y); };
                     
                     glutMotionFunc(mouseMoveCall);
                     glutPassiveMotionFunc(mouseMoveCall);
                     
                     glutEntryFunc([](int state) -> void {
-                        if      (state == GLUT_ENTERED) ptrPGE->koi_UpdateKeyFocus(true );
-                        else if (state == GLUT_LEFT   ) ptrPGE->koi_UpdateKeyFocus(false);
+                        if      (state == GLUT_ENTERED) pActive->ptrPGE->koi_UpdateKeyFocus(true );
+                        else if (state == GLUT_LEFT   ) pActive->ptrPGE->koi_UpdateKeyFocus(false);
                     });
                     
                     glutDisplayFunc(DrawFunct);
@@ -157,17 +159,19 @@
                     return koi::OK;
                 }
                 
-                virtual koi::rcode SetWindowTitle(const std::string& s) override { glutSetWindowTitle(s.c_str()); return koi::OK; }
+                virtual koi::rcode SetWindowTitle(const char* s) override { glutSetWindowTitle(s); return koi::OK; }
                 
                 virtual koi::rcode StartSystemEventLoop() override { glutMainLoop(); return koi::OK; }
                 
                 virtual koi::rcode HandleSystemEvent() override { return koi::OK; }
             };
             
-            std::atomic<bool>* Platform_GLUT::bActiveRef{ nullptr };
+            Platform_GLUT* Platform_GLUT::pActive = nullptr;
             
             //Custom Start
             koi::rcode KoiEngine::Start() {
+                if (bHeadless) return koi_StartThreaded(); // Nothing for GLUT to drive
+                
                 if (platform->ApplicationStartUp() != koi::OK) return koi::FAIL;
                 
                 // Construct the window
@@ -181,7 +185,7 @@
                 
                 if (!OnUserCreate()) return koi::FAIL;
                 
-                Platform_GLUT::bActiveRef = &bAtomActive;
+                Platform_GLUT::pActive = static_cast<Platform_GLUT*>(platform.get());
                 
                 glutWMCloseFunc(Platform_GLUT::ExitMainLoop);
                 
@@ -0,0 +1,127 @@
+//
+//  Mat4.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef Mat4_h
+#define Mat4_h
+
+    #include <math.h>
+    #include "Vector3.h"
+    #include "Quaternion.h"
+
+    namespace koi {
+        // MARK: koi::Mat4
+        // +------------------------------------------------------------------------------+
+        // | koi::Mat4 - 4x4 float matrix for 3D transforms                               |
+        // +------------------------------------------------------------------------------+
+        // Row major m[row][col], points are columns so a * b applies b first. Projection
+        // follows the OpenGL conventions: right handed view space looking down -z, clip
+        // space z from -w (near) to w (far).
+        struct Mat4 {
+            float m[4][4] = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { 0, 0, 0, 1 } };
+
+            Mat4 operator * (const Mat4& rhs) const;
+
+            Vector3f TransformPoint (const Vector3f& p) const;          // w of 1, no divide
+            Vector3f TransformVector(const Vector3f& v) const;          // w of 0, translation ignored
+            Mat4     Transposed     ()                  const;
+            Mat4     RigidInverse   ()                  const;          // Rotation and translation only
+
+            static Mat4 Identity   ();
+            static Mat4 Translation(const Vector3f& t);
+            static Mat4 Scale      (const Vector3f& s);
+            static Mat4 Rotation   (const Quaternionf& q);              // q must be unit length
+            static Mat4 FromQuaternion(const Quaternionf& q, const Vector3f& t);  // Rotate by q, then move by t
+            static Mat4 Perspective(float fFovY, float fAspect, float fNear, float fFar);  // fFovY in radians
+            static Mat4 LookAt     (const Vector3f& eye, const Vector3f& target, const Vector3f& up);
+        };
+
+        Mat4 Mat4::operator * (const Mat4& rhs) const {
+            Mat4 r;
+            for (int32_t i = 0; i < 4; i++)
+                for (int32_t j = 0; j < 4; j++)
+                    r.m[i][j] = m[i][0] * rhs.m[0][j] + m[i][1] * rhs.m[1][j] + m[i][2] * rhs.m[2][j] + m[i][3] * rhs.m[3][j];
+            return r;
+        }
+
+        Vector3f Mat4::TransformPoint(const Vector3f& p) const {
+            return { m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                     m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                     m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3] };
+        }
+
+        Vector3f Mat4::TransformVector(const Vector3f& v) const {
+            return { m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                     m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                     m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z };
+        }
+
+        Mat4 Mat4::Transposed() const {
+            Mat4 r;
+            for (int32_t i = 0; i < 4; i++) for (int32_t j = 0; j < 4; j++) r.m[i][j] = m[j][i];
+            return r;
+        }
+
+        Mat4 Mat4::RigidInverse() const {
+            // The inverse of a rotation is its transpose, the translation is undone in the rotated frame
+            Mat4 r;
+            for (int32_t i = 0; i < 3; i++) for (int32_t j = 0; j < 3; j++) r.m[i][j] = m[j][i];
+            for (int32_t i = 0; i < 3; i++) r.m[i][3] = -(r.m[i][0] * m[0][3] + r.m[i][1] * m[1][3] + r.m[i][2] * m[2][3]);
+            return r;
+        }
+
+        Mat4 Mat4::Identity() { return Mat4(); }
+
+        Mat4 Mat4::Translation(const Vector3f& t) {
+            Mat4 r;
+            r.m[0][3] = t.x; r.m[1][3] = t.y; r.m[2][3] = t.z;
+            return r;
+        }
+
+        Mat4 Mat4::Scale(const Vector3f& s) {
+            Mat4 r;
+            r.m[0][0] = s.x; r.m[1][1] = s.y; r.m[2][2] = s.z;
+            return r;
+        }
+
+        Mat4 Mat4::Rotation(const Quaternionf& q) { return FromQuaternion(q, { 0.0f, 0.0f, 0.0f }); }
+
+        Mat4 Mat4::FromQuaternion(const Quaternionf& q, const Vector3f& t) {
+            float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+            float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+            float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+            Mat4 r;
+            r.m[0][0] = 1 - 2 * (yy + zz); r.m[0][1] = 2 * (xy - wz);     r.m[0][2] = 2 * (xz + wy);     r.m[0][3] = t.x;
+            r.m[1][0] = 2 * (xy + wz);     r.m[1][1] = 1 - 2 * (xx + zz); r.m[1][2] = 2 * (yz - wx);     r.m[1][3] = t.y;
+            r.m[2][0] = 2 * (xz - wy);     r.m[2][1] = 2 * (yz + wx);     r.m[2][2] = 1 - 2 * (xx + yy); r.m[2][3] = t.z;
+            return r;
+        }
+
+        Mat4 Mat4::Perspective(float fFovY, float fAspect, float fNear, float fFar) {
+            float f = 1.0f / std::tan(fFovY * 0.5f);
+            Mat4 r;
+            r.m[0][0] = f / fAspect;
+            r.m[1][1] = f;
+            r.m[2][2] = (fFar + fNear) / (fNear - fFar);
+            r.m[2][3] = 2.0f * fFar * fNear / (fNear - fFar);
+            r.m[3][2] = -1.0f;
+            r.m[3][3] = 0.0f;
+            return r;
+        }
+
+        Mat4 Mat4::LookAt(const Vector3f& eye, const Vector3f& target, const Vector3f& up) {
+            Vector3f f = (target - eye).normalized();
+            Vector3f s = CrossProduct(f, up).normalized();
+            Vector3f u = CrossProduct(s, f);
+            Mat4 r;
+            r.m[0][0] =  s.x; r.m[0][1] =  s.y; r.m[0][2] =  s.z; r.m[0][3] = -DotProduct(s, eye);
+            r.m[1][0] =  u.x; r.m[1][1] =  u.y; r.m[1][2] =  u.z; r.m[1][3] = -DotProduct(u, eye);
+            r.m[2][0] = -f.x; r.m[2][1] = -f.y; r.m[2][2] = -f.z; r.m[2][3] =  DotProduct(f, eye);
+            return r;
+        }
+    }
+
+#endif /* Mat4_h */
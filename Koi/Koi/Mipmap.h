@@ -0,0 +1,82 @@
+//
+//  Mipmap.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef Mipmap_h
+#define Mipmap_h
+
+    #include "Global.h"
+    #include "Sprite.h"
+    #include "Parallel.h"
+    #include "Simd.h"
+
+    namespace koi {
+        // MARK: koi::Downsample2x2
+        // +------------------------------------------------------------------------------+
+        // | koi::Downsample2x2 - Box filters src into dst at half size                   |
+        // +------------------------------------------------------------------------------+
+        // dst must be max(1, src / 2) in both directions. Odd trailing rows and columns are
+        // dropped, a source dimension of 1 is reused for both taps.
+        void koi_DownsampleRows(const SpriteView& src, const SpriteView& dst, int32_t y0, int32_t y1) {
+            for (int32_t y = y0; y < y1; y++) {
+                const uint8_t* r0 = (const uint8_t*)src.GetRow(std::min(y * 2,     src.height - 1));
+                const uint8_t* r1 = (const uint8_t*)src.GetRow(std::min(y * 2 + 1, src.height - 1));
+                uint8_t* out = (uint8_t*)dst.GetRow(y);
+                int32_t x = 0;
+
+                if (src.width >= 2) {
+                    #if defined(KOI_SIMD_SSE2)
+                        // 4 output pixels from 8 source pixels on each row
+                        const __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+                        for (; x + 4 <= dst.width; x += 4) {
+                            __m128i a0 = _mm_loadu_si128((const __m128i*)(r0 + x * 8));
+                            __m128i a1 = _mm_loadu_si128((const __m128i*)(r0 + x * 8 + 16));
+                            __m128i b0 = _mm_loadu_si128((const __m128i*)(r1 + x * 8));
+                            __m128i b1 = _mm_loadu_si128((const __m128i*)(r1 + x * 8 + 16));
+                            // Widen to 16 bits, each register then holds two neighbouring pixels
+                            __m128i p01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+                            __m128i p23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+                            __m128i p45 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+                            __m128i p67 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+                            __m128i s01 = _mm_unpacklo_epi64(p01, p23), s23 = _mm_unpackhi_epi64(p01, p23);
+                            __m128i s45 = _mm_unpacklo_epi64(p45, p67), s67 = _mm_unpackhi_epi64(p45, p67);
+                            __m128i lo  = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(s01, s23), two), 2);
+                            __m128i hi  = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(s45, s67), two), 2);
+                            _mm_storeu_si128((__m128i*)(out + x * 4), _mm_packus_epi16(lo, hi));
+                        }
+                    #elif defined(KOI_SIMD_NEON)
+                        // vld2 splits even and odd pixels, so neighbours line up lane for lane
+                        for (; x + 4 <= dst.width; x += 4) {
+                            uint32x4x2_t a = vld2q_u32((const uint32_t*)(r0 + x * 8));
+                            uint32x4x2_t b = vld2q_u32((const uint32_t*)(r1 + x * 8));
+                            uint8x16_t ae = vreinterpretq_u8_u32(a.val[0]), ao = vreinterpretq_u8_u32(a.val[1]);
+                            uint8x16_t be = vreinterpretq_u8_u32(b.val[0]), bo = vreinterpretq_u8_u32(b.val[1]);
+                            uint16x8_t lo = vaddq_u16(vaddl_u8(vget_low_u8 (ae), vget_low_u8 (ao)), vaddl_u8(vget_low_u8 (be), vget_low_u8 (bo)));
+                            uint16x8_t hi = vaddq_u16(vaddl_u8(vget_high_u8(ae), vget_high_u8(ao)), vaddl_u8(vget_high_u8(be), vget_high_u8(bo)));
+                            vst1q_u8(out + x * 4, vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2)));
+                        }
+                    #endif
+                }
+
+                for (; x < dst.width; x++) {
+                    int32_t i0 = std::min(x * 2, src.width - 1) * 4, i1 = std::min(x * 2 + 1, src.width - 1) * 4;
+                    for (int32_t c = 0; c < 4; c++)
+                        out[x * 4 + c] = uint8_t((r0[i0 + c] + r0[i1 + c] + r1[i0 + c] + r1[i1 + c] + 2) >> 2);
+                }
+            }
+        }
+
+        void Downsample2x2(const SpriteView& src, const SpriteView& dst) {
+            if (src.Empty() || dst.Empty()) return;
+            constexpr int32_t nRowsPerTask = 32;
+            if (int64_t(dst.width) * dst.height < 256 * 256) { koi_DownsampleRows(src, dst, 0, dst.height); return; }
+            ParallelFor(0, (dst.height + nRowsPerTask - 1) / nRowsPerTask, [&](int32_t i) {
+                koi_DownsampleRows(src, dst, i * nRowsPerTask, std::min((i + 1) * nRowsPerTask, dst.height));
+            });
+        }
+    }
+
+#endif /* Mipmap_h */
@@ -0,0 +1,27 @@
+//
+//  Parallel.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef Parallel_h
+#define Parallel_h
+
+    #include <functional>
+    #include "JobSystem.h"
+
+    namespace koi {
+        // MARK: koi::ParallelFor
+        // +------------------------------------------------------------------------------+
+        // | koi::ParallelFor - Splits an index range across the hardware threads         |
+        // +------------------------------------------------------------------------------+
+        // Calls func(i) once for every i in [begin, end), handing out nGrain indices at a
+        // time on the process wide JobSystem. The calling thread takes part and the call
+        // returns once every index is done, nesting is fine.
+        void ParallelFor(int32_t begin, int32_t end, const std::function<void(int32_t)>& func, int32_t nGrain = 1) {
+            JobSystem::Get().ParallelFor(begin, end, func, nGrain);
+        }
+    }
+
+#endif /* Parallel_h */
@@ -0,0 +1,328 @@
+//
+//  Particles.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef Particles_h
+#define Particles_h
+
+    #include <algorithm>
+    #include <cmath>
+    #include <cstring>
+    #include <vector>
+    #include "Allocator.h"
+    #include "Color.h"
+    #include "Sprite.h"
+    #include "Parallel.h"
+    #include "VectorBatch.h"
+
+    namespace koi {
+        // MARK: koi::ParticleEmitter
+        // +------------------------------------------------------------------------------+
+        // | koi::ParticleEmitter - Where and how new particles start                     |
+        // +------------------------------------------------------------------------------+
+        struct ParticleEmitter {
+            Vector2f vPosition;
+            Vector2f vSpread      = { 0.0f, 0.0f };    // Half size of the box particles start in
+            float    fAngle       = 0.0f;              // Direction in radians
+            float    fAngleSpread = 3.14159265f;       // Up to this far either side of fAngle
+            float    fSpeedMin    = 20.0f, fSpeedMax = 60.0f;
+            float    fLifeMin     = 0.5f,  fLifeMax  = 1.5f;
+        };
+
+
+        // MARK: koi::ParticleSystem
+        // +------------------------------------------------------------------------------+
+        // | koi::ParticleSystem - Fixed capacity particles stored as one array per field |
+        // +------------------------------------------------------------------------------+
+        // Update integrates every field with koi_Lanes, then packs the survivors down in
+        // place, so the particle arrays never reallocate. Colour comes from a 256 entry
+        // ramp indexed by the fraction of life used. Particles are squares of SetSize
+        // pixels drawn straight into the target, one pixel or one span per row.
+        class ParticleSystem {
+        public:
+            explicit ParticleSystem(size_t nCapacity = 1 << 16);
+
+            size_t Size    () const { return nCount; }
+            size_t Capacity() const { return vX.size(); }
+
+            size_t Emit (const ParticleEmitter& e, size_t nCount);      // Returns how many fit
+            bool   Spawn(const Vector2f& vPos, const Vector2f& vVel, float fLife);
+            void   Clear() { nCount = 0; }
+
+            void SetGravity  (const Vector2f& g) { vGravity = g; }
+            void SetDrag     (float f)           { fDrag = f; }         // Fraction of velocity lost per second
+            void SetSize     (int32_t n)         { nSize = std::max(1, std::min(n, 32)); }
+            void SetColors   (Color cStart, Color cEnd);
+            void SetColorRamp(const std::vector<Color>& vKeys);         // Evenly spaced over the lifetime
+
+            void Update(float fElapsed, bool bParallel = true);
+
+            // Draws in particle order with NORMAL, MASK or ALPHA semantics. Large systems are
+            // binned into row bands drawn in parallel, the result is the same as serially.
+            // Positions map to (p - vOrigin) * fZoom on the target, sizes stay in pixels.
+            void Render(const SpriteView& target, Color::Mode mode = Color::ALPHA, float fBlend = 1.0f, bool bParallel = true,
+                        const Vector2f& vOrigin = { 0.0f, 0.0f }, float fZoom = 1.0f) const;
+
+            // Every covered pixel as f(x, y, colour), for targets Render can't handle
+            template<class F> void ForEachPixel(const F& f, const Vector2f& vOrigin = { 0.0f, 0.0f }, float fZoom = 1.0f) const;
+
+        private:
+            static constexpr size_t nBlock = 1 << 14;                   // Particles per update job
+            static constexpr int32_t nBandRows = 32;
+
+            void     koi_Integrate(size_t i0, size_t i1, float dt);
+            size_t   koi_Compact  (size_t i0, size_t i1);               // Returns the end of the survivors
+            void     koi_Move     (size_t nFrom, size_t nTo);
+            bool     koi_Corner   (size_t i, int32_t& px, int32_t& py) const;    // Top left pixel, false if too far out to convert
+            template<class Plot>
+            void     koi_DrawBand (const SpriteView& target, const Color* pRamp, const uint32_t* pIndex, size_t n, int32_t y0, int32_t y1, const Plot& plot) const;
+            uint32_t koi_Random   () { nSeed ^= nSeed << 13; nSeed ^= nSeed >> 17; nSeed ^= nSeed << 5; return nSeed; }
+            float    koi_Random   (float a, float b) { return a + (b - a) * float(koi_Random() >> 8) * (1.0f / 16777216.0f); }
+
+            AlignedVector<float> vX, vY, vVX, vVY;
+            AlignedVector<float> vAge;                                  // 0 at birth, 1 at death
+            AlignedVector<float> vRate;                                 // 1 / lifetime
+            size_t               nCount   = 0;
+            Vector2f             vGravity = { 0.0f, 0.0f };
+            float                fDrag    = 0.0f;
+            int32_t              nSize    = 1;
+            uint32_t             nSeed    = 0x9E3779B9u;
+            Color                vRamp[256];
+            std::vector<size_t>  vBlockEnd;                             // Survivors per block in a parallel update
+
+            // Render scratch and view, Render must not run on the same system from two threads
+            mutable std::vector<uint32_t> vBinned;
+            mutable std::vector<uint32_t> vBandStart;
+            mutable std::vector<uint32_t> vChunkOffset;
+            mutable std::vector<Color>    vRampBlend;
+            mutable Vector2f              vViewOrigin = { 0.0f, 0.0f };
+            mutable float                 fViewZoom   = 1.0f;
+        };
+
+        ParticleSystem::ParticleSystem(size_t nCapacity) {
+            vX.resize(nCapacity); vY.resize(nCapacity); vVX.resize(nCapacity); vVY.resize(nCapacity);
+            vAge.resize(nCapacity); vRate.resize(nCapacity);
+            SetColors(Color::WHITE, Color(255, 255, 255, 0));
+        }
+
+        void ParticleSystem::SetColors(Color cStart, Color cEnd) { SetColorRamp({ cStart, cEnd }); }
+
+        void ParticleSystem::SetColorRamp(const std::vector<Color>& vKeys) {
+            if (vKeys.empty()) return;
+            for (int32_t i = 0; i < 256; i++) {
+                float f = float(i) / 255.0f * float(vKeys.size() - 1);
+                size_t k = std::min(size_t(f), vKeys.size() - 1), k1 = std::min(k + 1, vKeys.size() - 1);
+                float t = f - float(k);
+                const Color& a = vKeys[k]; const Color& b = vKeys[k1];
+                vRamp[i] = Color(uint8_t(a.r + (b.r - a.r) * t + 0.5f), uint8_t(a.g + (b.g - a.g) * t + 0.5f),
+                                 uint8_t(a.b + (b.b - a.b) * t + 0.5f), uint8_t(a.a + (b.a - a.a) * t + 0.5f));
+            }
+        }
+
+        bool ParticleSystem::Spawn(const Vector2f& vPos, const Vector2f& vVel, float fLife) {
+            if (nCount == Capacity() || fLife <= 0.0f) return false;
+            vX[nCount] = vPos.x; vY[nCount] = vPos.y; vVX[nCount] = vVel.x; vVY[nCount] = vVel.y;
+            vAge[nCount] = 0.0f; vRate[nCount] = 1.0f / fLife;
+            nCount++;
+            return true;
+        }
+
+        size_t ParticleSystem::Emit(const ParticleEmitter& e, size_t n) {
+            n = std::min(n, Capacity() - nCount);
+            for (size_t i = 0; i < n; i++) {
+                float fAngle = e.fAngle + koi_Random(-e.fAngleSpread, e.fAngleSpread);
+                float fSpeed = koi_Random(e.fSpeedMin, e.fSpeedMax);
+                Spawn({ e.vPosition.x + koi_Random(-e.vSpread.x, e.vSpread.x), e.vPosition.y + koi_Random(-e.vSpread.y, e.vSpread.y) },
+                      { std::cos(fAngle) * fSpeed, std::sin(fAngle) * fSpeed }, std::max(koi_Random(e.fLifeMin, e.fLifeMax), 1e-3f));
+            }
+            return n;
+        }
+
+        void ParticleSystem::koi_Integrate(size_t i0, size_t i1, float dt) {
+            float* px = vX.data(); float* py = vY.data(); float* pvx = vVX.data(); float* pvy = vVY.data();
+            float* pAge = vAge.data(); const float* pRate = vRate.data();
+            const float fKeep = std::max(0.0f, 1.0f - fDrag * dt), gx = vGravity.x * dt, gy = vGravity.y * dt;
+            auto kernel = [&](auto lane, size_t i) {
+                using L = decltype(lane);
+                L vx = L::Load(pvx + i) * L::Set(fKeep) + L::Set(gx);
+                L vy = L::Load(pvy + i) * L::Set(fKeep) + L::Set(gy);
+                L::Store(pvx + i, vx);
+                L::Store(pvy + i, vy);
+                L::Store(px + i, L::Load(px + i) + vx * L::Set(dt));
+                L::Store(py + i, L::Load(py + i) + vy * L::Set(dt));
+                L::Store(pAge + i, L::Load(pAge + i) + L::Load(pRate + i) * L::Set(dt));
+            };
+            size_t i = i0;
+            for (; i + koi_Lanes::N <= i1; i += koi_Lanes::N) kernel(koi_Lanes(), i);
+            for (; i < i1; i++) kernel(koi_Lane(), i);
+        }
+
+        void ParticleSystem::koi_Move(size_t nFrom, size_t nTo) {
+            vX[nTo] = vX[nFrom]; vY[nTo] = vY[nFrom]; vVX[nTo] = vVX[nFrom]; vVY[nTo] = vVY[nFrom];
+            vAge[nTo] = vAge[nFrom]; vRate[nTo] = vRate[nFrom];
+        }
+
+        size_t ParticleSystem::koi_Compact(size_t i0, size_t i1) {
+            // Order is kept, it is the draw order
+            size_t j = i0;
+            for (size_t i = i0; i < i1; i++) {
+                if (vAge[i] >= 1.0f) continue;
+                if (i != j) koi_Move(i, j);
+                j++;
+            }
+            return j;
+        }
+
+        void ParticleSystem::Update(float dt, bool bParallel) {
+            size_t nBlocks = (nCount + nBlock - 1) / nBlock;
+            if (!bParallel || nBlocks < 2) {
+                koi_Integrate(0, nCount, dt);
+                nCount = koi_Compact(0, nCount);
+                return;
+            }
+
+            // Blocks integrate and pack on their own, then slide down behind each other
+            vBlockEnd.resize(nBlocks);
+            ParallelFor(0, int32_t(nBlocks), [&](int32_t b) {
+                size_t i0 = size_t(b) * nBlock, i1 = std::min(i0 + nBlock, nCount);
+                koi_Integrate(i0, i1, dt);
+                vBlockEnd[b] = koi_Compact(i0, i1);
+            });
+            size_t nAlive = vBlockEnd[0];
+            for (size_t b = 1; b < nBlocks; b++) {
+                size_t i0 = b * nBlock, n = vBlockEnd[b] - i0;
+                if (n && i0 != nAlive)
+                    for (AlignedVector<float>* v : { &vX, &vY, &vVX, &vVY, &vAge, &vRate })
+                        memmove(v->data() + nAlive, v->data() + i0, n * sizeof(float));
+                nAlive += n;
+            }
+            nCount = nAlive;
+        }
+
+        bool ParticleSystem::koi_Corner(size_t i, int32_t& px, int32_t& py) const {
+            constexpr float fLimit = 1 << 30;
+            float x = (vX[i] - vViewOrigin.x) * fViewZoom, y = (vY[i] - vViewOrigin.y) * fViewZoom;
+            if (!(std::abs(x) < fLimit && std::abs(y) < fLimit)) return false;
+            px = int32_t(std::floor(x)) - nSize / 2;
+            py = int32_t(std::floor(y)) - nSize / 2;
+            return true;
+        }
+
+        // plot(pDst, nCount, colour) writes one clipped row of a particle
+        template<class Plot>
+        void ParticleSystem::koi_DrawBand(const SpriteView& target, const Color* pRamp, const uint32_t* pIndex, size_t n, int32_t y0, int32_t y1, const Plot& plot) const {
+            if (nSize == 1) {
+                // Points: one float range test also throws out NaN, truncation is floor once inside
+                const float fWidth = float(target.width), fy0 = float(y0), fy1 = float(y1);
+                for (size_t k = 0; k < n; k++) {
+                    uint32_t i = pIndex ? pIndex[k] : uint32_t(k);
+                    float x = (vX[i] - vViewOrigin.x) * fViewZoom, y = (vY[i] - vViewOrigin.y) * fViewZoom;
+                    if (!(x >= 0.0f && x < fWidth && y >= fy0 && y < fy1)) continue;
+                    plot(target.GetRow(int32_t(y)) + int32_t(x), 1, pRamp[std::min(int32_t(vAge[i] * 256.0f), 255)]);
+                }
+                return;
+            }
+            for (size_t k = 0; k < n; k++) {
+                uint32_t i = pIndex ? pIndex[k] : uint32_t(k);
+                int32_t px, py;
+                if (!koi_Corner(i, px, py)) continue;
+                int32_t x1 = std::max(px, 0), x2 = std::min(px + nSize, target.width);
+                int32_t r1 = std::max(py, y0), r2 = std::min(py + nSize, y1);
+                if (x1 >= x2 || r1 >= r2) continue;
+                Color c = pRamp[std::min(int32_t(vAge[i] * 256.0f), 255)];
+                for (int32_t y = r1; y < r2; y++) plot(target.GetRow(y) + x1, x2 - x1, c);
+            }
+        }
+
+        void ParticleSystem::Render(const SpriteView& target, Color::Mode mode, float fBlend, bool bParallel, const Vector2f& vOrigin, float fZoom) const {
+            if (target.Empty() || nCount == 0 || mode == Color::CUSTOM) return;
+            vViewOrigin = vOrigin;
+            fViewZoom   = fZoom;
+
+            const Color* pRamp = vRamp;
+            if (mode == Color::ALPHA) {
+                // Blend factor folded into the ramp alpha once instead of per pixel
+                vRampBlend.assign(vRamp, vRamp + 256);
+                fBlend = std::min(std::max(fBlend, 0.0f), 1.0f);
+                for (Color& c : vRampBlend) c.a = uint8_t(c.a * fBlend + 0.5f);
+                pRamp = vRampBlend.data();
+            }
+
+            int32_t nBands = (target.height + nBandRows - 1) / nBandRows;
+            bool bBands = bParallel && nCount >= 16384 && nBands >= 2 && JobSystem::Get().Workers() > 0;
+            if (bBands) {
+                // Counting sort into row bands keeps particle order within each band, a square
+                // straddling two bands is listed in both and clipped to each
+                auto bands = [&](size_t i, int32_t& b1, int32_t& b2) {
+                    int32_t px, py;
+                    if (!koi_Corner(i, px, py) || py + nSize <= 0 || py >= target.height) return false;
+                    b1 = std::max(py, 0) / nBandRows;
+                    b2 = std::min(py + nSize - 1, target.height - 1) / nBandRows;
+                    return true;
+                };
+                // Chunks count and scatter in parallel, offsets run band major then chunk so the
+                // order within a band is still particle order
+                size_t nChunkSize = nBlock * 4, nChunks = (nCount + nChunkSize - 1) / nChunkSize;
+                vChunkOffset.assign(nChunks * nBands, 0);
+                ParallelFor(0, int32_t(nChunks), [&](int32_t c) {
+                    uint32_t* pCount = vChunkOffset.data() + c * nBands;
+                    for (size_t i = c * nChunkSize, e = std::min(i + nChunkSize, nCount); i < e; i++) {
+                        int32_t b1, b2;
+                        if (bands(i, b1, b2)) for (int32_t b = b1; b <= b2; b++) pCount[b]++;
+                    }
+                });
+                vBandStart.resize(nBands + 1);
+                uint32_t nTotal = 0;
+                for (int32_t b = 0; b < nBands; b++) {
+                    vBandStart[b] = nTotal;
+                    for (size_t c = 0; c < nChunks; c++) { uint32_t n = vChunkOffset[c * nBands + b]; vChunkOffset[c * nBands + b] = nTotal; nTotal += n; }
+                }
+                vBandStart[nBands] = nTotal;
+                vBinned.resize(nTotal);
+                ParallelFor(0, int32_t(nChunks), [&](int32_t c) {
+                    uint32_t* pFill = vChunkOffset.data() + c * nBands;
+                    for (size_t i = c * nChunkSize, e = std::min(i + nChunkSize, nCount); i < e; i++) {
+                        int32_t b1, b2;
+                        if (bands(i, b1, b2)) for (int32_t b = b1; b <= b2; b++) vBinned[pFill[b]++] = uint32_t(i);
+                    }
+                });
+            }
+
+            auto draw = [&](const auto& plot) {
+                if (!bBands) { koi_DrawBand(target, pRamp, nullptr, nCount, 0, target.height, plot); return; }
+                ParallelFor(0, nBands, [&](int32_t b) {
+                    koi_DrawBand(target, pRamp, vBinned.data() + vBandStart[b], vBandStart[b + 1] - vBandStart[b],
+                                 b * nBandRows, std::min((b + 1) * nBandRows, target.height), plot);
+                });
+            };
+            switch (mode) {
+                case Color::NORMAL: draw([](Color* p, int32_t n, Color c) { if (n == 1) *p = c; else std::fill(p, p + n, c); }); break;
+                case Color::MASK:   draw([](Color* p, int32_t n, Color c) { if (c.a == 255) std::fill(p, p + n, c); });         break;
+                default:
+                    draw([](Color* p, int32_t n, Color c) {
+                        uint32_t a = c.a + (c.a >> 7), k = 256 - a;     // 0 to 256, so opaque stays exact
+                        for (int32_t x = 0; x < n; x++) {
+                            Color d = p[x];
+                            p[x] = Color(uint8_t((c.r * a + d.r * k) >> 8), uint8_t((c.g * a + d.g * k) >> 8), uint8_t((c.b * a + d.b * k) >> 8));
+                        }
+                    });
+            }
+        }
+
+        template<class F> void ParticleSystem::ForEachPixel(const F& f, const Vector2f& vOrigin, float fZoom) const {
+            vViewOrigin = vOrigin;
+            fViewZoom   = fZoom;
+            for (size_t i = 0; i < nCount; i++) {
+                int32_t px, py;
+                if (!koi_Corner(i, px, py)) continue;
+                Color c = vRamp[std::min(int32_t(vAge[i] * 256.0f), 255)];
+                for (int32_t y = py; y < py + nSize; y++)
+                    for (int32_t x = px; x < px + nSize; x++) f(x, y, c);
+            }
+        }
+    }
+
+#endif /* Particles_h */
@@ -0,0 +1,345 @@
+//
+//  Pipeline3D.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef Pipeline3D_h
+#define Pipeline3D_h
+
+    #include "Global.h"
+    #include "Sprite.h"
+    #include "Sampler.h"
+    #include "PixelFormat.h"
+    #include "Parallel.h"
+    #include "Mat4.h"
+
+    namespace koi {
+        // MARK: koi::Mesh3D
+        // +------------------------------------------------------------------------------+
+        // | koi::Mesh3D - Indexed triangle list                                          |
+        // +------------------------------------------------------------------------------+
+        // Front faces wind counter clockwise when seen from outside.
+        struct Vertex3D {
+            Vector3f pos;
+            Vector2f uv;
+            Color    col = Color::WHITE;    // Multiplied with the texture
+        };
+
+        struct Mesh3D {
+            std::vector<Vertex3D> vVertices;
+            std::vector<uint32_t> vIndices;
+
+            static Mesh3D Cube(float fSize = 1.0f);     // Centred on the origin, every face mapped to the whole texture
+        };
+
+        Mesh3D Mesh3D::Cube(float fSize) {
+            // Each face is centre n with edges s and t, s x t = n keeps it counter clockwise from outside
+            static const float faces[6][9] = {
+                {  1, 0, 0,   0, 0,-1,   0, 1, 0 }, { -1, 0, 0,   0, 0, 1,   0, 1, 0 },
+                {  0, 1, 0,   1, 0, 0,   0, 0,-1 }, {  0,-1, 0,   1, 0, 0,   0, 0, 1 },
+                {  0, 0, 1,   1, 0, 0,   0, 1, 0 }, {  0, 0,-1,  -1, 0, 0,   0, 1, 0 },
+            };
+            static const float corners[4][4] = { { -1, -1, 0, 1 }, { 1, -1, 1, 1 }, { 1, 1, 1, 0 }, { -1, 1, 0, 0 } };
+            Mesh3D mesh;
+            float h = fSize * 0.5f;
+            for (uint32_t f = 0; f < 6; f++) {
+                const float* n = faces[f];
+                uint32_t nBase = uint32_t(mesh.vVertices.size());
+                for (const auto& c : corners) {
+                    Vertex3D v;
+                    v.pos = Vector3f(n[0] + c[0] * n[3] + c[1] * n[6], n[1] + c[0] * n[4] + c[1] * n[7], n[2] + c[0] * n[5] + c[1] * n[8]) * h;
+                    v.uv  = Vector2f(c[2], c[3]);
+                    mesh.vVertices.push_back(v);
+                }
+                for (uint32_t i : { 0u, 1u, 2u, 0u, 2u, 3u }) mesh.vIndices.push_back(nBase + i);
+            }
+            return mesh;
+        }
+
+
+        // MARK: koi::DepthBuffer
+        // +------------------------------------------------------------------------------+
+        // | koi::DepthBuffer - One 32 bit float per pixel, 0 is near and 1 is far        |
+        // +------------------------------------------------------------------------------+
+        struct DepthBuffer {
+            int32_t              width  = 0;
+            int32_t              height = 0;
+            AlignedVector<float> vDepth;
+
+            void         Resize(int32_t w, int32_t h) { width = std::max(w, 0); height = std::max(h, 0); vDepth.resize(size_t(width) * height); }
+            void         Clear (float f = 1.0f)       { std::fill(vDepth.begin(), vDepth.end(), f); }
+            float*       GetRow(int32_t y)            { return vDepth.data() + size_t(y) * width; }
+            const float* GetRow(int32_t y) const      { return vDepth.data() + size_t(y) * width; }
+        };
+
+
+        // MARK: koi::Pipeline3D
+        // +------------------------------------------------------------------------------+
+        // | koi::Pipeline3D - Software rasteriser for textured, depth tested triangles   |
+        // +------------------------------------------------------------------------------+
+        // Vertices go through matProj * matView * model, are clipped against the near and far
+        // planes plus a guard band around the screen, and are drawn with perspective correct
+        // texture coordinates and colours. Each draw call is rasterised in bands of rows
+        // spread over the threads, triangles keep their submission order inside a band so
+        // the result does not depend on the thread count.
+        //
+        //     Pipeline3D pipe;
+        //     pipe.matProj = Mat4::Perspective(1.0f, float(ScreenWidth()) / ScreenHeight(), 0.1f, 100.0f);
+        //     pipe.Begin(GetDrawTargetView());
+        //     pipe.DrawMesh(mesh, Mat4::FromQuaternion(q, { 0, 0, -3 }), texture.GetView());
+        class Pipeline3D {
+        public:
+            enum Cull { CULL_NONE, CULL_BACK, CULL_FRONT };
+
+            Mat4    matView;
+            Mat4    matProj;
+            Cull    cull        = CULL_BACK;
+            Sampler sampler;
+            bool    bDepthTest  = true;
+            bool    bDepthWrite = true;
+
+            // Counted since Begin
+            int32_t nTrianglesDrawn  = 0;                   // After clipping, one input triangle can become several
+            int32_t nTrianglesCulled = 0;                   // Back facing, degenerate or entirely clipped away
+
+            void         Begin         (const SpriteView& target, bool bClearDepth = true);  // Depth buffer follows the target size
+            void         DrawMesh      (const Mesh3D& mesh, const Mat4& matModel, const SpriteView& texture = SpriteView());   // Empty texture draws vertex colours
+            void         DrawTriangles (const Vertex3D* pVertices, const uint32_t* pIndices, size_t nIndices, const Mat4& matModel, const SpriteView& texture = SpriteView());
+            DepthBuffer& GetDepthBuffer() { return depth; }
+
+        private:
+            struct koi_ClipVertex { float x, y, z, w, u, v, c[4]; };
+            struct koi_ScreenTri {
+                int32_t x[3], y[3];                         // 28.4 fixed point pixels
+                float   z[3], iw[3], uw[3], vw[3], cw[3][4];// Everything but z is divided by w
+                int32_t nRowMin, nRowMax;                   // Pixel rows touched, inclusive
+                bool    bWhite;
+            };
+
+            static constexpr float   fGuardBand  = 4.0f;     // Clip space x and y are kept within +-4w
+            static constexpr int32_t nBandRows   = 32;
+
+            void koi_ClipAndSetup(const koi_ClipVertex* tri);
+            void koi_Setup       (const koi_ClipVertex& a, const koi_ClipVertex& b, const koi_ClipVertex& c);
+            void koi_Raster      (const koi_ScreenTri& t, int32_t y0, int32_t y1, const SpriteView& texture);
+            static float koi_ReduceUV(float t, Sampler::Address a);
+
+            SpriteView                  viewTarget;
+            DepthBuffer                 depth;
+            std::vector<koi_ClipVertex> vClip;
+            std::vector<koi_ScreenTri>  vTris;
+        };
+
+        void Pipeline3D::Begin(const SpriteView& target, bool bClearDepth) {
+            viewTarget = target;
+            if (depth.width != target.width || depth.height != target.height) { depth.Resize(target.width, target.height); bClearDepth = true; }
+            if (bClearDepth) depth.Clear();
+            nTrianglesDrawn = nTrianglesCulled = 0;
+        }
+
+        void Pipeline3D::DrawMesh(const Mesh3D& mesh, const Mat4& matModel, const SpriteView& texture) {
+            DrawTriangles(mesh.vVertices.data(), mesh.vIndices.data(), mesh.vIndices.size(), matModel, texture);
+        }
+
+        void Pipeline3D::DrawTriangles(const Vertex3D* pVertices, const uint32_t* pIndices, size_t nIndices, const Mat4& matModel, const SpriteView& texture) {
+            if (viewTarget.Empty() || nIndices < 3) return;
+
+            // Vertex stage, every vertex once however many triangles share it
+            Mat4 mvp = matProj * matView * matModel;
+            uint32_t nVertices = 0;
+            for (size_t i = 0; i < nIndices; i++) nVertices = std::max(nVertices, pIndices[i] + 1);
+            vClip.resize(nVertices);
+            for (uint32_t i = 0; i < nVertices; i++) {
+                const Vertex3D& v = pVertices[i];
+                koi_ClipVertex& o = vClip[i];
+                o.x = mvp.m[0][0] * v.pos.x + mvp.m[0][1] * v.pos.y + mvp.m[0][2] * v.pos.z + mvp.m[0][3];
+                o.y = mvp.m[1][0] * v.pos.x + mvp.m[1][1] * v.pos.y + mvp.m[1][2] * v.pos.z + mvp.m[1][3];
+                o.z = mvp.m[2][0] * v.pos.x + mvp.m[2][1] * v.pos.y + mvp.m[2][2] * v.pos.z + mvp.m[2][3];
+                o.w = mvp.m[3][0] * v.pos.x + mvp.m[3][1] * v.pos.y + mvp.m[3][2] * v.pos.z + mvp.m[3][3];
+                o.u = v.uv.x; o.v = v.uv.y;
+                o.c[0] = v.col.r; o.c[1] = v.col.g; o.c[2] = v.col.b; o.c[3] = v.col.a;
+            }
+
+            vTris.clear();
+            for (size_t i = 0; i + 2 < nIndices; i += 3) {
+                koi_ClipVertex tri[3] = { vClip[pIndices[i]], vClip[pIndices[i + 1]], vClip[pIndices[i + 2]] };
+                koi_ClipAndSetup(tri);
+            }
+            if (vTris.empty()) return;
+
+            // Raster stage, bands own their rows of colour and depth so they never race
+            int32_t nBands = (viewTarget.height + nBandRows - 1) / nBandRows;
+            auto band = [&](int32_t b) {
+                int32_t y0 = b * nBandRows, y1 = std::min(y0 + nBandRows, viewTarget.height);
+                for (const koi_ScreenTri& t : vTris)
+                    if (t.nRowMax >= y0 && t.nRowMin < y1) koi_Raster(t, y0, y1, texture);
+            };
+            int64_t nCover = 0;
+            for (const koi_ScreenTri& t : vTris) nCover += int64_t(t.nRowMax - t.nRowMin + 1) * viewTarget.width;
+            if (nBands > 1 && nCover >= 256 * 256) ParallelFor(0, nBands, band);
+            else for (int32_t b = 0; b < nBands; b++) band(b);
+        }
+
+        void Pipeline3D::koi_ClipAndSetup(const koi_ClipVertex* tri) {
+            // Signed distance to each clip plane, inside when >= 0
+            auto dist = [](const koi_ClipVertex& v, int32_t p) {
+                switch (p) {
+                    case 0:  return v.w + v.z;                  // Near
+                    case 1:  return v.w - v.z;                  // Far
+                    case 2:  return fGuardBand * v.w + v.x;
+                    case 3:  return fGuardBand * v.w - v.x;
+                    case 4:  return fGuardBand * v.w + v.y;
+                    default: return fGuardBand * v.w - v.y;
+                }
+            };
+
+            uint32_t nOutside = 0;
+            for (int32_t p = 0; p < 6; p++) {
+                int32_t nOut = (dist(tri[0], p) < 0) + (dist(tri[1], p) < 0) + (dist(tri[2], p) < 0);
+                if (nOut == 3) { nTrianglesCulled++; return; }
+                if (nOut) nOutside |= 1u << p;
+            }
+            if (nOutside == 0) { koi_Setup(tri[0], tri[1], tri[2]); return; }
+
+            // Sutherland-Hodgman against only the planes the triangle crosses, 3 + 6 vertices at most
+            koi_ClipVertex poly[2][9];
+            int32_t n = 3, cur = 0;
+            std::copy(tri, tri + 3, poly[0]);
+            for (int32_t p = 0; p < 6 && n >= 3; p++) {
+                if (!(nOutside & (1u << p))) continue;
+                const koi_ClipVertex* in = poly[cur];
+                koi_ClipVertex* out = poly[cur ^ 1];
+                int32_t m = 0;
+                for (int32_t i = 0; i < n; i++) {
+                    const koi_ClipVertex& a = in[i];
+                    const koi_ClipVertex& b = in[(i + 1) % n];
+                    float da = dist(a, p), db = dist(b, p);
+                    if (da >= 0) out[m++] = a;
+                    if ((da >= 0) != (db >= 0)) {
+                        float t = da / (da - db);
+                        koi_ClipVertex& v = out[m++];
+                        const float* fa = &a.x; const float* fb = &b.x; float* fv = &v.x;
+                        for (int32_t k = 0; k < 10; k++) fv[k] = fa[k] + (fb[k] - fa[k]) * t;
+                    }
+                }
+                n = m; cur ^= 1;
+            }
+            if (n < 3) { nTrianglesCulled++; return; }
+            for (int32_t i = 1; i + 1 < n; i++) koi_Setup(poly[cur][0], poly[cur][i], poly[cur][i + 1]);
+        }
+
+        void Pipeline3D::koi_Setup(const koi_ClipVertex& a, const koi_ClipVertex& b, const koi_ClipVertex& c) {
+            const koi_ClipVertex* v[3] = { &a, &b, &c };
+            koi_ScreenTri t;
+            float fHalfW = viewTarget.width * 0.5f, fHalfH = viewTarget.height * 0.5f;
+            for (int32_t i = 0; i < 3; i++) {
+                float iw = 1.0f / v[i]->w;
+                t.x[i]  = int32_t(std::lround((v[i]->x * iw + 1.0f) * fHalfW * 16.0f));
+                t.y[i]  = int32_t(std::lround((1.0f - v[i]->y * iw) * fHalfH * 16.0f));
+                t.z[i]  = v[i]->z * iw * 0.5f + 0.5f;
+                t.iw[i] = iw;
+                t.uw[i] = v[i]->u * iw;
+                t.vw[i] = v[i]->v * iw;
+                for (int32_t k = 0; k < 4; k++) t.cw[i][k] = v[i]->c[k] * iw;
+            }
+
+            // Screen y points down, so counter clockwise in clip space has a negative area here
+            int64_t nArea = int64_t(t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - int64_t(t.y[1] - t.y[0]) * (t.x[2] - t.x[0]);
+            if (nArea == 0 || (cull == CULL_BACK && nArea > 0) || (cull == CULL_FRONT && nArea < 0)) { nTrianglesCulled++; return; }
+            if (nArea < 0) {
+                // The rasteriser wants one winding, swap two vertices and everything they carry
+                std::swap(t.x[1], t.x[2]); std::swap(t.y[1], t.y[2]); std::swap(t.z[1], t.z[2]);
+                std::swap(t.iw[1], t.iw[2]); std::swap(t.uw[1], t.uw[2]); std::swap(t.vw[1], t.vw[2]);
+                for (int32_t k = 0; k < 4; k++) std::swap(t.cw[1][k], t.cw[2][k]);
+            }
+
+            int32_t nMinY = std::min(t.y[0], std::min(t.y[1], t.y[2])), nMaxY = std::max(t.y[0], std::max(t.y[1], t.y[2]));
+            t.nRowMin = std::max((nMinY + 7) >> 4, 0);
+            t.nRowMax = std::min((nMaxY - 8) >> 4, viewTarget.height - 1);
+            if (t.nRowMin > t.nRowMax) { nTrianglesCulled++; return; }
+            t.bWhite = a.c[0] == 255 && a.c[1] == 255 && a.c[2] == 255 && a.c[3] == 255
+                    && b.c[0] == 255 && b.c[1] == 255 && b.c[2] == 255 && b.c[3] == 255
+                    && c.c[0] == 255 && c.c[1] == 255 && c.c[2] == 255 && c.c[3] == 255;
+            vTris.push_back(t);
+            nTrianglesDrawn++;
+        }
+
+        // Interpolated UVs are unbounded, far out or non-finite ones would overflow the sampler's int
+        // conversions. REPEAT and MIRROR both repeat every 2 units, CLAMP saturates past the edge texel.
+        float Pipeline3D::koi_ReduceUV(float t, Sampler::Address a) {
+            if (t >= -2.0f && t <= 2.0f) return t;
+            if (a == Sampler::CLAMP) return t < 0.0f ? -1.0f : 2.0f;                 // NaN lands here too
+            float r = t - 2.0f * std::floor(t * 0.5f);
+            return std::isfinite(r) ? std::min(std::max(r, 0.0f), 2.0f) : 0.0f;
+        }
+
+        void Pipeline3D::koi_Raster(const koi_ScreenTri& t, int32_t y0, int32_t y1, const SpriteView& texture) {
+            int32_t nMinX = std::min(t.x[0], std::min(t.x[1], t.x[2])), nMaxX = std::max(t.x[0], std::max(t.x[1], t.x[2]));
+            int32_t px0 = std::max((nMinX + 7) >> 4, 0), px1 = std::min((nMaxX - 8) >> 4, viewTarget.width - 1);
+            int32_t py0 = std::max(t.nRowMin, y0),       py1 = std::min(t.nRowMax, y1 - 1);
+            if (px0 > px1 || py0 > py1) return;
+
+            // Edge i is opposite vertex i, its function is that vertex's unnormalised barycentric.
+            // Top and left edges own the pixels exactly on them, the others get a bias of -1.
+            int64_t e[3], dx[3], dy[3], bias[3];
+            int64_t cx = int64_t(px0) * 16 + 8, cy = int64_t(py0) * 16 + 8;
+            for (int32_t i = 0; i < 3; i++) {
+                int32_t a = (i + 1) % 3, b = (i + 2) % 3;
+                int64_t ex = t.x[b] - t.x[a], ey = t.y[b] - t.y[a];
+                e[i]    = ex * (cy - t.y[a]) - ey * (cx - t.x[a]);
+                dx[i]   = -ey * 16;
+                dy[i]   =  ex * 16;
+                bias[i] = (ey < 0 || (ey == 0 && ex > 0)) ? 0 : -1;
+            }
+            float fInvArea = 1.0f / float(e[0] + e[1] + e[2]);
+            bool  bNearest = sampler.filter == Sampler::NEAREST;
+            float fTexW = float(texture.width), fTexH = float(texture.height);
+
+            for (int32_t y = py0; y <= py1; y++, e[0] += dy[0], e[1] += dy[1], e[2] += dy[2]) {
+                // Solve each edge for the columns it lets through instead of testing every pixel
+                // Guard band edges can put the solutions far outside int32_t, so clamp in 64 bits first
+                int64_t nStart = px0, nEnd = px1;
+                for (int32_t i = 0; i < 3; i++) {
+                    int64_t v = e[i] + bias[i];
+                    if      (dx[i] > 0) { if (v < 0) nStart = std::max<int64_t>(nStart, px0 + (-v + dx[i] - 1) / dx[i]); }
+                    else if (dx[i] < 0) { nEnd = v < 0 ? px0 - 1 : std::min<int64_t>(nEnd, px0 + v / -dx[i]); }
+                    else if (v < 0)       nEnd = px0 - 1;
+                }
+                int32_t xs = int32_t(std::min<int64_t>(nStart, int64_t(px1) + 1));
+                int32_t xe = int32_t(std::max<int64_t>(nEnd,   int64_t(px0) - 1));
+                if (xs > xe) continue;
+
+                Color* row  = viewTarget.GetRow(y);
+                float* zrow = depth.GetRow(y);
+                int64_t e0 = e[0] + dx[0] * (xs - px0), e1 = e[1] + dx[1] * (xs - px0);
+                for (int32_t x = xs; x <= xe; x++, e0 += dx[0], e1 += dx[1]) {
+                    float l0 = float(e0) * fInvArea, l1 = float(e1) * fInvArea, l2 = 1.0f - l0 - l1;
+                    float z = l0 * t.z[0] + l1 * t.z[1] + l2 * t.z[2];
+                    if (bDepthTest && !(z < zrow[x])) continue;
+
+                    float w = 1.0f / (l0 * t.iw[0] + l1 * t.iw[1] + l2 * t.iw[2]);
+                    Color out = Color::WHITE;
+                    if (!texture.Empty()) {
+                        float u = koi_ReduceUV((l0 * t.uw[0] + l1 * t.uw[1] + l2 * t.uw[2]) * w, sampler.addrU);
+                        float v = koi_ReduceUV((l0 * t.vw[0] + l1 * t.vw[1] + l2 * t.vw[2]) * w, sampler.addrV);
+                        if (bNearest) out = sampler.Fetch(texture, int32_t(std::floor(u * fTexW)), int32_t(std::floor(v * fTexH)));
+                        else          out = sampler.Sample(texture, u, v);
+                    }
+                    if (!t.bWhite) {
+                        uint8_t* ch = &out.r;
+                        for (int32_t k = 0; k < 4; k++) {
+                            float c = (l0 * t.cw[0][k] + l1 * t.cw[1][k] + l2 * t.cw[2][k]) * w;
+                            ch[k] = uint8_t(Div255(ch[k] * uint32_t(std::min(std::max(c, 0.0f), 255.0f) + 0.5f)));
+                        }
+                    }
+                    if (out.a == 0) continue;                // Cut out texels leave colour and depth alone
+                    row[x] = out;
+                    if (bDepthWrite) zrow[x] = z;
+                }
+            }
+        }
+    }
+
+#endif /* Pipeline3D_h */
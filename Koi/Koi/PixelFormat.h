@@ -0,0 +1,232 @@
+//
+//  PixelFormat.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef PixelFormat_h
+#define PixelFormat_h
+
+    #include <array>
+    #include "Global.h"
+    #include "Sprite.h"
+    #include "Simd.h"
+
+    // Row kernels between pixel formats. src and dst may be the same buffer for the
+    // Color to Color kernels. Every kernel has an SSE2 and a NEON body plus a scalar
+    // tail, and all of them produce bit identical results on every path.
+
+    namespace koi {
+        // x / 255 rounded, exact for any x in [0, 255 * 255]
+        constexpr uint32_t Div255(uint32_t x) { return (x + 128 + ((x + 128) >> 8)) >> 8; }
+
+        #if defined(KOI_SIMD_SSE2)
+            inline __m128i koi_Div255(__m128i x) { // Same rounding as Div255, on 16 bit lanes
+                x = _mm_add_epi16(x, _mm_set1_epi16(128));
+                return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+            }
+            inline __m128i koi_BroadcastAlpha(__m128i v) { // Alpha into all four lanes of each 16 bit pixel
+                return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+            }
+        #elif defined(KOI_SIMD_NEON)
+            inline uint8x8_t koi_MulDiv255(uint8x8_t a, uint8x8_t b) {
+                uint16x8_t x = vmull_u8(a, b);
+                return vraddhn_u16(x, vrshrq_n_u16(x, 8));
+            }
+        #endif
+
+
+        // MARK: koi::Premultiply
+        // +------------------------------------------------------------------------------+
+        // | koi::Premultiply - Straight alpha to premultiplied                           |
+        // +------------------------------------------------------------------------------+
+        void Premultiply(const Color* src, Color* dst, int32_t count) {
+            int32_t i = 0;
+            #if defined(KOI_SIMD_SSE2)
+                const __m128i zero = _mm_setzero_si128();
+                const __m128i mAlpha = _mm_set1_epi32(int32_t(0xFF000000));
+                for (; i + 4 <= count; i += 4) {
+                    __m128i v  = _mm_loadu_si128((const __m128i*)(src + i));
+                    __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+                    lo = koi_Div255(_mm_mullo_epi16(lo, koi_BroadcastAlpha(lo)));
+                    hi = koi_Div255(_mm_mullo_epi16(hi, koi_BroadcastAlpha(hi)));
+                    __m128i r = _mm_or_si128(_mm_andnot_si128(mAlpha, _mm_packus_epi16(lo, hi)), _mm_and_si128(v, mAlpha));
+                    _mm_storeu_si128((__m128i*)(dst + i), r);
+                }
+            #elif defined(KOI_SIMD_NEON)
+                for (; i + 8 <= count; i += 8) {
+                    uint8x8x4_t v = vld4_u8((const uint8_t*)(src + i));
+                    v.val[0] = koi_MulDiv255(v.val[0], v.val[3]);
+                    v.val[1] = koi_MulDiv255(v.val[1], v.val[3]);
+                    v.val[2] = koi_MulDiv255(v.val[2], v.val[3]);
+                    vst4_u8((uint8_t*)(dst + i), v);
+                }
+            #endif
+            for (; i < count; i++) {
+                Color c = src[i];
+                dst[i] = Color(uint8_t(Div255(c.r * c.a)), uint8_t(Div255(c.g * c.a)), uint8_t(Div255(c.b * c.a)), c.a);
+            }
+        }
+
+
+        // MARK: koi::Unpremultiply
+        // +------------------------------------------------------------------------------+
+        // | koi::Unpremultiply - Premultiplied alpha back to straight                    |
+        // +------------------------------------------------------------------------------+
+        // A division per channel does not vectorise on SSE2 or NEON, this is a reciprocal
+        // table lookup and a multiply instead, which the compiler unrolls well.
+        void Unpremultiply(const Color* src, Color* dst, int32_t count) {
+            static const std::array<uint32_t, 256> vRecip = [] {
+                std::array<uint32_t, 256> t;
+                t[0] = 0;
+                for (uint32_t a = 1; a < 256; a++) t[a] = (255 * 65536 + a / 2) / a; // 16.16
+                return t;
+            }();
+            for (int32_t i = 0; i < count; i++) {
+                Color c = src[i];
+                uint32_t k = vRecip[c.a];
+                dst[i] = Color(uint8_t(std::min<uint32_t>((c.r * k + 32768) >> 16, 255)),
+                               uint8_t(std::min<uint32_t>((c.g * k + 32768) >> 16, 255)),
+                               uint8_t(std::min<uint32_t>((c.b * k + 32768) >> 16, 255)), c.a);
+            }
+        }
+
+
+        // MARK: koi::SwizzleRB
+        // +------------------------------------------------------------------------------+
+        // | koi::SwizzleRB - RGBA <-> BGRA                                               |
+        // +------------------------------------------------------------------------------+
+        void SwizzleRB(const Color* src, Color* dst, int32_t count) {
+            int32_t i = 0;
+            #if defined(KOI_SIMD_SSE2)
+                const __m128i mGA = _mm_set1_epi32(int32_t(0xFF00FF00)), mR = _mm_set1_epi32(0xFF);
+                for (; i + 4 <= count; i += 4) {
+                    __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+                    __m128i r = _mm_or_si128(_mm_and_si128(v, mGA),
+                                _mm_or_si128(_mm_slli_epi32(_mm_and_si128(v, mR), 16), _mm_and_si128(_mm_srli_epi32(v, 16), mR)));
+                    _mm_storeu_si128((__m128i*)(dst + i), r);
+                }
+            #elif defined(KOI_SIMD_NEON)
+                for (; i + 8 <= count; i += 8) {
+                    uint8x8x4_t v = vld4_u8((const uint8_t*)(src + i));
+                    uint8x8_t t = v.val[0]; v.val[0] = v.val[2]; v.val[2] = t;
+                    vst4_u8((uint8_t*)(dst + i), v);
+                }
+            #endif
+            for (; i < count; i++) {
+                uint32_t n = src[i].n;
+                dst[i].n = (n & 0xFF00FF00) | ((n & 0xFF) << 16) | ((n >> 16) & 0xFF);
+            }
+        }
+
+
+        // MARK: koi::ToRGB565
+        // +------------------------------------------------------------------------------+
+        // | koi::ToRGB565 - Drops alpha and truncates to 5:6:5, red in the top bits      |
+        // +------------------------------------------------------------------------------+
+        void ToRGB565(const Color* src, uint16_t* dst, int32_t count) {
+            int32_t i = 0;
+            #if defined(KOI_SIMD_SSE2)
+                const __m128i mR = _mm_set1_epi32(0xF8), mG = _mm_set1_epi32(0xFC00), mB = _mm_set1_epi32(0xF80000);
+                for (; i + 8 <= count; i += 8) {
+                    __m128i p[2];
+                    for (int32_t k = 0; k < 2; k++) {
+                        __m128i v = _mm_loadu_si128((const __m128i*)(src + i + k * 4));
+                        __m128i r = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(v, mR), 8),
+                                    _mm_or_si128(_mm_srli_epi32(_mm_and_si128(v, mG), 5), _mm_srli_epi32(_mm_and_si128(v, mB), 19)));
+                        p[k] = _mm_srai_epi32(_mm_slli_epi32(r, 16), 16); // Sign extend so the saturating pack keeps the bits
+                    }
+                    _mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(p[0], p[1]));
+                }
+            #elif defined(KOI_SIMD_NEON)
+                for (; i + 8 <= count; i += 8) {
+                    uint8x8x4_t v = vld4_u8((const uint8_t*)(src + i));
+                    uint16x8_t r = vshll_n_u8(vshr_n_u8(v.val[0], 3), 8);
+                    r = vorrq_u16(vshlq_n_u16(r, 3), vshlq_n_u16(vmovl_u8(vshr_n_u8(v.val[1], 2)), 5));
+                    r = vorrq_u16(r, vmovl_u8(vshr_n_u8(v.val[2], 3)));
+                    vst1q_u16(dst + i, r);
+                }
+            #endif
+            for (; i < count; i++) {
+                Color c = src[i];
+                dst[i] = uint16_t(((c.r >> 3) << 11) | ((c.g >> 2) << 5) | (c.b >> 3));
+            }
+        }
+
+
+        // MARK: koi::ToGrey
+        // +------------------------------------------------------------------------------+
+        // | koi::ToGrey - Rec. 601 luma, (77 r + 150 g + 29 b + 128) / 256               |
+        // +------------------------------------------------------------------------------+
+        void ToGrey(const Color* src, uint8_t* dst, int32_t count) {
+            int32_t i = 0;
+            #if defined(KOI_SIMD_SSE2)
+                const __m128i zero = _mm_setzero_si128(), w = _mm_setr_epi16(77, 150, 29, 0, 77, 150, 29, 0);
+                const __m128i round = _mm_set1_epi32(128);
+                for (; i + 4 <= count; i += 4) {
+                    __m128i v  = _mm_loadu_si128((const __m128i*)(src + i));
+                    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), w);   // r g pair, b a pair, per pixel
+                    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), w);
+                    lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+                    hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+                    __m128i s = _mm_unpacklo_epi64(_mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 0, 2, 0)));
+                    s = _mm_srli_epi32(_mm_add_epi32(s, round), 8);
+                    s = _mm_packus_epi16(_mm_packs_epi32(s, zero), zero);
+                    int32_t n = _mm_cvtsi128_si32(s);
+                    memcpy(dst + i, &n, 4);
+                }
+            #elif defined(KOI_SIMD_NEON)
+                for (; i + 8 <= count; i += 8) {
+                    uint8x8x4_t v = vld4_u8((const uint8_t*)(src + i));
+                    uint16x8_t s = vmull_u8(v.val[0], vdup_n_u8(77));
+                    s = vmlal_u8(s, v.val[1], vdup_n_u8(150));
+                    s = vmlal_u8(s, v.val[2], vdup_n_u8(29));
+                    vst1_u8(dst + i, vrshrn_n_u16(s, 8));
+                }
+            #endif
+            for (; i < count; i++) dst[i] = uint8_t((77 * src[i].r + 150 * src[i].g + 29 * src[i].b + 128) >> 8);
+        }
+
+
+        // MARK: koi::BlendPremultiplied
+        // +------------------------------------------------------------------------------+
+        // | koi::BlendPremultiplied - dst = src * f + dst * (1 - src.a * f)              |
+        // +------------------------------------------------------------------------------+
+        // Porter-Duff over for a premultiplied source, alpha included. nFactor is the
+        // global blend factor in 0..255, at 255 that is one multiply-add per channel.
+        void BlendPremultiplied(Color* dst, const Color* src, int32_t count, uint32_t nFactor = 255) {
+            int32_t i = 0;
+            #if defined(KOI_SIMD_SSE2)
+                const __m128i zero = _mm_setzero_si128(), m255 = _mm_set1_epi16(255), f = _mm_set1_epi16(int16_t(nFactor));
+                for (; i + 4 <= count; i += 4) {
+                    __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+                    __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+                    __m128i slo = _mm_unpacklo_epi8(s, zero), shi = _mm_unpackhi_epi8(s, zero);
+                    if (nFactor < 255) { slo = koi_Div255(_mm_mullo_epi16(slo, f)); shi = koi_Div255(_mm_mullo_epi16(shi, f)); }
+                    __m128i dlo = koi_Div255(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(m255, koi_BroadcastAlpha(slo))));
+                    __m128i dhi = koi_Div255(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(m255, koi_BroadcastAlpha(shi))));
+                    _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(_mm_add_epi16(slo, dlo), _mm_add_epi16(shi, dhi)));
+                }
+            #elif defined(KOI_SIMD_NEON)
+                const uint8x8_t f = vdup_n_u8(uint8_t(nFactor));
+                for (; i + 8 <= count; i += 8) {
+                    uint8x8x4_t s = vld4_u8((const uint8_t*)(src + i));
+                    uint8x8x4_t d = vld4_u8((const uint8_t*)(dst + i));
+                    if (nFactor < 255) for (int32_t c = 0; c < 4; c++) s.val[c] = koi_MulDiv255(s.val[c], f);
+                    uint8x8_t ia = vmvn_u8(s.val[3]);
+                    for (int32_t c = 0; c < 4; c++) d.val[c] = vqadd_u8(s.val[c], koi_MulDiv255(d.val[c], ia));
+                    vst4_u8((uint8_t*)(dst + i), d);
+                }
+            #endif
+            for (; i < count; i++) {
+                Color s = src[i], d = dst[i];
+                if (nFactor < 255) s = Color(uint8_t(Div255(s.r * nFactor)), uint8_t(Div255(s.g * nFactor)), uint8_t(Div255(s.b * nFactor)), uint8_t(Div255(s.a * nFactor)));
+                uint32_t ia = 255 - s.a;
+                dst[i] = Color(uint8_t(std::min<uint32_t>(s.r + Div255(d.r * ia), 255)), uint8_t(std::min<uint32_t>(s.g + Div255(d.g * ia), 255)),
+                               uint8_t(std::min<uint32_t>(s.b + Div255(d.b * ia), 255)), uint8_t(s.a + Div255(d.a * ia)));
+            }
+        }
+    }
+
+#endif /* PixelFormat_h */
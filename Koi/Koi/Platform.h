@@ -7,6 +7,8 @@
 
 #ifndef Platform_h
     #define Platform_h
+    #include <mutex>
+    #include <condition_variable>
     #include "Global.h"
 
     namespace koi {
@@ -23,10 +25,41 @@
             virtual koi::rcode ThreadCleanUp        () = 0;
             virtual koi::rcode CreateGraphics       (bool bFullScreen, bool bEnableVSYNC, const koi::Vector2i& vViewPos, const koi::Vector2i& vViewSize) = 0;
             virtual koi::rcode CreateWindowPane     (const koi::Vector2i& vWindowPos, koi::Vector2i& vWindowSize, bool bFullScreen) = 0;
-            virtual koi::rcode SetWindowTitle       (const std::string& s) = 0;
+            virtual koi::rcode SetWindowTitle       (const char* s) = 0;          // Built in the frame arena, copy it if kept
             virtual koi::rcode StartSystemEventLoop () = 0;
             virtual koi::rcode HandleSystemEvent    () = 0;
-            static koi::KoiEngine* ptrPGE;
+            
+            // Idle mode, see KoiEngine::EnableOnDemandRendering. WaitForEvents blocks the engine
+            // thread for up to fTimeout seconds (forever when negative) and returns OK when it was
+            // woken by input or Wake, FAIL when it timed out. Wake may be called from any thread.
+            // The default suits platforms that have no events of their own or pump them on
+            // another thread, whose koi_Update calls wake the engine.
+            virtual koi::rcode WaitForEvents        (float fTimeout);
+            virtual void       Wake                 ();
+            
+            // Owned by the engine, set up in koi_ConfigureSystem
+            koi::KoiEngine*           ptrPGE   = nullptr;
+            koi::Renderer*            renderer = nullptr;
+            std::map<size_t, uint8_t> mapKeys;      // System key code to koi::Key
+            
+        private:
+            std::mutex              mtxWake;
+            std::condition_variable cvWake;
+            bool                    bWoken = false;
         };
+        
+        koi::rcode Platform::WaitForEvents(float fTimeout) {
+            std::unique_lock<std::mutex> lock(mtxWake);
+            auto woken = [this] { return bWoken; };
+            if (fTimeout < 0.0f) cvWake.wait(lock, woken);
+            else if (!cvWake.wait_for(lock, std::chrono::duration<float>(fTimeout), woken)) return koi::FAIL;
+            bWoken = false;
+            return koi::OK;
+        }
+        
+        void Platform::Wake() {
+            { std::lock_guard<std::mutex> lock(mtxWake); bWoken = true; }
+            cvWake.notify_one();
+        }
     }
 #endif /* Platform_h */
@@ -47,13 +47,36 @@
     #include <atomic>
     #include <fstream>
     #include <map>
+    #include <unordered_map>
     #include <functional>
     #include <algorithm>
     #include <array>
     #include <cstring>
+    #include <cstdio>
+    #include "Simd.h"
     #include "Vector2.h"
     #include "Color.h"
     #include "Sprite.h"
+    #include "JobSystem.h"
+    #include "Parallel.h"
+    #include "VectorBatch.h"
+    #include "ImageLoader.h"
+    #include "AssetPack.h"
+    #include "Atlas.h"
+    #include "Mipmap.h"
+    #include "PixelFormat.h"
+    #include "Sampler.h"
+    #include "IndexedSprite.h"
+    #include "RLESprite.h"
+    #include "Font.h"
+    #include "Mat4.h"
+    #include "Pipeline3D.h"
+    #include "Animation.h"
+    #include "ECS.h"
+    #include "Spatial.h"
+    #include "Particles.h"
+    #include "TileMap.h"
+    #include "Audio.h"
     #include "Renderer.h"
     #include "Platform.h"
     #include "Global.h"
@@ -61,6 +84,7 @@
     #include "WindowsPlatform.h"
     #include "LinuxPlatform.h"
     #include "MacintoshPlatform.h"
+    #include "HeadlessPlatform.h"
 
 
     // MARK: Compiler Configuration
@@ -106,21 +130,8 @@
         #define KOI_GFX_OPENGL10
     #endif
 
-    #if defined(_WIN32)
-        #if defined(KOI_IMAGE_STB)
-            #define PGE_ILOADER_STB
-        #else
-            #define PGE_ILOADER_GDI
-        #endif
-    #endif
-
-    #if defined(__linux__) || defined(__APPLE__)
-        #if defined(KOI_IMAGE_STB)
-            #define PGE_ILOADER_STB
-        #else
-            #define PGE_ILOADER_LIBPNG
-        #endif
-    #endif
+    // Images are decoded by the built in PNG / QOI loader in ImageLoader.h on every
+    // platform, there is no external image library to configure.
 #endif // Koi_Engine_DEF
 
 
@@ -132,59 +143,12 @@
 #ifdef KOI_ENGINE_APPLICATION
 #undef KOI_ENGINE_APPLICATION
 
-    // MARK: koi::KoiEngine impl;
-    namespace koi {
-        // Need a couple of statics as these are singleton instances
-        // read from multiple locations
-        std::atomic<bool> KoiEngine::bAtomActive{ false };
-        koi::KoiEngine* koi::Platform::ptrPGE = nullptr;
-        koi::KoiEngine* koi::Renderer::ptrPGE = nullptr;
-    };
-
     // MARK: Platform Specifics;
     // +------------------------------------------------------------------------------+
     // | KoiEngine PLATFORM SPECIFIC IMPLEMENTATIONS                                  |
     // +------------------------------------------------------------------------------+
-
-
-    // MARK: Renderer OpenGL 1.0
-    // +------------------------------------------------------------------------------+
-    // | START RENDERER: OpenGL 1.0 (the original, the best...)                       |
-    // +------------------------------------------------------------------------------+
-    #if defined(KOI_GFX_OPENGL10)
-        #if defined(_WIN32)
-            #include <windows.h>
-            #include <dwmapi.h>
-            #include <GL/gl.h>
-            #pragma comment(lib, "Dwmapi.lib")
-            typedef BOOL(WINAPI wglSwapInterval_t) (int interval);
-            static  wglSwapInterval_t* wglSwapInterval = nullptr;
-            typedef HDC glDeviceContext_t;
-            typedef HGLRC glRenderContext_t;
-        #endif
-
-        #if defined(__linux__) || defined(__FreeBSD__)
-            #include <GL/gl.h>
-            namespace X11 {
-                #include <GL/glx.h>
-                #include <X11/X.h>
-                #include <X11/Xlib.h>
-            }
-
-            typedef int(glSwapInterval_t)(X11::Display* dpy, X11::GLXDrawable drawable, int interval);
-            static  glSwapInterval_t* glSwapIntervalEXT;
-            typedef X11::GLXContext   glDeviceContext_t;
-            typedef X11::GLXContext   glRenderContext_t;
-        #endif
-
-        #if defined(__APPLE__)
-            #define GL_SILENCE_DEPRECATION
-            #include <GLUT/glut.h>
-            #include <OpenGL/OpenGL.h>
-            #include <OpenGL/gl.h>
-            #include <OpenGL/glu.h>
-        #endif
-    #endif
+    // The OpenGL headers come in through Renderer.h, everything below is per engine
+    // instance so any number of engines can run side by side.
 
     // MARK: WINDOWS
     // +------------------------------------------------------------------------------+
@@ -222,35 +186,42 @@
 
     namespace koi {
         void KoiEngine::koi_ConfigureSystem() {
-            #if defined(_WIN32)
-                platform = std::make_unique<koi::Platform_Windows>();
-            #endif
-                    
-            #if defined(__linux__) || defined(__FreeBSD__)
-                platform = std::make_unique<koi::Platform_Linux>();
-            #endif
-                    
-            #if defined(__APPLE__)
-                platform = std::make_unique<koi::Platform_GLUT>();
-            #endif
-                    
-                    
-                    
-            #if defined(KOI_GFX_OPENGL10)
-                renderer = std::make_unique<koi::Renderer_OGL10>();
-            #endif
-                    
-            #if defined(KOI_GFX_OPENGL33)
-                renderer = std::make_unique<koi::Renderer_OGL33>();
-            #endif
-                    
-            #if defined(KOI_GFX_DIRECTX10)
-                renderer = std::make_unique<koi::Renderer_DX10>();
-            #endif
+            if (bHeadless) {
+                // No window or graphics context, frames are only rendered into the screen sprite
+                platform = std::make_unique<koi::Platform_Headless>();
+                renderer = std::make_unique<koi::Renderer_Headless>();
+            } else {
+                #if defined(_WIN32)
+                    platform = std::make_unique<koi::Platform_Windows>();
+                #endif
+                
+                #if defined(__linux__) || defined(__FreeBSD__)
+                    platform = std::make_unique<koi::Platform_Linux>();
+                #endif
                 
-            // Associate components with PGE instance
-            platform->ptrPGE = this;
-            renderer->ptrPGE = this;
+                #if defined(__APPLE__)
+                    platform = std::make_unique<koi::Platform_GLUT>();
+                #endif
+                
+                
+                
+                #if defined(KOI_GFX_OPENGL10)
+                    renderer = std::make_unique<koi::Renderer_OGL10>();
+                #endif
+                
+                #if defined(KOI_GFX_OPENGL33)
+                    renderer = std::make_unique<koi::Renderer_OGL33>();
+                #endif
+                
+                #if defined(KOI_GFX_DIRECTX10)
+                    renderer = std::make_unique<koi::Renderer_DX10>();
+                #endif
+            }
+            
+            // Associate components with this engine instance
+            platform->ptrPGE   = this;
+            platform->renderer = renderer.get();
+            renderer->ptrPGE   = this;
         }
     }
 
@@ -73,12 +73,27 @@ namespace koi {
     }
 
     
+    template<class T> T             DotProduct(const Quaternion<T>& a, const Quaternion<T>& b) { return a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z; }
+    // Both take the shorter way round, b is negated when the two are more than 180 degrees apart
+    template<class T> Quaternion<T> Nlerp(const Quaternion<T>& a, const Quaternion<T>& b, const T& t) {
+        T tb = DotProduct(a, b) < 0 ? -t : t;
+        return Quaternion<T>(a.w * (1 - t) + b.w * tb, a.x * (1 - t) + b.x * tb, a.y * (1 - t) + b.y * tb, a.z * (1 - t) + b.z * tb).normalized();
+    }
+    template<class T> Quaternion<T> Slerp(const Quaternion<T>& a, const Quaternion<T>& b, const T& t) {
+        T d = DotProduct(a, b), sign = d < 0 ? -1 : 1;
+        d *= sign;
+        if (d > T(0.9995)) return Nlerp(a, b, t);   // sin(theta) is too small to divide by
+        T theta = std::acos(d), s = 1 / std::sin(theta);
+        T ka = std::sin((1 - t) * theta) * s, kb = std::sin(t * theta) * s * sign;
+        return Quaternion<T>(a.w * ka + b.w * kb, a.x * ka + b.x * kb, a.y * ka + b.y * kb, a.z * ka + b.z * kb);
+    }
+
     template<class T> Vector3<T>    Quaternion<T>::v()          const { return { x, y, z }; }
     template<class T> T             Quaternion<T>::norm()       const { return this->magnitude(); }
     template<class T> T             Quaternion<T>::magnitude()  const { return (T)(std::sqrt(w * w + x * x + y * y + z * z)); }
     template<class T> T             Quaternion<T>::square()     const { return x * x + y * y + z * z; }
     template<class T> void          Quaternion<T>::normalize()        { T r = 1 / magnitude(); *this *= r; }
-    template<class T> Quaternion<T> Quaternion<T>::normalized() const { T r = 1 / magnitude(); *this * r; }
+    template<class T> Quaternion<T> Quaternion<T>::normalized() const { T r = 1 / magnitude(); return *this * r; }
     template<class T> Quaternion<T> Quaternion<T>::conjugate()  const { return { this->w, -this->x, -this->y, -this->z }; }
     template<class T> Quaternion<T> Quaternion<T>::reciprocal() const { return conjugate() / square(); }
     
@@ -96,7 +111,7 @@ namespace koi {
     template<class T> Quaternion<T>  Quaternion<T>::operator /  (const T& rhs)             const
     { return { this->w / rhs,   this->x / rhs,   this->y / rhs,   this->z / rhs   }; }
     template<class T> Quaternion<T>  Quaternion<T>::operator /  (const Quaternion<T>& rhs) const
-    { return { this->w / rhs.w, this->x / rhs.x, this->y / rhs.y, this->z / rhs.y }; }
+    { return { this->w / rhs.w, this->x / rhs.x, this->y / rhs.y, this->z / rhs.z }; }
     template<class T> Quaternion<T>& Quaternion<T>::operator += (const Quaternion<T>& rhs)
     { this->w += rhs.w; this->x += rhs.x; this->y += rhs.y; this->z += rhs.z; return *this; }
     template<class T> Quaternion<T>& Quaternion<T>::operator -= (const Quaternion<T>& rhs)
@@ -142,10 +157,10 @@ namespace koi {
     template<class T> Quaternion<T> Vector3<T>::operator + (const T& k) const                { return { k, *this }; }
     template<class T> Quaternion<T>             operator + (const T& k, const Vector3<T>& v) { return { k, v     }; }
     
-    template<class T> void       Vector3<T>::rotate (const Quaternion<T>& q)                                           { *this = (q * (0 + *this) * q.conjugate()).v(); }
+    template<class T> void       Vector3<T>::rotate (const Quaternion<T>& q)                                           { *this = (q * (T(0) + *this) * q.conjugate()).v(); }
     template<class T> void       Vector3<T>::rotate (const Vector3& axis,   const T& theta)                            { rotate(GetQuaternion(axis, theta)); }
     template<class T> void       Vector3<T>::rotate (const Vector3& origin, const Vector3& axis, const T& theta)       { *this = origin + (*this - origin).rotated(axis, theta); }
-    template<class T> Vector3<T> Vector3<T>::rotated(const Quaternion<T>& q)                                     const { return (q * (0 + *this) * q.conjugate()).v(); }
+    template<class T> Vector3<T> Vector3<T>::rotated(const Quaternion<T>& q)                                     const { return (q * (T(0) + *this) * q.conjugate()).v(); }
     template<class T> Vector3<T> Vector3<T>::rotated(const Vector3& axis,   const T& theta)                      const { return rotated(GetQuaternion(axis, theta)); }
     template<class T> Vector3<T> Vector3<T>::rotated(const Vector3& origin, const Vector3& axis, const T& theta) const { return origin + (*this - origin).rotated(axis, theta); }
 
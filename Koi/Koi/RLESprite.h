@@ -0,0 +1,65 @@
+//
+//  RLESprite.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef RLESprite_h
+#define RLESprite_h
+
+    #include "Global.h"
+    #include "Sprite.h"
+
+    namespace koi {
+        // MARK: koi::RLESprite
+        // +------------------------------------------------------------------------------+
+        // | koi::RLESprite - Sprite compiled into runs for transparent blitting          |
+        // +------------------------------------------------------------------------------+
+        // Fully transparent pixels are not stored at all, every row is a list of opaque and
+        // translucent runs. Drawing skips the gaps, copies opaque runs and blends the rest.
+        // Rebuild with Compile after changing the source sprite.
+        class RLESprite {
+        public:
+            enum RunType : uint8_t { OPAQUE, BLEND };
+            struct Run {
+                int32_t x;          // Start within the row
+                int32_t nLength;
+                int32_t nPixel;     // First pixel in vPixels
+                RunType type;
+            };
+
+            RLESprite() = default;
+            explicit RLESprite(const SpriteView& spr) { Compile(spr); }
+
+            void Compile(const SpriteView& spr);
+
+            int32_t            width  = 0;
+            int32_t            height = 0;
+            bool               bPremultiplied = false;
+            std::vector<Run>   vRuns;
+            std::vector<int32_t> vRowStart;     // Runs of row y are [vRowStart[y], vRowStart[y + 1])
+            std::vector<Color> vPixels;
+        };
+
+        void RLESprite::Compile(const SpriteView& spr) {
+            width = spr.width; height = spr.height; bPremultiplied = spr.bPremultiplied;
+            vRuns.clear(); vPixels.clear();
+            vRowStart.assign(size_t(std::max(height, 0)) + 1, 0);
+            for (int32_t y = 0; y < height; y++) {
+                const Color* row = spr.GetRow(y);
+                int32_t x = 0;
+                while (x < width) {
+                    if (row[x].a == 0) { x++; continue; }
+                    RunType type = row[x].a == 255 ? OPAQUE : BLEND;
+                    int32_t x0 = x;
+                    while (x < width && row[x].a != 0 && (row[x].a == 255) == (type == OPAQUE)) x++;
+                    vRuns.push_back({ x0, x - x0, int32_t(vPixels.size()), type });
+                    vPixels.insert(vPixels.end(), row + x0, row + x);
+                }
+                vRowStart[y + 1] = int32_t(vRuns.size());
+            }
+        }
+    }
+
+#endif /* RLESprite_h */
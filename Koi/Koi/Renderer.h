@@ -28,11 +28,36 @@
             virtual void            DrawWindowQuad(const koi::Vector2f& offset, const koi::Vector2f& scale, const koi::Color tint) = 0;
             virtual uint32_t        CreateTexture (const uint32_t       width , const uint32_t       height)                       = 0;
             virtual void            UpdateTexture (      uint32_t id,                 koi::Sprite*   spr)                          = 0;
+            virtual void            UpdateSubTexture(    uint32_t id,                 const koi::SpriteView& view)                 = 0; // Into the top left, keeps the texture's size if the view fits
             virtual uint32_t        DeleteTexture (const uint32_t id)                                                              = 0;
             virtual void            ApplyTexture  (      uint32_t id)                                                              = 0;
             virtual void            UpdateViewport(const koi::Vector2i& pos   , const koi::Vector2i& size)                         = 0;
             virtual void            ClearBuffer   (koi::Color           p     , bool bDepth)                                       = 0;
-            static  koi::KoiEngine* ptrPGE;
+            koi::KoiEngine*         ptrPGE = nullptr;                                                                      // Owning engine
+        };
+        
+        
+        // MARK: koi::Renderer_Headless
+        // +------------------------------------------------------------------------------+
+        // | koi::Renderer_Headless - Renderer without a device, frames stay in memory    |
+        // +------------------------------------------------------------------------------+
+        // Used by engines started without a window, e.g. tests, servers or several
+        // simulations running at once. The screen sprite is the only output.
+        class Renderer_Headless : public koi::Renderer {
+        public:
+            void            PrepareDevice ()                                                                               override { }
+            koi::rcode      CreateDevice  (std::vector<void*>,          bool,                           bool)                  override { return koi::OK; }
+            koi::rcode      DestroyDevice ()                                                                               override { return koi::OK; }
+            void            DisplayFrame  ()                                                                               override { }
+            void            PrepareDrawing()                                                                               override { }
+            void            DrawWindowQuad(const koi::Vector2f&,        const koi::Vector2f&,           const koi::Color)      override { }
+            uint32_t        CreateTexture (const uint32_t,              const uint32_t)                                    override { return 0; }
+            void            UpdateTexture (      uint32_t,                    koi::Sprite*)                                override { }
+            void            UpdateSubTexture(    uint32_t,                    const koi::SpriteView&)                      override { }
+            uint32_t        DeleteTexture (const uint32_t id)                                                              override { return id; }
+            void            ApplyTexture  (      uint32_t)                                                                 override { }
+            void            UpdateViewport(const koi::Vector2i&,        const koi::Vector2i&)                              override { }
+            void            ClearBuffer   (koi::Color,                  bool)                                              override { }
         };
     }
     
@@ -50,7 +75,6 @@
             #include <GL/gl.h>
             #pragma comment(lib, "Dwmapi.lib")
             typedef BOOL(WINAPI wglSwapInterval_t) (int interval);
-            static  wglSwapInterval_t* wglSwapInterval = nullptr;
             typedef HDC                glDeviceContext_t;
             typedef HGLRC              glRenderContext_t;
         #endif
@@ -64,7 +88,6 @@
             }
 
             typedef int(glSwapInterval_t)(X11::Display* dpy, X11::GLXDrawable drawable, int interval);
-            static  glSwapInterval_t* glSwapIntervalEXT;
             typedef X11::GLXContext   glDeviceContext_t;
             typedef X11::GLXContext   glRenderContext_t;
         #endif
@@ -88,8 +111,14 @@
                 #endif
             
                 bool bSync = false;
+                std::unordered_map<uint32_t, koi::Vector2i> mapTextureSize;   // Allocated size of every texture
+            
+                #if defined(_WIN32)
+                    wglSwapInterval_t* wglSwapInterval = nullptr;
+                #endif
             
                 #if defined(__linux__) || defined(__FreeBSD__)
+                    glSwapInterval_t* glSwapIntervalEXT = nullptr;
                     X11::Display*     koi_Display    = nullptr;
                     X11::Window*      koi_Window     = nullptr;
                     X11::XVisualInfo* koi_VisualInfo = nullptr;
@@ -226,8 +255,6 @@
                 }
             
                 uint32_t CreateTexture(const uint32_t width, const uint32_t height) override {
-                    UNUSED(width);
-                    UNUSED(height);
                     uint32_t id = 0;
                     glGenTextures(1, &id);
                     glBindTexture(GL_TEXTURE_2D, id);
@@ -236,14 +263,30 @@
                     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
                     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
                     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+                    mapTextureSize[id] = { int32_t(width), int32_t(height) };
                     return id;
                 }
             
-                uint32_t DeleteTexture(const uint32_t id) override { glDeleteTextures(1, &id); return id; }
+                uint32_t DeleteTexture(const uint32_t id) override { glDeleteTextures(1, &id); mapTextureSize.erase(id); return id; }
             
                 void UpdateTexture(uint32_t id, koi::Sprite* spr) override {
-                    UNUSED(id);
+                    glPixelStorei(GL_UNPACK_ROW_LENGTH, spr->stride); // Rows are padded out to 64 bytes
                     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, spr->width, spr->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, spr->GetData());
+                    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+                    mapTextureSize[id] = { spr->width, spr->height };
+                }
+            
+                void UpdateSubTexture(uint32_t id, const koi::SpriteView& view) override {
+                    // Storage is only reallocated when the view outgrows it, otherwise the rows are copied in place
+                    koi::Vector2i& size = mapTextureSize[id];
+                    if (view.width > size.x || view.height > size.y) {
+                        size = { std::max(view.width, size.x), std::max(view.height, size.y) };
+                        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+                    }
+                    glPixelStorei(GL_UNPACK_ROW_LENGTH, view.stride);
+                    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, view.width, view.height, GL_RGBA, GL_UNSIGNED_BYTE, view.pData);
+                    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
                 }
             
                 void ApplyTexture(uint32_t id) override { glBindTexture(GL_TEXTURE_2D, id); }
@@ -0,0 +1,134 @@
+//
+//  Sampler.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef Sampler_h
+#define Sampler_h
+
+    #include "Global.h"
+    #include "Sprite.h"
+
+    namespace koi {
+        // MARK: koi::Sampler
+        // +------------------------------------------------------------------------------+
+        // | koi::Sampler - Texel addressing and filtering                                |
+        // +------------------------------------------------------------------------------+
+        // Float coordinates are normalised, 0..1 across the sprite, with texel centres at
+        // (i + 0.5) / size. Spans step in 16.16 fixed point, so a span stays exact to a 65536th
+        // of a texel however long it is.
+        struct Sampler {
+            enum Address { CLAMP, REPEAT, MIRROR };
+            enum Filter  { NEAREST, BILINEAR };
+
+            Address addrU  = CLAMP;
+            Address addrV  = CLAMP;
+            Filter  filter = NEAREST;
+
+            Sampler(Address a = CLAMP, Filter f = NEAREST) : addrU(a), addrV(a), filter(f) {}
+            Sampler(Address u, Address v, Filter f) : addrU(u), addrV(v), filter(f) {}
+
+            static int32_t Wrap(int32_t i, int32_t n, Address a);   // Any i, n > 0
+
+            Color Fetch     (const SpriteView& spr, int32_t x, int32_t y) const;     // Addressed, never filtered
+            Color Sample    (const SpriteView& spr, float u, float v) const;
+            void  SampleSpan(const SpriteView& spr, float u, float v, float du, float dv, Color* out, int32_t count) const;
+            void  FetchRow  (const SpriteView& spr, int32_t x, int32_t y, Color* out, int32_t count) const; // out[i] = Fetch(x + i, y)
+
+        private:
+            Color koi_Bilinear(const SpriteView& spr, int64_t fx, int64_t fy) const; // 16.16 texel space, centres on integers
+        };
+
+        int32_t Sampler::Wrap(int32_t i, int32_t n, Address a) {
+            if (a == CLAMP) return i < 0 ? 0 : (i >= n ? n - 1 : i);
+            bool bPow2 = (n & (n - 1)) == 0;
+            if (a == REPEAT) {
+                if (bPow2) return i & (n - 1);
+                i %= n;
+                return i < 0 ? i + n : i;
+            }
+            // MIRROR repeats with period 2n, the second half running backwards
+            int32_t p = n * 2;
+            if (bPow2) i &= p - 1;
+            else     { i %= p; if (i < 0) i += p; }
+            return i < n ? i : p - 1 - i;
+        }
+
+        Color Sampler::Fetch(const SpriteView& spr, int32_t x, int32_t y) const {
+            if (spr.Empty()) return Color::BLANK;
+            return spr.GetRow(Wrap(y, spr.height, addrV))[Wrap(x, spr.width, addrU)];
+        }
+
+        Color Sampler::Sample(const SpriteView& spr, float u, float v) const {
+            Color c;
+            SampleSpan(spr, u, v, 0.0f, 0.0f, &c, 1);
+            return c;
+        }
+
+        Color Sampler::koi_Bilinear(const SpriteView& spr, int64_t fx, int64_t fy) const {
+            int32_t x0 = int32_t(fx >> 16), y0 = int32_t(fy >> 16);
+            uint32_t wx = uint32_t(fx >> 8) & 0xFF, wy = uint32_t(fy >> 8) & 0xFF;
+            int32_t xa = Wrap(x0, spr.width, addrU), xb = Wrap(x0 + 1, spr.width,  addrU);
+            const Color* r0 = spr.GetRow(Wrap(y0,     spr.height, addrV));
+            const Color* r1 = spr.GetRow(Wrap(y0 + 1, spr.height, addrV));
+
+            // Two channels per multiply, red/blue and green/alpha each sit in 0x00FF00FF lanes
+            auto lerp = [](uint32_t a, uint32_t b, uint32_t w) {
+                uint32_t rb = (((a & 0x00FF00FF) * (256 - w) + (b & 0x00FF00FF) * w) >> 8) & 0x00FF00FF;
+                uint32_t ga = (((a >> 8) & 0x00FF00FF) * (256 - w) + ((b >> 8) & 0x00FF00FF) * w) & 0xFF00FF00;
+                return rb | ga;
+            };
+            return Color(lerp(lerp(r0[xa].n, r0[xb].n, wx), lerp(r1[xa].n, r1[xb].n, wx), wy));
+        }
+
+        void Sampler::SampleSpan(const SpriteView& spr, float u, float v, float du, float dv, Color* out, int32_t count) const {
+            if (spr.Empty()) { std::fill_n(out, count, Color::BLANK); return; }
+            int64_t fx  = int64_t(double(u) * spr.width  * 65536.0), fy  = int64_t(double(v) * spr.height * 65536.0);
+            int64_t fdx = int64_t(double(du) * spr.width * 65536.0), fdy = int64_t(double(dv) * spr.height * 65536.0);
+
+            if (filter == BILINEAR) {
+                fx -= 0x8000; fy -= 0x8000; // Texel centres onto integer coordinates
+                for (int32_t i = 0; i < count; i++, fx += fdx, fy += fdy) out[i] = koi_Bilinear(spr, fx, fy);
+                return;
+            }
+
+            // Power of two repeat is the tiled background case, keep it down to two masks
+            int32_t w = spr.width, h = spr.height;
+            if (addrU == REPEAT && addrV == REPEAT && (w & (w - 1)) == 0 && (h & (h - 1)) == 0) {
+                for (int32_t i = 0; i < count; i++, fx += fdx, fy += fdy)
+                    out[i] = spr.GetRow(int32_t(fy >> 16) & (h - 1))[int32_t(fx >> 16) & (w - 1)];
+                return;
+            }
+            for (int32_t i = 0; i < count; i++, fx += fdx, fy += fdy)
+                out[i] = spr.GetRow(Wrap(int32_t(fy >> 16), h, addrV))[Wrap(int32_t(fx >> 16), w, addrU)];
+        }
+
+        void Sampler::FetchRow(const SpriteView& spr, int32_t x, int32_t y, Color* out, int32_t count) const {
+            if (spr.Empty()) { std::fill_n(out, count, Color::BLANK); return; }
+            const Color* row = spr.GetRow(Wrap(y, spr.height, addrV));
+            int32_t w = spr.width;
+
+            if (addrU == REPEAT) {
+                // Whole runs of the row at a time
+                int32_t sx = Wrap(x, w, REPEAT);
+                while (count > 0) {
+                    int32_t n = std::min(count, w - sx);
+                    memcpy((void*)out, row + sx, n * sizeof(Color));
+                    out += n; count -= n; sx = 0;
+                }
+            } else if (addrU == CLAMP) {
+                int32_t nLeft = std::min(count, std::max(0, -x));
+                std::fill_n(out, nLeft, row[0]);
+                out += nLeft; count -= nLeft; x += nLeft;
+                int32_t nMid = std::min(count, std::max(0, w - x));
+                if (nMid > 0) { memcpy((void*)out, row + x, nMid * sizeof(Color)); out += nMid; count -= nMid; }
+                std::fill_n(out, count, row[w - 1]);
+            } else {
+                for (int32_t i = 0; i < count; i++) out[i] = row[Wrap(x + i, w, MIRROR)];
+            }
+        }
+    }
+
+#endif /* Sampler_h */
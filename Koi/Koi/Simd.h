@@ -0,0 +1,31 @@
+//
+//  Simd.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef Simd_h
+#define Simd_h
+
+    // Picks the widest instruction set the compiler was told it may use. Every kernel keeps
+    // a scalar path, so defining KOI_NO_SIMD gives a portable build to compare against.
+    #if !defined(KOI_NO_SIMD)
+        #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+            #define KOI_SIMD_SSE2
+            #include <emmintrin.h>
+            #if defined(__SSE4_1__)
+                #define KOI_SIMD_SSE41
+                #include <smmintrin.h>
+            #endif
+            #if defined(__AVX2__)
+                #define KOI_SIMD_AVX2
+                #include <immintrin.h>
+            #endif
+        #elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+            #define KOI_SIMD_NEON
+            #include <arm_neon.h>
+        #endif
+    #endif
+
+#endif /* Simd_h */
@@ -0,0 +1,674 @@
+//
+//  Spatial.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef Spatial_h
+#define Spatial_h
+
+    #include <algorithm>
+    #include <cmath>
+    #include <limits>
+    #include <vector>
+    #include "Vector2.h"
+    #include "Parallel.h"
+
+    namespace koi {
+        // MARK: koi::AABB
+        // +------------------------------------------------------------------------------+
+        // | koi::AABB - Axis aligned box, min inclusive, max inclusive                   |
+        // +------------------------------------------------------------------------------+
+        struct AABB {
+            Vector2f vMin;
+            Vector2f vMax;
+
+            Vector2f Center  ()                const { return { (vMin.x + vMax.x) * 0.5f, (vMin.y + vMax.y) * 0.5f }; }
+            Vector2f Size    ()                const { return { vMax.x - vMin.x, vMax.y - vMin.y }; }
+            bool     Overlaps(const AABB& b)   const { return vMin.x <= b.vMax.x && b.vMin.x <= vMax.x && vMin.y <= b.vMax.y && b.vMin.y <= vMax.y; }
+            bool     Contains(const AABB& b)   const { return vMin.x <= b.vMin.x && b.vMax.x <= vMax.x && vMin.y <= b.vMin.y && b.vMax.y <= vMax.y; }
+            AABB     Merged  (const AABB& b)   const { return { { std::min(vMin.x, b.vMin.x), std::min(vMin.y, b.vMin.y) }, { std::max(vMax.x, b.vMax.x), std::max(vMax.y, b.vMax.y) } }; }
+
+            static AABB FromCircle(const Vector2f& c, float r) { return { { c.x - r, c.y - r }, { c.x + r, c.y + r } }; }
+        };
+
+
+        // MARK: koi::SpatialProxy
+        // +------------------------------------------------------------------------------+
+        // | koi::SpatialProxy - One object in a spatial index                            |
+        // +------------------------------------------------------------------------------+
+        // A box, or a circle when fRadius >= 0 (box is then its bounds). Queries and pair
+        // tests use the exact shape. nUser is free for the caller, e.g. an entity index.
+        struct SpatialProxy {
+            AABB     box;
+            Vector2f vCenter;
+            float    fRadius = -1.0f;
+            uint32_t nUser   = 0;
+        };
+
+        struct SpatialPair { int32_t a, b; };                       // a < b
+        struct RayHit      { int32_t nId = -1; float fT = 0.0f; };  // Point is origin + dir * fT
+
+        float koi_BoxDistanceSq(const AABB& b, const Vector2f& p) {
+            float dx = std::max(std::max(b.vMin.x - p.x, 0.0f), p.x - b.vMax.x);
+            float dy = std::max(std::max(b.vMin.y - p.y, 0.0f), p.y - b.vMax.y);
+            return dx * dx + dy * dy;
+        }
+
+        bool koi_Overlap(const SpatialProxy& a, const SpatialProxy& b) {
+            if (!a.box.Overlaps(b.box)) return false;
+            if (a.fRadius >= 0.0f && b.fRadius >= 0.0f) {
+                float r = a.fRadius + b.fRadius;
+                return (a.vCenter - b.vCenter).square() <= r * r;
+            }
+            if (a.fRadius >= 0.0f) return koi_BoxDistanceSq(b.box, a.vCenter) <= a.fRadius * a.fRadius;
+            if (b.fRadius >= 0.0f) return koi_BoxDistanceSq(a.box, b.vCenter) <= b.fRadius * b.fRadius;
+            return true;
+        }
+
+        bool koi_OverlapCircle(const SpatialProxy& p, const Vector2f& c, float r) {
+            if (p.fRadius >= 0.0f) return (p.vCenter - c).square() <= (p.fRadius + r) * (p.fRadius + r);
+            return koi_BoxDistanceSq(p.box, c) <= r * r;
+        }
+
+        // Slab test, fT is where the ray enters [0, fMaxT], a ray starting inside hits at 0
+        bool koi_RayBox(const AABB& b, const Vector2f& o, const Vector2f& d, float fMaxT, float& fT, float* pExit = nullptr) {
+            float t0 = 0.0f, t1 = fMaxT;
+            const float os[2] = { o.x, o.y }, ds[2] = { d.x, d.y };
+            const float mn[2] = { b.vMin.x, b.vMin.y }, mx[2] = { b.vMax.x, b.vMax.y };
+            for (int32_t i = 0; i < 2; i++) {
+                if (ds[i] == 0.0f) { if (os[i] < mn[i] || os[i] > mx[i]) return false; continue; }
+                float inv = 1.0f / ds[i];
+                float ta = (mn[i] - os[i]) * inv, tb = (mx[i] - os[i]) * inv;
+                if (ta > tb) std::swap(ta, tb);
+                t0 = std::max(t0, ta); t1 = std::min(t1, tb);
+                if (t0 > t1) return false;
+            }
+            fT = t0;
+            if (pExit) *pExit = t1;
+            return true;
+        }
+
+        bool koi_RayShape(const SpatialProxy& p, const Vector2f& o, const Vector2f& d, float fMaxT, float& fT) {
+            if (p.fRadius < 0.0f) return koi_RayBox(p.box, o, d, fMaxT, fT);
+            Vector2f m = o - p.vCenter;
+            float a = d.square(), b = DotProduct(m, d), c = m.square() - p.fRadius * p.fRadius;
+            if (c <= 0.0f) { fT = 0.0f; return true; }
+            float disc = b * b - a * c;
+            if (a == 0.0f || disc < 0.0f || b > 0.0f) return false;
+            fT = (-b - std::sqrt(disc)) / a;
+            return fT <= fMaxT;
+        }
+
+
+        // MARK: koi::SpatialHash
+        // +------------------------------------------------------------------------------+
+        // | koi::SpatialHash - Uniform grid of buckets, only occupied cells are stored   |
+        // +------------------------------------------------------------------------------+
+        // Best when objects are of similar size, pick a cell size close to that size. A
+        // proxy is linked into every cell it covers. Moving within the same cells only
+        // rewrites its box, so slowly moving objects cost almost nothing to update.
+        // Cells live in one open addressed table and list nodes in one flat array with a
+        // free list, nothing is allocated per object once the arrays have grown. A proxy
+        // covering more than nMaxProxyCells cells goes on an overflow list instead, which
+        // every query and pair test checks directly, so one huge box can't flood the table.
+        class SpatialHash {
+        public:
+            explicit SpatialHash(float fCellSize = 32.0f);
+
+            int32_t Insert      (const AABB& box, uint32_t nUser = 0);                  // Returns the proxy id
+            int32_t InsertCircle(const Vector2f& c, float r, uint32_t nUser = 0);
+            void    Move        (int32_t nId, const AABB& box);
+            void    MoveCircle  (int32_t nId, const Vector2f& c, float r);
+            void    Remove      (int32_t nId);
+            void    Clear       ();
+            int32_t Size        () const { return nProxies; }
+            const SpatialProxy& GetProxy(int32_t nId) const { return vProxies[nId]; }
+
+            // Results are appended, every proxy is reported once
+            void QueryRange (const AABB& box, std::vector<int32_t>& vOut) const;
+            void QueryRadius(const Vector2f& c, float r, std::vector<int32_t>& vOut) const;
+            bool Raycast    (const Vector2f& o, const Vector2f& d, float fMaxT, RayHit& hit) const;  // Nearest hit
+            void FindPairs  (std::vector<SpatialPair>& vOut, bool bParallel = true) const;           // Every overlapping pair once, in a stable order
+
+        private:
+            static constexpr int64_t nMaxProxyCells = 64;
+
+            struct Proxy : SpatialProxy {
+                int32_t ix0 = 0, iy0 = 0, ix1 = -1, iy1 = -1;      // Covered cells, empty when ix1 < ix0 (free slot)
+                bool    bOversized = false;                         // On vOversized instead of in the cells
+            };
+            struct Cell { uint64_t nKey = 0; int32_t nHead = -2; };  // -2 never used, -1 used but empty
+            struct Node { int32_t nProxy; int32_t nNext; };
+
+            static uint64_t koi_Key (int32_t ix, int32_t iy) { return (uint64_t(uint32_t(ix)) << 32) | uint32_t(iy); }
+            static uint64_t koi_Hash(uint64_t k)             { k ^= k >> 33; k *= 0xFF51AFD7ED558CCDull; k ^= k >> 33; return k; }
+            static AABB     koi_NoBox()                      { const float inf = std::numeric_limits<float>::infinity(); return { { inf, inf }, { -inf, -inf } }; }
+            int32_t koi_Cell    (int32_t ix, int32_t iy, bool bCreate);
+            int32_t koi_FindCell(int32_t ix, int32_t iy) const;
+            void    koi_Link    (int32_t nId);
+            void    koi_Unlink  (int32_t nId);
+            void    koi_Rehash  (size_t nSize);
+            void    koi_CellRange(const AABB& box, int32_t& ix0, int32_t& iy0, int32_t& ix1, int32_t& iy1) const;
+            int32_t koi_Add     (const SpatialProxy& p);
+            void    koi_Update  (int32_t nId, const SpatialProxy& p);
+            void    koi_PairsOf (int32_t nId, std::vector<SpatialPair>& vOut) const;
+
+            float               fCellSize, fInvCellSize;
+            std::vector<Proxy>  vProxies;
+            std::vector<int32_t> vFreeProxies;
+            std::vector<Cell>   vCells;                              // Power of two size
+            size_t              nUsedCells = 0;
+            std::vector<Node>   vNodes;
+            std::vector<int32_t> vOversized;
+            int32_t             nFreeNode  = -1;
+            int32_t             nProxies   = 0;
+            AABB                boxAll     = koi_NoBox();            // Grows to hold every proxy ever linked into cells, bounds rays
+        };
+
+        SpatialHash::SpatialHash(float fCell) : fCellSize(fCell), fInvCellSize(1.0f / fCell) { vCells.resize(256); }
+
+        void SpatialHash::koi_CellRange(const AABB& box, int32_t& ix0, int32_t& iy0, int32_t& ix1, int32_t& iy1) const {
+            // Clamped in float first, huge or infinite boxes would overflow the conversion
+            auto cell = [&](float v) { return int32_t(std::max(-1073741824.0f, std::min(std::floor(v * fInvCellSize), 1073741824.0f))); };
+            ix0 = cell(box.vMin.x); iy0 = cell(box.vMin.y);
+            ix1 = cell(box.vMax.x); iy1 = cell(box.vMax.y);
+        }
+
+        int32_t SpatialHash::koi_FindCell(int32_t ix, int32_t iy) const {
+            uint64_t k = koi_Key(ix, iy);
+            size_t mask = vCells.size() - 1;
+            for (size_t i = koi_Hash(k) & mask;; i = (i + 1) & mask) {
+                if (vCells[i].nHead == -2) return -1;
+                if (vCells[i].nKey == k) return int32_t(i);
+            }
+        }
+
+        int32_t SpatialHash::koi_Cell(int32_t ix, int32_t iy, bool bCreate) {
+            int32_t c = koi_FindCell(ix, iy);
+            if (c >= 0 || !bCreate) return c;
+            if ((nUsedCells + 1) * 2 > vCells.size()) koi_Rehash(vCells.size() * 2);
+            uint64_t k = koi_Key(ix, iy);
+            size_t mask = vCells.size() - 1, i = koi_Hash(k) & mask;
+            while (vCells[i].nHead != -2) i = (i + 1) & mask;
+            vCells[i] = { k, -1 };
+            nUsedCells++;
+            return int32_t(i);
+        }
+
+        void SpatialHash::koi_Rehash(size_t nSize) {
+            // Cells that emptied out are dropped here, so the table doesn't fill with dead keys
+            std::vector<Cell> vOld;
+            vOld.swap(vCells);
+            size_t nLive = 0;
+            for (const Cell& c : vOld) if (c.nHead >= 0) nLive++;
+            while (nSize > 256 && nLive * 4 < nSize) nSize >>= 1;
+            while ((nLive + 1) * 2 > nSize) nSize <<= 1;
+            vCells.assign(nSize, Cell());
+            nUsedCells = 0;
+            for (const Cell& c : vOld) {
+                if (c.nHead < 0) continue;
+                size_t i = koi_Hash(c.nKey) & (nSize - 1);
+                while (vCells[i].nHead != -2) i = (i + 1) & (nSize - 1);
+                vCells[i] = c;
+                nUsedCells++;
+            }
+        }
+
+        void SpatialHash::koi_Link(int32_t nId) {
+            Proxy& p = vProxies[nId];
+            p.bOversized = int64_t(p.ix1 - p.ix0 + 1) * int64_t(p.iy1 - p.iy0 + 1) > nMaxProxyCells;
+            if (p.bOversized) { vOversized.push_back(nId); return; }
+            for (int32_t iy = p.iy0; iy <= p.iy1; iy++)
+                for (int32_t ix = p.ix0; ix <= p.ix1; ix++) {
+                    int32_t c = koi_Cell(ix, iy, true);
+                    int32_t n;
+                    if (nFreeNode >= 0) { n = nFreeNode; nFreeNode = vNodes[n].nNext; }
+                    else { n = int32_t(vNodes.size()); vNodes.push_back({ 0, 0 }); }
+                    vNodes[n] = { nId, vCells[c].nHead };
+                    vCells[c].nHead = n;
+                }
+        }
+
+        void SpatialHash::koi_Unlink(int32_t nId) {
+            const Proxy& p = vProxies[nId];
+            if (p.bOversized) {
+                vOversized.erase(std::find(vOversized.begin(), vOversized.end(), nId));
+                return;
+            }
+            for (int32_t iy = p.iy0; iy <= p.iy1; iy++)
+                for (int32_t ix = p.ix0; ix <= p.ix1; ix++) {
+                    int32_t c = koi_FindCell(ix, iy);
+                    if (c < 0) continue;
+                    for (int32_t* pLink = &vCells[c].nHead; *pLink >= 0; pLink = &vNodes[*pLink].nNext) {
+                        if (vNodes[*pLink].nProxy != nId) continue;
+                        int32_t n = *pLink;
+                        *pLink = vNodes[n].nNext;
+                        vNodes[n].nNext = nFreeNode;
+                        nFreeNode = n;
+                        break;
+                    }
+                }
+        }
+
+        int32_t SpatialHash::koi_Add(const SpatialProxy& sp) {
+            int32_t nId;
+            if (!vFreeProxies.empty()) { nId = vFreeProxies.back(); vFreeProxies.pop_back(); }
+            else { nId = int32_t(vProxies.size()); vProxies.emplace_back(); }
+            Proxy& p = vProxies[nId];
+            static_cast<SpatialProxy&>(p) = sp;
+            koi_CellRange(sp.box, p.ix0, p.iy0, p.ix1, p.iy1);
+            koi_Link(nId);
+            if (!p.bOversized) boxAll = boxAll.Merged(sp.box);
+            nProxies++;
+            return nId;
+        }
+
+        void SpatialHash::koi_Update(int32_t nId, const SpatialProxy& sp) {
+            Proxy& p = vProxies[nId];
+            int32_t ix0, iy0, ix1, iy1;
+            koi_CellRange(sp.box, ix0, iy0, ix1, iy1);
+            if (ix0 != p.ix0 || iy0 != p.iy0 || ix1 != p.ix1 || iy1 != p.iy1) {
+                koi_Unlink(nId);
+                p.ix0 = ix0; p.iy0 = iy0; p.ix1 = ix1; p.iy1 = iy1;
+                koi_Link(nId);
+            }
+            uint32_t nUser = p.nUser;
+            static_cast<SpatialProxy&>(p) = sp;
+            p.nUser = nUser;
+            if (!p.bOversized) boxAll = boxAll.Merged(sp.box);
+        }
+
+        int32_t SpatialHash::Insert(const AABB& box, uint32_t nUser) {
+            SpatialProxy p; p.box = box; p.vCenter = box.Center(); p.nUser = nUser;
+            return koi_Add(p);
+        }
+
+        int32_t SpatialHash::InsertCircle(const Vector2f& c, float r, uint32_t nUser) {
+            SpatialProxy p; p.box = AABB::FromCircle(c, r); p.vCenter = c; p.fRadius = r; p.nUser = nUser;
+            return koi_Add(p);
+        }
+
+        void SpatialHash::Move(int32_t nId, const AABB& box) {
+            SpatialProxy p; p.box = box; p.vCenter = box.Center();
+            koi_Update(nId, p);
+        }
+
+        void SpatialHash::MoveCircle(int32_t nId, const Vector2f& c, float r) {
+            SpatialProxy p; p.box = AABB::FromCircle(c, r); p.vCenter = c; p.fRadius = r;
+            koi_Update(nId, p);
+        }
+
+        void SpatialHash::Remove(int32_t nId) {
+            Proxy& p = vProxies[nId];
+            if (p.ix1 < p.ix0) return;
+            koi_Unlink(nId);
+            p.ix0 = 0; p.ix1 = -1;
+            vFreeProxies.push_back(nId);
+            nProxies--;
+        }
+
+        void SpatialHash::Clear() {
+            vProxies.clear(); vFreeProxies.clear(); vNodes.clear(); vOversized.clear();
+            vCells.assign(256, Cell());
+            nUsedCells = 0; nFreeNode = -1; nProxies = 0;
+            boxAll = koi_NoBox();
+        }
+
+        void SpatialHash::QueryRange(const AABB& box, std::vector<int32_t>& vOut) const {
+            int32_t qx0, qy0, qx1, qy1;
+            koi_CellRange(box, qx0, qy0, qx1, qy1);
+            SpatialProxy q; q.box = box;
+            for (int32_t iy = qy0; iy <= qy1; iy++)
+                for (int32_t ix = qx0; ix <= qx1; ix++) {
+                    int32_t c = koi_FindCell(ix, iy);
+                    if (c < 0) continue;
+                    for (int32_t n = vCells[c].nHead; n >= 0; n = vNodes[n].nNext) {
+                        const Proxy& p = vProxies[vNodes[n].nProxy];
+                        // A proxy covering several queried cells is reported from the first one only
+                        if (ix != std::max(p.ix0, qx0) || iy != std::max(p.iy0, qy0)) continue;
+                        if (koi_Overlap(p, q)) vOut.push_back(vNodes[n].nProxy);
+                    }
+                }
+            for (int32_t nId : vOversized) if (koi_Overlap(vProxies[nId], q)) vOut.push_back(nId);
+        }
+
+        void SpatialHash::QueryRadius(const Vector2f& c, float r, std::vector<int32_t>& vOut) const {
+            int32_t qx0, qy0, qx1, qy1;
+            koi_CellRange(AABB::FromCircle(c, r), qx0, qy0, qx1, qy1);
+            for (int32_t iy = qy0; iy <= qy1; iy++)
+                for (int32_t ix = qx0; ix <= qx1; ix++) {
+                    int32_t cell = koi_FindCell(ix, iy);
+                    if (cell < 0) continue;
+                    for (int32_t n = vCells[cell].nHead; n >= 0; n = vNodes[n].nNext) {
+                        const Proxy& p = vProxies[vNodes[n].nProxy];
+                        if (ix != std::max(p.ix0, qx0) || iy != std::max(p.iy0, qy0)) continue;
+                        if (koi_OverlapCircle(p, c, r)) vOut.push_back(vNodes[n].nProxy);
+                    }
+                }
+            for (int32_t nId : vOversized) if (koi_OverlapCircle(vProxies[nId], c, r)) vOut.push_back(nId);
+        }
+
+        bool SpatialHash::Raycast(const Vector2f& o, const Vector2f& d, float fMaxT, RayHit& hit) const {
+            // Oversized proxies first, a hit there shortens the walk
+            hit.nId = -1; hit.fT = fMaxT;
+            for (int32_t nId : vOversized) {
+                float fT;
+                if (koi_RayShape(vProxies[nId], o, d, hit.fT, fT) && (hit.nId < 0 || fT < hit.fT)) { hit.nId = nId; hit.fT = fT; }
+            }
+
+            // Only walk the part of the ray that can meet anything in the cells
+            float tEnter, tExit;
+            if (boxAll.vMin.x > boxAll.vMax.x || !koi_RayBox(boxAll, o, d, hit.fT, tEnter, &tExit)) return hit.nId >= 0;
+
+            // Grid walk (Amanatides & Woo) from the entry point
+            Vector2f p = o + d * tEnter;
+            int32_t ix = int32_t(std::floor(p.x * fInvCellSize)), iy = int32_t(std::floor(p.y * fInvCellSize));
+            int32_t sx = d.x > 0 ? 1 : (d.x < 0 ? -1 : 0), sy = d.y > 0 ? 1 : (d.y < 0 ? -1 : 0);
+            const float inf = std::numeric_limits<float>::infinity();
+            float dtx = sx ? fCellSize / std::abs(d.x) : inf, dty = sy ? fCellSize / std::abs(d.y) : inf;
+            float tx = sx ? tEnter + ((sx > 0 ? (ix + 1) * fCellSize : ix * fCellSize) - p.x) / d.x : inf;
+            float ty = sy ? tEnter + ((sy > 0 ? (iy + 1) * fCellSize : iy * fCellSize) - p.y) / d.y : inf;
+
+            for (float t = tEnter; t <= std::min(tExit, hit.fT);) {
+                int32_t c = koi_FindCell(ix, iy);
+                if (c >= 0)
+                    for (int32_t n = vCells[c].nHead; n >= 0; n = vNodes[n].nNext) {
+                        float fT;
+                        if (koi_RayShape(vProxies[vNodes[n].nProxy], o, d, hit.fT, fT) && (hit.nId < 0 || fT < hit.fT)) { hit.nId = vNodes[n].nProxy; hit.fT = fT; }
+                    }
+                if (tx < ty) { t = tx; tx += dtx; ix += sx; }
+                else         { t = ty; ty += dty; iy += sy; }
+                if (t == inf) break;
+            }
+            return hit.nId >= 0;
+        }
+
+        void SpatialHash::koi_PairsOf(int32_t nId, std::vector<SpatialPair>& vOut) const {
+            // Pairs with an oversized proxy are reported by the lower id, which tests it directly
+            const Proxy& a = vProxies[nId];
+            if (a.bOversized) {
+                for (int32_t nOther = nId + 1; nOther < int32_t(vProxies.size()); nOther++) {
+                    const Proxy& b = vProxies[nOther];
+                    if (b.ix1 >= b.ix0 && koi_Overlap(a, b)) vOut.push_back({ nId, nOther });
+                }
+                return;
+            }
+            for (int32_t iy = a.iy0; iy <= a.iy1; iy++)
+                for (int32_t ix = a.ix0; ix <= a.ix1; ix++) {
+                    int32_t c = koi_FindCell(ix, iy);
+                    for (int32_t n = vCells[c].nHead; n >= 0; n = vNodes[n].nNext) {
+                        int32_t nOther = vNodes[n].nProxy;
+                        if (nOther <= nId) continue;
+                        const Proxy& b = vProxies[nOther];
+                        // Pairs sharing several cells are reported from the first shared one
+                        if (ix != std::max(a.ix0, b.ix0) || iy != std::max(a.iy0, b.iy0)) continue;
+                        if (koi_Overlap(a, b)) vOut.push_back({ nId, nOther });
+                    }
+                }
+            for (int32_t nOther : vOversized) if (nOther > nId && koi_Overlap(a, vProxies[nOther])) vOut.push_back({ nId, nOther });
+        }
+
+        void SpatialHash::FindPairs(std::vector<SpatialPair>& vOut, bool bParallel) const {
+            int32_t n = int32_t(vProxies.size());
+            auto valid = [&](int32_t i) { return vProxies[i].ix1 >= vProxies[i].ix0; };
+            if (!bParallel || n < 2048) {
+                for (int32_t i = 0; i < n; i++) if (valid(i)) koi_PairsOf(i, vOut);
+                return;
+            }
+            // Each block collects on its own, joining in block order keeps the output stable
+            constexpr int32_t nBlock = 512;
+            std::vector<std::vector<SpatialPair>> vBlocks((n + nBlock - 1) / nBlock);
+            ParallelFor(0, int32_t(vBlocks.size()), [&](int32_t b) {
+                for (int32_t i = b * nBlock, e = std::min(n, (b + 1) * nBlock); i < e; i++) if (valid(i)) koi_PairsOf(i, vBlocks[b]);
+            });
+            for (auto& v : vBlocks) vOut.insert(vOut.end(), v.begin(), v.end());
+        }
+
+
+        // MARK: koi::LooseQuadTree
+        // +------------------------------------------------------------------------------+
+        // | koi::LooseQuadTree - Quadtree whose nodes overlap by half a node each side   |
+        // +------------------------------------------------------------------------------+
+        // Handles mixed object sizes. An object goes to the deepest level whose nodes are
+        // at least its size, in the node holding its centre, so its place is computed
+        // directly without descending and it lives in exactly one node. Every level is a
+        // dense grid in one flat array, nodes keep a count of their subtree so queries
+        // skip empty branches. Objects outside the world go to the nearest border node.
+        class LooseQuadTree {
+        public:
+            explicit LooseQuadTree(const AABB& world, int32_t nMaxDepth = 8);
+
+            int32_t Insert      (const AABB& box, uint32_t nUser = 0);
+            int32_t InsertCircle(const Vector2f& c, float r, uint32_t nUser = 0);
+            void    Move        (int32_t nId, const AABB& box);
+            void    MoveCircle  (int32_t nId, const Vector2f& c, float r);
+            void    Remove      (int32_t nId);
+            void    Clear       ();
+            int32_t Size        () const { return nProxies; }
+            const SpatialProxy& GetProxy(int32_t nId) const { return vProxies[nId]; }
+
+            void QueryRange (const AABB& box, std::vector<int32_t>& vOut) const;
+            void QueryRadius(const Vector2f& c, float r, std::vector<int32_t>& vOut) const;
+            bool Raycast    (const Vector2f& o, const Vector2f& d, float fMaxT, RayHit& hit) const;
+            void FindPairs  (std::vector<SpatialPair>& vOut, bool bParallel = true) const;
+
+        private:
+            struct Proxy : SpatialProxy {
+                int32_t nNode = -1;                                 // -1 for a free slot
+                int32_t nPrev = -1, nNext = -1;
+            };
+
+            int32_t koi_Index   (int32_t nLevel, int32_t cx, int32_t cy) const { return vLevelStart[nLevel] + cy * (1 << nLevel) + cx; }
+            AABB    koi_Loose   (int32_t nLevel, int32_t cx, int32_t cy) const;
+            void    koi_NodeCoords(int32_t nNode, int32_t& nLevel, int32_t& cx, int32_t& cy) const;
+            void    koi_Place   (const AABB& box, int32_t& nLevel, int32_t& cx, int32_t& cy) const;
+            void    koi_Link    (int32_t nId, int32_t nLevel, int32_t cx, int32_t cy);
+            void    koi_Unlink  (int32_t nId);
+            int32_t koi_Add     (const SpatialProxy& p);
+            void    koi_Update  (int32_t nId, const SpatialProxy& p);
+            template<class Prune, class Visit> void koi_Walk(Prune& prune, Visit& visit, int32_t nMinLevel = 0) const;
+
+            AABB                 world;
+            float                fWorldSize;
+            int32_t              nMaxDepth;
+            std::vector<int32_t> vLevelStart;
+            std::vector<int32_t> vHead;                             // First proxy in each node
+            std::vector<int32_t> vCount;                            // Proxies in each subtree
+            std::vector<int32_t> vNodeLevel;                        // Level of each node, for unlinking
+            std::vector<Proxy>   vProxies;
+            std::vector<int32_t> vFreeProxies;
+            int32_t              nProxies = 0;
+        };
+
+        LooseQuadTree::LooseQuadTree(const AABB& w, int32_t nDepth) : world(w), nMaxDepth(std::max(0, std::min(nDepth, 12))) {
+            fWorldSize = std::max(w.vMax.x - w.vMin.x, w.vMax.y - w.vMin.y);
+            int32_t nNodes = 0;
+            for (int32_t l = 0; l <= nMaxDepth; l++) { vLevelStart.push_back(nNodes); nNodes += 1 << (2 * l); }
+            vHead.assign(nNodes, -1);
+            vCount.assign(nNodes, 0);
+            vNodeLevel.resize(nNodes);
+            for (int32_t l = 0; l <= nMaxDepth; l++) std::fill_n(vNodeLevel.begin() + vLevelStart[l], 1 << (2 * l), l);
+        }
+
+        AABB LooseQuadTree::koi_Loose(int32_t nLevel, int32_t cx, int32_t cy) const {
+            // Nodes on the border reach out forever, they hold what lies outside the world
+            const float inf = std::numeric_limits<float>::infinity();
+            float s = fWorldSize / float(1 << nLevel);
+            int32_t n = (1 << nLevel) - 1;
+            Vector2f vMin = { world.vMin.x + cx * s - s * 0.5f, world.vMin.y + cy * s - s * 0.5f };
+            return { { cx == 0 ? -inf : vMin.x, cy == 0 ? -inf : vMin.y }, { cx == n ? inf : vMin.x + s * 2.0f, cy == n ? inf : vMin.y + s * 2.0f } };
+        }
+
+        void LooseQuadTree::koi_NodeCoords(int32_t nNode, int32_t& nLevel, int32_t& cx, int32_t& cy) const {
+            nLevel = vNodeLevel[nNode];
+            int32_t i = nNode - vLevelStart[nLevel];
+            cx = i & ((1 << nLevel) - 1); cy = i >> nLevel;
+        }
+
+        void LooseQuadTree::koi_Place(const AABB& box, int32_t& nLevel, int32_t& cx, int32_t& cy) const {
+            Vector2f c = box.Center(), s = box.Size();
+            float fSize = std::max(s.x, s.y);
+            nLevel = 0;
+            while (nLevel < nMaxDepth && fWorldSize / float(2 << nLevel) >= fSize) nLevel++;
+            for (; nLevel > 0; nLevel--) {
+                float fCell = fWorldSize / float(1 << nLevel);
+                int32_t n = (1 << nLevel) - 1;
+                cx = int32_t(std::max(0.0f, std::min(float(n), std::floor((c.x - world.vMin.x) / fCell))));
+                cy = int32_t(std::max(0.0f, std::min(float(n), std::floor((c.y - world.vMin.y) / fCell))));
+                if (koi_Loose(nLevel, cx, cy).Contains(box)) return;
+            }
+            cx = cy = 0;
+        }
+
+        void LooseQuadTree::koi_Link(int32_t nId, int32_t nLevel, int32_t cx, int32_t cy) {
+            Proxy& p = vProxies[nId];
+            int32_t nNode = koi_Index(nLevel, cx, cy);
+            p.nNode = nNode; p.nPrev = -1; p.nNext = vHead[nNode];
+            if (p.nNext >= 0) vProxies[p.nNext].nPrev = nId;
+            vHead[nNode] = nId;
+            for (int32_t l = nLevel; l >= 0; l--) vCount[koi_Index(l, cx >> (nLevel - l), cy >> (nLevel - l))]++;
+        }
+
+        void LooseQuadTree::koi_Unlink(int32_t nId) {
+            Proxy& p = vProxies[nId];
+            if (p.nPrev >= 0) vProxies[p.nPrev].nNext = p.nNext; else vHead[p.nNode] = p.nNext;
+            if (p.nNext >= 0) vProxies[p.nNext].nPrev = p.nPrev;
+            int32_t nLevel, cx, cy;
+            koi_NodeCoords(p.nNode, nLevel, cx, cy);
+            for (int32_t l = nLevel; l >= 0; l--) vCount[koi_Index(l, cx >> (nLevel - l), cy >> (nLevel - l))]--;
+        }
+
+        int32_t LooseQuadTree::koi_Add(const SpatialProxy& sp) {
+            int32_t nId;
+            if (!vFreeProxies.empty()) { nId = vFreeProxies.back(); vFreeProxies.pop_back(); }
+            else { nId = int32_t(vProxies.size()); vProxies.emplace_back(); }
+            static_cast<SpatialProxy&>(vProxies[nId]) = sp;
+            int32_t l, cx, cy;
+            koi_Place(sp.box, l, cx, cy);
+            koi_Link(nId, l, cx, cy);
+            nProxies++;
+            return nId;
+        }
+
+        void LooseQuadTree::koi_Update(int32_t nId, const SpatialProxy& sp) {
+            Proxy& p = vProxies[nId];
+            uint32_t nUser = p.nUser;
+            static_cast<SpatialProxy&>(p) = sp;
+            p.nUser = nUser;
+            int32_t l, cx, cy;
+            koi_Place(sp.box, l, cx, cy);
+            if (koi_Index(l, cx, cy) == p.nNode) return;
+            koi_Unlink(nId);
+            koi_Link(nId, l, cx, cy);
+        }
+
+        int32_t LooseQuadTree::Insert(const AABB& box, uint32_t nUser) {
+            SpatialProxy p; p.box = box; p.vCenter = box.Center(); p.nUser = nUser;
+            return koi_Add(p);
+        }
+
+        int32_t LooseQuadTree::InsertCircle(const Vector2f& c, float r, uint32_t nUser) {
+            SpatialProxy p; p.box = AABB::FromCircle(c, r); p.vCenter = c; p.fRadius = r; p.nUser = nUser;
+            return koi_Add(p);
+        }
+
+        void LooseQuadTree::Move(int32_t nId, const AABB& box) {
+            SpatialProxy p; p.box = box; p.vCenter = box.Center();
+            koi_Update(nId, p);
+        }
+
+        void LooseQuadTree::MoveCircle(int32_t nId, const Vector2f& c, float r) {
+            SpatialProxy p; p.box = AABB::FromCircle(c, r); p.vCenter = c; p.fRadius = r;
+            koi_Update(nId, p);
+        }
+
+        void LooseQuadTree::Remove(int32_t nId) {
+            if (vProxies[nId].nNode < 0) return;
+            koi_Unlink(nId);
+            vProxies[nId].nNode = -1;
+            vFreeProxies.push_back(nId);
+            nProxies--;
+        }
+
+        void LooseQuadTree::Clear() {
+            std::fill(vHead.begin(), vHead.end(), -1);
+            std::fill(vCount.begin(), vCount.end(), 0);
+            vProxies.clear(); vFreeProxies.clear();
+            nProxies = 0;
+        }
+
+        // Depth first over non-empty nodes. Objects above nMinLevel are passed over.
+        template<class Prune, class Visit>
+        void LooseQuadTree::koi_Walk(Prune& prune, Visit& visit, int32_t nMinLevel) const {
+            // Explicit stack, each level pops one node and pushes at most four
+            struct Item { int32_t nLevel, cx, cy; };
+            Item vStack[3 * 12 + 4];
+            int32_t nTop = 0;
+            if (vCount[0] > 0) vStack[nTop++] = { 0, 0, 0 };
+            while (nTop > 0) {
+                Item it = vStack[--nTop];
+                if (prune(koi_Loose(it.nLevel, it.cx, it.cy))) continue;
+                if (it.nLevel >= nMinLevel)
+                    for (int32_t i = vHead[koi_Index(it.nLevel, it.cx, it.cy)]; i >= 0; i = vProxies[i].nNext) visit(i);
+                if (it.nLevel == nMaxDepth) continue;
+                for (int32_t k = 0; k < 4; k++) {
+                    Item child = { it.nLevel + 1, it.cx * 2 + (k & 1), it.cy * 2 + (k >> 1) };
+                    if (vCount[koi_Index(child.nLevel, child.cx, child.cy)] > 0) vStack[nTop++] = child;
+                }
+            }
+        }
+
+        void LooseQuadTree::QueryRange(const AABB& box, std::vector<int32_t>& vOut) const {
+            SpatialProxy q; q.box = box;
+            auto prune = [&](const AABB& node) { return !node.Overlaps(box); };
+            auto visit = [&](int32_t i) { if (koi_Overlap(vProxies[i], q)) vOut.push_back(i); };
+            koi_Walk(prune, visit);
+        }
+
+        void LooseQuadTree::QueryRadius(const Vector2f& c, float r, std::vector<int32_t>& vOut) const {
+            auto prune = [&](const AABB& node) { return koi_BoxDistanceSq(node, c) > r * r; };
+            auto visit = [&](int32_t i) { if (koi_OverlapCircle(vProxies[i], c, r)) vOut.push_back(i); };
+            koi_Walk(prune, visit);
+        }
+
+        bool LooseQuadTree::Raycast(const Vector2f& o, const Vector2f& d, float fMaxT, RayHit& hit) const {
+            hit.nId = -1; hit.fT = fMaxT;
+            auto prune = [&](const AABB& node) { float t; return !koi_RayBox(node, o, d, hit.fT, t); };
+            auto visit = [&](int32_t i) {
+                float t;
+                if (koi_RayShape(vProxies[i], o, d, hit.fT, t) && (hit.nId < 0 || t < hit.fT)) { hit.nId = i; hit.fT = t; }
+            };
+            koi_Walk(prune, visit);
+            return hit.nId >= 0;
+        }
+
+        void LooseQuadTree::FindPairs(std::vector<SpatialPair>& vOut, bool bParallel) const {
+            // Each object only tests objects on its own level or deeper, so the few large
+            // objects near the root aren't scanned by every small one
+            int32_t n = int32_t(vProxies.size());
+            auto pairsOf = [&](int32_t a, std::vector<SpatialPair>& vPairs) {
+                const Proxy& pa = vProxies[a];
+                if (pa.nNode < 0) return;
+                int32_t nLevel = vNodeLevel[pa.nNode];
+                auto prune = [&](const AABB& node) { return !node.Overlaps(pa.box); };
+                auto visit = [&](int32_t b) {
+                    if ((b > a || vNodeLevel[vProxies[b].nNode] > nLevel) && koi_Overlap(pa, vProxies[b])) vPairs.push_back({ std::min(a, b), std::max(a, b) });
+                };
+                koi_Walk(prune, visit, nLevel);
+            };
+            if (!bParallel || n < 2048) {
+                for (int32_t i = 0; i < n; i++) pairsOf(i, vOut);
+                return;
+            }
+            constexpr int32_t nBlock = 512;
+            std::vector<std::vector<SpatialPair>> vBlocks((n + nBlock - 1) / nBlock);
+            ParallelFor(0, int32_t(vBlocks.size()), [&](int32_t b) {
+                for (int32_t i = b * nBlock, e = std::min(n, (b + 1) * nBlock); i < e; i++) pairsOf(i, vBlocks[b]);
+            });
+            for (auto& v : vBlocks) vOut.insert(vOut.end(), v.begin(), v.end());
+        }
+    }
+
+#endif /* Spatial_h */
@@ -8,55 +8,268 @@
 #ifndef Sprite_h
 #define Sprite_h
 
+#include <memory>
+#include "Global.h"
 #include "Color.h"
 #include "Vector2.h"
+#include "Allocator.h"
 
 namespace koi {
+    struct SpriteView;
+    class  Sprite;
+
+    // Kernels the Sprite members call into, defined with the rest of their modules
+    void  Downsample2x2 (const SpriteView& src, const SpriteView& dst);   // Mipmap.h
+    void  Premultiply   (const Color* src, Color* dst, int32_t count);    // PixelFormat.h
+    void  Unpremultiply (const Color* src, Color* dst, int32_t count);
+    rcode koi_LoadSprite(Sprite& spr, const std::string& sImageFile);     // ImageLoader.h
+
+    // Pixel storage is 64 byte aligned and every row starts on a 64 byte boundary,
+    // so rows are addressed with stride rather than width. The padding is never drawn.
     class Sprite {
     public:
+        Sprite();
         Sprite(int32_t w, int32_t h);
+        Sprite(const std::string& sImageFile);     // PNG or QOI, see ImageLoader.h
+        Sprite(Color* pData, int32_t w, int32_t h, int32_t s); // Borrows pData, which must outlive the sprite
+        Sprite(const Sprite& spr);
+        Sprite(Sprite&& spr) noexcept;
         ~Sprite();
-        
+
+        Sprite& operator = (const Sprite& spr);
+        Sprite& operator = (Sprite&& spr) noexcept;
+
         int32_t width  = 0;
         int32_t height = 0;
+        int32_t stride = 0;     // Row pitch in pixels
         enum    Mode { NORMAL, PERIODIC };
         enum    Flip { NONE = 0, HORZ = 1, VERT = 2 };
-        
+
         Color   GetPixel(const Vector2i& a   ) const;
         Color   GetPixel(int32_t x, int32_t y) const;
         bool    SetPixel(const Vector2i& a   , Color p);
         bool    SetPixel(int32_t x, int32_t y, Color p);
         Color*  GetData ();
+        Color*  GetRow  (int32_t y);
+        const Color* GetRow(int32_t y) const;
+        rcode   Resize  (int32_t w, int32_t h);    // Contents become BLANK, the buffer is kept if it is big enough. FAIL leaves it 0x0
+        rcode   LoadFromFile(const std::string& sImageFile);
+        SpriteView GetView   () const;
+        SpriteView GetSubView(int32_t x, int32_t y, int32_t w, int32_t h) const;
+        int32_t    MipLevels  () const;              // Including level 0, which is the sprite itself
+        SpriteView GetMipLevel(int32_t nLevel);     // Builds the chain on first use, see Mipmap.h
+        void       BuildMips  ();
+        void       InvalidateMips();                // Call after writing pixels so the chain is rebuilt
+        void       Premultiply  ();                 // Converts the pixels and sets bPremultiplied, see PixelFormat.h
+        void       Unpremultiply();
         Color*  pColData   = nullptr;
+        size_t  nCapacity  = 0;                    // Bytes owned by pColData, 0 when the pixels are borrowed
         Mode    modeSample = Mode::NORMAL;
+        bool    bPremultiplied = false;            // Colour channels already scaled by alpha
+
+        static int32_t AlignedStride(int32_t w);
+
+    private:
+        void Release();
+
+        std::unique_ptr<std::vector<Sprite>> pMips; // Levels 1..n, half size each
+        bool    bMipsDirty = false;
+    };
+
+
+    // MARK: koi::SpriteView
+    // +------------------------------------------------------------------------------+
+    // | koi::SpriteView - Non owning window onto a rectangle of pixels               |
+    // +------------------------------------------------------------------------------+
+    // The view must not outlive the Sprite it was taken from, and is invalidated by Resize().
+    struct SpriteView {
+        Color*  pData  = nullptr;
+        int32_t width  = 0;
+        int32_t height = 0;
+        int32_t stride = 0;
+        bool    bPremultiplied = false;
+
+        SpriteView() = default;
+        SpriteView(Color* p, int32_t w, int32_t h, int32_t s, bool bPremul = false) : pData(p), width(w), height(h), stride(s), bPremultiplied(bPremul) {}
+        SpriteView(const Sprite& spr) : SpriteView(spr.pColData, spr.width, spr.height, spr.stride, spr.bPremultiplied) {}
+
+        bool       Empty   ()                    const { return pData == nullptr || width <= 0 || height <= 0; }
+        Color*     GetRow  (int32_t y)           const { return pData + y * stride; }
+        Color      GetPixel(int32_t x, int32_t y) const;
+        bool       SetPixel(int32_t x, int32_t y, Color p) const;
+        SpriteView SubView (int32_t x, int32_t y, int32_t w, int32_t h) const; // Clipped to this view
     };
-    
-    Sprite::Sprite(int32_t w, int32_t h) {
-        if (pColData) delete[] pColData;
-        width = w; height = h;
-        pColData = new Color[width * height];
-        for (int32_t i = 0; i < width * height; i++) pColData[i] = Color::BLANK;
-    }
-    
-    Sprite::~Sprite() { if (pColData) delete[] pColData; }
-    
-    Color* Sprite::GetData ()                           { return pColData;              }
-    Color  Sprite::GetPixel(const Vector2i& a) const    { return GetPixel(a.x, a.y   ); }
-    bool   Sprite::SetPixel(const Vector2i& a, Color p) { return SetPixel(a.x, a.y, p); }
-    
+
+    Color SpriteView::GetPixel(int32_t x, int32_t y) const {
+        if (x >= 0 && x < width && y >= 0 && y < height) return pData[y * stride + x];
+        else                                             return Color::BLANK;
+    }
+
+    bool SpriteView::SetPixel(int32_t x, int32_t y, Color p) const {
+        if (x >= 0 && x < width && y >= 0 && y < height) {
+            pData[y * stride + x] = p; return true;
+        } else return false;
+    }
+
+    SpriteView SpriteView::SubView(int32_t x, int32_t y, int32_t w, int32_t h) const {
+        int32_t x2 = std::min(x + w, width), y2 = std::min(y + h, height);
+        x = std::max(x, 0); y = std::max(y, 0);
+        if (x2 <= x || y2 <= y) return SpriteView(pData, 0, 0, stride, bPremultiplied);
+        return SpriteView(pData + y * stride + x, x2 - x, y2 - y, stride, bPremultiplied);
+    }
+
+    SpriteView Sprite::GetView   () const                                   { return SpriteView(*this);                 }
+    SpriteView Sprite::GetSubView(int32_t x, int32_t y, int32_t w, int32_t h) const { return GetView().SubView(x, y, w, h); }
+
+    int32_t Sprite::AlignedStride(int32_t w) {
+        constexpr int32_t nRowPixels = int32_t(nPixelAlignment / sizeof(Color));
+        return (w + nRowPixels - 1) & ~(nRowPixels - 1);
+    }
+
+    Sprite::Sprite() { }
+
+    Sprite::Sprite(int32_t w, int32_t h) { Resize(w, h); }
+
+    Sprite::Sprite(Color* pData, int32_t w, int32_t h, int32_t s) : width(w), height(h), stride(s), pColData(pData) { }
+
+    Sprite::Sprite(const Sprite& spr) : modeSample(spr.modeSample), bPremultiplied(spr.bPremultiplied) {
+        Resize(spr.width, spr.height);
+        for (int32_t y = 0; y < height; y++) memcpy(GetRow(y), spr.GetRow(y), width * sizeof(Color));
+    }
+
+    Sprite::Sprite(Sprite&& spr) noexcept
+        : width(spr.width), height(spr.height), stride(spr.stride),
+          pColData(spr.pColData), nCapacity(spr.nCapacity), modeSample(spr.modeSample), bPremultiplied(spr.bPremultiplied),
+          pMips(std::move(spr.pMips)), bMipsDirty(spr.bMipsDirty) {
+        spr.pColData = nullptr; spr.nCapacity = 0;
+        spr.width = spr.height = spr.stride = 0;
+    }
+
+    Sprite::~Sprite() { Release(); }
+
+    Sprite& Sprite::operator = (const Sprite& spr) {
+        if (this == &spr) return *this;
+        modeSample = spr.modeSample; bPremultiplied = spr.bPremultiplied;
+        Resize(spr.width, spr.height);
+        for (int32_t y = 0; y < height; y++) memcpy(GetRow(y), spr.GetRow(y), width * sizeof(Color));
+        return *this;
+    }
+
+    Sprite& Sprite::operator = (Sprite&& spr) noexcept {
+        if (this == &spr) return *this;
+        Release();
+        width = spr.width; height = spr.height; stride = spr.stride;
+        pColData = spr.pColData; nCapacity = spr.nCapacity; modeSample = spr.modeSample; bPremultiplied = spr.bPremultiplied;
+        pMips = std::move(spr.pMips); bMipsDirty = spr.bMipsDirty;
+        spr.pColData = nullptr; spr.nCapacity = 0;
+        spr.width = spr.height = spr.stride = 0;
+        return *this;
+    }
+
+    void Sprite::Release() {
+        if (nCapacity) PixelAllocator::Get().Release(pColData, nCapacity);
+        pColData = nullptr; nCapacity = 0;
+    }
+
+    rcode Sprite::Resize(int32_t w, int32_t h) {
+        if (w < 0) w = 0;
+        if (h < 0) h = 0;
+        pMips.reset();
+        width = height = stride = 0;
+        if (w > INT32_MAX - int32_t(nPixelAlignment)) { Release(); return FAIL; }
+        int32_t s = AlignedStride(w);
+        size_t nBytes = size_t(s) * size_t(h) * sizeof(Color);
+
+        // Color::BLANK is all zero bits, so a zeroed buffer is already cleared
+        if (nBytes <= nCapacity && nBytes * 2 > nCapacity) memset((void*)pColData, 0, nBytes);
+        else {
+            Release();
+            pColData = (Color*)PixelAllocator::Get().Allocate(nBytes, nCapacity, true);
+            if (pColData == nullptr && nBytes != 0) return FAIL;
+        }
+        width = w; height = h; stride = s;
+        return OK;
+    }
+
+    Color*       Sprite::GetData ()                           { return pColData;                }
+    Color*       Sprite::GetRow  (int32_t y)                  { return pColData + y * stride;   }
+    const Color* Sprite::GetRow  (int32_t y) const            { return pColData + y * stride;   }
+    Color        Sprite::GetPixel(const Vector2i& a) const    { return GetPixel(a.x, a.y   );   }
+    bool         Sprite::SetPixel(const Vector2i& a, Color p) { return SetPixel(a.x, a.y, p);   }
+
     Color Sprite::GetPixel(int32_t x, int32_t y) const {
         if (modeSample == Sprite::Mode::NORMAL) {
-            if (x >= 0 && x < width && y >= 0 && y < height) return pColData[y * width + x];
+            if (x >= 0 && x < width && y >= 0 && y < height) return pColData[y * stride + x];
             else                                             return Color::BLANK;
-        } else return pColData[abs(y % height) * width + abs(x % width)];
+        } else {
+            // PERIODIC repeats the sprite, the same as Sampler::REPEAT
+            if (width <= 0 || height <= 0) return Color::BLANK;
+            return pColData[((y % height + height) % height) * stride + (x % width + width) % width];
+        }
     }
-    
+
     bool Sprite::SetPixel(int32_t x, int32_t y, Color p) {
         if (x >= 0 && x < width && y >= 0 && y < height) {
-            pColData[y * width + x] = p; return true;
+            pColData[y * stride + x] = p; return true;
         } else return false;
     }
-    
+
+    Sprite::Sprite(const std::string& sImageFile)              { LoadFromFile(sImageFile); }
+    rcode  Sprite::LoadFromFile(const std::string& sImageFile) { return koi_LoadSprite(*this, sImageFile); }
+
+    // Mip chain, level 0 is the sprite itself
+    int32_t Sprite::MipLevels() const {
+        int32_t n = 1, s = std::max(width, height);
+        while (s > 1) { s >>= 1; n++; }
+        return n;
+    }
+
+    void Sprite::BuildMips() {
+        int32_t nLevels = MipLevels();
+        if (!pMips) pMips.reset(new std::vector<Sprite>());
+        pMips->resize(size_t(nLevels - 1));
+        SpriteView prev = GetView();
+        for (int32_t i = 1; i < nLevels; i++) {
+            Sprite& level = (*pMips)[i - 1];
+            if (level.Resize(std::max(1, width >> i), std::max(1, height >> i)) != OK) { pMips.reset(); return; }
+            level.bPremultiplied = bPremultiplied;
+            Downsample2x2(prev, level.GetView());
+            prev = level.GetView();
+        }
+        bMipsDirty = false;
+    }
+
+    void Sprite::InvalidateMips() { bMipsDirty = true; }
+
+    SpriteView Sprite::GetMipLevel(int32_t nLevel) {
+        if (nLevel <= 0) return GetView();
+        nLevel = std::min(nLevel, MipLevels() - 1);
+        if (nLevel == 0) return GetView();
+        if (!pMips || bMipsDirty) BuildMips();
+        if (!pMips) return GetView();                // Out of memory, the base level stands in
+        return (*pMips)[nLevel - 1].GetView();
+    }
+
+    // Conversions in place, the flag follows the pixels
+    void Sprite::Premultiply() {
+        if (bPremultiplied) return;
+        for (int32_t y = 0; y < height; y++) koi::Premultiply(GetRow(y), GetRow(y), width);
+        bPremultiplied = true;
+        InvalidateMips();
+    }
+
+    void Sprite::Unpremultiply() {
+        if (!bPremultiplied) return;
+        for (int32_t y = 0; y < height; y++) koi::Unpremultiply(GetRow(y), GetRow(y), width);
+        bPremultiplied = false;
+        InvalidateMips();
+    }
+
 }
 
+// The kernels declared above, so Sprite.h on its own is complete
+#include "Mipmap.h"
+#include "PixelFormat.h"
+#include "ImageLoader.h"
+
 #endif /* Sprite_h */
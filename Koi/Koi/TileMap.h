@@ -0,0 +1,178 @@
+//
+//  TileMap.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef TileMap_h
+#define TileMap_h
+
+    #include <algorithm>
+    #include <vector>
+    #include "Sprite.h"
+    #include "Atlas.h"
+    #include "PixelFormat.h"
+
+    namespace koi {
+        // MARK: koi::TileSet
+        // +------------------------------------------------------------------------------+
+        // | koi::TileSet - Tile images by id, id 0 is always the empty tile              |
+        // +------------------------------------------------------------------------------+
+        // Tiles are views, the sheet or atlas they come from must outlive the set.
+        class TileSet {
+        public:
+            struct Tile {
+                SpriteView view;
+                int32_t    nOffsetX = 0, nOffsetY = 0;              // Where the view sits in the tile cell
+            };
+
+            TileSet(int32_t nTileW, int32_t nTileH);
+
+            uint16_t Add     (const SpriteView& view, int32_t nOffsetX = 0, int32_t nOffsetY = 0);   // Returns the tile id
+            uint16_t AddSheet(const SpriteView& sheet);            // Cuts a grid left to right, top to bottom; returns the first id
+            uint16_t AddAtlas(const Atlas& atlas);                 // Every entry in atlas order, trimmed entries keep their offsets
+
+            int32_t     TileWidth () const { return nTileW; }
+            int32_t     TileHeight() const { return nTileH; }
+            int32_t     Size      () const { return int32_t(vTiles.size()); }
+            const Tile& operator[](uint16_t n) const { return vTiles[n]; }
+
+        private:
+            int32_t           nTileW, nTileH;
+            std::vector<Tile> vTiles;
+        };
+
+        TileSet::TileSet(int32_t w, int32_t h) : nTileW(std::max(w, 1)), nTileH(std::max(h, 1)) { vTiles.emplace_back(); }
+
+        uint16_t TileSet::Add(const SpriteView& view, int32_t nOffsetX, int32_t nOffsetY) {
+            vTiles.push_back({ view, nOffsetX, nOffsetY });
+            return uint16_t(vTiles.size() - 1);
+        }
+
+        uint16_t TileSet::AddSheet(const SpriteView& sheet) {
+            uint16_t nFirst = uint16_t(vTiles.size());
+            for (int32_t y = 0; y + nTileH <= sheet.height; y += nTileH)
+                for (int32_t x = 0; x + nTileW <= sheet.width; x += nTileW) Add(sheet.SubView(x, y, nTileW, nTileH));
+            return nFirst;
+        }
+
+        uint16_t TileSet::AddAtlas(const Atlas& atlas) {
+            uint16_t nFirst = uint16_t(vTiles.size());
+            for (const AtlasEntry& e : atlas.vEntries) Add(e.view, e.nOffsetX, e.nOffsetY);
+            return nFirst;
+        }
+
+
+        // MARK: koi::TileMap
+        // +------------------------------------------------------------------------------+
+        // | koi::TileMap - Layered tile grid drawn from cached chunk images              |
+        // +------------------------------------------------------------------------------+
+        // The map is cut into square chunks of nChunkTiles tiles. A chunk composites all of
+        // its layers into one premultiplied Sprite the first time it is asked for, and again
+        // only after SetTile changed it. Drawing a map is then one sprite blit per visible
+        // chunk, see KoiEngine::DrawTileMap. Chunks with no tiles have no image and are
+        // skipped, and chunks on the right and bottom edges only cover the tiles left there.
+        // The map keeps a pointer to the tile set, which must outlive it.
+        class TileMap {
+        public:
+            TileMap(const TileSet& tiles, int32_t nWidth, int32_t nHeight, int32_t nLayers = 1, int32_t nChunkTiles = 16);
+            TileMap(TileSet&&, int32_t, int32_t, int32_t = 1, int32_t = 16) = delete;     // A temporary set would dangle
+
+            void     SetTile   (int32_t nLayer, int32_t x, int32_t y, uint16_t nTile);   // Out of range is ignored
+            uint16_t GetTile   (int32_t nLayer, int32_t x, int32_t y) const;            // 0 when out of range
+            void     Invalidate();                                  // Rebuild every chunk, e.g. after tile pixels changed
+
+            int32_t Width      () const { return nWidth;  }         // In tiles
+            int32_t Height     () const { return nHeight; }
+            int32_t Layers     () const { return int32_t(vLayers.size()); }
+            int32_t ChunksX    () const { return nChunksX; }
+            int32_t ChunksY    () const { return nChunksY; }
+            int32_t ChunkWidth () const { return nChunkTiles * pTiles->TileWidth();  } // In pixels, edge chunks can be smaller
+            int32_t ChunkHeight() const { return nChunkTiles * pTiles->TileHeight(); }
+            int32_t Rebuilds   () const { return nRebuilds; }       // Chunk images built so far
+
+            const Sprite* GetChunk(int32_t cx, int32_t cy);        // Rebuilt first if needed, nullptr if it has no tiles
+
+        private:
+            struct Chunk {
+                Sprite  spr;
+                int32_t nTiles = 0;                                 // Non-empty tiles over all layers
+                bool    bDirty = true;
+            };
+
+            void koi_Build(Chunk& chunk, int32_t cx, int32_t cy);
+
+            const TileSet*                     pTiles;
+            int32_t                            nWidth, nHeight, nChunkTiles, nChunksX, nChunksY;
+            std::vector<std::vector<uint16_t>> vLayers;
+            std::vector<Chunk>                 vChunks;
+            std::vector<Color>                 vRow;                // Premultiplied tile row
+            int32_t                            nRebuilds = 0;
+        };
+
+        TileMap::TileMap(const TileSet& t, int32_t w, int32_t h, int32_t nLayers, int32_t nChunk)
+            : pTiles(&t), nWidth(std::max(w, 0)), nHeight(std::max(h, 0)), nChunkTiles(std::max(nChunk, 1)) {
+            nChunksX = (nWidth  + nChunkTiles - 1) / nChunkTiles;
+            nChunksY = (nHeight + nChunkTiles - 1) / nChunkTiles;
+            vLayers.assign(std::max(nLayers, 1), std::vector<uint16_t>(size_t(nWidth) * nHeight, 0));
+            vChunks.resize(size_t(nChunksX) * nChunksY);
+        }
+
+        void TileMap::SetTile(int32_t nLayer, int32_t x, int32_t y, uint16_t nTile) {
+            if (nLayer < 0 || nLayer >= Layers() || x < 0 || y < 0 || x >= nWidth || y >= nHeight) return;
+            uint16_t& n = vLayers[nLayer][size_t(y) * nWidth + x];
+            if (n == nTile) return;
+            Chunk& chunk = vChunks[size_t(y / nChunkTiles) * nChunksX + x / nChunkTiles];
+            chunk.nTiles += (nTile != 0) - (n != 0);
+            chunk.bDirty = true;
+            n = nTile;
+        }
+
+        uint16_t TileMap::GetTile(int32_t nLayer, int32_t x, int32_t y) const {
+            if (nLayer < 0 || nLayer >= Layers() || x < 0 || y < 0 || x >= nWidth || y >= nHeight) return 0;
+            return vLayers[nLayer][size_t(y) * nWidth + x];
+        }
+
+        void TileMap::Invalidate() { for (Chunk& c : vChunks) c.bDirty = true; }
+
+        const Sprite* TileMap::GetChunk(int32_t cx, int32_t cy) {
+            if (cx < 0 || cy < 0 || cx >= nChunksX || cy >= nChunksY) return nullptr;
+            Chunk& chunk = vChunks[size_t(cy) * nChunksX + cx];
+            if (chunk.nTiles == 0) return nullptr;
+            if (chunk.bDirty) koi_Build(chunk, cx, cy);
+            return &chunk.spr;
+        }
+
+        void TileMap::koi_Build(Chunk& chunk, int32_t cx, int32_t cy) {
+            const TileSet& tiles = *pTiles;
+            const int32_t tw = tiles.TileWidth(), th = tiles.TileHeight();
+            int32_t x0 = cx * nChunkTiles, y0 = cy * nChunkTiles;
+            int32_t x1 = std::min(x0 + nChunkTiles, nWidth), y1 = std::min(y0 + nChunkTiles, nHeight);
+            if (chunk.spr.Resize((x1 - x0) * tw, (y1 - y0) * th) != OK) return; // Same size again just clears it, stays dirty on failure
+            chunk.spr.bPremultiplied = true;
+            if (int32_t(vRow.size()) < tw) vRow.resize(tw);
+
+            // Layers in order, each tile clipped to its cell and blended over what is below
+            for (const auto& vTiles : vLayers)
+                for (int32_t ty = y0; ty < y1; ty++)
+                    for (int32_t tx = x0; tx < x1; tx++) {
+                        uint16_t n = vTiles[size_t(ty) * nWidth + tx];
+                        if (n == 0 || n >= tiles.Size()) continue;
+                        const TileSet::Tile& tile = tiles[n];
+                        int32_t sx1 = std::max(0, -tile.nOffsetX), sx2 = std::min(tile.view.width,  tw - tile.nOffsetX);
+                        int32_t sy1 = std::max(0, -tile.nOffsetY), sy2 = std::min(tile.view.height, th - tile.nOffsetY);
+                        if (sx1 >= sx2 || sy1 >= sy2) continue;
+                        int32_t dx = (tx - x0) * tw + tile.nOffsetX, dy = (ty - y0) * th + tile.nOffsetY;
+                        for (int32_t sy = sy1; sy < sy2; sy++) {
+                            const Color* src = tile.view.GetRow(sy) + sx1;
+                            if (!tile.view.bPremultiplied) { Premultiply(src, vRow.data(), sx2 - sx1); src = vRow.data(); }
+                            BlendPremultiplied(chunk.spr.GetRow(dy + sy) + dx + sx1, src, sx2 - sx1);
+                        }
+                    }
+            chunk.bDirty = false;
+            nRebuilds++;
+        }
+    }
+
+#endif /* TileMap_h */
@@ -73,7 +73,7 @@ namespace koi {
     template<class T> T          Vector2<T>::crossed(const Vector2<T>& rhs) const { return this->x * rhs.y - this->y * rhs.x; }
     
     template<class T> void       Vector2<T>::rotate (const T& theta)
-    { T s = sin(theta), c = cos(theta), _x = this->x; this->x = this->x * c - this->_y * s; this->y = _x * s + this->_y * c; }
+    { T s = sin(theta), c = cos(theta), _x = this->x; this->x = this->x * c - this->y * s; this->y = _x * s + this->y * c; }
     template<class T> void       Vector2<T>::rotate (const T& theta, const Vector2& origin)
     { T s = sin(theta), c = cos(theta); *this -= origin; *this = origin + Vector2<T>(this->x * c - this->y * s, this->x * s + this->y * c); }
     template<class T> Vector2<T> Vector2<T>::rotated(const T& theta) const
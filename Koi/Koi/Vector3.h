@@ -30,7 +30,7 @@ namespace koi {
         void    normalize();
         Vector3 normalized()                const;
         Vector3 orthogonal()                const;
-        T       crossed(const Vector3& rhs) const;
+        Vector3 crossed(const Vector3& rhs) const;
         
         void    rotate (const Quaternion<T>& q);
         Vector3 rotated(const Quaternion<T>& q) const;
@@ -82,15 +82,15 @@ namespace koi {
     template<class T> Vector3<T> Vector3<T>::normalized() const { T r = 1 / magnitude(); return *this * r; }
     template<class T> Vector3<T> Vector3<T>::orthogonal() const
     { T ax = abs(this->x), ay = abs(this->y), az = abs(this->z); return CrossProduct(*this, ax < ay ? (ax < az ? X_AXIS : Z_AXIS) : (ay < az ? Y_AXIS : Z_AXIS)); }
-    template<class T> T          Vector3<T>::crossed(const Vector3<T>& rhs) const
+    template<class T> Vector3<T> Vector3<T>::crossed(const Vector3<T>& rhs) const
     { return { this->y * rhs.z - this->z * rhs.y, this->z * rhs.x - this->x * rhs.z, this->x * rhs.y - this->y * rhs.x }; }
     
     template<class T> Vector3<T>  Vector3<T>::operator +  (const Vector3<T>& rhs) const { return { this->x + rhs.x, this->y + rhs.y, this->z + rhs.z }; }
     template<class T> Vector3<T>  Vector3<T>::operator -  (const Vector3<T>& rhs) const { return { this->x - rhs.x, this->y - rhs.y, this->z - rhs.z }; }
     template<class T> Vector3<T>  Vector3<T>::operator *  (const T& rhs)          const { return { this->x * rhs,   this->y * rhs,   this->z * rhs   }; }
-    template<class T> Vector3<T>  Vector3<T>::operator *  (const Vector3<T>& rhs) const { return { this->x * rhs.x, this->y * rhs.y, this->z * rhs.y }; }
+    template<class T> Vector3<T>  Vector3<T>::operator *  (const Vector3<T>& rhs) const { return { this->x * rhs.x, this->y * rhs.y, this->z * rhs.z }; }
     template<class T> Vector3<T>  Vector3<T>::operator /  (const T& rhs)          const { return { this->x / rhs,   this->y / rhs,   this->z / rhs   }; }
-    template<class T> Vector3<T>  Vector3<T>::operator /  (const Vector3<T>& rhs) const { return { this->x / rhs.x, this->y / rhs.y, this->z / rhs.y }; }
+    template<class T> Vector3<T>  Vector3<T>::operator /  (const Vector3<T>& rhs) const { return { this->x / rhs.x, this->y / rhs.y, this->z / rhs.z }; }
     template<class T> Vector3<T>& Vector3<T>::operator += (const Vector3<T>& rhs) { this->x += rhs.x; this->y += rhs.y; this->z += rhs.z; return *this; }
     template<class T> Vector3<T>& Vector3<T>::operator -= (const Vector3<T>& rhs) { this->x -= rhs.x; this->y -= rhs.y; this->z -= rhs.z; return *this; }
     template<class T> Vector3<T>& Vector3<T>::operator *= (const T& rhs)          { this->x *= rhs;   this->y *= rhs;   this->z *= rhs;   return *this; }
@@ -0,0 +1,402 @@
+//
+//  VectorBatch.h
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+
+#ifndef VectorBatch_h
+#define VectorBatch_h
+
+    #include "Allocator.h"
+    #include "Parallel.h"
+    #include "Simd.h"
+    #include "Vector2.h"
+    #include "Vector3.h"
+    #include "Quaternion.h"
+
+    namespace koi {
+        // MARK: koi::koi_Lanes
+        // +------------------------------------------------------------------------------+
+        // | koi::koi_Lanes - The float operations batch kernels are written against      |
+        // +------------------------------------------------------------------------------+
+        // Every kernel is a generic lambda run once per koi_Lanes::N elements and then once
+        // per leftover element with koi_Lane, so the SIMD and scalar paths share one body.
+        struct koi_Lane {
+            enum { N = 1 };
+            float v;
+            static koi_Lane Load (const float* p)          { return { *p }; }
+            static koi_Lane Set  (float f)                 { return { f }; }
+            static void     Store(float* p, koi_Lane a)    { *p = a.v; }
+            friend koi_Lane operator + (koi_Lane a, koi_Lane b) { return { a.v + b.v }; }
+            friend koi_Lane operator - (koi_Lane a, koi_Lane b) { return { a.v - b.v }; }
+            friend koi_Lane operator * (koi_Lane a, koi_Lane b) { return { a.v * b.v }; }
+            friend koi_Lane operator / (koi_Lane a, koi_Lane b) { return { a.v / b.v }; }
+            friend koi_Lane Max (koi_Lane a, koi_Lane b)        { return { a.v > b.v ? a.v : b.v }; }
+            friend koi_Lane Sqrt(koi_Lane a)                    { return { std::sqrt(a.v) }; }
+            friend koi_Lane FlipSign(koi_Lane a, koi_Lane s)    { return { std::signbit(s.v) ? -a.v : a.v }; }   // -a where s is negative
+        };
+
+        #if defined(KOI_SIMD_AVX2)
+            struct koi_Lanes {
+                enum { N = 8 };
+                __m256 v;
+                static koi_Lanes Load (const float* p)        { return { _mm256_loadu_ps(p) }; }
+                static koi_Lanes Set  (float f)               { return { _mm256_set1_ps(f) }; }
+                static void      Store(float* p, koi_Lanes a) { _mm256_storeu_ps(p, a.v); }
+                friend koi_Lanes operator + (koi_Lanes a, koi_Lanes b) { return { _mm256_add_ps(a.v, b.v) }; }
+                friend koi_Lanes operator - (koi_Lanes a, koi_Lanes b) { return { _mm256_sub_ps(a.v, b.v) }; }
+                friend koi_Lanes operator * (koi_Lanes a, koi_Lanes b) { return { _mm256_mul_ps(a.v, b.v) }; }
+                friend koi_Lanes operator / (koi_Lanes a, koi_Lanes b) { return { _mm256_div_ps(a.v, b.v) }; }
+                friend koi_Lanes Max (koi_Lanes a, koi_Lanes b)        { return { _mm256_max_ps(a.v, b.v) }; }
+                friend koi_Lanes Sqrt(koi_Lanes a)                     { return { _mm256_sqrt_ps(a.v) }; }
+                friend koi_Lanes FlipSign(koi_Lanes a, koi_Lanes s)    { return { _mm256_xor_ps(a.v, _mm256_and_ps(s.v, _mm256_set1_ps(-0.0f))) }; }
+            };
+        #elif defined(KOI_SIMD_SSE2)
+            struct koi_Lanes {
+                enum { N = 4 };
+                __m128 v;
+                static koi_Lanes Load (const float* p)        { return { _mm_loadu_ps(p) }; }
+                static koi_Lanes Set  (float f)               { return { _mm_set1_ps(f) }; }
+                static void      Store(float* p, koi_Lanes a) { _mm_storeu_ps(p, a.v); }
+                friend koi_Lanes operator + (koi_Lanes a, koi_Lanes b) { return { _mm_add_ps(a.v, b.v) }; }
+                friend koi_Lanes operator - (koi_Lanes a, koi_Lanes b) { return { _mm_sub_ps(a.v, b.v) }; }
+                friend koi_Lanes operator * (koi_Lanes a, koi_Lanes b) { return { _mm_mul_ps(a.v, b.v) }; }
+                friend koi_Lanes operator / (koi_Lanes a, koi_Lanes b) { return { _mm_div_ps(a.v, b.v) }; }
+                friend koi_Lanes Max (koi_Lanes a, koi_Lanes b)        { return { _mm_max_ps(a.v, b.v) }; }
+                friend koi_Lanes Sqrt(koi_Lanes a)                     { return { _mm_sqrt_ps(a.v) }; }
+                friend koi_Lanes FlipSign(koi_Lanes a, koi_Lanes s)    { return { _mm_xor_ps(a.v, _mm_and_ps(s.v, _mm_set1_ps(-0.0f))) }; }
+            };
+        #elif defined(KOI_SIMD_NEON)
+            struct koi_Lanes {
+                enum { N = 4 };
+                float32x4_t v;
+                static koi_Lanes Load (const float* p)        { return { vld1q_f32(p) }; }
+                static koi_Lanes Set  (float f)               { return { vdupq_n_f32(f) }; }
+                static void      Store(float* p, koi_Lanes a) { vst1q_f32(p, a.v); }
+                friend koi_Lanes operator + (koi_Lanes a, koi_Lanes b) { return { vaddq_f32(a.v, b.v) }; }
+                friend koi_Lanes operator - (koi_Lanes a, koi_Lanes b) { return { vsubq_f32(a.v, b.v) }; }
+                friend koi_Lanes operator * (koi_Lanes a, koi_Lanes b) { return { vmulq_f32(a.v, b.v) }; }
+                friend koi_Lanes Max (koi_Lanes a, koi_Lanes b)        { return { vmaxq_f32(a.v, b.v) }; }
+                friend koi_Lanes FlipSign(koi_Lanes a, koi_Lanes s) {
+                    uint32x4_t sign = vandq_u32(vreinterpretq_u32_f32(s.v), vdupq_n_u32(0x80000000u));
+                    return { vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(a.v), sign)) };
+                }
+                #if defined(__aarch64__)
+                    friend koi_Lanes operator / (koi_Lanes a, koi_Lanes b) { return { vdivq_f32(a.v, b.v) }; }
+                    friend koi_Lanes Sqrt(koi_Lanes a)                     { return { vsqrtq_f32(a.v) }; }
+                #else
+                    // ARMv7 has estimates only, two Newton steps get within an ulp or two
+                    friend koi_Lanes operator / (koi_Lanes a, koi_Lanes b) {
+                        float32x4_t r = vrecpeq_f32(b.v);
+                        r = vmulq_f32(r, vrecpsq_f32(b.v, r));
+                        r = vmulq_f32(r, vrecpsq_f32(b.v, r));
+                        return { vmulq_f32(a.v, r) };
+                    }
+                    friend koi_Lanes Sqrt(koi_Lanes a) {
+                        float32x4_t r = vrsqrteq_f32(a.v);
+                        r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a.v, r), r));
+                        r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a.v, r), r));
+                        float32x4_t s = vmulq_f32(a.v, r);   // 0 * inf would be nan, keep zero lanes zero
+                        return { vbslq_f32(vceqq_f32(a.v, vdupq_n_f32(0.0f)), a.v, s) };
+                    }
+                #endif
+            };
+        #else
+            typedef koi_Lane koi_Lanes;
+        #endif
+
+        // Runs f(lane, i) across [0, n). Big batches are split into blocks over the threads,
+        // below that the cost of starting them is more than the work.
+        template<class F> void koi_BatchFor(size_t n, const F& f) {
+            constexpr size_t nBlock = 1 << 16, nParallel = 1 << 20;
+            auto run = [&](size_t i, size_t e) {
+                for (; i + koi_Lanes::N <= e; i += koi_Lanes::N) f(koi_Lanes(), i);
+                for (; i < e; i++) f(koi_Lane(), i);
+            };
+            if (n < nParallel) { run(0, n); return; }
+            ParallelFor(0, int32_t((n + nBlock - 1) / nBlock), [&](int32_t b) {
+                run(size_t(b) * nBlock, std::min(size_t(b + 1) * nBlock, n));
+            });
+        }
+
+
+        // MARK: koi::Vector2Batch
+        // +------------------------------------------------------------------------------+
+        // | koi::Vector2Batch - Structure of arrays Vector2f storage                     |
+        // +------------------------------------------------------------------------------+
+        struct Vector2Batch {
+            AlignedVector<float> x, y;
+
+            Vector2Batch() = default;
+            explicit Vector2Batch(size_t n) { Resize(n); }
+
+            size_t   Size   () const                        { return x.size(); }
+            void     Resize (size_t n)                      { x.resize(n); y.resize(n); }
+            void     Reserve(size_t n)                      { x.reserve(n); y.reserve(n); }
+            void     Clear  ()                              { x.clear(); y.clear(); }
+            void     Push   (const Vector2f& v)             { x.push_back(v.x); y.push_back(v.y); }
+            Vector2f Get    (size_t i) const                { return { x[i], y[i] }; }
+            void     Set    (size_t i, const Vector2f& v)   { x[i] = v.x; y[i] = v.y; }
+        };
+
+
+        // MARK: koi::Vector3Batch
+        // +------------------------------------------------------------------------------+
+        // | koi::Vector3Batch - Structure of arrays Vector3f storage                     |
+        // +------------------------------------------------------------------------------+
+        struct Vector3Batch {
+            AlignedVector<float> x, y, z;
+
+            Vector3Batch() = default;
+            explicit Vector3Batch(size_t n) { Resize(n); }
+
+            size_t   Size   () const                        { return x.size(); }
+            void     Resize (size_t n)                      { x.resize(n); y.resize(n); z.resize(n); }
+            void     Reserve(size_t n)                      { x.reserve(n); y.reserve(n); z.reserve(n); }
+            void     Clear  ()                              { x.clear(); y.clear(); z.clear(); }
+            void     Push   (const Vector3f& v)             { x.push_back(v.x); y.push_back(v.y); z.push_back(v.z); }
+            Vector3f Get    (size_t i) const                { return { x[i], y[i], z[i] }; }
+            void     Set    (size_t i, const Vector3f& v)   { x[i] = v.x; y[i] = v.y; z[i] = v.z; }
+        };
+
+
+        // MARK: koi::QuaternionBatch
+        // +------------------------------------------------------------------------------+
+        // | koi::QuaternionBatch - Structure of arrays Quaternionf storage               |
+        // +------------------------------------------------------------------------------+
+        struct QuaternionBatch {
+            AlignedVector<float> w, x, y, z;
+
+            QuaternionBatch() = default;
+            explicit QuaternionBatch(size_t n) { Resize(n); }
+
+            size_t      Size   () const                         { return w.size(); }
+            void        Resize (size_t n)                       { w.resize(n); x.resize(n); y.resize(n); z.resize(n); }
+            void        Reserve(size_t n)                       { w.reserve(n); x.reserve(n); y.reserve(n); z.reserve(n); }
+            void        Clear  ()                               { w.clear(); x.clear(); y.clear(); z.clear(); }
+            void        Push   (const Quaternionf& q)           { w.push_back(q.w); x.push_back(q.x); y.push_back(q.y); z.push_back(q.z); }
+            Quaternionf Get    (size_t i) const                 { return { w[i], x[i], y[i], z[i] }; }
+            void        Set    (size_t i, const Quaternionf& q) { w[i] = q.w; x[i] = q.x; y[i] = q.y; z[i] = q.z; }
+        };
+
+
+        // MARK: Batch Kernels
+        // +------------------------------------------------------------------------------+
+        // | Batch Kernels - In place transforms and per element products                 |
+        // +------------------------------------------------------------------------------+
+        // Results match calling the Vector2 / Vector3 / Quaternion operators on every element,
+        // to rounding. Output arrays are resized to the input and may alias an input.
+        void Translate(Vector2Batch& v, const Vector2f& d);
+        void Scale    (Vector2Batch& v, const Vector2f& s);
+        void Rotate   (Vector2Batch& v, float theta);                             // Same direction as Vector2::rotated
+        void Rotate   (Vector2Batch& v, float theta, const Vector2f& origin);
+        void Transform(Vector2Batch& v, const Vector2f& s, float theta, const Vector2f& d); // Scale, rotate, then translate
+        void Dot      (const Vector2Batch& a, const Vector2Batch& b, AlignedVector<float>& out);
+        void Normalize(Vector2Batch& v);                                          // Zero vectors stay zero
+
+        void Translate(Vector3Batch& v, const Vector3f& d);
+        void Scale    (Vector3Batch& v, const Vector3f& s);
+        void Rotate   (Vector3Batch& v, const Quaternionf& q);                    // q must be unit length
+        void Dot      (const Vector3Batch& a, const Vector3Batch& b, AlignedVector<float>& out);
+        void Cross    (const Vector3Batch& a, const Vector3Batch& b, Vector3Batch& out);
+        void Normalize(Vector3Batch& v);                                          // Zero vectors stay zero
+        void Rotate   (Vector3Batch& v, const QuaternionBatch& q);                // Element i by q[i], every q unit length
+
+        void Multiply (const QuaternionBatch& a, const QuaternionBatch& b, QuaternionBatch& out); // a[i] * b[i]
+        void Normalize(QuaternionBatch& q);                                       // Zero quaternions stay zero
+
+
+        void Translate(Vector2Batch& v, const Vector2f& d) {
+            float* px = v.x.data(); float* py = v.y.data();
+            koi_BatchFor(v.Size(), [&](auto l, size_t i) {
+                using L = decltype(l);
+                L::Store(px + i, L::Load(px + i) + L::Set(d.x));
+                L::Store(py + i, L::Load(py + i) + L::Set(d.y));
+            });
+        }
+
+        void Scale(Vector2Batch& v, const Vector2f& s) {
+            float* px = v.x.data(); float* py = v.y.data();
+            koi_BatchFor(v.Size(), [&](auto l, size_t i) {
+                using L = decltype(l);
+                L::Store(px + i, L::Load(px + i) * L::Set(s.x));
+                L::Store(py + i, L::Load(py + i) * L::Set(s.y));
+            });
+        }
+
+        void Rotate(Vector2Batch& v, float theta) { Transform(v, { 1.0f, 1.0f }, theta, { 0.0f, 0.0f }); }
+
+        void Rotate(Vector2Batch& v, float theta, const Vector2f& origin) {
+            float s = std::sin(theta), c = std::cos(theta);
+            float* px = v.x.data(); float* py = v.y.data();
+            koi_BatchFor(v.Size(), [&](auto l, size_t i) {
+                using L = decltype(l);
+                L x = L::Load(px + i) - L::Set(origin.x), y = L::Load(py + i) - L::Set(origin.y);
+                L::Store(px + i, L::Set(origin.x) + (x * L::Set(c) - y * L::Set(s)));
+                L::Store(py + i, L::Set(origin.y) + (x * L::Set(s) + y * L::Set(c)));
+            });
+        }
+
+        void Transform(Vector2Batch& v, const Vector2f& s, float theta, const Vector2f& d) {
+            // Scale folds into the rotation, one 2x2 matrix and an offset per point
+            float sn = std::sin(theta), cs = std::cos(theta);
+            float m00 = cs * s.x, m01 = -sn * s.y, m10 = sn * s.x, m11 = cs * s.y;
+            float* px = v.x.data(); float* py = v.y.data();
+            koi_BatchFor(v.Size(), [&](auto l, size_t i) {
+                using L = decltype(l);
+                L x = L::Load(px + i), y = L::Load(py + i);
+                L::Store(px + i, x * L::Set(m00) + y * L::Set(m01) + L::Set(d.x));
+                L::Store(py + i, x * L::Set(m10) + y * L::Set(m11) + L::Set(d.y));
+            });
+        }
+
+        void Dot(const Vector2Batch& a, const Vector2Batch& b, AlignedVector<float>& out) {
+            size_t n = std::min(a.Size(), b.Size());
+            out.resize(n);
+            const float *ax = a.x.data(), *ay = a.y.data(), *bx = b.x.data(), *by = b.y.data();
+            float* po = out.data();
+            koi_BatchFor(n, [&](auto l, size_t i) {
+                using L = decltype(l);
+                L::Store(po + i, L::Load(ax + i) * L::Load(bx + i) + L::Load(ay + i) * L::Load(by + i));
+            });
+        }
+
+        void Normalize(Vector2Batch& v) {
+            float* px = v.x.data(); float* py = v.y.data();
+            koi_BatchFor(v.Size(), [&](auto l, size_t i) {
+                using L = decltype(l);
+                L x = L::Load(px + i), y = L::Load(py + i);
+                L r = L::Set(1.0f) / Sqrt(Max(x * x + y * y, L::Set(1e-30f)));
+                L::Store(px + i, x * r);
+                L::Store(py + i, y * r);
+            });
+        }
+
+
+        void Translate(Vector3Batch& v, const Vector3f& d) {
+            float* px = v.x.data(); float* py = v.y.data(); float* pz = v.z.data();
+            koi_BatchFor(v.Size(), [&](auto l, size_t i) {
+                using L = decltype(l);
+                L::Store(px + i, L::Load(px + i) + L::Set(d.x));
+                L::Store(py + i, L::Load(py + i) + L::Set(d.y));
+                L::Store(pz + i, L::Load(pz + i) + L::Set(d.z));
+            });
+        }
+
+        void Scale(Vector3Batch& v, const Vector3f& s) {
+            float* px = v.x.data(); float* py = v.y.data(); float* pz = v.z.data();
+            koi_BatchFor(v.Size(), [&](auto l, size_t i) {
+                using L = decltype(l);
+                L::Store(px + i, L::Load(px + i) * L::Set(s.x));
+                L::Store(py + i, L::Load(py + i) * L::Set(s.y));
+                L::Store(pz + i, L::Load(pz + i) * L::Set(s.z));
+            });
+        }
+
+        void Rotate(Vector3Batch& v, const Quaternionf& q) {
+            // q v q* expanded for a unit q: v + w t + u x t with t = 2 (u x v), 15 multiplies
+            // instead of the two full quaternion products Vector3::rotated does
+            float* px = v.x.data(); float* py = v.y.data(); float* pz = v.z.data();
+            koi_BatchFor(v.Size(), [&](auto l, size_t i) {
+                using L = decltype(l);
+                L qw = L::Set(q.w), qx = L::Set(q.x), qy = L::Set(q.y), qz = L::Set(q.z), two = L::Set(2.0f);
+                L x = L::Load(px + i), y = L::Load(py + i), z = L::Load(pz + i);
+                L tx = two * (qy * z - qz * y), ty = two * (qz * x - qx * z), tz = two * (qx * y - qy * x);
+                L::Store(px + i, x + qw * tx + (qy * tz - qz * ty));
+                L::Store(py + i, y + qw * ty + (qz * tx - qx * tz));
+                L::Store(pz + i, z + qw * tz + (qx * ty - qy * tx));
+            });
+        }
+
+        void Dot(const Vector3Batch& a, const Vector3Batch& b, AlignedVector<float>& out) {
+            size_t n = std::min(a.Size(), b.Size());
+            out.resize(n);
+            const float *ax = a.x.data(), *ay = a.y.data(), *az = a.z.data();
+            const float *bx = b.x.data(), *by = b.y.data(), *bz = b.z.data();
+            float* po = out.data();
+            koi_BatchFor(n, [&](auto l, size_t i) {
+                using L = decltype(l);
+                L::Store(po + i, L::Load(ax + i) * L::Load(bx + i) + L::Load(ay + i) * L::Load(by + i) + L::Load(az + i) * L::Load(bz + i));
+            });
+        }
+
+        void Cross(const Vector3Batch& a, const Vector3Batch& b, Vector3Batch& out) {
+            size_t n = std::min(a.Size(), b.Size());
+            out.Resize(n);
+            const float *ax = a.x.data(), *ay = a.y.data(), *az = a.z.data();
+            const float *bx = b.x.data(), *by = b.y.data(), *bz = b.z.data();
+            float *ox = out.x.data(), *oy = out.y.data(), *oz = out.z.data();
+            koi_BatchFor(n, [&](auto l, size_t i) {
+                using L = decltype(l);
+                // Everything is loaded before the first store so out may be a or b
+                L x0 = L::Load(ax + i), y0 = L::Load(ay + i), z0 = L::Load(az + i);
+                L x1 = L::Load(bx + i), y1 = L::Load(by + i), z1 = L::Load(bz + i);
+                L::Store(ox + i, y0 * z1 - z0 * y1);
+                L::Store(oy + i, z0 * x1 - x0 * z1);
+                L::Store(oz + i, x0 * y1 - y0 * x1);
+            });
+        }
+
+        void Normalize(Vector3Batch& v) {
+            float* px = v.x.data(); float* py = v.y.data(); float* pz = v.z.data();
+            koi_BatchFor(v.Size(), [&](auto l, size_t i) {
+                using L = decltype(l);
+                L x = L::Load(px + i), y = L::Load(py + i), z = L::Load(pz + i);
+                L r = L::Set(1.0f) / Sqrt(Max(x * x + y * y + z * z, L::Set(1e-30f)));
+                L::Store(px + i, x * r);
+                L::Store(py + i, y * r);
+                L::Store(pz + i, z * r);
+            });
+        }
+
+        void Rotate(Vector3Batch& v, const QuaternionBatch& q) {
+            // Same expansion as the single quaternion Rotate, with q loaded per element
+            size_t n = std::min(v.Size(), q.Size());
+            float* px = v.x.data(); float* py = v.y.data(); float* pz = v.z.data();
+            const float *qw = q.w.data(), *qx = q.x.data(), *qy = q.y.data(), *qz = q.z.data();
+            koi_BatchFor(n, [&](auto l, size_t i) {
+                using L = decltype(l);
+                L w = L::Load(qw + i), ux = L::Load(qx + i), uy = L::Load(qy + i), uz = L::Load(qz + i), two = L::Set(2.0f);
+                L x = L::Load(px + i), y = L::Load(py + i), z = L::Load(pz + i);
+                L tx = two * (uy * z - uz * y), ty = two * (uz * x - ux * z), tz = two * (ux * y - uy * x);
+                L::Store(px + i, x + w * tx + (uy * tz - uz * ty));
+                L::Store(py + i, y + w * ty + (uz * tx - ux * tz));
+                L::Store(pz + i, z + w * tz + (ux * ty - uy * tx));
+            });
+        }
+
+
+        void Multiply(const QuaternionBatch& a, const QuaternionBatch& b, QuaternionBatch& out) {
+            size_t n = std::min(a.Size(), b.Size());
+            out.Resize(n);
+            const float *aw = a.w.data(), *ax = a.x.data(), *ay = a.y.data(), *az = a.z.data();
+            const float *bw = b.w.data(), *bx = b.x.data(), *by = b.y.data(), *bz = b.z.data();
+            float *ow = out.w.data(), *ox = out.x.data(), *oy = out.y.data(), *oz = out.z.data();
+            koi_BatchFor(n, [&](auto l, size_t i) {
+                using L = decltype(l);
+                // Everything is loaded before the first store so out may be a or b
+                L w0 = L::Load(aw + i), x0 = L::Load(ax + i), y0 = L::Load(ay + i), z0 = L::Load(az + i);
+                L w1 = L::Load(bw + i), x1 = L::Load(bx + i), y1 = L::Load(by + i), z1 = L::Load(bz + i);
+                L::Store(ow + i, w0 * w1 - x0 * x1 - y0 * y1 - z0 * z1);
+                L::Store(ox + i, w0 * x1 + x0 * w1 + y0 * z1 - z0 * y1);
+                L::Store(oy + i, w0 * y1 - x0 * z1 + y0 * w1 + z0 * x1);
+                L::Store(oz + i, w0 * z1 + x0 * y1 - y0 * x1 + z0 * w1);
+            });
+        }
+
+        void Normalize(QuaternionBatch& q) {
+            float* pw = q.w.data(); float* px = q.x.data(); float* py = q.y.data(); float* pz = q.z.data();
+            koi_BatchFor(q.Size(), [&](auto l, size_t i) {
+                using L = decltype(l);
+                L w = L::Load(pw + i), x = L::Load(px + i), y = L::Load(py + i), z = L::Load(pz + i);
+                L r = L::Set(1.0f) / Sqrt(Max(w * w + x * x + y * y + z * z, L::Set(1e-30f)));
+                L::Store(pw + i, w * r);
+                L::Store(px + i, x * r);
+                L::Store(py + i, y * r);
+                L::Store(pz + i, z * r);
+            });
+        }
+    }
+
+#endif /* VectorBatch_h */
@@ -154,11 +154,11 @@
                     return koi::OK;
                 }
                 
-                virtual koi::rcode SetWindowTitle(const std::string& s) override {
+                virtual koi::rcode SetWindowTitle(const char* s) override {
                     #ifdef UNICODE
                         SetWindowText(koi_hWnd, ConvertS2W(s).c_str());
                     #else
-                        SetWindowText(koi_hWnd, s.c_str());
+                        SetWindowText(koi_hWnd, s);
                     #endif
                     return koi::OK;
                 }
@@ -175,7 +175,18 @@
                 virtual koi::rcode HandleSystemEvent() override { return koi::rcode::FAIL; }
                 
                 // Windows Event Handler - this is statically connected to the windows event system
+                // The platform passed to CreateWindowEx is kept in the window's user data, so every
+                // window reports to its own engine
                 static LRESULT CALLBACK koi_WindowEvent(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
+                    if (uMsg == WM_CREATE) {
+                        SetWindowLongPtr(hWnd, GWLP_USERDATA, (LONG_PTR)((LPCREATESTRUCT)lParam)->lpCreateParams);
+                        return 0;
+                    }
+                    
+                    Platform_Windows* self = (Platform_Windows*)GetWindowLongPtr(hWnd, GWLP_USERDATA);
+                    if (!self) return DefWindowProc(hWnd, uMsg, wParam, lParam);
+                    koi::KoiEngine* ptrPGE = self->ptrPGE;
+                    
                     switch (uMsg) {
                         case WM_MOUSEMOVE: {
                             uint16_t x = lParam & 0xFFFF; uint16_t y = (lParam >> 16) & 0xFFFF;
@@ -188,8 +199,8 @@
                         case WM_MOUSELEAVE:  ptrPGE->koi_UpdateMouseFocus(false);                                    return 0;
                         case WM_SETFOCUS:    ptrPGE->koi_UpdateKeyFocus(true);                                       return 0;
                         case WM_KILLFOCUS:   ptrPGE->koi_UpdateKeyFocus(false);                                      return 0;
-                        case WM_KEYDOWN:     ptrPGE->koi_UpdateKeyState(mapKeys[wParam], true);                      return 0;
-                        case WM_KEYUP:       ptrPGE->koi_UpdateKeyState(mapKeys[wParam], false);                     return 0;
+                        case WM_KEYDOWN:     ptrPGE->koi_UpdateKeyState(self->mapKeys[wParam], true);                      return 0;
+                        case WM_KEYUP:       ptrPGE->koi_UpdateKeyState(self->mapKeys[wParam], false);                     return 0;
                         case WM_LBUTTONDOWN: ptrPGE->koi_UpdateMouseState(0, true);                                  return 0;
                         case WM_LBUTTONUP:   ptrPGE->koi_UpdateMouseState(0, false);                                 return 0;
                         case WM_RBUTTONDOWN: ptrPGE->koi_UpdateMouseState(1, true);                                  return 0;
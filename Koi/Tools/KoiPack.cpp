@@ -0,0 +1,46 @@
+//
+//  KoiPack.cpp
+//  Koi
+//
+//  Created by Michael Schuff on 2/2/21.
+//
+//  Builds an asset pack from PNG / QOI files, each entry is named after its file name
+//  without the directory:
+//
+//      koipack [-c] out.pack image.png [image.qoi ...]
+//
+//  -c LZ4 compresses entries that shrink by at least an eighth. Compressed entries are
+//  decoded on load instead of being used straight out of the mapping.
+//
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../Koi/ImageLoader.h"
+#include "../Koi/AssetPack.h"
+
+int main(int argc, char** argv) {
+    int  nArg      = 1;
+    bool bCompress = false;
+    if (nArg < argc && strcmp(argv[nArg], "-c") == 0) { bCompress = true; nArg++; }
+    if (argc - nArg < 2) {
+        fprintf(stderr, "usage: koipack [-c] out.pack images...\n");
+        return 1;
+    }
+
+    std::string sPackFile = argv[nArg++];
+    std::vector<std::string> vFiles(argv + nArg, argv + argc);
+    std::vector<koi::Sprite> vSprites;
+    std::vector<koi::rcode>  vResults = koi::ImageLoader::LoadImages(vFiles, vSprites);
+
+    koi::AssetPackBuilder builder;
+    for (size_t i = 0; i < vFiles.size(); i++) {
+        if (vResults[i] != koi::OK) { fprintf(stderr, "koipack: could not load %s\n", vFiles[i].c_str()); return 1; }
+        size_t nSlash = vFiles[i].find_last_of("/\\");
+        if (builder.Add(nSlash == std::string::npos ? vFiles[i] : vFiles[i].substr(nSlash + 1), vSprites[i]) != koi::OK) { fprintf(stderr, "koipack: out of memory adding %s\n", vFiles[i].c_str()); return 1; }
+    }
+
+    if (builder.Write(sPackFile, bCompress) != koi::OK) { fprintf(stderr, "koipack: could not write %s\n", sPackFile.c_str()); return 1; }
+    printf("koipack: %zu images -> %s\n", vFiles.size(), sPackFile.c_str());
+    return 0;
+}